@@ -34,3 +34,27 @@ macro(add_individual_test _TEST_NAME)
         ${TEST_HOST_LIB} ${EXTRA_LIBS} )
     add_test(NAME roo_${_TEST_NAME}_test COMMAND ${_TEST_NAME}_test)
 endmacro()
+
+# 性能测试，只编译不加入ctest
+macro(add_individual_bench _BENCH_NAME)
+    add_executable(${_BENCH_NAME}_bench
+        ${_BENCH_NAME}Bench.cpp)
+
+    target_link_libraries(${_BENCH_NAME}_bench
+        ${TEST_HOST_LIB} ${EXTRA_LIBS} )
+endmacro()
+
+# 模糊测试，只编译不加入ctest，clang下链接libFuzzer，其他编译器使用自带的随机驱动
+macro(add_individual_fuzz _FUZZ_NAME)
+    add_executable(${_FUZZ_NAME}_fuzz
+        ${_FUZZ_NAME}Fuzz.cpp)
+
+    if(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+        target_compile_definitions(${_FUZZ_NAME}_fuzz PRIVATE ARGUS_LIBFUZZER)
+        set_target_properties(${_FUZZ_NAME}_fuzz PROPERTIES
+            COMPILE_FLAGS "-fsanitize=fuzzer,address" LINK_FLAGS "-fsanitize=fuzzer,address")
+    endif()
+
+    target_link_libraries(${_FUZZ_NAME}_fuzz
+        ${TEST_HOST_LIB} ${EXTRA_LIBS} )
+endmacro()
@@ -10,6 +10,7 @@
 #include <crypto/SslSetup.h>
 
 #include <Captain.h>
+#include <IsolatedExecutor.h>
 
 #include <xtra_rhel.h>
 
@@ -26,8 +27,11 @@ int main(int argc, char* argv[]) {
     strncpy(cfgFile, program_invocation_short_name, strlen(program_invocation_short_name));
     strcat(cfgFile, ".conf");
     int opt_g = 0;
-    while ((opt_g = getopt(argc, argv, "c:dhv")) != -1) {
+    while ((opt_g = getopt(argc, argv, "c:dhvw:")) != -1) {
         switch (opt_g) {
+            case 'w':
+                // 由IsolatedExecutor启动的worker进程，不初始化服务
+                return tzrpc::IsolatedExecutor::worker_main(optarg);
             case 'c':
                 memset(cfgFile, 0, sizeof(cfgFile));
                 strncpy(cfgFile, optarg, PATH_MAX);
@@ -87,7 +91,8 @@ int main(int argc, char* argv[]) {
 
     if(!tzrpc::Captain::instance().init(cfgFile)) {
         roo::log_err("system manager init error!");
-        ::exit(EXIT_FAILURE);
+        // 定时器等线程已经启动，已经加载的任务还在调度，不能执行静态对象的析构
+        ::_exit(EXIT_FAILURE);
     }
 
     std::time_t now = boost::chrono::system_clock::to_time_t(boost::chrono::system_clock::now());
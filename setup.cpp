@@ -1,5 +1,7 @@
 #include <signal.h>
+#include <pthread.h>
 
+#include <thread>
 #include <iostream>
 #include <ctime>
 #include <cstdio>
@@ -52,12 +54,42 @@ static void interrupted_callback(int signal) {
     }
 }
 
+// 优雅退出需要等待执行中的任务，不能在信号处理函数中阻塞，所以SIGTERM
+// 在所有线程中屏蔽，由专门的线程sigwait同步处理
+static void terminate_signal_routine() {
+
+    sigset_t mask;
+    ::sigemptyset(&mask);
+    ::sigaddset(&mask, SIGTERM);
+
+    int signal = 0;
+    if (::sigwait(&mask, &signal) != 0) {
+        roo::log_err("sigwait for SIGTERM failed.");
+        return;
+    }
+
+    roo::log_warning("SIGTERM recv, do service_graceful ... ");
+    if (!tzrpc::Captain::instance().service_graceful()) {
+        roo::log_err("service_graceful not finished cleanly, see cut off tasks above.");
+    }
+
+    tzrpc::Captain::instance().service_terminate();
+}
+
 void init_signal_handle() {
 
     ::signal(SIGPIPE, SIG_IGN);
     ::signal(SIGUSR1, interrupted_callback);
     ::signal(SIGHUP, interrupted_callback);
 
+    // 需要在创建其他线程之前调用，这样后续线程都会继承该信号屏蔽字
+    sigset_t mask;
+    ::sigemptyset(&mask);
+    ::sigaddset(&mask, SIGTERM);
+    ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    std::thread(terminate_signal_routine).detach();
+
     return;
 }
 
@@ -20,7 +20,12 @@
 #include <scaffold/Setting.h>
 #include <scaffold/Status.h>
 
+#include "HotLog.h"
+#include "FireTimer.h"
+#include "ResultPipeline.h"
 #include "JobExecutor.h"
+#include "ShardManager.h"
+#include "ControlServer.h"
 #include "Captain.h"
 
 namespace tzrpc {
@@ -32,8 +37,18 @@ Captain& Captain::instance() {
 }
 
 Captain::Captain() :
-    running_(true),
-    initialized_(false) {
+    initialized_(false),
+    running_(true) {
+}
+
+void Captain::set_running(bool running) {
+
+    if (running_.exchange(running) == running) {
+        return;
+    }
+
+    roo::log_warning("Captain switch to %s.", running ? "running" : "standby");
+    ShardManager::instance().leadership_changed();
 }
 
 
@@ -42,20 +57,14 @@ Captain::Captain() :
 static bool service_enable = true;
 
 
+// 服务的成员发生变化，立即重新分配分片，不用等待下一轮定时检查
 static int callback_for_serv(const std::string& dept, const std::string& serv,
                              const std::map<std::string, std::string>& property) {
     
     if (!service_enable)
         return 0;
 
-    if(Captain::instance().zk_frame_->recipe_service_try_lock("bankpay", "argus_service", "master", 0)) {
-        roo::log_info("owns lock ...");
-        Captain::instance().running_ = true;
-    } else {
-        roo::log_info("lost lock ...");
-        Captain::instance().running_ = false;
-    }
-
+    ShardManager::instance().rebalance();
     return 0;
 }
 
@@ -68,21 +77,21 @@ static int callback_for_node(const std::string& dept, const std::string& serv, c
         if(value >=0 && value <=7 ) {
             roo::log_warning("roo::log_level setup to %d", value);
             tzrpc::roo::log_init(value);
+            HotLog::set_level(value);
         }
     }
 
-    // 是否放弃锁竞争
+    // 是否放弃分片竞争
     iter = property.find("enable");
     if( iter == property.end() || iter->second != "1") {
-        // 放弃锁
-        roo::log_warning("node %s not enabled, give up lock_master and disable running", node.c_str());
-        Captain::instance().zk_frame_->recipe_service_unlock("bankpay", "argus_service", "master");
+        // 放弃持有的分片
+        roo::log_warning("node %s not enabled, give up all shards and disable running", node.c_str());
+        Captain::instance().set_running(false);
         service_enable = false;
-        Captain::instance().running_ = false;
     } else {
-        // 启用服务，并尝试锁竞争
+        // 启用服务，并尝试获取分片
         service_enable = true;
-        callback_for_serv(dept, serv, {});
+        Captain::instance().set_running(true);
     }
 
     return 0;
@@ -130,27 +139,35 @@ bool Captain::init(const std::string& cfgFile) {
     roo::log_init(log_level, "", log_path, LOG_LOCAL6);
     roo::log_warning("Initialized roo::Log with level %d, path %s.", log_level, log_path.c_str());
 
-    status_ptr_ = std::make_shared<roo::Status>();
-    if (!status_ptr_) {
-        roo::log_err("Create roo::Status failed.");
+    // 任务热路径上的日志异步输出
+    if (!HotLog::instance().init(log_level)) {
+        roo::log_err("init HotLog failed.");
         return false;
     }
 
-    if (!JobExecutor::instance().init(*setting_ptr)) {
-        roo::log_err("JobExecutor init failed, critital error.");
+    // 任务触发的定时器，JobExecutor初始化的时候就会设置调度
+    if (!FireTimer::instance().init()) {
+        roo::log_err("init FireTimer failed.");
         return false;
     }
 
-    // add specified builtin task here
+    status_ptr_ = std::make_shared<roo::Status>();
+    if (!status_ptr_) {
+        roo::log_err("Create roo::Status failed.");
+        return false;
+    }
 
+    status_ptr_->attach_status_callback(
+        "HotLog",
+        std::bind(&HotLog::module_status, &HotLog::instance(),
+                  std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
 
-    
 #ifdef WITH_ZOOKEEPER
 
     // fail will throw exception
     
     int         instance_port;
-    conf_ptr->lookupValue("schedule.instance_port", instance_port);
+    setting_ptr->lookupValue("schedule.instance_port", instance_port);
     if(instance_port < 0)  instance_port = 0;
 
     insane_bind_ = std::make_shared<InsaneBind>(instance_port);
@@ -159,8 +176,8 @@ bool Captain::init(const std::string& cfgFile) {
 
     std::string zookeeper_idc;
     std::string zookeeper_host;
-    conf_ptr->lookupValue("schedule.zookeeper_idc", zookeeper_idc);
-    conf_ptr->lookupValue("schedule.zookeeper_host", zookeeper_host);
+    setting_ptr->lookupValue("schedule.zookeeper_idc", zookeeper_idc);
+    setting_ptr->lookupValue("schedule.zookeeper_host", zookeeper_host);
 
     if(zookeeper_idc.empty() || zookeeper_host.empty()) {
         roo::log_err("zookeeper conf not found!");
@@ -205,16 +222,45 @@ bool Captain::init(const std::string& cfgFile) {
     }
 #endif
 
-    if(zk_frame_->recipe_service_try_lock("bankpay", "argus_service", "master", 0)) {
-        running_ = true;
-    } else {
-        running_ = false;
+    roo::log_info("initialize with zookeeper successfully.");
+
+#endif // WITH_ZOOKEEPER
+
+    // 任务加载之前确定持有的分片，zookeeper后端依赖上面的zk_frame_
+    if (!ShardManager::instance().init(*setting_ptr)) {
+        roo::log_err("ShardManager init failed.");
+        return false;
     }
 
+    // 任务的执行结果输出，需要在任务开始执行之前启动
+    if (!ResultPipeline::instance().init(*setting_ptr)) {
+        roo::log_err("ResultPipeline init failed.");
+        return false;
+    }
 
-    roo::log_info("initialize with zookeeper successfully.");
+    if (ResultPipeline::instance().enabled()) {
+        status_ptr_->attach_status_callback(
+            "ResultPipeline",
+            std::bind(&ResultPipeline::module_status, &ResultPipeline::instance(),
+                      std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    }
 
-#endif // WITH_ZOOKEEPER
+    if (!JobExecutor::instance().init(*setting_ptr)) {
+        roo::log_err("JobExecutor init failed, critital error.");
+        return false;
+    }
+
+    // add specified builtin task here
+
+    std::string control_socket;
+    setting_ptr->lookupValue("schedule.control_socket", control_socket);
+    if (!control_socket.empty()) {
+        control_ptr_ = std::make_shared<ControlServer>(control_socket);
+        if (!control_ptr_ || !control_ptr_->init()) {
+            roo::log_err("Create and init ControlServer with %s failed.", control_socket.c_str());
+            return false;
+        }
+    }
 
 
     JobExecutor::instance().threads_start();
@@ -226,11 +272,22 @@ bool Captain::init(const std::string& cfgFile) {
 }
 
 
+// 停止调度，在限定时间内等待队列排空和执行中的任务结束，然后卸载so
 bool Captain::service_graceful() {
 
-    JobExecutor::instance().threads_join();
-    timer_ptr_->threads_join();
-    return true;
+    roo::log_warning("about to shutdown service gracefully ...");
+    bool clean = JobExecutor::instance().shutdown_graceful();
+    FireTimer::instance().stop();
+
+    // 任务排空之后才释放分片，避免接管的实例重复执行
+    ShardManager::instance().stop();
+
+    // 输出排空期间执行完的结果
+    ResultPipeline::instance().stop();
+
+    // 输出缓存的日志，之后同步输出
+    HotLog::instance().stop();
+    return clean;
 }
 
 void Captain::service_terminate() {
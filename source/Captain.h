@@ -12,6 +12,7 @@
 #include <map>
 #include <vector>
 #include <memory>
+#include <atomic>
 
 namespace roo {
 class Setting;
@@ -33,6 +34,7 @@ namespace tzrpc {
 
 
 class InsaneBind;
+class ControlServer;
 
 
 class Captain {
@@ -50,10 +52,13 @@ public:
 
 public:
 
-    // 实例仍然会调度，这里控制是否执行函数
+    // 节点是否参与调度，standby的时候放弃所有的分片，任务不设置定时器，
+    // 切换回来的时候按照当前时间重新计算下一次触发
+    bool running() const {
+        return running_;
+    }
+    void set_running(bool running);
 
-    volatile bool running_;
-    
 #ifdef WITH_ZOOKEEPER
     std::shared_ptr<InsaneBind> insane_bind_;
     std::shared_ptr<Clotho::zkFrame> zk_frame_;
@@ -70,12 +75,15 @@ private:
 
 
     bool initialized_;
+    std::atomic<bool> running_;
 
 public:
 
     std::shared_ptr<roo::Setting> setting_ptr_;
     std::shared_ptr<roo::Status> status_ptr_;
     std::shared_ptr<roo::Timer> timer_ptr_;
+
+    std::shared_ptr<ControlServer> control_ptr_;
 };
 
 } // end namespace tzrpc
@@ -0,0 +1,29 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <other/Log.h>
+
+#include "Clock.h"
+
+namespace tzrpc {
+
+static SystemClock system_clock;
+
+std::atomic<Clock*> Clock::current_(&system_clock);
+
+void Clock::install(Clock* clock) {
+
+    if (!clock) {
+        clock = &system_clock;
+    }
+
+    current_.store(clock, std::memory_order_release);
+    roo::log_warning("install %s clock, now %ld.",
+                     clock->is_virtual() ? "virtual" : "system", static_cast<long>(clock->now()));
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,101 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_CLOCK_H__
+#define __TZSERIAL_CLOCK_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+
+namespace tzrpc {
+
+// 调度使用的时钟，SchTime计算下一次触发、JobInstance记录调度状态以及
+// FireTimer的到期时间都从这里取时间
+//
+// 默认是系统时钟，测试和模拟的时候可以安装VirtualClock，由FireTimer::run_until()
+// 驱动时间前进，一天的调度可以在几秒之内重放完成。
+class Clock {
+
+public:
+    virtual ~Clock() { }
+
+    // 墙上时间，秒，用于cron的计算
+    virtual time_t now() = 0;
+
+    // 定时器使用的时间，微秒，只有差值有意义
+    virtual int64_t now_us() = 0;
+
+    virtual bool is_virtual() const = 0;
+
+    // 当前生效的时钟
+    static Clock& instance() {
+        return *current_.load(std::memory_order_acquire);
+    }
+
+    // 安装时钟，NULL恢复系统时钟。调用者负责时钟的生命周期，并且只在调度
+    // 开始之前或者结束之后切换
+    static void install(Clock* clock);
+
+private:
+    static std::atomic<Clock*> current_;
+};
+
+
+class SystemClock : public Clock {
+
+public:
+    virtual time_t now() {
+        return ::time(NULL);
+    }
+
+    virtual int64_t now_us() {
+        struct timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000 * 1000 + ts.tv_nsec / 1000;
+    }
+
+    virtual bool is_virtual() const {
+        return false;
+    }
+};
+
+
+// 虚拟时钟，时间只在advance_to()的时候前进，now()和now_us()使用同一个基准
+class VirtualClock : public Clock {
+
+public:
+    explicit VirtualClock(time_t start) :
+        now_us_(static_cast<int64_t>(start) * 1000 * 1000) {
+    }
+
+    virtual time_t now() {
+        return static_cast<time_t>(now_us_ / (1000 * 1000));
+    }
+
+    virtual int64_t now_us() {
+        return now_us_;
+    }
+
+    virtual bool is_virtual() const {
+        return true;
+    }
+
+    // 时间不会后退
+    void advance_to(int64_t us) {
+        if (us > now_us_) {
+            now_us_ = us;
+        }
+    }
+
+private:
+    std::atomic<int64_t> now_us_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_CLOCK_H__
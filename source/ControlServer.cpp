@@ -0,0 +1,413 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <other/Log.h>
+
+#include "RunHistory.h"
+#include "JobExecutor.h"
+#include "ControlServer.h"
+#include "Captain.h"
+
+namespace tzrpc {
+
+// 单行命令的最大长度，超过的连接直接关闭
+static const size_t kMaxLineSize = 4096;
+static const int    kMaxEvents = 64;
+
+
+ControlServer::~ControlServer() {
+
+    stop();
+
+    if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+        ::unlink(path_.c_str());
+        listen_fd_ = -1;
+    }
+
+    if (epoll_fd_ >= 0) {
+        ::close(epoll_fd_);
+        epoll_fd_ = -1;
+    }
+}
+
+
+bool ControlServer::init() {
+
+    struct sockaddr_un addr;
+    if (path_.empty() || path_.size() >= sizeof(addr.sun_path)) {
+        roo::log_err("invalid control socket path: %s", path_.c_str());
+        return false;
+    }
+
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        roo::log_err("create unix socket failed: %s", strerror(errno));
+        return false;
+    }
+
+    // 上次异常退出残留的socket文件
+    ::unlink(path_.c_str());
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (::bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        roo::log_err("bind %s failed: %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    // add命令会dlopen任意路径的so，只允许本用户连接，accept的时候还会校验对端
+    if (::chmod(path_.c_str(), 0600) != 0 || ::listen(listen_fd_, 16) != 0) {
+        roo::log_err("chmod and listen %s failed: %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        roo::log_err("epoll_create failed: %s", strerror(errno));
+        return false;
+    }
+
+    struct epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) != 0) {
+        roo::log_err("epoll_ctl add listen fd failed: %s", strerror(errno));
+        return false;
+    }
+
+    thread_ = boost::thread(std::bind(&ControlServer::run, this));
+
+    roo::log_warning("ControlServer listen at %s.", path_.c_str());
+    return true;
+}
+
+void ControlServer::stop() {
+
+    stop_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+
+void ControlServer::run() {
+
+    roo::log_warning("ControlServer thread %#lx about to loop ...", (long)pthread_self());
+
+    struct epoll_event events[kMaxEvents];
+
+    while (!stop_) {
+
+        int num = ::epoll_wait(epoll_fd_, events, kMaxEvents, 1000 /*1s*/);
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            roo::log_err("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < num; ++i) {
+
+            int fd = events[i].data.fd;
+            if (fd == listen_fd_) {
+                handle_accept();
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_conn(fd);
+                continue;
+            }
+
+            if (events[i].events & EPOLLIN) {
+                handle_read(fd);
+            }
+
+            if ((events[i].events & EPOLLOUT) && conns_.find(fd) != conns_.end()) {
+                handle_write(fd);
+            }
+        }
+    }
+
+    for (auto iter = conns_.begin(); iter != conns_.end(); ++iter) {
+        ::close(iter->first);
+    }
+    conns_.clear();
+
+    roo::log_warning("ControlServer thread %#lx is about to terminate ... ", (long)pthread_self());
+}
+
+
+void ControlServer::handle_accept() {
+
+    while (true) {
+
+        int fd = ::accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                roo::log_err("accept control connection failed: %s", strerror(errno));
+            }
+            return;
+        }
+
+        // 只接受root和本进程用户的连接
+        struct ucred cred {};
+        socklen_t cred_len = sizeof(cred);
+        if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+            (cred.uid != 0 && cred.uid != ::geteuid())) {
+            roo::log_err("reject control connection from pid %d uid %d.",
+                         static_cast<int>(cred.pid), static_cast<int>(cred.uid));
+            ::close(fd);
+            continue;
+        }
+
+        struct epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            roo::log_err("epoll_ctl add conn fd failed: %s", strerror(errno));
+            ::close(fd);
+            continue;
+        }
+
+        conns_[fd] = Connection();
+    }
+}
+
+
+void ControlServer::handle_read(int fd) {
+
+    auto iter = conns_.find(fd);
+    if (iter == conns_.end()) {
+        return;
+    }
+
+    Connection& conn = iter->second;
+    char buf[1024];
+
+    while (true) {
+
+        ssize_t len = ::read(fd, buf, sizeof(buf));
+        if (len > 0) {
+            conn.in_.append(buf, len);
+
+            // 每次读取之后就处理完整的行，缓存的只有不完整的一行，超长的直接关闭
+            size_t pos = 0;
+            while ((pos = conn.in_.find('\n')) != std::string::npos) {
+                std::string line = conn.in_.substr(0, pos);
+                conn.in_.erase(0, pos + 1);
+                conn.out_ += execute(line);
+            }
+
+            if (conn.in_.size() > kMaxLineSize) {
+                roo::log_err("control command too long, close connection.");
+                close_conn(fd);
+                return;
+            }
+
+            continue;
+        }
+
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // 对端关闭，或者出错
+        close_conn(fd);
+        return;
+    }
+
+    if (!conn.out_.empty()) {
+        handle_write(fd);
+    }
+}
+
+
+void ControlServer::handle_write(int fd) {
+
+    auto iter = conns_.find(fd);
+    if (iter == conns_.end()) {
+        return;
+    }
+
+    Connection& conn = iter->second;
+    while (!conn.out_.empty()) {
+
+        ssize_t len = ::write(fd, conn.out_.data(), conn.out_.size());
+        if (len > 0) {
+            conn.out_.erase(0, len);
+            continue;
+        }
+
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        close_conn(fd);
+        return;
+    }
+
+    update_events(fd);
+}
+
+// 有待发送的数据时才关注EPOLLOUT
+void ControlServer::update_events(int fd) {
+
+    auto iter = conns_.find(fd);
+    if (iter == conns_.end()) {
+        return;
+    }
+
+    struct epoll_event ev {};
+    ev.events = EPOLLIN;
+    if (!iter->second.out_.empty()) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = fd;
+
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void ControlServer::close_conn(int fd) {
+
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+    ::close(fd);
+    conns_.erase(fd);
+}
+
+
+// <job> <defer|async> <so_path> <sch_time...>
+bool ControlServer::parse_spec(const std::vector<std::string>& vec, JobSpec& spec) {
+
+    spec.name_ = vec[1];
+    spec.so_path_ = vec[3];
+
+    if (vec[2] == "async") {
+        spec.exec_method_ = ExecuteMethod::kExecAsync;
+    } else if (vec[2] == "defer") {
+        spec.exec_method_ = ExecuteMethod::kExecDefer;
+    } else {
+        return false;
+    }
+
+    // 剩余的部分都是sch_time
+    spec.sch_time_ = vec[4];
+    for (size_t i = 5; i < vec.size(); ++i) {
+        spec.sch_time_ += " " + vec[i];
+    }
+
+    return true;
+}
+
+
+std::string ControlServer::execute(const std::string& line) {
+
+    std::string cmd = line;
+    boost::algorithm::trim(cmd);
+    if (cmd.empty()) {
+        return "";
+    }
+
+    std::vector<std::string> vec {};
+    boost::split(vec, cmd, boost::is_any_of(" \t"), boost::token_compress_on);
+
+    const std::string& op = vec[0];
+    std::string output;
+    bool ok = true;
+    JobExecutor& executor = JobExecutor::instance();
+
+    if (op == "list" && vec.size() == 1) {
+        executor.task_list(output);
+    } else if (op == "stats" && vec.size() == 1) {
+        executor.task_stats(output);
+    } else if (op == "stats" && vec.size() == 2) {
+        ok = executor.task_stat(vec[1], output);
+    } else if (op == "runs") {
+        ok = RunHistory::instance().query(cmd, output);
+    } else if (op == "pause" && vec.size() == 2) {
+        ok = executor.pause_task(vec[1]);
+    } else if (op == "resume" && vec.size() == 2) {
+        ok = executor.resume_task(vec[1]);
+    } else if (op == "trigger" && vec.size() == 2) {
+        ok = executor.trigger_task(vec[1]);
+    } else if (op == "standby" && vec.size() == 1) {
+        Captain::instance().set_running(false);
+    } else if (op == "activate" && vec.size() == 1) {
+        Captain::instance().set_running(true);
+    } else if (op == "remove" && vec.size() == 2) {
+
+        // 不会阻塞事件循环，执行中的调度结束之后才真正卸载
+        if (!executor.task_exists(vec[1])) {
+            ok = false;
+        } else {
+            ok = executor.remove_so_task(vec[1]);
+        }
+
+    } else if (op == "add" && vec.size() >= 5) {
+
+        JobSpec spec {};
+        if (!parse_spec(vec, spec)) {
+            return "ERR invalid exec_method " + vec[2] + "\n";
+        }
+
+        // dlopen和module_init可能很慢，在async_task_中加载，不阻塞其他连接
+        ok = executor.add_so_task_async(spec);
+
+    } else if (op == "update" && vec.size() >= 5) {
+
+        JobSpec spec {};
+        if (!parse_spec(vec, spec)) {
+            return "ERR invalid exec_method " + vec[2] + "\n";
+        }
+
+        // 其余的配置不能通过命令修改，保留原来的
+        JobSpec current {};
+        if (executor.task_spec(spec.name_, current)) {
+            spec.desc_ = current.desc_;
+            spec.misfire_ = current.misfire_;
+            spec.isolate_ = current.isolate_;
+            spec.timeout_sec_ = current.timeout_sec_;
+            spec.retry_ = current.retry_;
+            spec.lazy_ = current.lazy_;
+        }
+
+        ok = executor.update_so_task(spec);
+
+    } else {
+        return "ERR unknown command: " + cmd + "\n";
+    }
+
+    if (!output.empty() && output[output.size() - 1] != '\n') {
+        output += "\n";
+    }
+
+    if (!ok) {
+        return output + "ERR " + op + " failed\n";
+    }
+
+    return output + "OK\n";
+}
+
+} // end namespace tzrpc
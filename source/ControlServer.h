@@ -0,0 +1,90 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_CONTROL_SERVER_H__
+#define __TZSERIAL_CONTROL_SERVER_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+#include <unordered_map>
+
+#include "JobInstance.h"
+
+#include <gtest/gtest_prod.h>
+
+namespace tzrpc {
+
+// 本地的Unix Domain Socket管理接口，基于epoll，按行处理文本命令
+//
+//   list                                        所有任务的状态
+//   stats [job]                                 执行器或者单个任务的统计
+//   add <job> <defer|async> <so_path> <sch_time>      后台加载，OK表示已经提交
+//   update <job> <defer|async> <so_path> <sch_time>   原地更新，不打断执行
+//   remove <job>
+//   pause <job> | resume <job> | trigger <job>
+//   runs <job> last <N> | runs last <N>         最近的执行记录
+//   standby | activate                          节点退出或者重新参与调度
+//
+// 每个命令的响应以 "OK" 或者 "ERR reason" 单独一行结束
+class ControlServer {
+
+    friend class ControlServerTest;
+    FRIEND_TEST(ControlServerTest, CommandTest);
+    FRIEND_TEST(ControlServerTest, ReadLimitTest);
+
+public:
+    explicit ControlServer(const std::string& path) :
+        path_(path),
+        listen_fd_(-1),
+        epoll_fd_(-1),
+        stop_(false) {
+    }
+
+    ~ControlServer();
+
+    // 禁止拷贝
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    bool init();
+    void stop();
+
+    // 执行单条命令，返回完整的响应
+    std::string execute(const std::string& line);
+
+private:
+
+    struct Connection {
+        std::string in_;
+        std::string out_;
+    };
+
+    void run();
+
+    static bool parse_spec(const std::vector<std::string>& vec, JobSpec& spec);
+
+    void handle_accept();
+    void handle_read(int fd);
+    void handle_write(int fd);
+    void close_conn(int fd);
+    void update_events(int fd);
+
+    std::string path_;
+    int listen_fd_;
+    int epoll_fd_;
+
+    // 只在run()线程中访问
+    std::unordered_map<int, Connection> conns_;
+
+    std::atomic<bool> stop_;
+    boost::thread thread_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_CONTROL_SERVER_H__
@@ -0,0 +1,198 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <other/Log.h>
+
+#include "Coordinator.h"
+
+namespace tzrpc {
+
+static const char* kMemberPrefix = "member.";
+static const char* kShardPrefix  = "shard.";
+
+
+LocalCoordinator::~LocalCoordinator() {
+
+    for (auto iter = shard_fds_.begin(); iter != shard_fds_.end(); ++iter) {
+        ::close(iter->second);
+    }
+    shard_fds_.clear();
+
+    if (member_fd_ >= 0) {
+        ::unlink((dir_ + "/" + kMemberPrefix + self_).c_str());
+        ::close(member_fd_);
+        member_fd_ = -1;
+    }
+}
+
+bool LocalCoordinator::init() {
+
+    if (dir_.empty() || self_.empty() || self_.find('/') != std::string::npos) {
+        roo::log_err("invalid local coordinator dir %s, self %s.", dir_.c_str(), self_.c_str());
+        return false;
+    }
+
+    if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+        roo::log_err("create coordinator dir %s failed: %s", dir_.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (!join()) {
+        return false;
+    }
+
+    roo::log_warning("LocalCoordinator join %s as %s.", dir_.c_str(), self_.c_str());
+    return true;
+}
+
+// 创建并锁定自己的member文件，如果文件被其他实例误当做残留文件删除，
+// 在members()中发现之后重新加入
+bool LocalCoordinator::join() {
+
+    if (joined()) {
+        return true;
+    }
+
+    if (member_fd_ >= 0) {
+        ::close(member_fd_);
+        member_fd_ = -1;
+    }
+
+    // 所有的fd都是CLOEXEC，隔离执行的worker进程不会继承这些锁
+    std::string path = dir_ + "/" + kMemberPrefix + self_;
+    member_fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (member_fd_ < 0) {
+        roo::log_err("open member file %s failed: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (::flock(member_fd_, LOCK_EX | LOCK_NB) != 0) {
+        roo::log_err("member %s already alive in %s.", self_.c_str(), dir_.c_str());
+        ::close(member_fd_);
+        member_fd_ = -1;
+        return false;
+    }
+
+    left_ = false;
+    return true;
+}
+
+void LocalCoordinator::leave() {
+
+    if (member_fd_ >= 0) {
+        ::unlink((dir_ + "/" + kMemberPrefix + self_).c_str());
+        ::close(member_fd_);
+        member_fd_ = -1;
+    }
+
+    left_ = true;
+}
+
+bool LocalCoordinator::joined() {
+
+    struct stat path_st {};
+    struct stat fd_st {};
+    std::string path = dir_ + "/" + kMemberPrefix + self_;
+
+    return member_fd_ >= 0 &&
+           ::stat(path.c_str(), &path_st) == 0 && ::fstat(member_fd_, &fd_st) == 0 &&
+           path_st.st_ino == fd_st.st_ino && path_st.st_dev == fd_st.st_dev;
+}
+
+bool LocalCoordinator::try_acquire(uint32_t shard) {
+
+    if (shard_fds_.find(shard) != shard_fds_.end()) {
+        return true;
+    }
+
+    std::string path = dir_ + "/" + kShardPrefix + std::to_string(static_cast<unsigned long long>(shard));
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        roo::log_err("open shard file %s failed: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (::flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    shard_fds_[shard] = fd;
+    return true;
+}
+
+void LocalCoordinator::release(uint32_t shard) {
+
+    auto iter = shard_fds_.find(shard);
+    if (iter == shard_fds_.end()) {
+        return;
+    }
+
+    ::flock(iter->second, LOCK_UN);
+    ::close(iter->second);
+    shard_fds_.erase(iter);
+}
+
+bool LocalCoordinator::members(std::vector<std::string>& nodes) {
+
+    nodes.clear();
+
+    if (!left_ && !join()) {
+        roo::log_err("LocalCoordinator rejoin %s failed.", dir_.c_str());
+        return false;
+    }
+
+    DIR* dir = ::opendir(dir_.c_str());
+    if (!dir) {
+        roo::log_err("opendir %s failed: %s", dir_.c_str(), strerror(errno));
+        return false;
+    }
+
+    const size_t prefix_len = strlen(kMemberPrefix);
+    struct dirent* entry = NULL;
+    while ((entry = ::readdir(dir)) != NULL) {
+
+        std::string name = entry->d_name;
+        if (name.compare(0, prefix_len, kMemberPrefix) != 0) {
+            continue;
+        }
+
+        std::string id = name.substr(prefix_len);
+        if (id == self_) {
+            nodes.push_back(id);
+            continue;
+        }
+
+        // 能够加锁说明对应的实例已经退出，清理残留的文件
+        std::string path = dir_ + "/" + name;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (::flock(fd, LOCK_SH | LOCK_NB) == 0) {
+            ::unlink(path.c_str());
+        } else {
+            nodes.push_back(id);
+        }
+        ::close(fd);
+    }
+
+    ::closedir(dir);
+
+    std::sort(nodes.begin(), nodes.end());
+    return true;
+}
+
+} // end namespace tzrpc
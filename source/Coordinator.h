@@ -0,0 +1,152 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_COORDINATOR_H__
+#define __TZSERIAL_COORDINATOR_H__
+
+#include <xtra_rhel.h>
+
+#include <map>
+
+#ifdef WITH_ZOOKEEPER
+#include <clotho/zkFrame.h>
+#endif
+
+namespace tzrpc {
+
+// 多个调度实例之间的协调后端：成员管理和分片锁
+//
+// 所有的调用都在ShardManager的定时器线程中进行，后端不需要考虑并发。
+// try_acquire对于已经持有的分片需要重新确认，这样会话过期等原因丢失的
+// 锁可以在下一轮检查中被发现。
+class Coordinator {
+
+public:
+    virtual ~Coordinator() { }
+
+    virtual bool init() = 0;
+
+    // standby的时候退出成员列表，其他实例重新分配它的分片，join()可以重复调用
+    virtual bool join() = 0;
+    virtual void leave() = 0;
+
+    // 非阻塞，已经持有返回true
+    virtual bool try_acquire(uint32_t shard) = 0;
+    virtual void release(uint32_t shard) = 0;
+
+    // 当前存活的实例(包括自己)，不支持成员管理的后端返回false
+    virtual bool members(std::vector<std::string>& nodes) = 0;
+
+    virtual std::string backend() const = 0;
+};
+
+
+// 基于文件锁的单机实现，用于测试和同一台机器上的多实例部署
+//
+// dir/member.<id>  实例存活期间一直持有的文件锁，能够被加锁说明实例已经退出
+// dir/shard.<N>    分片锁
+//
+// 进程退出的时候内核自动释放flock，所以不会出现残留的锁。
+class LocalCoordinator : public Coordinator {
+
+public:
+    LocalCoordinator(const std::string& dir, const std::string& self) :
+        dir_(dir),
+        self_(self),
+        member_fd_(-1),
+        left_(false) {
+    }
+
+    virtual ~LocalCoordinator();
+
+    // 禁止拷贝
+    LocalCoordinator(const LocalCoordinator&) = delete;
+    LocalCoordinator& operator=(const LocalCoordinator&) = delete;
+
+    virtual bool init();
+
+    virtual bool join();
+    virtual void leave();
+
+    virtual bool try_acquire(uint32_t shard);
+    virtual void release(uint32_t shard);
+
+    virtual bool members(std::vector<std::string>& nodes);
+
+    virtual std::string backend() const {
+        return "local";
+    }
+
+private:
+    bool joined();
+
+    std::string dir_;
+    std::string self_;
+
+    int member_fd_;
+    bool left_;
+    std::map<uint32_t, int> shard_fds_;
+};
+
+
+#ifdef WITH_ZOOKEEPER
+
+// 基于ZooKeeper的实现，每个分片对应一个Clotho的服务锁，会话过期之后锁
+// 自动释放。Clotho没有提供成员列表，所以按照抢占的方式获取分片
+class ZkCoordinator : public Coordinator {
+
+public:
+    ZkCoordinator(const std::shared_ptr<Clotho::zkFrame>& zk_frame,
+                  const std::string& dept, const std::string& serv) :
+        zk_frame_(zk_frame),
+        dept_(dept),
+        serv_(serv) {
+    }
+
+    virtual bool init() {
+        return !!zk_frame_;
+    }
+
+    // 节点的注册由Captain管理
+    virtual bool join() {
+        return true;
+    }
+
+    virtual void leave() {
+    }
+
+    virtual bool try_acquire(uint32_t shard) {
+        return zk_frame_->recipe_service_try_lock(dept_, serv_, lock_name(shard), 0);
+    }
+
+    virtual void release(uint32_t shard) {
+        zk_frame_->recipe_service_unlock(dept_, serv_, lock_name(shard));
+    }
+
+    virtual bool members(std::vector<std::string>& nodes) {
+        return false;
+    }
+
+    virtual std::string backend() const {
+        return "zookeeper";
+    }
+
+private:
+    static std::string lock_name(uint32_t shard) {
+        return "shard-" + std::to_string(static_cast<unsigned long long>(shard));
+    }
+
+    std::shared_ptr<Clotho::zkFrame> zk_frame_;
+    std::string dept_;
+    std::string serv_;
+};
+
+#endif // WITH_ZOOKEEPER
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_COORDINATOR_H__
@@ -0,0 +1,149 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_CRON_LITERAL_H__
+#define __TZSERIAL_CRON_LITERAL_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+namespace tzrpc {
+
+// 编译期解析的sch_time，用于内置任务
+//
+//   constexpr SchTime kDaily = "0 0 3"_cron;
+//   add_builtin_task("daily", "desc", ARGUS_CRON("0 0 3"), func);
+//
+// 语法和运行时的SchTime::parse()一致："秒 分 时"，每一项是逗号分隔的
+// *、*/n、a-b或者a。非法的表达式在编译期求值的时候抛出异常，变成编译错误，
+// 所以需要在constexpr的上下文中使用，ARGUS_CRON()保证在编译期求值。
+struct CronMask {
+    uint64_t sec_;
+    uint64_t min_;
+    uint64_t hour_;
+    const char* str_;
+};
+
+namespace cron_detail {
+
+// C++11的constexpr函数只能有一个return语句，下面都写成递归的形式
+
+constexpr bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+constexpr bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+constexpr const char* skip_space(const char* s) {
+    return is_space(*s) ? skip_space(s + 1) : s;
+}
+
+constexpr const char* field_end(const char* s) {
+    return (*s == '\0' || is_space(*s)) ? s : field_end(s + 1);
+}
+
+constexpr int field_count(const char* s) {
+    return *skip_space(s) == '\0' ? 0 : 1 + field_count(field_end(skip_space(s)));
+}
+
+// 第k个字段的开始位置
+constexpr const char* field_at(const char* s, int k) {
+    return k == 0 ? skip_space(s) : field_at(field_end(skip_space(s)), k - 1);
+}
+
+constexpr const char* item_end(const char* s, const char* e) {
+    return (s == e || *s == ',') ? s : item_end(s + 1, e);
+}
+
+constexpr const char* digits_end(const char* s, const char* e) {
+    return (s != e && is_digit(*s)) ? digits_end(s + 1, e) : s;
+}
+
+constexpr int digits_value(const char* s, const char* e, int acc) {
+    return s == e ? acc : digits_value(s + 1, e, acc * 10 + (*s - '0'));
+}
+
+// [s, e)必须是1到2位的数字，并且小于n
+constexpr int number(const char* s, const char* e, int n) {
+    return (s == e || digits_end(s, e) != e || e - s > 2) ?
+           throw std::invalid_argument("cron: expect number") :
+           digits_value(s, e, 0) < n ? digits_value(s, e, 0) :
+           throw std::invalid_argument("cron: value out of range");
+}
+
+constexpr uint64_t all_mask(int n) {
+    return (1ULL << n) - 1;
+}
+
+constexpr uint64_t step_mask(int from, int step, int n) {
+    return from >= n ? 0 : ((1ULL << from) | step_mask(from + step, step, n));
+}
+
+constexpr uint64_t range_mask(int from, int to) {
+    return from < to ? (all_mask(to + 1) & ~all_mask(from)) :
+           throw std::invalid_argument("cron: range from must be less than to");
+}
+
+// */n，n为空的时候等同于*
+constexpr uint64_t star_mask(const char* s, const char* e, int n) {
+    return e == s + 1 ? all_mask(n) :
+           s[1] != '/' ? throw std::invalid_argument("cron: expect / after *") :
+           e == s + 2 ? all_mask(n) :
+           number(s + 2, e, n) > 0 ? step_mask(0, number(s + 2, e, n), n) :
+           throw std::invalid_argument("cron: step must be positive");
+}
+
+constexpr uint64_t value_mask(const char* s, const char* e, int n) {
+    return digits_end(s, e) == e ? (1ULL << number(s, e, n)) :
+           *digits_end(s, e) != '-' ? throw std::invalid_argument("cron: unexpected character") :
+           range_mask(number(s, digits_end(s, e), n), number(digits_end(s, e) + 1, e, n));
+}
+
+constexpr uint64_t item_mask(const char* s, const char* e, int n) {
+    return s == e ? throw std::invalid_argument("cron: empty item") :
+           *s == '*' ? star_mask(s, e, n) : value_mask(s, e, n);
+}
+
+constexpr uint64_t field_mask(const char* s, const char* e, int n) {
+    return item_end(s, e) == e ? item_mask(s, e, n) :
+           (item_mask(s, item_end(s, e), n) | field_mask(item_end(s, e) + 1, e, n));
+}
+
+constexpr uint64_t field_of(const char* str, int k, int n) {
+    return field_mask(field_at(str, k), field_end(field_at(str, k)), n);
+}
+
+} // end namespace cron_detail
+
+constexpr CronMask cron_compile(const char* str) {
+    return cron_detail::field_count(str) != 3 ?
+           throw std::invalid_argument("cron: expect sec min hour") :
+           CronMask { cron_detail::field_of(str, 0, 60),
+                      cron_detail::field_of(str, 1, 60),
+                      cron_detail::field_of(str, 2, 24),
+                      str };
+}
+
+constexpr CronMask operator"" _cron(const char* str, std::size_t) {
+    return cron_compile(str);
+}
+
+} // end namespace tzrpc
+
+// 作为模板参数强制在编译期求值，非法的表达式无法通过编译
+#define ARGUS_CRON(str) \
+    (::tzrpc::CronMask { \
+        std::integral_constant<uint64_t, ::tzrpc::cron_compile(str).sec_>::value, \
+        std::integral_constant<uint64_t, ::tzrpc::cron_compile(str).min_>::value, \
+        std::integral_constant<uint64_t, ::tzrpc::cron_compile(str).hour_>::value, \
+        str })
+
+#endif // __TZSERIAL_CRON_LITERAL_H__
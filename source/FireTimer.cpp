@@ -0,0 +1,182 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+
+#include <other/Log.h>
+
+#include "FireTimer.h"
+
+namespace tzrpc {
+
+void JE_defer_batch_begin();
+void JE_defer_batch_end();
+
+// 预先分配的定时器项，超过之后按照vector的方式扩容
+static const size_t kFireTimerReserve = 1024;
+
+FireTimer& FireTimer::instance() {
+    static FireTimer helper;
+    return helper;
+}
+
+bool FireTimer::init() {
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (running_) {
+        roo::log_err("FireTimer already initialized.");
+        return false;
+    }
+
+    heap_.reserve(kFireTimerReserve);
+    if (Clock::instance().is_virtual()) {
+        roo::log_warning("FireTimer with virtual clock, driven by run_until().");
+        return true;
+    }
+
+    stop_ = false;
+    fire_thread_ = boost::thread(std::bind(&FireTimer::fire_run, this));
+    running_ = true;
+
+    roo::log_warning("FireTimer initialized, reserve %lu entries.", static_cast<unsigned long>(kFireTimerReserve));
+    return true;
+}
+
+void FireTimer::stop() {
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!running_) {
+            return;
+        }
+
+        running_ = false;
+        stop_ = true;
+    }
+
+    cond_.notify_all();
+    fire_thread_.join();
+
+    std::lock_guard<std::mutex> lock(lock_);
+    heap_.clear();
+}
+
+int64_t FireTimer::add(const JobRef& ref, uint64_t gen, int32_t msec) {
+
+    Entry entry {};
+    entry.deadline_us_ = now_us() + static_cast<int64_t>(msec) * 1000;
+    entry.ref_ = ref;
+    entry.gen_ = gen;
+
+    bool earliest = false;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (heap_.size() == heap_.capacity()) {
+            ++grows_;
+        }
+
+        heap_.push_back(entry);
+        std::push_heap(heap_.begin(), heap_.end(), Later());
+        earliest = (heap_.front().deadline_us_ == entry.deadline_us_);
+    }
+
+    // 只有最早的到期时间变化的时候才需要唤醒
+    if (earliest) {
+        cond_.notify_one();
+    }
+
+    return entry.deadline_us_;
+}
+
+uint64_t FireTimer::run_until(VirtualClock& clock, int64_t until_us) {
+
+    uint64_t count = 0;
+
+    while (true) {
+
+        Entry entry {};
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (heap_.empty() || heap_.front().deadline_us_ > until_us) {
+                break;
+            }
+
+            std::pop_heap(heap_.begin(), heap_.end(), Later());
+            entry = heap_.back();
+            heap_.pop_back();
+        }
+
+        clock.advance_to(entry.deadline_us_);
+        job_on_timer(entry.ref_, entry.gen_);
+        ++count;
+    }
+
+    clock.advance_to(until_us);
+    fired_ += count;
+    return count;
+}
+
+size_t FireTimer::size() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return heap_.size();
+}
+
+void FireTimer::fire_run() {
+
+    roo::log_warning("FireTimer thread %#lx about to loop ...", (long)pthread_self());
+
+    std::vector<Entry> due;
+    due.reserve(kFireTimerReserve);
+
+    while (true) {
+
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            while (!stop_) {
+
+                if (heap_.empty()) {
+                    cond_.wait(lock);
+                    continue;
+                }
+
+                int64_t wait_us = heap_.front().deadline_us_ - now_us();
+                if (wait_us <= 0) {
+                    break;
+                }
+                cond_.wait_for(lock, std::chrono::microseconds(wait_us));
+            }
+
+            if (stop_) {
+                break;
+            }
+
+            int64_t now = now_us();
+            while (!heap_.empty() && heap_.front().deadline_us_ <= now) {
+                std::pop_heap(heap_.begin(), heap_.end(), Later());
+                if (due.size() == due.capacity()) {
+                    ++grows_;
+                }
+                due.push_back(heap_.back());
+                heap_.pop_back();
+            }
+        }
+
+        // 回调中需要锁住任务并投递到队列，在锁外执行，不阻塞add()。
+        // 同一次到期的defer任务攒成一批入队，只加一次锁、唤醒一次
+        JE_defer_batch_begin();
+        for (size_t i = 0; i < due.size(); ++i) {
+            job_on_timer(due[i].ref_, due[i].gen_);
+        }
+        JE_defer_batch_end();
+        fired_ += due.size();
+        due.clear();
+    }
+
+    roo::log_warning("FireTimer thread %#lx is about to terminate ... ", (long)pthread_self());
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,106 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_FIRE_TIMER_H__
+#define __TZSERIAL_FIRE_TIMER_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+#include <condition_variable>
+
+#include <boost/thread.hpp>
+
+#include "Clock.h"
+#include "JobInstance.h"
+
+namespace tzrpc {
+
+// 任务触发专用的定时器
+//
+// roo::Timer每次设置都会创建TimerObject和保存回调的std::function，
+// 任务的每次触发都需要分配内存。这里的定时器项只有JobRef和代数，按值
+// 存放在预先分配的最小堆中，容量稳定之后设置和触发都不再分配内存。
+// 定时器项不能撤销，重新调度的时候增加代数，过期的项在触发时被丢弃。
+//
+// 时间取自Clock，安装VirtualClock的时候不启动定时器线程，由run_until()
+// 在调用者的线程中按照到期的顺序触发。
+class FireTimer {
+
+public:
+    static FireTimer& instance();
+
+    bool init();
+    void stop();
+
+    // msec毫秒之后在定时器线程中调用job_on_timer(ref, gen)，返回到期时间
+    int64_t add(const JobRef& ref, uint64_t gen, int32_t msec);
+
+    // 当前时钟的时间，微秒
+    static int64_t now_us() {
+        return Clock::instance().now_us();
+    }
+
+    // 虚拟时钟的驱动：依次把时钟推进到每个到期项并触发，直到until_us，
+    // 返回触发的次数。触发中新增的项如果不晚于until_us也会被执行
+    uint64_t run_until(VirtualClock& clock, int64_t until_us);
+
+    size_t size();
+
+    uint64_t fired() const {
+        return fired_;
+    }
+
+    // 堆扩容的次数
+    uint64_t grows() const {
+        return grows_;
+    }
+
+private:
+
+    FireTimer() :
+        running_(false),
+        stop_(false),
+        fired_(0),
+        grows_(0) {
+    }
+
+    ~FireTimer() { }
+
+    // 禁止拷贝
+    FireTimer(const FireTimer&) = delete;
+    FireTimer& operator=(const FireTimer&) = delete;
+
+    struct Entry {
+        int64_t  deadline_us_;
+        JobRef   ref_;
+        uint64_t gen_;
+    };
+
+    struct Later {
+        bool operator()(const Entry& a, const Entry& b) const {
+            return a.deadline_us_ > b.deadline_us_;
+        }
+    };
+
+    void fire_run();
+
+    std::mutex lock_;
+    std::condition_variable cond_;
+    std::vector<Entry> heap_;
+
+    bool running_;
+    bool stop_;
+    boost::thread fire_thread_;
+
+    std::atomic<uint64_t> fired_;
+    std::atomic<uint64_t> grows_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_FIRE_TIMER_H__
@@ -0,0 +1,351 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/time.h>
+
+#include <algorithm>
+
+#include <other/Log.h>
+
+#include "HotLog.h"
+
+namespace tzrpc {
+
+// 后台线程取出日志的间隔
+static const int32_t kHotLogDrainMsec = 20;
+
+std::atomic<int> HotLog::level_(LOG_DEBUG);
+
+HotLog& HotLog::instance() {
+    static HotLog helper;
+    return helper;
+}
+
+int64_t HotLog::now_us() {
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return static_cast<int64_t>(tv.tv_sec) * 1000 * 1000 + tv.tv_usec;
+}
+
+bool HotLog::init(int level) {
+
+    if (running_) {
+        roo::log_err("HotLog already initialized.");
+        return false;
+    }
+
+    set_level(level);
+
+    stop_ = false;
+    batch_.reserve(kHotLogRingSize * 4);
+    drain_thread_ = boost::thread(std::bind(&HotLog::drain_run, this));
+    running_ = true;
+
+    roo::log_warning("HotLog initialized with level %d.", level);
+    return true;
+}
+
+void HotLog::stop() {
+
+    if (!running_) {
+        return;
+    }
+
+    // 之后的写入都同步输出，等待已经看到running_的写入结束，最后一次取出
+    // 之后不会再有日志写入队列
+    running_ = false;
+
+    {
+        // 持有drain_lock_，等待期间后台线程不会回收队列
+        std::lock_guard<std::mutex> drain_lock(drain_lock_);
+        std::lock_guard<std::mutex> lock(lock_);
+        for (size_t i = 0; i < rings_.size(); ++i) {
+            while (rings_[i]->busy_) {
+                boost::this_thread::yield();
+            }
+        }
+    }
+
+    stop_ = true;
+    drain_thread_.join();
+
+    // 停止之前已经写入队列的日志
+    drain();
+}
+
+
+// 每个线程第一次写日志的时候分配自己的队列，线程退出之后由后台线程在
+// 队列取空之后回收。异步任务每次在新的线程中执行，回收的队列放到空闲列表
+// 中给之后的线程复用，不会每个线程都分配一次
+namespace {
+
+struct ThreadRingHolder {
+
+    void* ring_;
+    std::atomic<bool>* closed_;
+
+    ThreadRingHolder() :
+        ring_(NULL),
+        closed_(NULL) {
+    }
+
+    ~ThreadRingHolder() {
+        if (closed_) {
+            closed_->store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadRingHolder ring_holder;
+
+} // end anonymous namespace
+
+HotLog::ThreadRing* HotLog::thread_ring() {
+
+    if (likely(ring_holder.ring_ != NULL)) {
+        return static_cast<ThreadRing*>(ring_holder.ring_);
+    }
+
+    ThreadRing* ring = NULL;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!free_rings_.empty()) {
+            ring = free_rings_.back();
+            free_rings_.pop_back();
+        } else {
+            ++ring_allocs_;
+        }
+    }
+
+    if (!ring) {
+        ring = new ThreadRing();
+    }
+
+    ring->ring_.reset();
+    ring->closed_ = false;
+    ring->busy_ = false;
+    ring->written_ = 0;
+    ring->dropped_ = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        rings_.push_back(ring);
+    }
+
+    ring_holder.ring_ = ring;
+    ring_holder.closed_ = &ring->closed_;
+    return ring;
+}
+
+void HotLog::commit(const HotLogRecord& rec) {
+
+    // 错误和告警不能丢失，直接同步输出
+    if (!running_ || rec.level_ <= LOG_WARNING) {
+        emit(rec);
+        return;
+    }
+
+    // 先标记busy_再检查running_，和stop()中的顺序相反，stop()看到busy_为false
+    // 之后，这里一定能看到running_为false
+    ThreadRing* ring = thread_ring();
+    ring->busy_ = true;
+    if (unlikely(!running_)) {
+        ring->busy_ = false;
+        emit(rec);
+        return;
+    }
+
+    if (likely(ring->ring_.push(rec))) {
+        ring->written_.store(ring->written_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    } else {
+        ring->dropped_.store(ring->dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    ring->busy_.store(false, std::memory_order_release);
+}
+
+
+void HotLog::drain_run() {
+
+    while (!stop_) {
+        if (drain() == 0) {
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(kHotLogDrainMsec));
+        }
+    }
+}
+
+size_t HotLog::drain() {
+
+    std::lock_guard<std::mutex> drain_lock(drain_lock_);
+
+    std::vector<ThreadRing*> rings;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        rings = rings_;
+    }
+
+    // 取出之前已经关闭的队列，线程的所有写入都在关闭之前，本轮取空之后可以回收
+    std::vector<bool> closed(rings.size(), false);
+    for (size_t i = 0; i < rings.size(); ++i) {
+        closed[i] = rings[i]->closed_.load(std::memory_order_acquire);
+    }
+
+    batch_.clear();
+    HotLogRecord rec;
+    for (size_t i = 0; i < rings.size(); ++i) {
+        while (rings[i]->ring_.pop(rec)) {
+            batch_.push_back(rec);
+        }
+    }
+
+    // 多个线程的日志按照写入的时间输出
+    std::stable_sort(batch_.begin(), batch_.end(),
+                     [](const HotLogRecord& a, const HotLogRecord& b) {
+                         return a.time_us_ < b.time_us_;
+                     });
+
+    for (size_t i = 0; i < batch_.size(); ++i) {
+        emit(batch_[i]);
+    }
+    drained_ += batch_.size();
+
+    for (size_t i = 0; i < rings.size(); ++i) {
+        if (!closed[i]) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        rings_.erase(std::find(rings_.begin(), rings_.end(), rings[i]));
+        retired_written_ += rings[i]->written_;
+        retired_dropped_ += rings[i]->dropped_;
+        if (free_rings_.size() < kHotLogFreeRings) {
+            free_rings_.push_back(rings[i]);
+        } else {
+            delete rings[i];
+        }
+    }
+
+    return batch_.size();
+}
+
+
+// 按照 {} 占位符依次替换参数，参数不够的时候保留 {}
+std::string HotLog::format(const HotLogRecord& rec) {
+
+    std::string msg;
+    msg.reserve(128);
+
+    size_t offset = 0;
+    uint8_t arg = 0;
+    char buf[32];
+
+    for (const char* p = rec.fmt_; *p; ++p) {
+
+        if (p[0] != '{' || p[1] != '}' || arg >= rec.argc_) {
+            msg.push_back(*p);
+            continue;
+        }
+
+        ++p;
+        switch (rec.types_[arg++]) {
+            case kHotArgInt: {
+                int64_t v;
+                ::memcpy(&v, rec.data_ + offset, sizeof(v));
+                offset += sizeof(v);
+                ::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(v));
+                msg.append(buf);
+                break;
+            }
+            case kHotArgUint: {
+                uint64_t v;
+                ::memcpy(&v, rec.data_ + offset, sizeof(v));
+                offset += sizeof(v);
+                ::snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(v));
+                msg.append(buf);
+                break;
+            }
+            case kHotArgDouble: {
+                double v;
+                ::memcpy(&v, rec.data_ + offset, sizeof(v));
+                offset += sizeof(v);
+                ::snprintf(buf, sizeof(buf), "%g", v);
+                msg.append(buf);
+                break;
+            }
+            case kHotArgStr: {
+                size_t len = static_cast<uint8_t>(rec.data_[offset]);
+                msg.append(rec.data_ + offset + 1, len);
+                offset += 1 + len;
+                break;
+            }
+        }
+    }
+
+    return msg;
+}
+
+void HotLog::emit(const HotLogRecord& rec) {
+
+    std::string msg = format(rec);
+
+    switch (rec.level_) {
+        case LOG_EMERG:
+        case LOG_ALERT:
+        case LOG_CRIT:
+        case LOG_ERR:     roo::log_err("%s", msg.c_str()); break;
+        case LOG_WARNING: roo::log_warning("%s", msg.c_str()); break;
+        case LOG_NOTICE:  roo::log_notice("%s", msg.c_str()); break;
+        case LOG_INFO:    roo::log_info("%s", msg.c_str()); break;
+        default:          roo::log_debug("%s", msg.c_str()); break;
+    }
+}
+
+
+uint64_t HotLog::dropped() {
+
+    std::lock_guard<std::mutex> lock(lock_);
+    uint64_t dropped = retired_dropped_;
+    for (size_t i = 0; i < rings_.size(); ++i) {
+        dropped += rings_[i]->dropped_;
+    }
+    return dropped;
+}
+
+
+int HotLog::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "Argus";
+    name = "HotLog";
+
+    uint64_t written = 0;
+    uint64_t dropped = 0;
+    size_t count = 0;
+    size_t free_count = 0;
+    uint64_t allocs = 0;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        written = retired_written_;
+        dropped = retired_dropped_;
+        for (size_t i = 0; i < rings_.size(); ++i) {
+            written += rings_[i]->written_;
+            dropped += rings_[i]->dropped_;
+        }
+        count = rings_.size();
+        free_count = free_rings_.size();
+        allocs = ring_allocs_;
+    }
+
+    std::stringstream ss;
+    ss << "level: " << level_ << ", rings: " << count << ", free: " << free_count
+       << ", allocated: " << allocs
+       << ", written: " << written << ", drained: " << drained_
+       << ", dropped: " << dropped << std::endl;
+
+    val = ss.str();
+    return 0;
+}
+
+} // end namespace tzrpc
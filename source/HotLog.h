@@ -0,0 +1,233 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_HOT_LOG_H__
+#define __TZSERIAL_HOT_LOG_H__
+
+#include <xtra_rhel.h>
+
+#include <syslog.h>
+
+#include <atomic>
+#include <type_traits>
+
+#include "ShmRing.h"
+
+namespace tzrpc {
+
+static const size_t kHotLogArgMax  = 6;
+static const size_t kHotLogDataMax = 208;
+static const size_t kHotLogStrMax  = 80;    // 单个字符串参数最多拷贝的长度
+static const size_t kHotLogRingSize = 256;  // 每个线程缓存的记录数
+static const size_t kHotLogFreeRings = 32;  // 保留的已回收队列数
+
+enum HotLogArgType : uint8_t {
+    kHotArgInt    = 1,
+    kHotArgUint   = 2,
+    kHotArgDouble = 3,
+    kHotArgStr    = 4,
+};
+
+// 一条日志的二进制形式：格式串的指针，以及按照类型打包的参数值
+struct HotLogRecord {
+    int64_t     time_us_;
+    const char* fmt_;
+    uint8_t     level_;
+    uint8_t     argc_;
+    uint16_t    size_;
+    uint8_t     types_[kHotLogArgMax];
+    char        data_[kHotLogDataMax];
+};
+
+
+// 参数打包，空间不足的参数被丢弃，格式化的时候输出为 {}
+inline void hot_log_put(HotLogRecord& rec, uint8_t type, const void* val, size_t len) {
+
+    if (rec.argc_ >= kHotLogArgMax || rec.size_ + len > kHotLogDataMax) {
+        return;
+    }
+
+    rec.types_[rec.argc_++] = type;
+    ::memcpy(rec.data_ + rec.size_, val, len);
+    rec.size_ += static_cast<uint16_t>(len);
+}
+
+inline void hot_log_put_str(HotLogRecord& rec, const char* str, size_t len) {
+
+    if (len > kHotLogStrMax) {
+        len = kHotLogStrMax;
+    }
+
+    // 长度和内容连续存放
+    if (rec.argc_ >= kHotLogArgMax || rec.size_ + 1 + len > kHotLogDataMax) {
+        return;
+    }
+
+    rec.types_[rec.argc_++] = kHotArgStr;
+    rec.data_[rec.size_] = static_cast<char>(len);
+    ::memcpy(rec.data_ + rec.size_ + 1, str, len);
+    rec.size_ += static_cast<uint16_t>(1 + len);
+}
+
+inline void hot_log_put(HotLogRecord& rec, const char* str) {
+    hot_log_put_str(rec, str ? str : "(null)", str ? ::strlen(str) : 6);
+}
+
+inline void hot_log_put(HotLogRecord& rec, const std::string& str) {
+    hot_log_put_str(rec, str.c_str(), str.size());
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+hot_log_put(HotLogRecord& rec, const T& val) {
+    int64_t v = val;
+    hot_log_put(rec, kHotArgInt, &v, sizeof(v));
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+hot_log_put(HotLogRecord& rec, const T& val) {
+    uint64_t v = val;
+    hot_log_put(rec, kHotArgUint, &v, sizeof(v));
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+hot_log_put(HotLogRecord& rec, const T& val) {
+    double v = val;
+    hot_log_put(rec, kHotArgDouble, &v, sizeof(v));
+}
+
+inline void hot_log_pack(HotLogRecord& rec) {
+}
+
+template<typename T, typename... Args>
+inline void hot_log_pack(HotLogRecord& rec, const T& val, const Args&... args) {
+    hot_log_put(rec, val);
+    hot_log_pack(rec, args...);
+}
+
+
+// 任务热路径上的异步日志
+//
+// 调用线程只把格式串的指针和参数的二进制值写入本线程的环形队列，不分配内存、
+// 不加锁，后台线程批量取出之后再格式化并写入roo::Log。格式串使用 {} 作为
+// 占位符，必须是字符串常量；字符串参数按值拷贝，超长的被截断。日志级别不满足
+// 的时候只有一次比较，队列满的时候丢弃并计数。ERR和WARNING不经过队列，
+// 总是同步输出，不会被丢弃。后台线程没有启动的时候(比如测试程序)同步输出。
+class HotLog {
+
+public:
+    static HotLog& instance();
+
+    bool init(int level);
+    // 输出所有缓存的日志，之后的日志同步输出
+    void stop();
+
+    static void set_level(int level) {
+        level_.store(level, std::memory_order_relaxed);
+    }
+
+    static bool enabled(int level) {
+        return level <= level_.load(std::memory_order_relaxed);
+    }
+
+    template<typename... Args>
+    void log(int level, const char* fmt, const Args&... args) {
+
+        HotLogRecord rec;
+        rec.time_us_ = now_us();
+        rec.fmt_ = fmt;
+        rec.level_ = static_cast<uint8_t>(level);
+        rec.argc_ = 0;
+        rec.size_ = 0;
+        hot_log_pack(rec, args...);
+
+        commit(rec);
+    }
+
+    // 取出所有线程缓存的日志并输出，返回输出的条数
+    size_t drain();
+
+    // 队列满被丢弃的日志条数
+    uint64_t dropped();
+
+    static std::string format(const HotLogRecord& rec);
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+private:
+
+    HotLog() :
+        running_(false),
+        stop_(false),
+        ring_allocs_(0),
+        retired_written_(0),
+        retired_dropped_(0),
+        drained_(0) {
+    }
+
+    ~HotLog() {
+        for (size_t i = 0; i < free_rings_.size(); ++i) {
+            delete free_rings_[i];
+        }
+    }
+
+    // 禁止拷贝
+    HotLog(const HotLog&) = delete;
+    HotLog& operator=(const HotLog&) = delete;
+
+    struct ThreadRing {
+        ShmRing<HotLogRecord, kHotLogRingSize> ring_;
+        std::atomic<bool>     closed_;      // 所属线程已经退出
+        std::atomic<bool>     busy_;        // 所属线程正在写入，stop()等待写入结束
+        std::atomic<uint64_t> written_;
+        std::atomic<uint64_t> dropped_;
+    };
+
+    static int64_t now_us();
+    static void emit(const HotLogRecord& rec);
+
+    void commit(const HotLogRecord& rec);
+    ThreadRing* thread_ring();
+    void drain_run();
+
+    static std::atomic<int> level_;
+
+    std::atomic<bool> running_;
+    std::atomic<bool> stop_;
+    boost::thread drain_thread_;
+
+    std::mutex lock_;
+    std::vector<ThreadRing*> rings_;
+    std::vector<ThreadRing*> free_rings_;   // 线程退出之后取空的队列，新线程优先复用
+    uint64_t ring_allocs_;
+    uint64_t retired_written_;
+    uint64_t retired_dropped_;
+
+    // drain()可能被后台线程和stop()同时调用
+    std::mutex drain_lock_;
+    std::vector<HotLogRecord> batch_;
+    std::atomic<uint64_t> drained_;
+};
+
+} // end namespace tzrpc
+
+
+#define HOT_LOG(level, fmt, ...) \
+    do { \
+        if (::tzrpc::HotLog::enabled(level)) \
+            ::tzrpc::HotLog::instance().log(level, fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#define HOT_LOG_ERR(fmt, ...)     HOT_LOG(LOG_ERR, fmt, ##__VA_ARGS__)
+#define HOT_LOG_WARNING(fmt, ...) HOT_LOG(LOG_WARNING, fmt, ##__VA_ARGS__)
+#define HOT_LOG_NOTICE(fmt, ...)  HOT_LOG(LOG_NOTICE, fmt, ##__VA_ARGS__)
+#define HOT_LOG_INFO(fmt, ...)    HOT_LOG(LOG_INFO, fmt, ##__VA_ARGS__)
+#define HOT_LOG_DEBUG(fmt, ...)   HOT_LOG(LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif // __TZSERIAL_HOT_LOG_H__
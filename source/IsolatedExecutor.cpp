@@ -0,0 +1,656 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+#include <map>
+#include <thread>
+
+#include <other/Log.h>
+
+#include "SoWrapper.h"
+#include "RunHistory.h"
+#include "JobInstance.h"
+#include "IsolatedExecutor.h"
+
+namespace tzrpc {
+
+// worker启动之后的握手，以及回收时等待退出的时间
+static const int32_t kWorkerReadyMsec = 3000;
+static const int32_t kWorkerExitMsec  = 1000;
+// 超时请求取消之后，等待so自行返回的时间
+static const int32_t kWorkerCancelMsec = 1000;
+
+// worker进程中正在执行的请求，用于job_cancel_requested()
+static const IsolatedChannel* worker_channel = NULL;
+static uint64_t worker_seq = 0;
+
+IsolatedExecutor& IsolatedExecutor::instance() {
+    static IsolatedExecutor helper;
+    return helper;
+}
+
+
+static void copy_field(char* dest, size_t size, const std::string& src) {
+    size_t len = std::min(size - 1, src.size());
+    memcpy(dest, src.data(), len);
+    dest[len] = '\0';
+}
+
+static int64_t current_rss_kb() {
+
+    long pages = 0;
+    long resident = 0;
+
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp) {
+        return 0;
+    }
+
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+
+    return static_cast<int64_t>(resident) * ::sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static void notify_fd(int fd) {
+    uint64_t val = 1;
+    while (::write(fd, &val, sizeof(val)) < 0 && errno == EINTR) {
+        // retry
+    }
+}
+
+
+bool IsolatedExecutor::init(const libconfig::Config& conf) {
+
+    int workers = 0;
+    int max_rss_mb = 512;
+    conf.lookupValue("schedule.isolated_workers", workers);
+    conf.lookupValue("schedule.isolated_max_runs", max_runs_);
+    conf.lookupValue("schedule.isolated_max_rss_mb", max_rss_mb);
+
+    if (workers == 0) {
+        roo::log_warning("isolated_workers not set, IsolatedExecutor disabled.");
+        return true;
+    }
+
+    if (workers < 0 || workers > 100 || max_runs_ <= 0 || max_rss_mb <= 0) {
+        roo::log_err("invalid isolated setting, workers %d, max_runs %d, max_rss_mb %d",
+                     workers, max_runs_, max_rss_mb);
+        return false;
+    }
+    max_rss_kb_ = static_cast<int64_t>(max_rss_mb) * 1024;
+
+    char exe[PATH_MAX] {};
+    ssize_t len = ::readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len <= 0) {
+        roo::log_err("readlink /proc/self/exe failed: %s", strerror(errno));
+        return false;
+    }
+    exe_path_.assign(exe, len);
+
+    // worker继承读端，服务进程持有写端，服务退出之后worker读到POLLHUP跟着退出。
+    // PR_SET_PDEATHSIG跟随的是fork的线程而不是进程，worker可能在async的执行
+    // 线程中重建，这个线程结束的时候worker会被误杀
+    int fds[2] {};
+    if (alive_wfd_ < 0) {
+        if (::pipe2(fds, O_CLOEXEC) != 0) {
+            roo::log_err("create isolated alive pipe failed: %s", strerror(errno));
+            return false;
+        }
+        alive_rfd_ = fds[0];
+        alive_wfd_ = fds[1];
+    }
+
+    // 初始化之后workers_的大小不再改变，Worker的引用一直有效
+    Worker worker {};
+    worker.pid_ = -1;
+    worker.shm_fd_ = worker.req_fd_ = worker.rsp_fd_ = -1;
+    workers_.assign(workers, worker);
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        if (!spawn(workers_[i])) {
+            roo::log_err("spawn isolated worker %d failed.", static_cast<int>(i));
+            return false;
+        }
+    }
+
+    roo::log_warning("IsolatedExecutor started %d workers with %s, max_runs %d, max_rss %ld KB.",
+                     workers, exe_path_.c_str(), max_runs_, static_cast<long>(max_rss_kb_));
+    return true;
+}
+
+
+bool IsolatedExecutor::spawn(Worker& worker) {
+
+    // 共享内存在fork之前就已经unlink，只通过继承的fd访问，进程退出后自动释放
+    char shm_name[64] {};
+    snprintf(shm_name, sizeof(shm_name), "/argus-isolated-%d-%lu",
+             static_cast<int>(::getpid()), static_cast<unsigned long>(spawned_++));
+
+    worker.shm_fd_ = ::shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (worker.shm_fd_ < 0) {
+        roo::log_err("shm_open %s failed: %s", shm_name, strerror(errno));
+        return false;
+    }
+    ::shm_unlink(shm_name);
+
+    void* addr = MAP_FAILED;
+    if (::ftruncate(worker.shm_fd_, sizeof(IsolatedChannel)) == 0) {
+        addr = ::mmap(NULL, sizeof(IsolatedChannel), PROT_READ | PROT_WRITE, MAP_SHARED, worker.shm_fd_, 0);
+    }
+
+    if (addr == MAP_FAILED) {
+        roo::log_err("map isolated channel failed: %s", strerror(errno));
+        release(worker);
+        return false;
+    }
+
+    worker.chan_ = static_cast<IsolatedChannel*>(addr);
+    worker.chan_->magic_ = kIsolatedMagic;
+    worker.chan_->worker_pid_ = 0;
+    worker.chan_->cancel_seq_.store(0);
+    worker.chan_->req_.reset();
+    worker.chan_->rsp_.reset();
+
+    worker.req_fd_ = ::eventfd(0, EFD_CLOEXEC);
+    worker.rsp_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (worker.req_fd_ < 0 || worker.rsp_fd_ < 0) {
+        roo::log_err("create eventfd failed: %s", strerror(errno));
+        release(worker);
+        return false;
+    }
+
+    // fork之后只能调用async-signal-safe的函数，参数提前准备好
+    char arg[64] {};
+    snprintf(arg, sizeof(arg), "%d,%d,%d,%d", worker.shm_fd_, worker.req_fd_, worker.rsp_fd_, alive_rfd_);
+    char opt[] = "-w";
+    char* const argv[] = { const_cast<char*>(exe_path_.c_str()), opt, arg, NULL };
+
+    sigset_t empty;
+    ::sigemptyset(&empty);
+
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        roo::log_err("fork isolated worker failed: %s", strerror(errno));
+        release(worker);
+        return false;
+    }
+
+    if (pid == 0) {
+        ::fcntl(worker.shm_fd_, F_SETFD, 0);
+        ::fcntl(worker.req_fd_, F_SETFD, 0);
+        ::fcntl(worker.rsp_fd_, F_SETFD, 0);
+        ::fcntl(alive_rfd_, F_SETFD, 0);
+
+        // 父进程中屏蔽的SIGTERM需要恢复
+        ::sigprocmask(SIG_SETMASK, &empty, NULL);
+
+        ::execv(exe_path_.c_str(), argv);
+        ::_exit(127);
+    }
+
+    worker.pid_ = pid;
+    worker.seq_ = 0;
+    worker.runs_ = 0;
+
+    // 等待worker的握手，这样exec失败不会被当做任务执行失败
+    IsolatedResponse rsp {};
+    if (!wait_response(worker, rsp, kWorkerReadyMsec)) {
+        roo::log_err("isolated worker %d not ready.", static_cast<int>(pid));
+        reap(worker, true);
+        return false;
+    }
+
+    roo::log_notice("isolated worker %d spawned.", static_cast<int>(pid));
+    return true;
+}
+
+
+// 释放worker的共享内存和通知fd，进程需要已经退出
+void IsolatedExecutor::release(Worker& worker) {
+
+    if (worker.chan_) {
+        ::munmap(worker.chan_, sizeof(IsolatedChannel));
+        worker.chan_ = NULL;
+    }
+
+    if (worker.shm_fd_ >= 0) {
+        ::close(worker.shm_fd_);
+        worker.shm_fd_ = -1;
+    }
+
+    if (worker.req_fd_ >= 0) {
+        ::close(worker.req_fd_);
+        worker.req_fd_ = -1;
+    }
+
+    if (worker.rsp_fd_ >= 0) {
+        ::close(worker.rsp_fd_);
+        worker.rsp_fd_ = -1;
+    }
+
+    worker.pid_ = -1;
+}
+
+void IsolatedExecutor::reap(Worker& worker, bool force) {
+
+    if (worker.pid_ > 0) {
+
+        pid_t pid = worker.pid_;
+        int status = 0;
+        bool exited = false;
+
+        if (!force) {
+            IsolatedRequest req {};
+            req.seq_ = ++worker.seq_;
+            req.cmd_ = kIsolatedExit;
+            if (worker.chan_->req_.push(req)) {
+                notify_fd(worker.req_fd_);
+            }
+
+            for (int i = 0; i < kWorkerExitMsec / 10; ++i) {
+                if (::waitpid(pid, &status, WNOHANG) == pid) {
+                    exited = true;
+                    break;
+                }
+                ::usleep(10 * 1000);
+            }
+        }
+
+        if (!exited) {
+            ::kill(pid, SIGKILL);
+            ::waitpid(pid, &status, 0);
+        }
+
+        roo::log_notice("isolated worker %d reaped, status %d.", static_cast<int>(pid), status);
+    }
+
+    release(worker);
+}
+
+
+bool IsolatedExecutor::wait_response(Worker& worker, IsolatedResponse& rsp, int32_t timeout_ms) {
+
+    auto deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout_ms);
+
+    while (true) {
+
+        while (worker.chan_->rsp_.pop(rsp)) {
+            if (rsp.seq_ == worker.seq_) {
+                return true;
+            }
+            roo::log_err("drop stale isolated response seq %lu, expect %lu.",
+                         static_cast<unsigned long>(rsp.seq_), static_cast<unsigned long>(worker.seq_));
+        }
+
+        if (timeout_ms >= 0 && boost::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+
+        struct pollfd pfd {};
+        pfd.fd = worker.rsp_fd_;
+        pfd.events = POLLIN;
+        int num = ::poll(&pfd, 1, 200);
+        if (num > 0) {
+            uint64_t val = 0;
+            ssize_t len = ::read(worker.rsp_fd_, &val, sizeof(val));
+            (void)len;
+            continue;
+        }
+
+        // 周期检查worker是否已经退出
+        int status = 0;
+        if (::waitpid(worker.pid_, &status, WNOHANG) != worker.pid_) {
+            continue;
+        }
+
+        // worker可能在写完结果之后才退出
+        while (worker.chan_->rsp_.pop(rsp)) {
+            if (rsp.seq_ == worker.seq_) {
+                worker.pid_ = -1;
+                return true;
+            }
+        }
+
+        if (WIFSIGNALED(status)) {
+            roo::log_err("isolated worker %d killed by signal %d.",
+                         static_cast<int>(worker.pid_), WTERMSIG(status));
+        } else {
+            roo::log_err("isolated worker %d exit with %d.",
+                         static_cast<int>(worker.pid_), WEXITSTATUS(status));
+        }
+
+        worker.pid_ = -1;
+        return false;
+    }
+}
+
+
+// 等待执行结果，超时之后请求取消，宽限时间之后仍然没有返回则返回false
+bool IsolatedExecutor::wait_isolated(Worker& worker, const JobSpec& spec, IsolatedResponse& rsp) {
+
+    if (spec.timeout_sec_ <= 0) {
+        return wait_response(worker, rsp, -1);
+    }
+
+    if (wait_response(worker, rsp, spec.timeout_sec_ * 1000)) {
+        return true;
+    }
+
+    if (worker.pid_ <= 0) {
+        return false;
+    }
+
+    worker.chan_->cancel_seq_.store(worker.seq_, std::memory_order_release);
+    return wait_response(worker, rsp, kWorkerCancelMsec);
+}
+
+
+int IsolatedExecutor::execute(const JobSpec& spec) {
+
+    IsolatedRequest req {};
+    if (spec.so_path_.size() >= sizeof(req.so_path_)) {
+        roo::log_err("so_path too long for isolated execute: %s", spec.so_path_.c_str());
+        return -1;
+    }
+
+    Worker* worker = NULL;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (!stopped_ && !worker) {
+            for (size_t i = 0; i < workers_.size(); ++i) {
+                if (!workers_[i].busy_) {
+                    worker = &workers_[i];
+                    break;
+                }
+            }
+
+            if (!worker) {
+                cond_.wait(lock);
+            }
+        }
+
+        if (!worker) {
+            roo::log_err("IsolatedExecutor stopped, reject job %s.", spec.name_.c_str());
+            return -1;
+        }
+
+        worker->busy_ = true;
+    }
+
+    // 之前回收或者崩溃后重建失败的，在这里重试
+    int code = -1;
+    if (worker->pid_ <= 0) {
+        release(*worker);
+        spawn(*worker);
+    }
+
+    if (worker->pid_ > 0) {
+
+        req.seq_ = ++worker->seq_;
+        req.cmd_ = kIsolatedRun;
+        copy_field(req.name_, sizeof(req.name_), spec.name_);
+        copy_field(req.desc_, sizeof(req.desc_), spec.desc_);
+        copy_field(req.sch_time_, sizeof(req.sch_time_), spec.sch_time_);
+        copy_field(req.so_path_, sizeof(req.so_path_), spec.so_path_);
+
+        IsolatedResponse rsp {};
+        bool pushed = worker->chan_->req_.push(req);
+        if (pushed) {
+            notify_fd(worker->req_fd_);
+        }
+
+        if (!pushed) {
+            roo::log_err("isolated worker %d request ring full.", static_cast<int>(worker->pid_));
+        } else if (!wait_isolated(*worker, spec, rsp)) {
+
+            if (worker->pid_ > 0) {
+                ++timeouts_;
+                code = kIsolatedTimeout;
+                roo::log_err("isolated job %s timeout %d secs, kill worker %d.",
+                             spec.name_.c_str(), spec.timeout_sec_, static_cast<int>(worker->pid_));
+            } else {
+                ++crashed_;
+                roo::log_err("isolated worker crashed while running job %s.", spec.name_.c_str());
+            }
+            reap(*worker, true);
+
+        } else {
+
+            code = rsp.code_;
+            if (rsp.load_failed_) {
+                roo::log_err("isolated worker load %s failed.", spec.so_path_.c_str());
+            }
+
+            ++worker->runs_;
+            if (worker->pid_ <= 0 ||
+                worker->runs_ >= static_cast<uint64_t>(max_runs_) || rsp.rss_kb_ > max_rss_kb_) {
+                roo::log_notice("recycle isolated worker %d, runs %lu, rss %ld KB.",
+                                static_cast<int>(worker->pid_),
+                                static_cast<unsigned long>(worker->runs_), static_cast<long>(rsp.rss_kb_));
+                ++recycled_;
+                reap(*worker, false);
+            }
+        }
+    }
+
+    bool stopped = false;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopped = stopped_;
+    }
+
+    if (worker->pid_ <= 0 && !stopped) {
+        release(*worker);
+        spawn(*worker);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        worker->busy_ = false;
+    }
+    cond_.notify_one();
+
+    return code;
+}
+
+
+void IsolatedExecutor::stop() {
+
+    std::vector<Worker*> idle {};
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopped_ = true;
+
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            if (workers_[i].busy_) {
+                // 执行线程检测到worker退出之后返回
+                if (workers_[i].pid_ > 0) {
+                    roo::log_err("kill busy isolated worker %d.", static_cast<int>(workers_[i].pid_));
+                    ::kill(workers_[i].pid_, SIGKILL);
+                }
+                continue;
+            }
+
+            workers_[i].busy_ = true;
+            idle.push_back(&workers_[i]);
+        }
+    }
+    cond_.notify_all();
+
+    for (size_t i = 0; i < idle.size(); ++i) {
+        reap(*idle[i], false);
+    }
+
+    roo::log_warning("IsolatedExecutor stopped, spawned %lu, recycled %lu, crashed %lu.",
+                     static_cast<unsigned long>(spawned_), static_cast<unsigned long>(recycled_),
+                     static_cast<unsigned long>(crashed_));
+}
+
+
+int IsolatedExecutor::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "Argus";
+    name = "IsolatedExecutor";
+
+    std::stringstream ss;
+    ss << "spawned: " << spawned_ << ", recycled: " << recycled_
+       << ", crashed: " << crashed_ << ", timeouts: " << timeouts_ << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            ss << "\tworker " << i << ": pid " << workers_[i].pid_
+               << ", runs " << workers_[i].runs_
+               << ", busy " << (workers_[i].busy_ ? "true" : "false") << std::endl;
+        }
+    }
+
+    val = ss.str();
+    return 0;
+}
+
+
+bool IsolatedExecutor::worker_cancel_requested() {
+
+    const IsolatedChannel* chan = worker_channel;
+    return chan && chan->cancel_seq_.load(std::memory_order_acquire) == worker_seq;
+}
+
+
+// worker进程中执行，so和对应的JobInstance按照so_path缓存，进程退出的时候卸载
+int IsolatedExecutor::worker_main(const std::string& arg) {
+
+    int shm_fd = -1;
+    int req_fd = -1;
+    int rsp_fd = -1;
+    int alive_fd = -1;
+    if (sscanf(arg.c_str(), "%d,%d,%d,%d", &shm_fd, &req_fd, &rsp_fd, &alive_fd) != 4) {
+        roo::log_err("invalid isolated worker arg: %s", arg.c_str());
+        return EXIT_FAILURE;
+    }
+
+    void* addr = ::mmap(NULL, sizeof(IsolatedChannel), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (addr == MAP_FAILED) {
+        roo::log_err("map isolated channel failed: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    IsolatedChannel* chan = static_cast<IsolatedChannel*>(addr);
+    if (chan->magic_ != kIsolatedMagic) {
+        roo::log_err("invalid isolated channel magic: %x", chan->magic_);
+        return EXIT_FAILURE;
+    }
+
+    // 信号由父进程处理，worker只跟随父进程退出
+    ::signal(SIGHUP, SIG_IGN);
+    ::signal(SIGUSR1, SIG_IGN);
+    ::signal(SIGINT, SIG_IGN);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    // 管道没有数据写入，只有服务进程退出、写端全部关闭的时候poll才返回，
+    // 这时候正在执行的so也一并结束
+    std::thread([alive_fd]() {
+        struct pollfd pfd {};
+        pfd.fd = alive_fd;
+        pfd.events = POLLIN;
+        while (::poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+            // retry
+        }
+        ::_exit(EXIT_FAILURE);
+    }).detach();
+
+    chan->worker_pid_ = static_cast<uint32_t>(::getpid());
+
+    IsolatedResponse ready {};
+    chan->rsp_.push(ready);
+    notify_fd(rsp_fd);
+
+    std::map<std::string, std::shared_ptr<SoWrapperFunc>> handlers;
+    std::map<std::string, std::shared_ptr<JobInstance>> jobs;
+
+    while (true) {
+
+        uint64_t val = 0;
+        ssize_t len = ::read(req_fd, &val, sizeof(val));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (len != sizeof(val)) {
+            roo::log_err("isolated worker read notify failed: %s", strerror(errno));
+            break;
+        }
+
+        IsolatedRequest req {};
+        while (chan->req_.pop(req)) {
+
+            if (req.cmd_ == kIsolatedExit) {
+                roo::log_notice("isolated worker %d exit.", static_cast<int>(::getpid()));
+                jobs.clear();
+                handlers.clear();
+                return EXIT_SUCCESS;
+            }
+
+            IsolatedResponse rsp {};
+            rsp.seq_ = req.seq_;
+            rsp.start_us_ = RunHistory::now_us();
+
+            std::shared_ptr<SoWrapperFunc>& handler = handlers[req.so_path_];
+            if (!handler) {
+                handler = std::make_shared<SoWrapperFunc>(req.so_path_);
+                if (!handler->init()) {
+                    handler.reset();
+                }
+            }
+
+            // 传给so的JobInstance只用于获取任务信息，不参与调度
+            JobSpec spec {};
+            spec.name_ = req.name_;
+            spec.desc_ = req.desc_;
+            spec.sch_time_ = req.sch_time_;
+            spec.so_path_ = req.so_path_;
+            spec.isolate_ = true;
+
+            std::shared_ptr<JobInstance>& job = jobs[spec.name_];
+            if (!job || job->spec() != spec) {
+                job = std::make_shared<JobInstance>(spec);
+            }
+
+            if (handler) {
+                worker_channel = chan;
+                worker_seq = req.seq_;
+                rsp.code_ = (*handler)(job.get());
+                worker_channel = NULL;
+            } else {
+                handlers.erase(req.so_path_);
+                rsp.code_ = -1;
+                rsp.load_failed_ = 1;
+            }
+
+            rsp.end_us_ = RunHistory::now_us();
+            rsp.rss_kb_ = current_rss_kb();
+
+            chan->rsp_.push(rsp);
+            notify_fd(rsp_fd);
+        }
+    }
+
+    return EXIT_FAILURE;
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,157 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_ISOLATED_EXECUTOR_H__
+#define __TZSERIAL_ISOLATED_EXECUTOR_H__
+
+#include <xtra_rhel.h>
+
+#include <cerrno>
+#include <atomic>
+#include <condition_variable>
+
+#include <libconfig/libconfig.h++>
+
+#include "ShmRing.h"
+
+namespace tzrpc {
+
+enum IsolatedCommand : uint32_t {
+    kIsolatedRun  = 1,
+    kIsolatedExit = 2,
+};
+
+// 超长的字段会被截断，so_path超长的任务不能隔离执行
+struct IsolatedRequest {
+    uint64_t seq_;
+    uint32_t cmd_;
+    char     name_[96];
+    char     desc_[160];
+    char     sch_time_[64];
+    char     so_path_[512];
+};
+
+struct IsolatedResponse {
+    uint64_t seq_;
+    int32_t  code_;
+    int32_t  load_failed_;
+    int64_t  start_us_;
+    int64_t  end_us_;
+    int64_t  rss_kb_;       // 执行之后worker的常驻内存
+};
+
+static const uint32_t kIsolatedMagic = 0x41524753; // ARGS
+static const size_t   kIsolatedRingSize = 4;
+
+// 超时之后被kill的执行返回值
+static const int32_t  kIsolatedTimeout = -ETIMEDOUT;
+
+struct IsolatedChannel {
+    uint32_t magic_;
+    uint32_t worker_pid_;
+    std::atomic<uint64_t> cancel_seq_;  // 父进程请求取消的执行序号
+    ShmRing<IsolatedRequest,  kIsolatedRingSize> req_;
+    ShmRing<IsolatedResponse, kIsolatedRingSize> rsp_;
+};
+
+
+struct JobSpec;
+
+// 进程隔离的执行器
+//
+// 预先创建的worker进程 (fork + exec自身，以-w模式启动)，按需dlopen任务的so并
+// 缓存，执行请求和结果通过共享内存中的环形队列传递，eventfd通知。so的崩溃
+// 或者泄漏只影响worker，worker执行一定次数或者内存超过阈值之后被回收重建。
+// 调用execute()的执行线程会一直阻塞到结果返回，和进程内执行的语义一致，
+// 所以隔离的任务总是投递到async执行，不会占住defer的执行线程。
+class IsolatedExecutor {
+
+public:
+    static IsolatedExecutor& instance();
+
+    // isolated_workers为0则不启用
+    bool init(const libconfig::Config& conf);
+    bool enabled() const {
+        return !workers_.empty();
+    }
+
+    // 返回任务的执行结果，worker崩溃或者加载so失败返回负值。设置了timeout_sec
+    // 的任务超时之后先通过共享内存请求取消，宽限时间内没有返回则kill掉worker
+    int execute(const JobSpec& spec);
+
+    // 通知空闲的worker退出，仍然在执行的worker直接kill
+    void stop();
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+    // worker进程的入口，arg为父进程传递的 "shm_fd,req_fd,rsp_fd,alive_fd"
+    static int worker_main(const std::string& arg);
+
+    // worker进程中当前的执行是否被父进程取消，不在worker中总是返回false
+    static bool worker_cancel_requested();
+
+private:
+
+    IsolatedExecutor() :
+        max_runs_(1000),
+        max_rss_kb_(512 * 1024),
+        alive_rfd_(-1),
+        alive_wfd_(-1),
+        stopped_(false),
+        spawned_(0),
+        recycled_(0),
+        crashed_(0),
+        timeouts_(0) {
+    }
+
+    ~IsolatedExecutor() { }
+
+    // 禁止拷贝
+    IsolatedExecutor(const IsolatedExecutor&) = delete;
+    IsolatedExecutor& operator=(const IsolatedExecutor&) = delete;
+
+    struct Worker {
+        pid_t    pid_;
+        int      shm_fd_;
+        int      req_fd_;
+        int      rsp_fd_;
+        IsolatedChannel* chan_;
+        uint64_t seq_;
+        uint64_t runs_;
+        bool     busy_;
+    };
+
+    bool spawn(Worker& worker);
+    void reap(Worker& worker, bool force);
+    void release(Worker& worker);
+
+    // 等待worker的执行结果，worker退出或者超时返回false，timeout_ms小于0一直等待
+    bool wait_response(Worker& worker, IsolatedResponse& rsp, int32_t timeout_ms);
+    bool wait_isolated(Worker& worker, const JobSpec& spec, IsolatedResponse& rsp);
+
+    std::string exe_path_;
+    int32_t max_runs_;
+    int64_t max_rss_kb_;
+
+    // 服务进程存活的管道，写端只在服务进程中，见worker_main()
+    int alive_rfd_;
+    int alive_wfd_;
+
+    std::mutex lock_;
+    std::condition_variable cond_;
+    std::vector<Worker> workers_;
+    bool stopped_;
+
+    std::atomic<uint64_t> spawned_;
+    std::atomic<uint64_t> recycled_;
+    std::atomic<uint64_t> crashed_;
+    std::atomic<uint64_t> timeouts_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_ISOLATED_EXECUTOR_H__
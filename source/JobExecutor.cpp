@@ -8,6 +8,8 @@
 
 #include <xtra_rhel.h>
 
+#include <unordered_set>
+
 #include <concurrency/Timer.h>
 #include <scaffold/Setting.h>
 #include <scaffold/Status.h>
@@ -15,18 +17,67 @@
 
 #include "Captain.h"
 
+#include "HotLog.h"
+#include "StateStore.h"
+#include "RunHistory.h"
+#include "IsolatedExecutor.h"
 #include "JobInstance.h"
+#include "JobSlab.h"
+#include "JobManifest.h"
+#include "Clock.h"
+#include "FireTimer.h"
 #include "JobExecutor.h"
 
 namespace tzrpc {
 
 
-void JE_add_task_defer(std::shared_ptr<JobInstance>& ins) {
-    JobExecutor::instance().defer_queue_.PUSH(ins);
+// 定时器线程一次触发中到期的defer任务，见JE_defer_batch_begin()
+struct DeferBatch {
+    bool open_;
+    std::vector<JobRef> refs_;
+};
+
+static thread_local DeferBatch defer_batch {};
+
+void JE_add_task_defer(const JobRef& ref) {
+    if (defer_batch.open_) {
+        defer_batch.refs_.push_back(ref);
+        return;
+    }
+    JobExecutor::instance().defer_queue_.PUSH(ref);
+}
+
+void JE_defer_batch_begin() {
+    defer_batch.open_ = true;
+}
+
+void JE_defer_batch_end() {
+    defer_batch.open_ = false;
+    if (!defer_batch.refs_.empty()) {
+        JobExecutor::instance().defer_queue_.PUSH_BATCH(&defer_batch.refs_[0], defer_batch.refs_.size());
+        defer_batch.refs_.clear();
+    }
+}
+
+void JE_add_task_async(const JobRef& ref) {
+    JobExecutor::instance().async_queue_.PUSH(ref);
+}
+
+bool JE_coalesce_task() {
+    JobExecutor& executor = JobExecutor::instance();
+    if (!executor.queue_coalesce_) {
+        return false;
+    }
+    ++executor.coalesced_;
+    return true;
 }
 
-void JE_add_task_async(std::shared_ptr<JobInstance>& ins) {
-    JobExecutor::instance().async_queue_.PUSH(ins);
+void JE_drop_task(const JobRef& ref) {
+
+    JobPin pin(ref);
+    if (JobInstance* inst = pin.get()) {
+        inst->on_dropped();
+    }
 }
 
 
@@ -36,6 +87,82 @@ JobExecutor& JobExecutor::instance() {
 }
 
 
+static bool parse_misfire_policy(const std::string& misfire, enum MisfirePolicy& policy) {
+
+    if (misfire.empty() || misfire == "skip") {
+        policy = MisfirePolicy::kMisfireSkip;
+    } else if (misfire == "once") {
+        policy = MisfirePolicy::kMisfireOnce;
+    } else {
+        roo::log_err("invalid misfire policy: %s", misfire.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool parse_queue_overflow(const std::string& overflow, enum QueueOverflow& policy) {
+
+    if (overflow.empty() || overflow == "drop_oldest") {
+        policy = QueueOverflow::kDropOldest;
+    } else if (overflow == "reject_new") {
+        policy = QueueOverflow::kRejectNew;
+    } else {
+        roo::log_err("invalid queue_overflow policy: %s", overflow.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// 配置文件中单个so任务的配置
+bool parse_job_spec(const libconfig::Setting& setting, JobSpec& spec) {
+
+    std::string exec_method;
+    std::string misfire;
+
+    setting.lookupValue("name", spec.name_);
+    setting.lookupValue("desc", spec.desc_);
+    setting.lookupValue("sch_time", spec.sch_time_);
+    setting.lookupValue("exec_method", exec_method);
+    setting.lookupValue("so_path", spec.so_path_);
+    setting.lookupValue("misfire", misfire);
+    setting.lookupValue("isolate", spec.isolate_);
+    setting.lookupValue("timeout_sec", spec.timeout_sec_);
+    setting.lookupValue("retry_max", spec.retry_.max_attempts_);
+    setting.lookupValue("retry_backoff_ms", spec.retry_.backoff_ms_);
+    setting.lookupValue("retry_backoff_max_ms", spec.retry_.backoff_max_ms_);
+    setting.lookupValue("retry_jitter", spec.retry_.jitter_);
+    setting.lookupValue("lazy_load", spec.lazy_);
+    setting.lookupValue("enable", spec.enable_);
+
+    if (spec.timeout_sec_ < 0) {
+        roo::log_err("invalid timeout_sec: %d", spec.timeout_sec_);
+        return false;
+    }
+
+    if (spec.retry_.max_attempts_ < 0 || spec.retry_.backoff_ms_ <= 0 ||
+        spec.retry_.backoff_max_ms_ < spec.retry_.backoff_ms_) {
+        roo::log_err("invalid retry setting: max %d, backoff %d, backoff_max %d",
+                     spec.retry_.max_attempts_, spec.retry_.backoff_ms_, spec.retry_.backoff_max_ms_);
+        return false;
+    }
+
+    if (!exec_method.empty()) {
+        if (exec_method == "defer") {
+            spec.exec_method_ = ExecuteMethod::kExecDefer;
+        } else if (exec_method == "async") {
+            spec.exec_method_ = ExecuteMethod::kExecAsync;
+        } else {
+            roo::log_err("invalid exec_method: %s", exec_method.c_str());
+            return false;
+        }
+    }
+
+    return parse_misfire_policy(misfire, spec.misfire_);
+}
+
+
 bool JobExecutor::init(const libconfig::Config& conf) {
 
     // common params
@@ -44,6 +171,17 @@ bool JobExecutor::init(const libconfig::Config& conf) {
     conf.lookupValue("schedule.thread_pool_step_queue_size", conf_.thread_step_queue_size_);
 
     conf.lookupValue("schedule.thread_pool_async_size", conf_.thread_number_async_);
+    conf.lookupValue("schedule.shutdown_drain_sec", conf_.shutdown_drain_sec_);
+    conf.lookupValue("schedule.init_threads", conf_.init_threads_);
+    conf.lookupValue("schedule.dispatch_batch", conf_.dispatch_batch_);
+    conf.lookupValue("schedule.lazy_prefetch_sec", conf_.lazy_prefetch_sec_);
+    conf.lookupValue("schedule.lazy_idle_sec", conf_.lazy_idle_sec_);
+    conf.lookupValue("schedule.defer_queue_capacity", conf_.defer_queue_capacity_);
+    conf.lookupValue("schedule.async_queue_capacity", conf_.async_queue_capacity_);
+    conf.lookupValue("schedule.queue_coalesce", conf_.queue_coalesce_);
+
+    std::string queue_overflow;
+    conf.lookupValue("schedule.queue_overflow", queue_overflow);
 
     if (conf_.thread_number_hard_ < conf_.thread_number_) {
         conf_.thread_number_hard_ = conf_.thread_number_;
@@ -69,6 +207,39 @@ bool JobExecutor::init(const libconfig::Config& conf) {
         return false;
     }
 
+    if (conf_.shutdown_drain_sec_ < 0) {
+        roo::log_err("invalid shutdown_drain_sec setting: %d",
+                conf_.shutdown_drain_sec_);
+        return false;
+    }
+
+    if (conf_.init_threads_ <= 0 || conf_.init_threads_ > 100) {
+        roo::log_err("invalid init_threads setting: %d",
+                conf_.init_threads_);
+        return false;
+    }
+
+    if (conf_.dispatch_batch_ <= 0 || conf_.dispatch_batch_ > kDispatchBatchMax) {
+        roo::log_err("invalid dispatch_batch setting: %d",
+                conf_.dispatch_batch_);
+        return false;
+    }
+    dispatch_batch_ = conf_.dispatch_batch_;
+
+    if (conf_.lazy_prefetch_sec_ < 0 || conf_.lazy_idle_sec_ <= 0) {
+        roo::log_err("invalid lazy_prefetch_sec and lazy_idle_sec setting: %d, %d",
+                conf_.lazy_prefetch_sec_, conf_.lazy_idle_sec_);
+        return false;
+    }
+
+    if (conf_.defer_queue_capacity_ < 0 || conf_.async_queue_capacity_ < 0 ||
+        !parse_queue_overflow(queue_overflow, conf_.queue_overflow_)) {
+        roo::log_err("invalid defer_queue_capacity and async_queue_capacity setting: %d, %d",
+                conf_.defer_queue_capacity_, conf_.async_queue_capacity_);
+        return false;
+    }
+    apply_queue_limit();
+
     // 检查是否需要创建thread_adjust定时任务，进行线程池的动态伸缩
     if (conf_.thread_number_hard_ > conf_.thread_number_ &&
         conf_.thread_step_queue_size_ > 0) {
@@ -84,26 +255,56 @@ bool JobExecutor::init(const libconfig::Config& conf) {
         }
     }
 
-    // so_handlers
-    // 进行动态任务的加载和初始化
+    // 调度状态的持久化，需要在任务加载之前完成，用于判断重启期间的misfire
+    std::string state_file;
+    int state_flush_msec = 1000;
+    conf.lookupValue("schedule.state_file", state_file);
+    conf.lookupValue("schedule.state_flush_msec", state_flush_msec);
+    if (!StateStore::instance().init(state_file)) {
+        roo::log_err("init StateStore with %s failed.", state_file.c_str());
+        return false;
+    }
 
-    try {
-        const libconfig::Setting& handlers = conf.lookup("schedule.so_handlers");
+    if (StateStore::instance().enabled()) {
 
-        for (int i = 0; i < handlers.getLength(); ++i) {
-            const libconfig::Setting& handler = handlers[i];
-            if (!handle_so_task_conf(handler)) {
-                roo::log_err("prase handle detail conf failed.");
-                return false;
-            }
+        if (state_flush_msec <= 0) {
+            roo::log_err("invalid state_flush_msec setting: %d", state_flush_msec);
+            return false;
         }
 
-    } catch (const libconfig::SettingNotFoundException& nfex) {
-        roo::log_err("schedule.so_handlers not found!");
-    } catch (std::exception& e) {
-        roo::log_err("execptions catched for %s", e.what());
+        state_flush_timer_ = Captain::instance().timer_ptr_->add_better_timer(
+                             std::bind(&StateStore::flush, &StateStore::instance()), state_flush_msec, true);
+        if (!state_flush_timer_) {
+            roo::log_err("create state flush timer failed.");
+            return false;
+        }
+    }
+
+    // 执行超时的watchdog，没有配置timeout_sec的任务检查开销可以忽略
+    timeout_check_timer_ = Captain::instance().timer_ptr_->add_better_timer(
+                           std::bind(&JobExecutor::timeout_check, this, std::placeholders::_1),
+                           1 * 1000, true);
+    if (!timeout_check_timer_) {
+        roo::log_err("create timeout check timer failed.");
+        return false;
+    }
+
+    // 需要在加载隔离执行的任务之前启动worker进程
+    if (!IsolatedExecutor::instance().init(conf)) {
+        roo::log_err("init IsolatedExecutor failed.");
+        return false;
     }
 
+    // so_handlers
+    // 进行动态任务的加载和初始化
+
+    std::vector<JobLoadItem> batch;
+    if (!handle_so_tasks(conf, false, batch) || !load_so_tasks(batch)) {
+        roo::log_err("load so tasks failed.");
+        return false;
+    }
+    conf_tasks_ = conf_seen_;
+
 
     // other initialize
 
@@ -113,18 +314,31 @@ bool JobExecutor::init(const libconfig::Config& conf) {
         return false;
     }
 
-    async_main_ = boost::thread(std::bind(&JobExecutor::job_executor_async_run, this));
+    // async_main_取出任务之后直接交给async_task_，需要先创建
     async_task_ = std::make_shared<roo::AsyncTask>(conf_.thread_number_async_);
     if (!async_task_ ) {
         roo::log_err("create async_task failed.");
         return false;
     }
+    async_main_ = boost::thread(std::bind(&JobExecutor::job_executor_async_run, this));
 
     Captain::instance().status_ptr_->attach_status_callback(
         "JobExecutor",
         std::bind(&JobExecutor::module_status, this,
                   std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
 
+    Captain::instance().status_ptr_->attach_status_callback(
+        "RunHistory",
+        std::bind(&RunHistory::module_status, &RunHistory::instance(),
+                  std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+    if (IsolatedExecutor::instance().enabled()) {
+        Captain::instance().status_ptr_->attach_status_callback(
+            "IsolatedExecutor",
+            std::bind(&IsolatedExecutor::module_status, &IsolatedExecutor::instance(),
+                      std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    }
+
     Captain::instance().setting_ptr_->attach_runtime_callback(
         "JobExecutor",
         std::bind(&JobExecutor::module_runtime, this,
@@ -134,60 +348,278 @@ bool JobExecutor::init(const libconfig::Config& conf) {
 }
 
 
-bool JobExecutor::handle_so_task_conf(const libconfig::Setting& setting) {
+// 配置了so_manifest的时候从预编译的清单加载，否则读取so_handlers
+bool JobExecutor::handle_so_tasks(const libconfig::Config& conf, bool runtime, std::vector<JobLoadItem>& batch) {
 
-    std::string name;
-    std::string desc;
-    std::string sch_time;
-    std::string exec_method;
-    std::string so_path;
-    bool status = true;
+    std::string so_manifest;
+    conf.lookupValue("schedule.so_manifest", so_manifest);
+    conf_seen_.clear();
 
-    setting.lookupValue("name", name);
-    setting.lookupValue("desc", desc);
-    setting.lookupValue("sch_time", sch_time);
-    setting.lookupValue("exec_method", exec_method);
-    setting.lookupValue("so_path", so_path);
-    setting.lookupValue("enable", status);
+    if (!so_manifest.empty()) {
+        if (!handle_so_manifest(so_manifest, runtime, batch)) {
+            roo::log_err("handle so_manifest %s failed.", so_manifest.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    try {
+        const libconfig::Setting& handlers = conf.lookup("schedule.so_handlers");
+
+        for (int i = 0; i < handlers.getLength(); ++i) {
+            const libconfig::Setting& handler = handlers[i];
+            bool ok = runtime ? handle_so_task_runtime_conf(handler, batch) : handle_so_task_conf(handler, batch);
+            if (!ok) {
+                roo::log_err("prase handle detail conf failed.");
+                return false;
+            }
+        }
+
+    } catch (const libconfig::SettingNotFoundException& nfex) {
+        roo::log_err("schedule.so_handlers not found!");
+    } catch (std::exception& e) {
+        roo::log_err("execptions catched for %s", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+bool JobExecutor::handle_so_task_conf(const libconfig::Setting& setting, std::vector<JobLoadItem>& batch) {
+
+    JobSpec spec {};
+    if (!parse_job_spec(setting, spec)) {
+        return false;
+    }
+
+    return handle_so_task_spec(spec, NULL, batch);
+}
+
+static JobLoadItem make_load_item(const JobSpec& spec, const CronMask* sch) {
+
+    JobLoadItem item {};
+    item.spec_ = spec;
+    item.precompiled_ = (sch != NULL);
+    if (sch) {
+        item.sch_ = *sch;
+    }
+    return item;
+}
+
+bool JobExecutor::handle_so_task_spec(const JobSpec& spec, const CronMask* sch, std::vector<JobLoadItem>& batch) {
+
+    conf_seen_.insert(spec.name_);
 
     // 禁用的服务，初始化的时候不予加载
-    if (!status) {
-        roo::log_err("Task %s marked disabled, skip it at init stage.", name.c_str());
+    if (!spec.enable_) {
+        roo::log_err("Task %s marked disabled, skip it at init stage.", spec.name_.c_str());
         return true;
     }
 
-    enum ExecuteMethod method = ExecuteMethod::kExecDefer;
-    if (!exec_method.empty()) {
-        if (exec_method == "defer") {
-            method = ExecuteMethod::kExecDefer;
-        } else if (exec_method == "async") {
-            method = ExecuteMethod::kExecAsync;
-        } else {
-            roo::log_err("invalid exec_method: %s", exec_method.c_str());
+    batch.push_back(make_load_item(spec, sch));
+    return true;
+}
+
+// 映射只在收集期间保留，任务从中拷贝出自己的配置，sch_.str_不会在之后使用
+bool JobExecutor::handle_so_manifest(const std::string& path, bool runtime, std::vector<JobLoadItem>& batch) {
+
+    int64_t start_us = Clock::instance().now_us();
+
+    JobManifest manifest;
+    if (!manifest.open(path)) {
+        return false;
+    }
+
+    JobSpec spec {};
+    CronMask sch {};
+    for (uint32_t i = 0; i < manifest.size(); ++i) {
+
+        manifest.job_at(i, spec, sch);
+        bool ok = runtime ? handle_so_task_runtime_spec(spec, &sch, batch) : handle_so_task_spec(spec, &sch, batch);
+        if (!ok) {
+            roo::log_err("handle manifest job %s failed.", spec.name_.c_str());
             return false;
         }
     }
 
-    std::unique_lock<std::mutex> lock(lock_);
-    if (tasks_.find(name) != tasks_.end()) {
-        roo::log_err("task %s already registered, reject it (duplicate configure?)", name.c_str());
-        return false;
+    roo::log_warning("%u jobs handled from manifest %s in %ld ms.", manifest.size(), path.c_str(),
+                     static_cast<long>((Clock::instance().now_us() - start_us) / 1000));
+    return true;
+}
+
+
+static void load_so_task(JobLoadItem& item) {
+
+    const JobSpec& spec = item.spec_;
+    auto ins = item.precompiled_ ? std::make_shared<JobInstance>(spec, item.sch_) :
+                                   std::make_shared<JobInstance>(spec);
+    if (!ins->init(item.error_)) {
+        if (item.error_.empty()) {
+            item.error_ = "init failed";
+        }
+        return;
+    }
+
+    item.ins_ = ins;
+}
+
+bool JobExecutor::load_so_tasks(std::vector<JobLoadItem>& batch) {
+
+    if (batch.empty()) {
+        return true;
+    }
+
+    int64_t start_us = Clock::instance().now_us();
+
+    // 和已经注册的任务以及本批次中的任务重名的，不予加载
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        std::unordered_set<std::string> names;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const std::string& name = batch[i].spec_.name_;
+            if (draining_) {
+                batch[i].error_ = "JobExecutor is shutting down";
+            } else if (tasks_.find(name) != tasks_.end() || !names.insert(name).second) {
+                batch[i].error_ = "already registered (duplicate configure?)";
+            }
+        }
+    }
+
+    // 按照so_path分组，同一个so的module_init在一个线程中依次调用
+    std::unordered_map<std::string, size_t> group_index;
+    std::vector<std::vector<size_t>> groups;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (!batch[i].error_.empty()) {
+            continue;
+        }
+
+        auto iter = group_index.find(batch[i].spec_.so_path_);
+        if (iter == group_index.end()) {
+            iter = group_index.insert(std::make_pair(batch[i].spec_.so_path_, groups.size())).first;
+            groups.push_back(std::vector<size_t>());
+        }
+        groups[iter->second].push_back(i);
     }
 
-    auto ins = std::make_shared<JobInstance>(name, desc, sch_time, so_path, method);
-    if (!ins || !ins->init()) {
-        roo::log_err("init JobInstance failed, name: %s", name.c_str());
+    std::atomic<size_t> next_group(0);
+    auto load_groups = [&]() {
+        size_t index = 0;
+        while ((index = next_group++) < groups.size()) {
+            const std::vector<size_t>& group = groups[index];
+            for (size_t i = 0; i < group.size(); ++i) {
+                load_so_task(batch[group[i]]);
+            }
+        }
+    };
+
+    size_t workers = std::min(static_cast<size_t>(conf_.init_threads_), groups.size());
+    if (workers <= 1) {
+        load_groups();
+    } else {
+        std::vector<boost::thread> threads;
+        for (size_t i = 0; i < workers; ++i) {
+            threads.push_back(boost::thread(load_groups));
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+    }
+
+    // 发布，初始化期间可能有同名的任务通过ControlServer注册了
+    size_t loaded = 0;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            JobLoadItem& item = batch[i];
+            if (!item.ins_) {
+                continue;
+            }
+
+            if (tasks_.find(item.spec_.name_) != tasks_.end()) {
+                item.error_ = "already registered (duplicate configure?)";
+                continue;
+            }
+
+            // 发布之后才设置第一次调度，定时器触发的时候任务一定已经注册
+            tasks_[item.spec_.name_] = item.ins_;
+            if (!item.ins_->start(item.error_)) {
+                tasks_.erase(item.spec_.name_);
+                continue;
+            }
+            ++loaded;
+        }
+    }
+
+    // 发布失败的任务在锁外析构
+    std::string failed_names;
+    size_t failed = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        JobLoadItem& item = batch[i];
+        if (item.error_.empty()) {
+            continue;
+        }
+
+        item.ins_.reset();
+        roo::log_err("load task %s failed: %s", item.spec_.name_.c_str(), item.error_.c_str());
+        if (failed < 10) {
+            failed_names += (failed ? ", " : "") + item.spec_.name_;
+        }
+        ++failed;
+    }
+
+    long elapsed_ms = static_cast<long>((Clock::instance().now_us() - start_us) / 1000);
+    if (failed) {
+        roo::log_err("load %lu tasks with %lu threads in %ld ms, %lu failed: %s%s",
+                     static_cast<unsigned long>(batch.size()), static_cast<unsigned long>(workers), elapsed_ms,
+                     static_cast<unsigned long>(failed), failed_names.c_str(), failed > 10 ? ", ..." : "");
         return false;
     }
 
-    tasks_[name] = ins;
-    roo::log_info("register handler %s success.", name.c_str());
+    roo::log_warning("load %lu tasks (%lu so) with %lu threads in %ld ms.",
+                     static_cast<unsigned long>(loaded), static_cast<unsigned long>(groups.size()),
+                     static_cast<unsigned long>(workers), elapsed_ms);
     return true;
 }
 
 
 
 
+void JobExecutor::timeout_check(const boost::system::error_code& ec) {
+
+    reap_retiring();
+
+    std::vector<std::shared_ptr<JobInstance>> tasks{};
+    int32_t prefetch_sec = 0;
+    int32_t idle_sec = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
+            tasks.push_back(iter->second);
+        }
+        prefetch_sec = conf_.lazy_prefetch_sec_;
+        idle_sec = conf_.lazy_idle_sec_;
+    }
+
+    time_t now = Clock::instance().now();
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        if (tasks[i]->check_timeout(now)) {
+            ++timeouts_;
+        }
+
+        // dlopen和module_init可能很慢，不在定时器线程中执行
+        if (async_task_ && tasks[i]->lazy_check(now, prefetch_sec, idle_sec)) {
+            ++lazy_prefetches_;
+            std::shared_ptr<JobInstance> ins = tasks[i];
+            auto func = [ins]() {
+                ins->lazy_load();
+            };
+            async_task_->add_async_task(func);
+        }
+    }
+}
+
+
 void JobExecutor::threads_adjust(const boost::system::error_code& ec) {
 
     JobExecutorConf conf{};
@@ -225,13 +657,20 @@ void JobExecutor::threads_adjust(const boost::system::error_code& ec) {
 }
 
 
+void JobExecutor::apply_queue_limit() {
+
+    defer_queue_.set_limit(static_cast<size_t>(conf_.defer_queue_capacity_), conf_.queue_overflow_, JE_drop_task);
+    async_queue_.set_limit(static_cast<size_t>(conf_.async_queue_capacity_), conf_.queue_overflow_, JE_drop_task);
+    queue_coalesce_ = conf_.queue_coalesce_;
+}
+
 void JobExecutor::job_executor_run(roo::ThreadObjPtr ptr) {
 
     roo::log_warning("JobExecutor thread %#lx about to loop ...", (long)pthread_self());
 
-    while (true) {
+    std::vector<JobRef> refs(kDispatchBatchMax);
 
-        std::weak_ptr<JobInstance> job_instance{};
+    while (true) {
 
         if (unlikely(ptr->status_ == roo::ThreadStatus::kTerminating)) {
             roo::log_err("thread %#lx is about to terminating...", (long)pthread_self());
@@ -244,17 +683,29 @@ void JobExecutor::job_executor_run(roo::ThreadObjPtr ptr) {
             continue;
         }
 
-        if (!defer_queue_.POP(job_instance, 1000 /*1s*/)) {
+        // 一次唤醒最多取出dispatch_batch_个任务依次执行，在队列的锁内计入
+        // in_flight_，退出时的排空不会漏掉还没有开始执行的
+        size_t count = defer_queue_.POP_BATCH(&refs[0], static_cast<size_t>(dispatch_batch_.load()),
+                                              1000 /*1s*/, &in_flight_);
+        if (count == 0) {
             continue;
         }
 
-        if (auto s_instance = job_instance.lock()) {
+        for (size_t i = 0; i < count; ++i) {
 
-            // call it
-            (*s_instance)();
+            // 前面的任务执行期间其他线程空闲下来的，剩下的交还给它们
+            if (i > 0 && defer_queue_.HAND_BACK(&refs[i], count - i, &in_flight_) > 0) {
+                break;
+            }
 
-        } else {
-            roo::log_info("instance already release before, give up this task.");
+            JobPin pin(refs[i]);
+            if (JobInstance* s_instance = pin.get()) {
+                // call it
+                (*s_instance)();
+            } else {
+                HOT_LOG_INFO("instance already release before, give up this task.");
+            }
+            --in_flight_;
         }
     }
 
@@ -271,19 +722,46 @@ void JobExecutor::job_executor_async_run() {
 
     roo::log_warning("JobExecutor async %#lx about to loop ...", (long)pthread_self());
 
-    while (true) {
+    while (!async_stop_) {
+
+        // 异步线程都在忙的时候不再取出，积压的任务留在async_queue_中，
+        // async_queue_capacity才能真正限制住
+        {
+            std::unique_lock<std::mutex> lock(async_lock_);
+            if (!async_cond_.wait_for(lock, std::chrono::milliseconds(1000), [this] {
+                    return async_stop_ || async_running_ < conf_.thread_number_async_; })) {
+                continue;
+            }
+        }
+
+        if (async_stop_) {
+            break;
+        }
 
-        std::weak_ptr<JobInstance> job_instance{};
+        JobRef job_ref {};
 
-        if (!async_queue_.POP(job_instance, 1000 /*1s*/)) {
+        // 取出之后交给async_task_，到真正执行结束之前都算作in_flight，避免退出时漏掉
+        if (!async_queue_.POP(job_ref, 1000 /*1s*/, &in_flight_)) {
             continue;
         }
 
-        if (auto s_instance = job_instance.lock()) {
-            auto func = std::bind(&JobInstance::operator(), s_instance);
+        // pin一直持有到异步执行结束，期间任务不会被删除
+        if (JobInstance* s_instance = JobSlab::instance().pin(job_ref)) {
+            ++async_running_;
+            auto func = [this, job_ref, s_instance]() {
+                (*s_instance)();
+                JobSlab::instance().unpin(job_ref);
+                {
+                    std::lock_guard<std::mutex> lock(async_lock_);
+                    --async_running_;
+                }
+                async_cond_.notify_one();
+                --in_flight_;
+            };
             async_task_->add_async_task(func);
         } else {
-            roo::log_info("instance already release before, give up this task.");
+            --in_flight_;
+            HOT_LOG_INFO("instance already release before, give up this task.");
         }
 
     }
@@ -317,6 +795,11 @@ int JobExecutor::module_status(std::string& module, std::string& name, std::stri
 
 int JobExecutor::module_runtime(const libconfig::Config& conf) {
 
+    if (draining_) {
+        roo::log_err("JobExecutor is shutting down, ignore runtime update.");
+        return -1;
+    }
+
     // 首先是JobExecutor全局信息(比如线程池等)的动态更新
 
     JobExecutorConf new_conf{};
@@ -325,6 +808,17 @@ int JobExecutor::module_runtime(const libconfig::Config& conf) {
     conf.lookupValue("schedule.thread_pool_size_hard", new_conf.thread_number_hard_);
     conf.lookupValue("schedule.thread_pool_step_queue_size", new_conf.thread_step_queue_size_);
     conf.lookupValue("schedule.thread_pool_async_size", new_conf.thread_number_async_);
+    conf.lookupValue("schedule.shutdown_drain_sec", new_conf.shutdown_drain_sec_);
+    conf.lookupValue("schedule.init_threads", new_conf.init_threads_);
+    conf.lookupValue("schedule.dispatch_batch", new_conf.dispatch_batch_);
+    conf.lookupValue("schedule.lazy_prefetch_sec", new_conf.lazy_prefetch_sec_);
+    conf.lookupValue("schedule.lazy_idle_sec", new_conf.lazy_idle_sec_);
+    conf.lookupValue("schedule.defer_queue_capacity", new_conf.defer_queue_capacity_);
+    conf.lookupValue("schedule.async_queue_capacity", new_conf.async_queue_capacity_);
+    conf.lookupValue("schedule.queue_coalesce", new_conf.queue_coalesce_);
+
+    std::string queue_overflow;
+    conf.lookupValue("schedule.queue_overflow", queue_overflow);
 
     if (new_conf.thread_number_hard_ < new_conf.thread_number_) {
         new_conf.thread_number_hard_ = new_conf.thread_number_;
@@ -358,10 +852,71 @@ int JobExecutor::module_runtime(const libconfig::Config& conf) {
         conf_.thread_step_queue_size_ = new_conf.thread_step_queue_size_;
     }
 
-#if 0
-    if (new_conf.thread_number_async_ <= 0) {
-        roo::log_err("invalid thread_pool_async_size setting: %d",
-                new_conf.thread_number_async_);
+    if (new_conf.shutdown_drain_sec_ < 0) {
+        roo::log_err("invalid shutdown_drain_sec setting: %d",
+                new_conf.shutdown_drain_sec_);
+    } else if (new_conf.shutdown_drain_sec_ != conf_.shutdown_drain_sec_) {
+        roo::log_notice("update shutdown_drain_sec from %d to %d",
+                   conf_.shutdown_drain_sec_, new_conf.shutdown_drain_sec_);
+        conf_.shutdown_drain_sec_ = new_conf.shutdown_drain_sec_;
+    }
+
+    if (new_conf.init_threads_ <= 0 || new_conf.init_threads_ > 100) {
+        roo::log_err("invalid init_threads setting: %d",
+                new_conf.init_threads_);
+    } else if (new_conf.init_threads_ != conf_.init_threads_) {
+        roo::log_notice("update init_threads from %d to %d",
+                   conf_.init_threads_, new_conf.init_threads_);
+        conf_.init_threads_ = new_conf.init_threads_;
+    }
+
+    if (new_conf.dispatch_batch_ <= 0 || new_conf.dispatch_batch_ > kDispatchBatchMax) {
+        roo::log_err("invalid dispatch_batch setting: %d",
+                new_conf.dispatch_batch_);
+    } else if (new_conf.dispatch_batch_ != conf_.dispatch_batch_) {
+        roo::log_notice("update dispatch_batch from %d to %d",
+                   conf_.dispatch_batch_, new_conf.dispatch_batch_);
+        conf_.dispatch_batch_ = new_conf.dispatch_batch_;
+        dispatch_batch_ = conf_.dispatch_batch_;
+    }
+
+    if (new_conf.lazy_prefetch_sec_ < 0 || new_conf.lazy_idle_sec_ <= 0) {
+        roo::log_err("invalid lazy_prefetch_sec and lazy_idle_sec setting: %d, %d",
+                new_conf.lazy_prefetch_sec_, new_conf.lazy_idle_sec_);
+    } else if (new_conf.lazy_prefetch_sec_ != conf_.lazy_prefetch_sec_ ||
+               new_conf.lazy_idle_sec_ != conf_.lazy_idle_sec_) {
+        roo::log_notice("update lazy_prefetch_sec and lazy_idle_sec from %d, %d to %d, %d",
+                   conf_.lazy_prefetch_sec_, conf_.lazy_idle_sec_,
+                   new_conf.lazy_prefetch_sec_, new_conf.lazy_idle_sec_);
+        conf_.lazy_prefetch_sec_ = new_conf.lazy_prefetch_sec_;
+        conf_.lazy_idle_sec_ = new_conf.lazy_idle_sec_;
+    }
+
+    if (new_conf.defer_queue_capacity_ < 0 || new_conf.async_queue_capacity_ < 0 ||
+        !parse_queue_overflow(queue_overflow, new_conf.queue_overflow_)) {
+        roo::log_err("invalid defer_queue_capacity and async_queue_capacity setting: %d, %d",
+                new_conf.defer_queue_capacity_, new_conf.async_queue_capacity_);
+    } else if (new_conf.defer_queue_capacity_ != conf_.defer_queue_capacity_ ||
+               new_conf.async_queue_capacity_ != conf_.async_queue_capacity_ ||
+               new_conf.queue_overflow_ != conf_.queue_overflow_ ||
+               new_conf.queue_coalesce_ != conf_.queue_coalesce_) {
+        roo::log_notice("update defer_queue_capacity, async_queue_capacity, queue_overflow and queue_coalesce "
+                        "from %d, %d, %d, %d to %d, %d, %d, %d",
+                   conf_.defer_queue_capacity_, conf_.async_queue_capacity_,
+                   static_cast<int32_t>(conf_.queue_overflow_), conf_.queue_coalesce_,
+                   new_conf.defer_queue_capacity_, new_conf.async_queue_capacity_,
+                   static_cast<int32_t>(new_conf.queue_overflow_), new_conf.queue_coalesce_);
+        conf_.defer_queue_capacity_ = new_conf.defer_queue_capacity_;
+        conf_.async_queue_capacity_ = new_conf.async_queue_capacity_;
+        conf_.queue_overflow_ = new_conf.queue_overflow_;
+        conf_.queue_coalesce_ = new_conf.queue_coalesce_;
+        apply_queue_limit();
+    }
+
+#if 0
+    if (new_conf.thread_number_async_ <= 0) {
+        roo::log_err("invalid thread_pool_async_size setting: %d",
+                new_conf.thread_number_async_);
     } else if (new_conf.thread_number_async_ != conf_.thread_number_async_) {
         roo::log_notice("update thread_pool_async_size from %d to %d",
                    conf_.thread_number_async_, new_conf.thread_number_async_);
@@ -399,23 +954,20 @@ int JobExecutor::module_runtime(const libconfig::Config& conf) {
     }
 
 
-    // 然后针对so-handlers进行配置
+    // 然后针对so-handlers进行配置，已有的任务原地更新，新增的任务批量加载
 
-    try {
-        const libconfig::Setting& handlers = conf.lookup("schedule.so_handlers");
+    std::vector<JobLoadItem> batch;
+    if (!handle_so_tasks(conf, true, batch)) {
+        roo::log_err("handle so tasks failed.");
+        return -1;
+    }
 
-        for (int i = 0; i < handlers.getLength(); ++i) {
-            const libconfig::Setting& handler = handlers[i];
-            if (!handle_so_task_runtime_conf(handler)) {
-                roo::log_err("prase handle detail conf failed.");
-                return false;
-            }
-        }
+    // 配置完整处理成功之后才删除，解析失败的时候不会误删任务
+    remove_stale_tasks(conf_seen_);
 
-    } catch (const libconfig::SettingNotFoundException& nfex) {
-        roo::log_err("schedule.so_handlers not found!");
-    } catch (std::exception& e) {
-        roo::log_err("execptions catched for %s", e.what());
+    if (!load_so_tasks(batch)) {
+        roo::log_err("load new so tasks failed.");
+        return -1;
     }
 
 
@@ -435,24 +987,129 @@ bool JobExecutor::add_builtin_task(const std::string& name, const std::string& d
     if (async)
         method = ExecuteMethod::kExecAsync;
 
+    return register_builtin(std::make_shared<JobInstance>(name, desc, time_str, func, method));
+}
+
+bool JobExecutor::add_builtin_task(const std::string& name, const std::string& desc,
+                                   const CronMask& sch, const std::function<int(JobInstance *)>& func,
+                                   bool async) {
+
+    if (name.empty() || !sch.str_ || !func ) {
+        roo::log_err("param fast check failed.");
+        return false;
+    }
+
+    enum ExecuteMethod method = ExecuteMethod::kExecDefer;
+    if (async)
+        method = ExecuteMethod::kExecAsync;
+
+    return register_builtin(std::make_shared<JobInstance>(name, desc, sch, func, method));
+}
+
+bool JobExecutor::register_builtin(const std::shared_ptr<JobInstance>& ins) {
+
+    const std::string& name = ins->name();
+
+    if (draining_) {
+        roo::log_err("JobExecutor is shutting down, reject task %s.", name.c_str());
+        return false;
+    }
+
     std::unique_lock<std::mutex> lock(lock_);
     if (tasks_.find(name) != tasks_.end()) {
         roo::log_err("task %s already registered, reject it (duplicate configure?)", name.c_str());
         return false;
     }
 
-    auto ins = std::make_shared<JobInstance>(name, desc, time_str, func, method);
-    if (!ins || !ins->init()) {
-        roo::log_err("init builtin JobInstance failed, name: %s", name.c_str());
+    std::string error;
+    if (!ins->init(error)) {
+        roo::log_err("init builtin JobInstance failed, name: %s, %s", name.c_str(), error.c_str());
         return false;
     }
 
+    // 发布之后才设置第一次调度
     tasks_[name] = ins;
+    if (!ins->start(error)) {
+        tasks_.erase(name);
+        roo::log_err("start builtin JobInstance failed, name: %s, %s", name.c_str(), error.c_str());
+        return false;
+    }
+
     roo::log_info("register handler %s success.", name.c_str());
     return true;
 }
 
 
+bool JobExecutor::add_so_task(const JobSpec& spec) {
+    return add_so_task(spec, NULL);
+}
+
+// 初始化的时候不持有lock_，dlopen和module_init不会阻塞其他任务的管理操作
+bool JobExecutor::add_so_task(const JobSpec& spec, const CronMask* sch) {
+
+    std::vector<JobLoadItem> batch(1, make_load_item(spec, sch));
+    if (!load_so_tasks(batch)) {
+        return false;
+    }
+
+    roo::log_info("register handler %s success.", spec.name_.c_str());
+    return true;
+}
+
+// 和trigger_task()一样在async_task_中执行，计入in_flight_，退出的时候会等待
+bool JobExecutor::add_so_task_async(const JobSpec& spec) {
+
+    if (draining_) {
+        roo::log_err("JobExecutor is shutting down, reject task %s.", spec.name_.c_str());
+        return false;
+    }
+
+    if (spec.name_.empty() || spec.sch_time_.empty() || spec.so_path_.empty()) {
+        roo::log_err("param fast check failed.");
+        return false;
+    }
+
+    if (task_exists(spec.name_)) {
+        roo::log_err("task %s already registered, reject it.", spec.name_.c_str());
+        return false;
+    }
+
+    ++in_flight_;
+    auto func = [this, spec]() {
+        if (!add_so_task(spec)) {
+            roo::log_err("add task %s from %s failed.", spec.name_.c_str(), spec.so_path_.c_str());
+        }
+        --in_flight_;
+    };
+    async_task_->add_async_task(func);
+
+    roo::log_notice("task %s submitted, loading %s.", spec.name_.c_str(), spec.so_path_.c_str());
+    return true;
+}
+
+
+bool JobExecutor::update_so_task(const JobSpec& spec) {
+
+    if (draining_) {
+        roo::log_err("JobExecutor is shutting down, reject update %s.", spec.name_.c_str());
+        return false;
+    }
+
+    auto ins = find_task(spec.name_);
+    if (!ins) {
+        roo::log_err("task %s not registered.", spec.name_.c_str());
+        return false;
+    }
+
+    if (ins->is_builtin()) {
+        roo::log_err("builtin task %s can not be updated.", spec.name_.c_str());
+        return false;
+    }
+
+    return ins->update(spec);
+}
+
+
 bool JobExecutor::task_exists(const std::string& name) {
 
     std::unique_lock<std::mutex> lock(lock_);
@@ -464,93 +1121,399 @@ bool JobExecutor::task_exists(const std::string& name) {
 }
 
 
-bool JobExecutor::remove_so_task(const std::string& name) {
+std::shared_ptr<JobInstance> JobExecutor::find_task(const std::string& name) {
 
-    std::unique_lock<std::mutex> lock(lock_);
+    std::lock_guard<std::mutex> lock(lock_);
 
-    auto handle = tasks_.find(name);
-    if (handle == tasks_.end()) {
-        roo::log_err("task %s not registered, fast return", name.c_str());
-        return true;
+    auto iter = tasks_.find(name);
+    if (iter == tasks_.end()) {
+        return std::shared_ptr<JobInstance>();
     }
 
-    if (handle->second->is_builtin()) {
-        roo::log_err("remove builtin task, weird... hh");
+    return iter->second;
+}
+
+bool JobExecutor::pause_task(const std::string& name) {
+
+    auto ins = find_task(name);
+    if (!ins) {
+        roo::log_err("task %s not registered.", name.c_str());
         return false;
     }
 
-    // tasks_ 持有一份，shared_from_this()持有一份
-    // terminate中会取消timer，释放掉shared_from_this()
-    handle->second->terminate();
+    if (!ins->pause()) {
+        roo::log_err("task %s is not running, can not pause.", name.c_str());
+        return false;
+    }
 
-    while (!handle->second.unique()) {
-        roo::log_notice("handle outside ref count: %d ...", static_cast<int>(handle->second.use_count() - 1));
-        boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    roo::log_notice("task %s paused.", name.c_str());
+    return true;
+}
+
+bool JobExecutor::resume_task(const std::string& name) {
+
+    auto ins = find_task(name);
+    if (!ins) {
+        roo::log_err("task %s not registered.", name.c_str());
+        return false;
     }
 
-    tasks_.erase(name);
-    handle = tasks_.end();
+    if (!ins->resume()) {
+        roo::log_err("task %s is not paused, can not resume.", name.c_str());
+        return false;
+    }
 
-    roo::log_notice("handler %s successful removed.", name.c_str());
+    roo::log_notice("task %s resumed.", name.c_str());
     return true;
 }
 
+// 手动触发的任务统一在async_task_中执行，不占用调度的位置
+bool JobExecutor::trigger_task(const std::string& name) {
 
+    if (draining_) {
+        roo::log_err("JobExecutor is shutting down, reject trigger %s.", name.c_str());
+        return false;
+    }
 
-bool JobExecutor::handle_so_task_runtime_conf(const libconfig::Setting& setting) {
+    auto ins = find_task(name);
+    if (!ins) {
+        roo::log_err("task %s not registered.", name.c_str());
+        return false;
+    }
 
-    std::string name;
-    std::string desc;
-    std::string sch_time;
-    std::string exec_method;
-    std::string so_path;
-    bool status = true;
+    // 和调度的执行互斥，run_once()中还会再次检查
+    if (ins->is_running()) {
+        roo::log_err("task %s is running, reject trigger.", name.c_str());
+        return false;
+    }
 
-    setting.lookupValue("name", name);
-    setting.lookupValue("desc", desc);
-    setting.lookupValue("sch_time", sch_time);
-    setting.lookupValue("exec_method", exec_method);
-    setting.lookupValue("so_path", so_path);
-    setting.lookupValue("enable", status);
+    ++in_flight_;
+    auto func = [this, ins]() {
+        ins->run_once();
+        --in_flight_;
+    };
+    async_task_->add_async_task(func);
+
+    roo::log_notice("task %s triggered manually.", name.c_str());
+    return true;
+}
+
+void JobExecutor::task_list(std::string& output) {
+
+    std::stringstream ss;
 
-    // 禁用的服务，一直阻塞，直到服务不再被占用，然后卸载
-    if (!status) {
-        roo::log_err("task %s marked disabled, we will try to unload it", name.c_str());
-        return remove_so_task(name);
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
+            ss << iter->second->stat_str() << std::endl;
+        }
     }
 
-    // 检查是否存在，如果存在则直接跳过
-    // 如果需要更新服务，需要先将其mark为delete的，然后再加载之
+    output = ss.str();
+}
 
-    enum ExecuteMethod method = ExecuteMethod::kExecDefer;
-    if (!exec_method.empty()) {
-        if (exec_method == "defer") {
-            method = ExecuteMethod::kExecDefer;
-        } else if (exec_method == "async") {
-            method = ExecuteMethod::kExecAsync;
-        } else {
-            roo::log_err("invalid exec_method: %s", exec_method.c_str());
+bool JobExecutor::task_stat(const std::string& name, std::string& output) {
+
+    auto ins = find_task(name);
+    if (!ins) {
+        output = "task " + name + " not registered.";
+        return false;
+    }
+
+    output = ins->stat_str();
+    return true;
+}
+
+bool JobExecutor::task_spec(const std::string& name, JobSpec& spec) {
+
+    auto ins = find_task(name);
+    if (!ins) {
+        return false;
+    }
+
+    spec = ins->spec();
+    return true;
+}
+
+// 需要在lock_下面获取任务列表：正在注册的任务如果在分片归属变化之前完成
+// 了init，一定会出现在这里的列表中，否则init的时候已经看到了新的归属
+void JobExecutor::shards_changed(const std::vector<uint32_t>& shards) {
+
+    std::vector<bool> mask;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (shards[i] >= mask.size()) {
+            mask.resize(shards[i] + 1, false);
+        }
+        mask[shards[i]] = true;
+    }
+
+    std::vector<std::shared_ptr<JobInstance>> tasks{};
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
+            uint32_t shard = iter->second->shard();
+            if (shard < mask.size() && mask[shard]) {
+                tasks.push_back(iter->second);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        tasks[i]->shard_changed();
+    }
+
+    roo::log_warning("%d shards changed, %d tasks affected.",
+                     static_cast<int>(shards.size()), static_cast<int>(tasks.size()));
+}
+
+void JobExecutor::task_stats(std::string& output) {
+
+    std::stringstream ss;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        ss << "tasks: " << tasks_.size() << std::endl;
+    }
+
+    ss << "defer_queue: " << defer_queue_.SIZE() << std::endl
+       << "async_queue: " << async_queue_.SIZE() << std::endl
+       << "defer_dropped: " << defer_queue_.dropped() << std::endl
+       << "async_dropped: " << async_queue_.dropped() << std::endl
+       << "coalesced: " << coalesced_ << std::endl
+       << "job_slab: " << JobSlab::instance().size() << std::endl
+       << "fires: " << FireTimer::instance().fired() << std::endl
+       << "fire_allocs: " << FireTimer::instance().grows() + JobQueue::pool().allocated() << std::endl
+       << "in_flight: " << in_flight_ << std::endl
+       << "timeouts: " << timeouts_ << std::endl
+       << "lazy_prefetches: " << lazy_prefetches_ << std::endl
+       << "draining: " << (draining_ ? "true" : "false") << std::endl;
+
+    output = ss.str();
+}
+
+
+bool JobExecutor::remove_so_task(const std::string& name) {
+
+    std::shared_ptr<JobInstance> ins;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+
+        auto handle = tasks_.find(name);
+        if (handle == tasks_.end()) {
+            roo::log_err("task %s not registered, fast return", name.c_str());
+            return true;
+        }
+
+        if (handle->second->is_builtin()) {
+            roo::log_err("remove builtin task, weird... hh");
             return false;
         }
+
+        ins = handle->second;
+        tasks_.erase(handle);
     }
 
-    std::unique_lock<std::mutex> lock(lock_);
-    if (tasks_.find(name) != tasks_.end()) {
-        roo::log_err("task %s already registered, reject it (duplicate configure?)", name.c_str());
+    // 定时器和队列中只有JobRef，终止之后到期的调度不再执行；正在执行的
+    // 调度持有pin，析构中的JobSlab::release()会等待，所以放到retiring_中
+    // 等执行结束之后再析构，不在这里阻塞。同时请求正在执行的调度取消
+    ins->terminate();
+    ins->cancel_running();
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        retiring_.push_back(ins);
+    }
+
+    roo::log_notice("handler %s removed, release after running schedules finished.", name.c_str());
+    return true;
+}
+
+void JobExecutor::remove_stale_tasks(const std::set<std::string>& seen) {
+
+    std::vector<std::string> stale;
+    for (auto iter = conf_tasks_.begin(); iter != conf_tasks_.end(); ++iter) {
+        if (seen.find(*iter) == seen.end()) {
+            stale.push_back(*iter);
+        }
+    }
+    conf_tasks_ = seen;
+
+    for (size_t i = 0; i < stale.size(); ++i) {
+        roo::log_warning("task %s removed from configure, we will unload it.", stale[i].c_str());
+        remove_so_task(stale[i]);
+    }
+}
+
+// 由timeout_check()周期调用，执行结束并且没有外部引用的任务在锁外析构
+void JobExecutor::reap_retiring() {
+
+    std::vector<std::shared_ptr<JobInstance>> reaped;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (size_t i = 0; i < retiring_.size(); ) {
+            const std::shared_ptr<JobInstance>& ins = retiring_[i];
+            if (ins.unique() && JobSlab::instance().pins(ins->ref()) == 0) {
+                reaped.push_back(ins);
+                retiring_[i] = retiring_.back();
+                retiring_.pop_back();
+                continue;
+            }
+            ++i;
+        }
+    }
+
+    for (size_t i = 0; i < reaped.size(); ++i) {
+        roo::log_notice("handler %s successful removed.", reaped[i]->name().c_str());
+    }
+}
+
+
+
+bool JobExecutor::handle_so_task_runtime_conf(const libconfig::Setting& setting, std::vector<JobLoadItem>& batch) {
+
+    JobSpec spec {};
+    if (!parse_job_spec(setting, spec)) {
         return false;
     }
 
-    auto ins = std::make_shared<JobInstance>(name, desc, sch_time, so_path, method);
-    if (!ins || !ins->init()) {
-        roo::log_err("init JobInstance failed, name: %s", name.c_str());
+    return handle_so_task_runtime_spec(spec, NULL, batch);
+}
+
+bool JobExecutor::handle_so_task_runtime_spec(const JobSpec& spec, const CronMask* sch,
+                                              std::vector<JobLoadItem>& batch) {
+
+    conf_seen_.insert(spec.name_);
+
+    // 禁用的服务直接删除，执行中的调度结束之后再卸载
+    if (!spec.enable_) {
+        roo::log_err("task %s marked disabled, we will try to unload it", spec.name_.c_str());
+        return remove_so_task(spec.name_);
+    }
+
+    // 新增的任务直接加载，已经存在的任务只应用变化的部分，不会打断
+    // 正在执行的任务，也不会重置没有变化的任务的调度
+    auto ins = find_task(spec.name_);
+    if (!ins) {
+        return handle_so_task_spec(spec, sch, batch);
+    }
+
+    if (ins->is_builtin()) {
+        roo::log_err("task %s is builtin, can not be configured.", spec.name_.c_str());
         return false;
     }
 
-    tasks_[name] = ins;
-    roo::log_info("register handler %s success.", name.c_str());
-    return true;
+    if (ins->spec() == spec) {
+        return true;
+    }
+
+    roo::log_warning("task %s configure changed, apply it in place.", spec.name_.c_str());
+    return ins->update(spec, sch);
 }
 
 
+bool JobExecutor::shutdown_graceful() {
+
+    if (draining_.exchange(true)) {
+        roo::log_err("JobExecutor shutdown already in progress.");
+        return false;
+    }
+
+    int drain_sec = 0;
+    std::vector<std::shared_ptr<JobInstance>> tasks{};
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        drain_sec = conf_.shutdown_drain_sec_;
+        for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
+            tasks.push_back(iter->second);
+        }
+
+        // 已经删除还没有回收的任务同样需要等待和卸载
+        tasks.insert(tasks.end(), retiring_.begin(), retiring_.end());
+    }
+
+    roo::log_warning("JobExecutor shutdown: stop scheduling %d tasks, drain deadline %d secs.",
+                     static_cast<int>(tasks.size()), drain_sec);
+
+    // 撤销所有的定时器，已经入队的任务仍然会被执行，执行完后不再调度下一次
+    if (thread_adjust_timer_) {
+        thread_adjust_timer_->revoke_timer();
+        thread_adjust_timer_.reset();
+    }
+
+    if (state_flush_timer_) {
+        state_flush_timer_->revoke_timer();
+        state_flush_timer_.reset();
+    }
+
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        tasks[i]->terminate();
+    }
+
+    auto deadline = boost::chrono::steady_clock::now() + boost::chrono::seconds(drain_sec);
+    while (boost::chrono::steady_clock::now() < deadline) {
+
+        if (defer_queue_.SIZE() == 0 && async_queue_.SIZE() == 0 && in_flight_ == 0) {
+            break;
+        }
+
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    }
+
+    // 工作线程退出，不再处理队列中剩余的任务，仍然在隔离进程中执行的任务
+    // 被直接kill，这样阻塞等待结果的工作线程可以返回
+    async_stop_ = true;
+    if (IsolatedExecutor::instance().enabled()) {
+        IsolatedExecutor::instance().stop();
+    }
+    threads_start_stop_graceful();
+
+    size_t defer_left = defer_queue_.SIZE();
+    size_t async_left = async_queue_.SIZE();
+    int32_t in_flight = in_flight_;
+
+    bool clean = (defer_left == 0 && async_left == 0 && in_flight == 0);
+    if (!clean) {
+        roo::log_err("JobExecutor shutdown deadline reached, cut off: "
+                     "defer_queue %d, async_queue %d, in_flight %d.",
+                     static_cast<int>(defer_left), static_cast<int>(async_left), in_flight);
+    }
+
+    // async_main_只负责投递，最多1s之后看到async_stop_退出；排空之后执行线程
+    // 都在队列上等待，同样在1s之内退出。仍然阻塞在so中的线程无法回收，不等待
+    if (async_main_.joinable()) {
+        async_main_.join();
+    }
+
+    if (clean) {
+        threads_join();
+        async_task_.reset();
+    }
+
+    if (timeout_check_timer_) {
+        timeout_check_timer_->revoke_timer();
+        timeout_check_timer_.reset();
+    }
+
+    // 释放所有任务的so，仍然在执行的任务持有自己的引用，执行结束之后才调用
+    // module_exit和dlclose
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        if (tasks[i]->is_running()) {
+            roo::log_err("task %s still running when shutdown, unload after it finished.",
+                         tasks[i]->name().c_str());
+        }
+
+        tasks[i]->unload();
+    }
+
+    StateStore::instance().flush();
+
+    roo::log_warning("JobExecutor shutdown finished %s.", clean ? "cleanly" : "with tasks cut off");
+    return clean;
+}
+
 
 } // end namespace tzrpc
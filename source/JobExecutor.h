@@ -11,9 +11,14 @@
 
 #include <xtra_rhel.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
 #include <other/Log.h>
 
-#include <container/EQueue.h>
 #include <concurrency/ThreadPool.h>
 #include <concurrency/AsyncTask.h>
 
@@ -21,6 +26,8 @@
 #include <scaffold/Status.h>
 
 #include "JobInstance.h"
+#include "JobQueue.h"
+#include "JobSlab.h"
 
 #include <gtest/gtest_prod.h>
 
@@ -38,26 +45,80 @@ struct JobExecutorConf {
     int thread_step_queue_size_;
     int thread_number_async_;
 
+    int shutdown_drain_sec_;  // 优雅退出时等待队列排空、任务结束的最长时间
+    int init_threads_;        // 启动和reload时并行加载任务的线程数
+    int dispatch_batch_;      // 执行线程一次唤醒最多取出的defer任务数
+
+    int lazy_prefetch_sec_;   // lazy_load的任务在调度前多久加载so
+    int lazy_idle_sec_;       // lazy_load的任务空闲多久之后卸载so
+
+    int defer_queue_capacity_;    // 执行队列的容量，0表示不限制
+    int async_queue_capacity_;
+    QueueOverflow queue_overflow_;
+    bool queue_coalesce_;         // 同一任务已经在队列中的时候合并新的触发
+
     JobExecutorConf() :
         thread_number_(1),
         thread_number_hard_(1),
         thread_step_queue_size_(0),
-        thread_number_async_(10) {
+        thread_number_async_(10),
+        shutdown_drain_sec_(10),
+        init_threads_(8),
+        dispatch_batch_(16),
+        lazy_prefetch_sec_(10),
+        lazy_idle_sec_(300),
+        defer_queue_capacity_(0),
+        async_queue_capacity_(0),
+        queue_overflow_(QueueOverflow::kDropOldest),
+        queue_coalesce_(true) {
     }
 
 } __attribute__((aligned(4)));
 
 
 
-void JE_add_task_defer(std::shared_ptr<JobInstance>& ins);
-void JE_add_task_async(std::shared_ptr<JobInstance>& ins);
+void JE_add_task_defer(const JobRef& ref);
+void JE_add_task_async(const JobRef& ref);
+
+// FireTimer一次触发循环的开始和结束，期间当前线程投递的defer任务先缓存，
+// 结束的时候一次性入队
+void JE_defer_batch_begin();
+void JE_defer_batch_end();
+
+// 任务上一次的触发还在执行队列中等待，开启了queue_coalesce的时候返回true，
+// 本次触发合并到队列中的那一次
+bool JE_coalesce_task();
+
+// 执行队列满被丢弃的任务，释放这一次调度，没有其他调度的时候重新设置下一次触发
+void JE_drop_task(const JobRef& ref);
+
+// dispatch_batch的上限
+static const int kDispatchBatchMax = 1024;
+
+// 配置文件中单个so任务的配置，argus_manifest转换的时候也使用
+bool parse_job_spec(const libconfig::Setting& setting, JobSpec& spec);
+
+// 批量加载中的一个任务，加载完成之后ins_或者error_二者有一
+struct JobLoadItem {
+    JobSpec spec_;
+    CronMask sch_;
+    bool precompiled_;
+    std::shared_ptr<JobInstance> ins_;
+    std::string error_;
+};
 
 class JobExecutor {
 
     FRIEND_TEST(ExecutorFriendTest, SoHandleTest);
+    FRIEND_TEST(ExecutorFriendTest, ReloadRemoveTest);
+    FRIEND_TEST(ExecutorFriendTest, LoadBatchTest);
+    FRIEND_TEST(ExecutorFriendTest, RuntimeSpecTest);
+    FRIEND_TEST(ControlServerTest, CommandTest);
 
-    friend void JE_add_task_defer(std::shared_ptr<JobInstance>& ins);
-    friend void JE_add_task_async(std::shared_ptr<JobInstance>& ins);
+    friend void JE_add_task_defer(const JobRef& ref);
+    friend void JE_add_task_async(const JobRef& ref);
+    friend void JE_defer_batch_end();
+    friend bool JE_coalesce_task();
 
 public:
 
@@ -67,38 +128,127 @@ public:
     bool add_builtin_task(const std::string& name, const std::string& desc,
                           const std::string& time_str, const std::function<int(JobInstance *)>& func,
                           bool async = false);
+    // 调度在编译期解析，见CronLiteral.h
+    bool add_builtin_task(const std::string& name, const std::string& desc,
+                          const CronMask& sch, const std::function<int(JobInstance *)>& func,
+                          bool async = false);
     bool task_exists(const std::string& name);
 
+    // 运行时对单个任务的管理，供ControlServer使用
+    bool add_so_task(const JobSpec& spec);
+    // 检查之后把dlopen和module_init交给async_task_，不阻塞调用线程，
+    // 返回true只表示已经提交，加载的结果在日志中，成功之后task_exists()
+    bool add_so_task_async(const JobSpec& spec);
+    // 原地更新已经存在的任务，只应用变化的配置项
+    bool update_so_task(const JobSpec& spec);
+
+    // 不阻塞调用者：任务立即从注册表中移除并终止，仍然在执行的调度结束之后
+    // 由timeout_check()回收，执行卡住的任务不会阻塞管理接口和配置重载
+    bool remove_so_task(const std::string& name);
+
+    bool pause_task(const std::string& name);
+    bool resume_task(const std::string& name);
+    bool trigger_task(const std::string& name);
+
+    void task_list(std::string& output);
+    void task_stats(std::string& output);
+    bool task_stat(const std::string& name, std::string& output);
+    bool task_spec(const std::string& name, JobSpec& spec);
+
+    // 分片的归属发生变化，通知其中的任务设置或者撤销调度
+    void shards_changed(const std::vector<uint32_t>& shards);
+
     bool init(const libconfig::Config& conf);
     int module_runtime(const libconfig::Config& conf);
     int module_status(std::string& module, std::string& name, std::string& val);
 
+    // 停止新的触发，在shutdown_drain_sec_时间内排空队列并等待执行中的任务，
+    // 然后调用module_exit卸载so，返回false表示有任务被截断
+    bool shutdown_graceful();
+
 private:
 
     JobExecutorConf conf_;
 
     std::mutex lock_;
-    std::map<std::string, std::shared_ptr<JobInstance>> tasks_;
+    std::unordered_map<std::string, std::shared_ptr<JobInstance>> tasks_;
 
-    // so task都是通过配置文件动态处理的，所以全部都是private
-    bool handle_so_task_conf(const libconfig::Setting& setting);
-    bool handle_so_task_runtime_conf(const libconfig::Setting& setting);
+    // 已经删除，还有执行中的调度或者外部引用的任务，由lock_保护
+    std::vector<std::shared_ptr<JobInstance>> retiring_;
+    void reap_retiring();
 
-    // 无限阻塞，直到引用计数合法后，卸载对应so
-    bool remove_so_task(const std::string& name);
+    std::shared_ptr<JobInstance> find_task(const std::string& name);
+    bool register_builtin(const std::shared_ptr<JobInstance>& ins);
+
+    // sch不为空的时候是预编译的调度，不再解析spec.sch_time_
+    bool add_so_task(const JobSpec& spec, const CronMask* sch);
+
+    // so task都是通过配置文件动态处理的，所以全部都是private
+    // 需要新加载的任务放到batch中，由load_so_tasks()统一加载
+    bool handle_so_task_conf(const libconfig::Setting& setting, std::vector<JobLoadItem>& batch);
+    bool handle_so_task_runtime_conf(const libconfig::Setting& setting, std::vector<JobLoadItem>& batch);
+    bool handle_so_task_spec(const JobSpec& spec, const CronMask* sch, std::vector<JobLoadItem>& batch);
+    bool handle_so_task_runtime_spec(const JobSpec& spec, const CronMask* sch, std::vector<JobLoadItem>& batch);
+    bool handle_so_tasks(const libconfig::Config& conf, bool runtime, std::vector<JobLoadItem>& batch);
+
+    // 配置(so_handlers或者so_manifest)中出现过的任务，只在初始化和配置重载中
+    // 访问。conf_seen_是本次处理的配置中的任务，conf_tasks_是上一次的
+    std::set<std::string> conf_seen_;
+    std::set<std::string> conf_tasks_;
+
+    // 重载的时候删除上一次配置中有、本次配置中已经没有的任务，
+    // 通过ControlServer添加的任务不在配置中，不受影响
+    void remove_stale_tasks(const std::set<std::string>& seen);
+
+    // 从预编译的任务清单加载，见JobManifest
+    bool handle_so_manifest(const std::string& path, bool runtime, std::vector<JobLoadItem>& batch);
+
+    // 在init_threads_个线程中并行初始化(解析、dlopen、module_init)，只在发布
+    // 的时候持有lock_。使用同一个so的任务在同一个线程中依次初始化，so的
+    // module_init不会被并发调用。有任何任务失败返回false，失败的原因汇总输出
+    bool load_so_tasks(std::vector<JobLoadItem>& batch);
 
     // 在线程池中依序列执行
-    roo::EQueue<std::weak_ptr<JobInstance>> defer_queue_;
+    JobQueue defer_queue_;
     roo::ThreadPool threads_;
     void job_executor_run(roo::ThreadObjPtr ptr);  // main task loop
 
 
     // 每个任务开辟一个新的线程执行，主要是用于比较耗时的任务
-    roo::EQueue<std::weak_ptr<JobInstance>> async_queue_;
+    JobQueue async_queue_;
     boost::thread async_main_;
     std::shared_ptr<roo::AsyncTask> async_task_;
     void job_executor_async_run();  // main task loop
 
+    // 正在执行(包括已经交给async_task_还没有开始)的任务数目
+    std::atomic<int32_t> in_flight_;
+
+    // 从async_queue_交给async_task_还没有执行结束的任务数目，达到异步线程数
+    // 之后async_main_不再取出，任务留在async_queue_中受容量限制
+    std::atomic<int32_t> async_running_;
+    std::mutex async_lock_;
+    std::condition_variable async_cond_;
+
+    // 进入退出流程后不再接受新的任务注册和配置更新
+    std::atomic<bool> draining_;
+    std::atomic<bool> async_stop_;
+
+    // 所有任务累计的执行超时次数
+    std::atomic<uint64_t> timeouts_;
+
+    // lazy_load任务提交的预取次数
+    std::atomic<uint64_t> lazy_prefetches_;
+
+    // conf_.dispatch_batch_的副本，执行线程不加锁读取
+    std::atomic<int32_t> dispatch_batch_;
+
+    // conf_.queue_coalesce_的副本，以及累计合并的触发次数
+    std::atomic<bool> queue_coalesce_;
+    std::atomic<uint64_t> coalesced_;
+
+    // 按照conf_设置两个执行队列的容量和溢出策略
+    void apply_queue_limit();
+
 public:
 
     int threads_start() {
@@ -125,7 +275,23 @@ public:
 
 private:
 
-    JobExecutor() { }
+    JobExecutor() :
+        in_flight_(0),
+        async_running_(0),
+        draining_(false),
+        async_stop_(false),
+        timeouts_(0),
+        lazy_prefetches_(0),
+        dispatch_batch_(16),
+        queue_coalesce_(true),
+        coalesced_(0) {
+
+        // 注册表中的任务析构的时候还会访问JobSlab和RunHistory，在这里先构造，
+        // 进程退出的静态析构中它们在JobExecutor之后才析构
+        JobSlab::instance();
+        RunHistory::instance();
+    }
+
     virtual ~JobExecutor() { }
 
     // 禁止拷贝
@@ -135,6 +301,13 @@ private:
     // 根据rpc_queue_自动伸缩线程负载
     std::shared_ptr<roo::TimerObject> thread_adjust_timer_;
     void threads_adjust(const boost::system::error_code& ec);
+
+    // 周期性的将任务调度状态批量落盘
+    std::shared_ptr<roo::TimerObject> state_flush_timer_;
+
+    // 执行超时的检查，同时处理lazy_load任务的预取和空闲卸载
+    std::shared_ptr<roo::TimerObject> timeout_check_timer_;
+    void timeout_check(const boost::system::error_code& ec);
 };
 
 
@@ -6,11 +6,24 @@
  */
 
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+
 #include <other/Log.h>
-#include <string/StrUtil.h>
 
 #include "SoWrapper.h"
+#include "HotLog.h"
+#include "StateStore.h"
+#include "IsolatedExecutor.h"
+#include "ShardManager.h"
+#include "Clock.h"
+#include "FireTimer.h"
 #include "JobInstance.h"
+#include "JobSlab.h"
+#include "ResultPipeline.h"
 
 #include "Captain.h"
 
@@ -21,143 +34,193 @@ namespace tzrpc {
 
 // meta char:  * , - /
 // 根据指定的时间设置字符串，解析出下面的interval point成员
+//
+// 单次扫描，不分配内存，语法和CronLiteral.h中编译期的解析一致
+
+static const char* kSchFieldName[] = { "sec", "min", "hour" };
+
+std::string SchError::str() const {
+
+    std::stringstream ss;
+    if (field_ >= 0 && field_ < 3) {
+        ss << "field " << kSchFieldName[field_] << ", ";
+    }
+    ss << "column " << column_ << ": " << (reason_ ? reason_ : "unknown");
+    return ss.str();
+}
+
+static inline bool sch_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
 
+static inline bool sch_fail(SchError& error, int32_t field, size_t column, const char* reason) {
+    error.field_ = field;
+    error.column_ = static_cast<int32_t>(column);
+    error.reason_ = reason;
+    return false;
+}
+
+// 从pos开始读取1到2位的数字，值必须小于max_val
+static bool sch_number(boost::string_ref str, size_t& pos, size_t end, int max_val,
+                       int32_t field, int& value, SchError& error) {
+
+    size_t begin = pos;
+    value = 0;
+    while (pos < end && str[pos] >= '0' && str[pos] <= '9') {
+        if (pos - begin >= 2) {
+            return sch_fail(error, field, begin, "value out of range");
+        }
+        value = value * 10 + (str[pos] - '0');
+        ++pos;
+    }
 
+    if (pos == begin) {
+        return sch_fail(error, field, begin, "expect number");
+    }
+
+    if (value >= max_val) {
+        return sch_fail(error, field, begin, "value out of range");
+    }
+
+    return true;
+}
 
-// 用来解析 时、分、秒的
+// 用来解析 时、分、秒的，[begin, end)是str中该字段的范围
 template<std::size_t N>
-bool SchTime::parse_subtime(const std::string& sch_str, std::bitset<N>& store) {
+bool SchTime::parse_subtime(boost::string_ref str, size_t begin, size_t end, int32_t field,
+                            std::bitset<N>& store, SchError& error) {
 
-    int max_val = static_cast<int>(N); // ignore warning
-    std::vector<std::string> vec;
-    boost::split(vec, sch_str, boost::is_any_of(","));
+    const int max_val = static_cast<int>(N);
+    size_t pos = begin;
 
-    for (size_t i = 0; i < vec.size(); ++i) {
+    while (true) {
 
-        if (vec[i].find('*') != std::string::npos) {
-            // *
-            if (vec[i].size() == 1) {
-                store.set();
-                return true;
-            }
+        if (pos == end || str[pos] == ',') {
+            return sch_fail(error, field, pos, "empty item");
+        }
 
-            // */3
-            auto it = vec[i].find('/');
-            if (it == std::string::npos) {
-                roo::log_err("invalid sch_str: %s, subitem: %s", sch_str.c_str(), vec[i].c_str());
-                return false;
+        if (str[pos] == '*') {
+
+            ++pos;
+            // * 和 */ 等同
+            if (pos < end && str[pos] != ',') {
+                if (str[pos] != '/') {
+                    return sch_fail(error, field, pos, "expect '/' after '*'");
+                }
+                ++pos;
             }
 
-            std::string time_istr = vec[i].substr(it + 1);
-            // */ -> */1
-            if (time_istr.empty()) {
+            if (pos == end || str[pos] == ',') {
                 store.set();
-                return true;
             } else {
-                int time_i = ::atoi(time_istr.c_str());
-                if (time_i > 0 && time_i < max_val) {
-                    for (auto j = 0; j < max_val; j = j + time_i) {
-                        store.set(j);
-                    }
-                } else {
-                    roo::log_err("invalid sch_str: %s, subitem: %s", sch_str.c_str(), vec[i].c_str());
+                // */3
+                size_t step_pos = pos;
+                int step = 0;
+                if (!sch_number(str, pos, end, max_val, field, step, error)) {
                     return false;
                 }
+                if (step == 0) {
+                    return sch_fail(error, field, step_pos, "step must be positive");
+                }
+                for (int j = 0; j < max_val; j += step) {
+                    store.set(j);
+                }
             }
 
-            continue;
-        }
-
-        if (vec[i].find('-') != std::string::npos) {
-
-            std::vector<std::string> time_p;
-            boost::split(time_p, vec[i], boost::is_any_of("-"));
-            if (time_p.size() != 2 ||
-                time_p[0].empty() || time_p[1].empty()) {
-                roo::log_err("invalid sch_str: %s, subitem: %s", sch_str.c_str(), vec[i].c_str());
-                return false;
-            }
-
-            int from = ::atoi(time_p[0].c_str());
-            int to = ::atoi(time_p[1].c_str());
+        } else {
 
-            if (from < 0 || to < 0 ||
-                from > max_val || to > max_val ||
-                from >= to) {
-                roo::log_err("invalid sch_str: %s, subitem: %s", sch_str.c_str(), vec[i].c_str());
+            int from = 0;
+            if (!sch_number(str, pos, end, max_val, field, from, error)) {
                 return false;
             }
 
-            while (from <= to) {
+            if (pos < end && str[pos] == '-') {
+                ++pos;
+                size_t to_pos = pos;
+                int to = 0;
+                if (!sch_number(str, pos, end, max_val, field, to, error)) {
+                    return false;
+                }
+                if (from >= to) {
+                    return sch_fail(error, field, to_pos, "range from must be less than to");
+                }
+                for (int j = from; j <= to; ++j) {
+                    store.set(j);
+                }
+            } else {
                 store.set(from);
-                ++from;
             }
         }
 
+        if (pos == end) {
+            return true;
+        }
 
-        if (!vec[i].empty()) {
-            int from = ::atoi(vec[i].c_str());
-            if (from < 0 || from > max_val) {
-                roo::log_err("invalid sch_str: %s, subitem: %s", sch_str.c_str(), vec[i].c_str());
-                return false;
-            }
-
-            //
-            store.set(from);
+        if (str[pos] != ',') {
+            return sch_fail(error, field, pos, "unexpected character");
         }
+        ++pos;
     }
-
-    return true;
 }
 
 
+bool SchTime::parse(boost::string_ref sch_str, SchError& error) {
 
+    std::bitset<60> sec_tp;
+    std::bitset<60> min_tp;
+    std::bitset<24> hour_tp;
 
-bool SchTime::parse(const std::string& sch_str) {
+    size_t pos = 0;
+    const size_t size = sch_str.size();
 
-    // reset before value
-    sec_tp_.reset();
-    min_tp_.reset();
-    hour_tp_.reset();
+    for (int32_t field = 0; ; ++field) {
 
-    std::vector<std::string> sub{};
-    boost::split(sub, sch_str, boost::is_any_of(" \t\n"));
+        while (pos < size && sch_space(sch_str[pos])) {
+            ++pos;
+        }
 
-    // 删除连接处的可能空白字符
-    for (auto it = sub.begin(); it != sub.end();) {
-        roo::StrUtil::trim_whitespace(*it);
-        if (it->empty()) {
-            it = sub.erase(it);
-        } else {
-            ++it;
+        if (pos == size) {
+            if (field < 3) {
+                return sch_fail(error, field, pos, "missing field");
+            }
+            break;
         }
-    }
 
-    if (sub.size() != 3) {
-        roo::log_err("invalid sch_str: %s", sch_str.c_str());
-        return false;
-    }
+        if (field >= 3) {
+            return sch_fail(error, -1, pos, "too many fields");
+        }
 
-    // sec
-    if (!parse_subtime<60>(sub[0], sec_tp_)) {
-        roo::log_err("parse sec part failed, full str: %s.", sch_str.c_str());
-        return false;
-    }
+        size_t end = pos;
+        while (end < size && !sch_space(sch_str[end])) {
+            ++end;
+        }
 
-    // min
-    if (!parse_subtime<60>(sub[1], min_tp_)) {
-        roo::log_err("parse min part failed, full str: %s.", sch_str.c_str());
-        return false;
-    }
+        bool ok = false;
+        if (field == 0) {
+            ok = parse_subtime<60>(sch_str, pos, end, field, sec_tp, error);
+        } else if (field == 1) {
+            ok = parse_subtime<60>(sch_str, pos, end, field, min_tp, error);
+        } else {
+            ok = parse_subtime<24>(sch_str, pos, end, field, hour_tp, error);
+        }
 
-    // hour
-    if (!parse_subtime<24>(sub[2], hour_tp_)) {
-        roo::log_err("parse hour part failed, full str: %s.", sch_str.c_str());
-        return false;
+        if (!ok) {
+            return false;
+        }
+        pos = end;
     }
 
-    if (sec_tp_.none() || min_tp_.none() || hour_tp_.none()) {
-        roo::log_err("integrity check failed...");
+    sec_tp_ = sec_tp;
+    min_tp_ = min_tp;
+    hour_tp_ = hour_tp;
+    return true;
+}
+
+bool SchTime::parse(const std::string& sch_str) {
+
+    SchError error {};
+    if (!parse(boost::string_ref(sch_str), error)) {
+        roo::log_err("invalid sch_str \"%s\", %s", sch_str.c_str(), error.str().c_str());
         return false;
     }
 
@@ -192,7 +255,7 @@ uint8_t SchTime::find_ge_of(const std::bitset<N>& bits, int from) {
 
 
 int32_t SchTime::next_interval() {
-    time_t now = ::time(NULL);
+    time_t now = Clock::instance().now();
     return next_interval(now);
 }
 
@@ -254,7 +317,8 @@ int32_t SchTime::next_interval(time_t from) {
             }
 
             next_tm = ::mktime(&tm_time) - from;
-            if (next_tm < 0) { // 日期溢出了
+            // 日期溢出了，每天只触发一次的调度在触发的那一秒计算得到0
+            if (next_tm <= 0) {
                 roo::log_info("overflow day switch from %d-%d-%d %d:%d:%d",
                           tm_time.tm_year + 1900, tm_time.tm_mon, tm_time.tm_mday,
                           tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
@@ -276,69 +340,186 @@ int32_t SchTime::next_interval(time_t from) {
 
 
 
+int32_t RetryPolicy::delay_ms(uint32_t attempt) const {
+
+    int64_t delay = backoff_ms_;
+    for (uint32_t i = 1; i < attempt && delay < backoff_max_ms_; ++i) {
+        delay *= 2;
+    }
+
+    if (delay > backoff_max_ms_) {
+        delay = backoff_max_ms_;
+    }
+
+    if (jitter_ && delay > 1) {
+        static thread_local std::mt19937 engine(std::random_device{}());
+        std::uniform_int_distribution<int64_t> dist(delay / 2, delay);
+        delay = dist(engine);
+    }
+
+    return static_cast<int32_t>(delay);
+}
+
+
 JobInstance::~JobInstance() {
+
+    // 先等待队列和执行线程中的引用释放，之后JobRef都会失效，不会再有执行
+    // 写入RunHistory；调用者需要保证没有持有JobExecutor::lock_，见retiring_
+    if (hot_) {
+        JobSlab::instance().release(ref_);
+        hot_ = NULL;
+    }
+
+    if (run_job_id_) {
+        RunHistory::instance().unregister_job(run_job_id_);
+    }
     roo::log_info("Job destructed forever:\n%s", this->str().c_str());
 }
 
+void JobInstance::attach_slab(enum ExecuteMethod method, bool isolate) {
+    hot_ = JobSlab::instance().alloc(this, ref_);
+    if (hot_) {
+        hot_->reset(method, isolate);
+    }
+}
+
 
 // 对于内置类型，只需要进行next_trigger计算下一次执行时间
 // 就可以了，对于so类型，则进行实际的so加载和初始化
 bool JobInstance::init() {
+    std::string error;
+    return init(error) && start(error);
+}
+
+bool JobInstance::init(std::string& error) {
 
     if (name_.empty() || time_str_.empty() || (!builtin_func_ && so_path_.empty()) ) {
         roo::log_err("param fast check failed.");
+        error = "name, sch_time or so_path empty";
         return false;
     }
 
-    if (!sch_timer_.parse(time_str_)) {
-        roo::log_err("parse time setting failed %s.", time_str_.c_str());
+    if (!hot_) {
+        roo::log_err("job %s alloc JobSlab failed, slab size %u.", name_.c_str(), JobSlab::instance().size());
+        error = "JobSlab exhausted";
         return false;
     }
 
-    if (!builtin_func_) {
-        so_handler_.reset(new SoWrapperFunc(so_path_));
-        if (!so_handler_ || !so_handler_->init()) {
-            roo::log_err("create and init so_handler failed.");
+    if (!precompiled_) {
+        SchError sch_error {};
+        if (!hot_->sch_timer_.parse(boost::string_ref(time_str_), sch_error)) {
+            roo::log_err("parse time setting failed %s, %s.", time_str_.c_str(), sch_error.str().c_str());
+            error = "invalid sch_time \"" + time_str_ + "\", " + sch_error.str();
             return false;
         }
     }
 
-    if (!next_trigger()) {
-        roo::log_err("first init next_trigger failed.");
+    hot_->shard_ = ShardManager::instance().shard_of(name_);
+
+    // 隔离执行的so只在worker进程中加载
+    if (hot_->isolate_ && !IsolatedExecutor::instance().enabled()) {
+        roo::log_err("job %s marked isolate, but IsolatedExecutor not enabled.", name_.c_str());
+        error = "isolate but IsolatedExecutor not enabled";
         return false;
     }
 
+    // lazy模式只检查so是否存在，进入预取窗口的时候才加载
+    if (!builtin_func_ && !hot_->isolate_) {
+        if (lazy_) {
+            if (::access(so_path_.c_str(), R_OK) != 0) {
+                roo::log_err("lazy job %s so %s not readable.", name_.c_str(), so_path_.c_str());
+                error = so_path_ + " not readable";
+                return false;
+            }
+        } else {
+            so_handler_ = load_so(so_path_);
+            if (!so_handler_) {
+                roo::log_err("create and init so_handler failed.");
+                error = "load " + so_path_ + " failed (dlopen, module_init or so_handler)";
+                return false;
+            }
+        }
+    }
+
+    // 在设置调度之前注册，第一次执行的时候一定有run_job_id_
+    run_job_id_ = RunHistory::instance().register_job(name_, &run_ring_);
+
+    // 恢复上次持久化的状态，如果重启期间错过了触发，根据策略决定是否补执行
+    JobStateRecord record {};
+    state_slot_ = StateStore::instance().attach(name_);
+    if (StateStore::instance().lookup(state_slot_, record)) {
+
+        hot_->last_fire_ = record.last_fire_;
+        hot_->last_result_ = record.last_result_;
+
+        time_t now = Clock::instance().now();
+        if (record.next_target_ > 0 && record.next_target_ < now &&
+            record.last_fire_ < record.next_target_) {
+            roo::log_warning("job %s missed fire at %ld during restart, misfire policy %d.",
+                             name_.c_str(), static_cast<long>(record.next_target_),
+                             static_cast<int32_t>(misfire_));
+            catch_up_ = (misfire_ == MisfirePolicy::kMisfireOnce);
+        }
+    }
+
     roo::log_info("JobInstance initialized finished:\n%s", this->str().c_str());
     return true;
 }
 
+bool JobInstance::start(std::string& error) {
 
+    std::lock_guard<std::mutex> lock(hot_->lock_);
 
-int JobInstance::operator()() {
-
-    SAFE_ASSERT(builtin_func_ || so_handler_);
+    // 其他实例持有的分片，补执行由持有者负责
+    if (catch_up_ && ShardManager::instance().owns(hot_->shard_)) {
+        catch_up_ = false;
+        if (!arm_trigger(1000)) {
+            roo::log_err("arm misfire catch up trigger failed.");
+            error = "arm misfire catch up trigger failed";
+            return false;
+        }
+    } else if (!next_trigger()) {
+        roo::log_err("first init next_trigger failed.");
+        error = "arm first trigger failed";
+        return false;
+    }
 
-    do {
+    return true;
+}
 
-        if(!Captain::instance().running_)
-            break;
 
 
-        int code = 0;
-        if (builtin_func_) {
-            code = builtin_func_(this);
-        } else if (so_handler_) {
-            code = (*so_handler_)(this);
-        } else {
-            roo::log_err("job with empty func!");
-            return -1;
-        }
+int JobInstance::operator()() {
 
-        if (code != 0) {
-            roo::log_err("job func return %d, job desc: %s", code, this->str().c_str());
+    bool paused = false;
+    bool manual = false;
+    uint64_t owner = 0;
+    uint32_t attempt = 0;
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        paused = (hot_->exec_status_ == ExecuteStatus::kPaused);
+        manual = hot_->manual_;
+        attempt = hot_->attempt_;
+
+        owner = ++hot_->slot_seq_;
+        hot_->slot_owner_ = owner;
+        hot_->slot_start_ = Clock::instance().now();
+
+        // 从执行队列中取出，虚拟时钟下直接执行的没有计数
+        if (hot_->queued_ > 0) {
+            --hot_->queued_;
         }
+    }
 
-    } while (0);
+    // 暂停期间已经设置的调度仍然会触发，但是不执行，也不设置下一次调度
+    // 分片在入队之后被释放的，同样不执行；手动触发的执行还没有结束的，
+    // 跳过本次执行，正常设置下一次调度
+    int code = 0;
+    if (manual) {
+        HOT_LOG_NOTICE("job {} manual run in progress, skip this schedule.", name_);
+    } else if (!paused && ShardManager::instance().owns(hot_->shard_)) {
+        code = execute(attempt, owner);
+    }
 
 
     // 如果设置了Terminate标识，则设置退出标志
@@ -346,58 +527,680 @@ int JobInstance::operator()() {
     //
     // 如果用户对同一个so设置两个任务，可能会有问题，不要这么做
     //
-    if (exec_status_ == ExecuteStatus::kTerminating) {
-        roo::log_notice("marked job terminating, we will disabled it!");
-        exec_status_ = ExecuteStatus::kDisabled;
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+
+    // 超时的时候调度已经被watchdog释放并重新设置了
+    if (hot_->slot_owner_ != owner) {
+        HOT_LOG_NOTICE("job {} overrun run finished, schedule already released.", name_);
         return 0;
     }
 
+    hot_->slot_owner_ = 0;
+    hot_->armed_ = false;
+
+    if (hot_->exec_status_ == ExecuteStatus::kTerminating) {
+        HOT_LOG_NOTICE("marked job {} terminating, we will disabled it!", name_);
+        hot_->exec_status_ = ExecuteStatus::kDisabled;
+        return 0;
+    }
+
+    if (code != 0 && retry_trigger(code)) {
+        return 0;
+    }
+
+    hot_->attempt_ = 0;
     next_trigger();
     
     return 0;
 }
 
+// 手动触发，只执行一次，不影响正常的调度
+int JobInstance::run_once() {
+
+    // 调度正在执行或者已经有手动触发的，不再执行
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        if (hot_->slot_owner_ != 0 || hot_->running_ > 0 || hot_->manual_) {
+            HOT_LOG_WARNING("job {} is running, skip manual run.", name_);
+            return -1;
+        }
+        hot_->manual_ = true;
+    }
+
+    int code = execute(0, 0, true);
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    hot_->manual_ = false;
+    return code;
+}
+
+// 执行线程上当前执行的序号，见cancel_requested()
+static thread_local uint64_t current_run_seq = 0;
+
+int JobInstance::execute(uint32_t attempt, uint64_t run_seq, bool manual) {
+
+    int code = 0;
+    RunRecord record {};
+    record.start_us_ = RunHistory::now_us();
+    record.thread_id_ = static_cast<uint64_t>(pthread_self());
+    record.attempt_ = attempt;
+
+    // 持有so的引用，执行期间即使被热替换也不会卸载
+    std::shared_ptr<SoWrapperFunc> handler;
+    bool isolate = false;
+    bool miss = false;
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        handler = so_handler_;
+        isolate = hot_->isolate_;
+        if (!builtin_func_ && !isolate && !handler && lazy_) {
+            ++load_stat_.misses_;
+            miss = true;
+        }
+    }
+
+    // 预取没有覆盖到(比如手动触发、预取窗口比检查周期小)，在执行线程中加载
+    if (miss) {
+        HOT_LOG_NOTICE("lazy job {} not loaded before fire, load now.", name_);
+        handler = lazy_load();
+    }
+
+    // 输出结果的时候传给so填写响应
+    msg_t rsp {};
+    bool report = ResultPipeline::instance().enabled();
+    int64_t lag_us = 0;
+    {
+        // last_fire_等和定时器线程、stat_str()共享，需要在锁内修改
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        if (report && !manual) {
+            lag_us = std::max<int64_t>(FireTimer::now_us() - hot_->due_us_, 0);
+        }
+        hot_->last_fire_ = Clock::instance().now();
+    }
+
+    ++hot_->running_;
+    current_run_seq = run_seq;
+    if (builtin_func_) {
+        code = builtin_func_(this);
+    } else if (isolate) {
+        code = IsolatedExecutor::instance().execute(spec());
+    } else if (handler) {
+        code = (*handler)(this, report ? &rsp : NULL);
+    } else {
+        current_run_seq = 0;
+        --hot_->running_;
+        roo::log_err("job with empty func!");
+        return -1;
+    }
+    current_run_seq = 0;
+    --hot_->running_;
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        hot_->last_result_ = code;
+    }
 
-void JE_add_task_defer(std::shared_ptr<JobInstance>& ins);
-void JE_add_task_async(std::shared_ptr<JobInstance>& ins);
+    // 只看本次执行是否被取消，之前超时的执行不影响后面正常的执行
+    bool cancelled = run_seq != 0 && run_seq <= hot_->cancel_seq_;
+
+    record.end_us_ = RunHistory::now_us();
+    record.code_ = code;
+    if (cancelled) {
+        record.flags_ |= kRunTimedOut;
+    }
+    RunHistory::instance().record(run_job_id_, run_ring_, record);
+
+    if (report) {
+        JobResult result;
+        result.lag_us_ = lag_us;
+        result.start_us_ = record.start_us_;
+        result.end_us_ = record.end_us_;
+        result.code_ = code;
+        result.attempt_ = attempt;
+        result.flags_ = (cancelled ? kResultTimedOut : 0) | (isolate ? kResultIsolated : 0) |
+                        (manual ? kResultManual : 0);
+        result.rsp_len_ = static_cast<uint32_t>(rsp.len);
+        result.rsp_ = rsp.data;
+        size_t len = std::min(name_.size(), kResultNameMax - 1);
+        ::memcpy(result.name_, name_.c_str(), len);
+        result.name_[len] = '\0';
+        ResultPipeline::instance().submit(result);
+    }
+
+    ++run_count_;
+    if (code != 0) {
+        ++fail_count_;
+        HOT_LOG_ERR("job {} func return {}, attempt {}.", name_, code, attempt);
+    }
+
+    return code;
+}
+
+
+void JE_add_task_defer(const JobRef& ref);
+void JE_add_task_async(const JobRef& ref);
+bool JE_coalesce_task();
 
 bool JobInstance::next_trigger() {
 
-    if (exec_status_ != ExecuteStatus::kRunning) {
-        roo::log_notice("current exec_status is %d, not next...", static_cast<uint8_t>(exec_status_));
+    if (hot_->exec_status_ != ExecuteStatus::kRunning) {
+        HOT_LOG_NOTICE("job {} current exec_status is {}, not next...", name_, static_cast<uint8_t>(hot_->exec_status_));
         return false;
     }
 
-    int next_interval = sch_timer_.next_interval();
+    // 不属于本实例的任务不设置定时器，获得分片的时候由shard_changed()设置
+    if (!ShardManager::instance().owns(hot_->shard_)) {
+        hot_->next_fire_ = 0;
+        return true;
+    }
+
+    int next_interval = hot_->sch_timer_.next_interval();
     if (next_interval <= 0) {
         roo::log_err("next_interval failed.");
         return false;
     }
 
-    if (exec_method_ == ExecuteMethod::kExecDefer) {
-        timer_ = Captain::instance().timer_ptr_->add_better_timer(
-            std::bind(JE_add_task_defer, shared_from_this()), next_interval * 1000, false);
-    } else if (exec_method_ == ExecuteMethod::kExecAsync) {
-        timer_ = Captain::instance().timer_ptr_->add_better_timer(
-            std::bind(JE_add_task_async, shared_from_this()), next_interval * 1000, false);
+    return arm_trigger(next_interval * 1000);
+}
+
+// 在定时器上设置重试，不占用执行线程。重试的时间不能晚于下一次正常的
+// 调度，否则直接等待正常调度，这样任何时候仍然只有一个调度存在
+bool JobInstance::retry_trigger(int code) {
+
+    if (hot_->exec_status_ != ExecuteStatus::kRunning ||
+        hot_->attempt_ >= static_cast<uint32_t>(retry_.max_attempts_) ||
+        !ShardManager::instance().owns(hot_->shard_)) {
+        return false;
+    }
+
+    int32_t delay = retry_.delay_ms(hot_->attempt_ + 1);
+    int next_interval = hot_->sch_timer_.next_interval();
+    if (next_interval > 0 && delay >= next_interval * 1000) {
+        HOT_LOG_NOTICE("job {} retry {} after {} ms overlaps next fire in {} secs, skip retry.",
+                       name_, hot_->attempt_ + 1, delay, next_interval);
+        return false;
+    }
+
+    if (!arm_trigger(delay)) {
+        return false;
+    }
+
+    ++hot_->attempt_;
+    ++retry_count_;
+    HOT_LOG_WARNING("job {} failed with {}, retry {}/{} after {} ms.",
+                    name_, code, hot_->attempt_, retry_.max_attempts_, delay);
+    return true;
+}
+
+bool JobInstance::arm_trigger(int32_t msec) {
+
+    if (hot_->exec_method_ != ExecuteMethod::kExecDefer && hot_->exec_method_ != ExecuteMethod::kExecAsync) {
+        roo::log_err("unknown exec_method: %d", static_cast<int32_t>(hot_->exec_method_));
+        return false;
+    }
+
+    hot_->due_us_ = FireTimer::instance().add(ref_, hot_->sched_gen_, msec);
+
+    hot_->armed_ = true;
+    hot_->timer_pending_ = true;
+    hot_->next_fire_ = Clock::instance().now() + (msec + 999) / 1000;
+    StateStore::instance().update(state_slot_, hot_->last_fire_, hot_->last_result_, hot_->next_fire_);
+
+    HOT_LOG_INFO("next trigger for {} success, with next_interval: {} msecs.", name_, msec);
+    return true;
+}
+
+
+// 定时器到期，按照当前的exec_method投递到对应的执行器，所以修改的
+// exec_method在下一次触发的时候生效
+void JobInstance::on_timer(uint64_t gen) {
+
+    enum ExecuteMethod method;
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        if (gen != hot_->sched_gen_) {
+            HOT_LOG_INFO("job {} drop stale timer, gen {} vs {}.", name_, gen, hot_->sched_gen_);
+            return;
+        }
+
+        hot_->timer_pending_ = false;
+        method = hot_->exec_method_;
+
+        // 隔离执行的任务在整个子进程执行期间阻塞调用线程，统一交给async
+        // 执行，不占用defer的执行线程
+        if (hot_->isolate_) {
+            method = ExecuteMethod::kExecAsync;
+        }
+
+        // 上一次触发还在执行队列中等待的，合并到那一次，不重复入队
+        if (!Clock::instance().is_virtual()) {
+            if (hot_->queued_ > 0 && JE_coalesce_task()) {
+                ++coalesce_count_;
+                HOT_LOG_INFO("job {} still queued, coalesce this fire.", name_);
+                return;
+            }
+            ++hot_->queued_;
+        }
+    }
+
+    // 虚拟时钟下在驱动线程中直接执行，下一次调度按照执行时的虚拟时间计算，
+    // 模拟的结果是确定的
+    if (Clock::instance().is_virtual()) {
+        (*this)();
+        return;
+    }
+
+    if (method == ExecuteMethod::kExecAsync) {
+        JE_add_task_async(ref_);
+    } else {
+        JE_add_task_defer(ref_);
+    }
+}
+
+void JobInstance::on_dropped() {
+
+    ++drop_count_;
+    HOT_LOG_WARNING("job {} dropped by full execute queue.", name_);
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    if (hot_->queued_ > 0) {
+        --hot_->queued_;
+    }
+
+    // 还有其他的调度在定时器中、队列中或者正在执行的，由它设置下一次调度
+    if (hot_->timer_pending_ || hot_->queued_ > 0 || hot_->slot_owner_ != 0) {
+        return;
+    }
+
+    hot_->armed_ = false;
+
+    if (hot_->exec_status_ == ExecuteStatus::kTerminating) {
+        HOT_LOG_NOTICE("marked job {} terminating, we will disabled it!", name_);
+        hot_->exec_status_ = ExecuteStatus::kDisabled;
+        return;
+    }
+
+    // 被丢弃的重试不再继续，等待正常的调度
+    hot_->attempt_ = 0;
+    next_trigger();
+}
+
+// 定时器只保存JobRef，到期的时候任务可能已经被删除
+void job_on_timer(JobRef ref, uint64_t gen) {
+
+    JobPin pin(ref);
+    if (JobInstance* inst = pin.get()) {
+        inst->on_timer(gen);
     } else {
-        roo::log_err("unknown exec_method: %d", static_cast<int32_t>(exec_method_));
+        HOT_LOG_INFO("drop timer for removed job, id {} gen {}.", ref.id_, ref.gen_);
+    }
+}
+
+
+bool JobInstance::check_timeout(time_t now) {
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+
+    if (timeout_sec_ <= 0 || hot_->slot_owner_ == 0 || now - hot_->slot_start_ < timeout_sec_) {
         return false;
     }
 
-    roo::log_info("next trigger for %s success, with next_interval: %d secs.",
-              name_.c_str(), next_interval);
+    roo::log_err("job %s run overrun %ld secs (timeout %d), request cancel and release schedule.",
+                 name_.c_str(), static_cast<long>(now - hot_->slot_start_), timeout_sec_);
+
+    ++timeout_count_;
+    hot_->cancel_seq_ = hot_->slot_owner_;
+
+    // 超时的执行不重试，直接等待下一次正常调度
+    hot_->slot_owner_ = 0;
+    hot_->armed_ = false;
+    hot_->attempt_ = 0;
+
+    // 暂停或者终止的任务，不再设置下一次调度
+    if (hot_->exec_status_ == ExecuteStatus::kTerminating) {
+        hot_->exec_status_ = ExecuteStatus::kDisabled;
+    } else if (hot_->exec_status_ == ExecuteStatus::kRunning) {
+        next_trigger();
+    }
+
     return true;
 }
 
 
+void JobInstance::shard_changed() {
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+
+    if (ShardManager::instance().owns(hot_->shard_)) {
+        if (!hot_->armed_ && hot_->exec_status_ == ExecuteStatus::kRunning) {
+            hot_->attempt_ = 0;
+            next_trigger();
+        }
+        return;
+    }
+
+    if (hot_->timer_pending_) {
+        ++hot_->sched_gen_;
+        hot_->timer_pending_ = false;
+        hot_->armed_ = false;
+        hot_->attempt_ = 0;
+        hot_->next_fire_ = 0;
+    }
+}
+
+
 void JobInstance::terminate() {
 
-    exec_status_ = ExecuteStatus::kTerminating;
-    if (timer_) {
-        timer_->revoke_timer();
-        timer_.reset();
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    hot_->exec_status_ = ExecuteStatus::kTerminating;
+    ++hot_->sched_gen_;
+    hot_->timer_pending_ = false;
+}
+
+bool JobInstance::cancel_requested() const {
+    return current_run_seq != 0 && current_run_seq <= hot_->cancel_seq_;
+}
+
+void JobInstance::cancel_running() {
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    hot_->cancel_seq_ = hot_->slot_seq_;
+}
+
+// 暂停的时候不撤销定时器，由已经设置的调度在触发时放弃执行，这样任何时刻
+// 最多只有一个调度存在，不会因为撤销和触发的竞争导致重复调度
+bool JobInstance::pause() {
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    if (hot_->exec_status_ != ExecuteStatus::kRunning) {
+        return false;
+    }
+
+    hot_->exec_status_ = ExecuteStatus::kPaused;
+    return true;
+}
+
+bool JobInstance::resume() {
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    if (hot_->exec_status_ != ExecuteStatus::kPaused) {
+        return false;
+    }
+
+    hot_->exec_status_ = ExecuteStatus::kRunning;
+
+    // 调度仍然存在的话，触发的时候会正常执行并设置下一次调度
+    if (hot_->armed_) {
+        return true;
     }
+
+    return next_trigger();
+}
+
+std::string JobInstance::stat_str() const {
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    const char* status = "unknown";
+    switch (hot_->exec_status_) {
+        case ExecuteStatus::kRunning:     status = "running"; break;
+        case ExecuteStatus::kTerminating: status = "terminating"; break;
+        case ExecuteStatus::kDisabled:    status = "disabled"; break;
+        case ExecuteStatus::kPaused:      status = "paused"; break;
+    }
+
+    std::stringstream ss;
+    ss << name_ << " status: " << status
+       << ", exec_method: " << (hot_->exec_method_ == ExecuteMethod::kExecAsync ? "async" : "defer")
+       << ", isolate: " << (hot_->isolate_ ? "true" : "false")
+       << ", shard: " << hot_->shard_ << (ShardManager::instance().owns(hot_->shard_) ? "" : "(standby)")
+       << ", sch_time: " << time_str_
+       << ", next_fire: " << static_cast<long>(hot_->next_fire_)
+       << ", last_fire: " << static_cast<long>(hot_->last_fire_)
+       << ", last_result: " << hot_->last_result_
+       << ", runs: " << run_count_
+       << ", fails: " << fail_count_
+       << ", timeout_sec: " << timeout_sec_
+       << ", timeouts: " << timeout_count_
+       << ", retry: " << hot_->attempt_ << "/" << retry_.max_attempts_
+       << ", retries: " << retry_count_
+       << ", drops: " << drop_count_
+       << ", coalesced: " << coalesce_count_
+       << ", in_flight: " << hot_->running_;
+
+    if (!builtin_func_ && !hot_->isolate_) {
+        ss << ", lazy: " << (lazy_ ? "true" : "false")
+           << ", so: " << (so_handler_ ? "loaded" : "unloaded")
+           << ", so_loads: " << load_stat_.loads_
+           << ", so_unloads: " << load_stat_.unloads_
+           << ", so_misses: " << load_stat_.misses_
+           << ", open_us: " << load_stat_.open_us_
+           << ", module_init_us: " << load_stat_.init_us_
+           << ", module_init_total_us: " << load_stat_.init_total_us_;
+    }
+
+    return ss.str();
+}
+
+
+std::shared_ptr<SoWrapperFunc> JobInstance::load_so(const std::string& path) {
+
+    auto handler = std::make_shared<SoWrapperFunc>(path);
+    if (!handler->init()) {
+        return std::shared_ptr<SoWrapperFunc>();
+    }
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    ++load_stat_.loads_;
+    load_stat_.open_us_ = handler->open_us();
+    load_stat_.init_us_ = handler->init_us();
+    load_stat_.init_total_us_ += handler->init_us();
+    load_stat_.loaded_at_ = Clock::instance().now();
+    return handler;
+}
+
+std::shared_ptr<SoWrapperFunc> JobInstance::lazy_load() {
+
+    std::lock_guard<std::mutex> load_lock(load_lock_);
+
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        if (so_handler_ || hot_->isolate_ || builtin_func_) {
+            prefetching_ = false;
+            return so_handler_;
+        }
+        path = so_path_;
+    }
+
+    auto handler = load_so(path);
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+    prefetching_ = false;
+    if (!handler) {
+        roo::log_err("lazy load so %s for job %s failed.", path.c_str(), name_.c_str());
+        return handler;
+    }
+
+    so_handler_ = handler;
+    HOT_LOG_INFO("lazy job {} loaded, dlopen {} us, module_init {} us.",
+                 name_, load_stat_.open_us_, load_stat_.init_us_);
+    return handler;
+}
+
+bool JobInstance::lazy_check(time_t now, int32_t prefetch_sec, int32_t idle_sec) {
+
+    // 释放的so在锁外析构，module_exit和dlclose不占用hot_->lock_
+    std::shared_ptr<SoWrapperFunc> retired;
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        if (!lazy_ || hot_->isolate_ || builtin_func_) {
+            return false;
+        }
+
+        // 已经触发还没有执行完的调度next_fire_在now之前，同样在窗口内
+        bool upcoming = hot_->next_fire_ > 0 && hot_->next_fire_ - now <= prefetch_sec;
+
+        if (!so_handler_) {
+            if (upcoming && !prefetching_ && hot_->exec_status_ == ExecuteStatus::kRunning) {
+                prefetching_ = true;
+                return true;
+            }
+            return false;
+        }
+
+        if (upcoming || hot_->running_ > 0 ||
+            now - std::max(hot_->last_fire_, load_stat_.loaded_at_) < idle_sec) {
+            return false;
+        }
+
+        retired.swap(so_handler_);
+        ++load_stat_.unloads_;
+        HOT_LOG_INFO("lazy job {} idle, unload {}.", name_, so_path_);
+    }
+
+    return false;
+}
+
+void JobInstance::unload() {
+
+    // 在锁外释放，执行中的调度持有自己的引用，最后一个引用释放的时候
+    // 才会module_exit和dlclose
+    std::shared_ptr<SoWrapperFunc> retired;
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+        retired.swap(so_handler_);
+    }
+}
+
+
+// 只应用发生变化的配置项，调度和执行中的任务不受影响：
+//  - sch_time变化，如果调度还在定时器中，撤销之后按照新的时间重新设置；
+//    已经在队列中或者执行中的，结束后按照新的时间设置下一次调度
+//  - exec_method变化，在下一次定时器触发的时候投递到新的执行器
+//  - so_path变化，先在锁外加载新的so，成功之后再替换，旧的so在最后
+//    一个执行中的引用释放之后才卸载
+bool JobInstance::update(const JobSpec& spec, const CronMask* sch) {
+
+    if (spec.name_ != name_ || is_builtin()) {
+        roo::log_err("job %s can not be updated with spec %s.", name_.c_str(), spec.name_.c_str());
+        return false;
+    }
+
+    if (spec.sch_time_.empty() || spec.so_path_.empty()) {
+        roo::log_err("job %s update param fast check failed.", name_.c_str());
+        return false;
+    }
+
+    // 和预取、按需加载互斥，期间so_path_和so_handler_只在这里修改
+    std::lock_guard<std::mutex> load_lock(load_lock_);
+
+    JobSpec current = this->spec();
+    if (current == spec) {
+        return true;
+    }
+
+    SchTime sch_timer;
+    if (sch) {
+        sch_timer = SchTime(*sch);
+    } else if (spec.sch_time_ != current.sch_time_ && !sch_timer.parse(spec.sch_time_)) {
+        roo::log_err("parse time setting failed %s.", spec.sch_time_.c_str());
+        return false;
+    }
+
+    if (spec.isolate_ && !IsolatedExecutor::instance().enabled()) {
+        roo::log_err("job %s marked isolate, but IsolatedExecutor not enabled.", name_.c_str());
+        return false;
+    }
+
+    // 切换到进程内执行，或者进程内执行的so_path变化，需要在本进程加载so；
+    // 切换到lazy模式的不加载，原来加载的so失效的时候直接释放
+    std::shared_ptr<SoWrapperFunc> handler;
+    bool stale = (spec.so_path_ != current.so_path_ || current.isolate_);
+    if (!spec.isolate_ && spec.lazy_ && ::access(spec.so_path_.c_str(), R_OK) != 0) {
+        roo::log_err("lazy job %s so %s not readable.", name_.c_str(), spec.so_path_.c_str());
+        return false;
+    }
+
+    if (!spec.isolate_ && !spec.lazy_) {
+        bool loaded = false;
+        {
+            std::lock_guard<std::mutex> lock(hot_->lock_);
+            loaded = !!so_handler_;
+        }
+
+        if (stale || !loaded) {
+            handler = load_so(spec.so_path_);
+            if (!handler) {
+                roo::log_err("load new so %s for job %s failed.", spec.so_path_.c_str(), name_.c_str());
+                return false;
+            }
+        }
+    }
+
+    // 替换下来的旧so，在锁外释放
+    std::shared_ptr<SoWrapperFunc> retired;
+    {
+        std::lock_guard<std::mutex> lock(hot_->lock_);
+
+        desc_ = spec.desc_;
+        hot_->exec_method_ = spec.exec_method_;
+        misfire_ = spec.misfire_;
+        timeout_sec_ = spec.timeout_sec_;
+        retry_ = spec.retry_;
+
+        if (handler || spec.isolate_ || (spec.lazy_ && stale)) {
+            retired.swap(so_handler_);
+            so_handler_ = handler;
+        }
+        so_path_ = spec.so_path_;
+        lazy_ = spec.lazy_;
+        hot_->isolate_ = spec.isolate_;
+
+        if (spec.sch_time_ != time_str_) {
+            time_str_ = spec.sch_time_;
+            hot_->sch_timer_ = sch_timer;
+
+            if (hot_->timer_pending_ && hot_->exec_status_ == ExecuteStatus::kRunning) {
+                ++hot_->sched_gen_;
+                hot_->timer_pending_ = false;
+                hot_->armed_ = false;
+                next_trigger();
+            }
+        }
+    }
+
+    roo::log_warning("job %s updated:\n%s", name_.c_str(), this->str().c_str());
+    return true;
+}
+
+JobSpec JobInstance::spec() const {
+
+    std::lock_guard<std::mutex> lock(hot_->lock_);
+
+    JobSpec spec;
+    spec.name_ = name_;
+    spec.desc_ = desc_;
+    spec.sch_time_ = time_str_;
+    spec.so_path_ = so_path_;
+    spec.exec_method_ = hot_->exec_method_;
+    spec.misfire_ = misfire_;
+    spec.isolate_ = hot_->isolate_;
+    spec.timeout_sec_ = timeout_sec_;
+    spec.retry_ = retry_;
+    spec.lazy_ = lazy_;
+    spec.enable_ = true;
+    return spec;
 }
 
 } // end namespace tzrpc
+
+
+// so查询本次执行是否已经被取消，隔离执行的时候由父进程通过共享内存设置
+extern "C" int job_cancel_requested(const msg_t* req) {
+
+    if (tzrpc::IsolatedExecutor::worker_cancel_requested()) {
+        return 1;
+    }
+
+    const tzrpc::JobInstance* inst = reinterpret_cast<const tzrpc::JobInstance*>(req);
+    return (inst && inst->cancel_requested()) ? 1 : 0;
+}
@@ -11,13 +11,29 @@
 #include <xtra_rhel.h>
 
 #include <bitset>
+#include <atomic>
+
+#include <boost/utility/string_ref.hpp>
 
 #include <concurrency/Timer.h>
 
+#include <gtest/gtest_prod.h>
+
 #include "SoWrapper.h"
+#include "CronLiteral.h"
+#include "RunHistory.h"
 
 namespace tzrpc {
 
+// sch_time解析失败的位置和原因
+struct SchError {
+    int32_t field_;         // 0 秒 1 分 2 时，-1 表示字段的个数不对
+    int32_t column_;        // 出错的位置，从0开始
+    const char* reason_;
+
+    std::string str() const;
+};
+
 // https://crontab.guru
 class SchTime {
 
@@ -26,7 +42,15 @@ public:
         sec_tp_(0), min_tp_(0), hour_tp_(0) {
     }
 
-    // 根据指定的时间设置字符串，解析出下面的interval point成员
+    // 编译期解析的结果，见CronLiteral.h
+    constexpr SchTime(const CronMask& mask) :
+        sec_tp_(mask.sec_), min_tp_(mask.min_), hour_tp_(mask.hour_) {
+    }
+
+    // 根据指定的时间设置字符串，解析出下面的interval point成员，
+    // 失败的时候原来的值保持不变
+    bool parse(boost::string_ref sch_str, SchError& error);
+    // 失败的时候输出日志
     bool parse(const std::string& sch_str);
 
     // 根据给定的时间，计算出下一个触发的时间间隔
@@ -35,6 +59,19 @@ public:
 
     std::string str() const;
 
+    // 解析之后的时间点，离线的分析工具直接按照位图计算触发
+    const std::bitset<60>& sec_points() const {
+        return sec_tp_;
+    }
+
+    const std::bitset<60>& min_points() const {
+        return min_tp_;
+    }
+
+    const std::bitset<24>& hour_points() const {
+        return hour_tp_;
+    }
+
 private:
 
     template<std::size_t N>
@@ -42,7 +79,8 @@ private:
 
     // 用来解析 时、分、秒的
     template<std::size_t N>
-    bool parse_subtime(const std::string& sch_str, std::bitset<N>& store);
+    bool parse_subtime(boost::string_ref str, size_t begin, size_t end, int32_t field,
+                       std::bitset<N>& store, SchError& error);
 
 
     // time_point
@@ -65,9 +103,184 @@ enum class ExecuteStatus : uint8_t {
     kRunning = 1,
     kTerminating = 2,
     kDisabled = 3,
+    kPaused = 4,
+};
+
+// 重启期间错过的触发如何处理
+enum class MisfirePolicy : uint8_t {
+    kMisfireSkip = 1,   // 直接跳过，等待下一次触发
+    kMisfireOnce = 2,   // 启动后立即补执行一次
+};
+
+// 执行失败(返回非0)之后的重试策略，重试的间隔按照指数退避
+//   backoff_ms_ * 2^(attempt-1)，不超过backoff_max_ms_
+// jitter_打开的时候在 [delay/2, delay] 之间随机，避免多个任务同时重试
+struct RetryPolicy {
+
+    int32_t max_attempts_;      // 最多重试的次数，0表示不重试
+    int32_t backoff_ms_;
+    int32_t backoff_max_ms_;
+    bool    jitter_;
+
+    RetryPolicy() :
+        max_attempts_(0),
+        backoff_ms_(1000),
+        backoff_max_ms_(60 * 1000),
+        jitter_(true) {
+    }
+
+    // 第attempt次重试之前的等待时间
+    int32_t delay_ms(uint32_t attempt) const;
+
+    bool operator==(const RetryPolicy& other) const {
+        return max_attempts_ == other.max_attempts_ && backoff_ms_ == other.backoff_ms_ &&
+               backoff_max_ms_ == other.backoff_max_ms_ && jitter_ == other.jitter_;
+    }
+};
+
+// 任务的配置信息，来自配置文件或者管理接口
+struct JobSpec {
+
+    std::string name_;
+    std::string desc_;
+    std::string sch_time_;
+    std::string so_path_;
+    enum ExecuteMethod exec_method_;
+    enum MisfirePolicy misfire_;
+    bool isolate_;      // 在独立的worker进程中执行，见IsolatedExecutor
+    int32_t timeout_sec_;   // 单次执行的超时时间，0表示不限制
+    RetryPolicy retry_;
+    bool lazy_;         // 调度前才加载so，空闲之后卸载，见JobInstance::lazy_check()
+    bool enable_;
+
+    JobSpec() :
+        exec_method_(ExecuteMethod::kExecDefer),
+        misfire_(MisfirePolicy::kMisfireSkip),
+        isolate_(false),
+        timeout_sec_(0),
+        lazy_(false),
+        enable_(true) {
+    }
+
+    bool operator==(const JobSpec& other) const {
+        return name_ == other.name_ && desc_ == other.desc_ &&
+               sch_time_ == other.sch_time_ && so_path_ == other.so_path_ &&
+               exec_method_ == other.exec_method_ && misfire_ == other.misfire_ &&
+               isolate_ == other.isolate_ && timeout_sec_ == other.timeout_sec_ &&
+               retry_ == other.retry_ && lazy_ == other.lazy_ && enable_ == other.enable_;
+    }
+
+    bool operator!=(const JobSpec& other) const {
+        return !(*this == other);
+    }
+};
+
+
+// 任务在JobSlab中的标识，id会被重用，gen_用来识别已经删除的任务。
+// 队列和定时器中只保存JobRef，不持有任务的引用
+struct JobRef {
+    uint32_t id_;
+    uint32_t gen_;
 };
 
-class JobInstance : public std::enable_shared_from_this<JobInstance> {
+// 定时器的回调，任务已经删除的时候丢弃
+void job_on_timer(JobRef ref, uint64_t gen);
+
+// 调度热路径上访问的状态，在JobSlab中按照cache line对齐连续存放，
+// 名字、描述、so路径等配置信息留在JobInstance中。
+// 除了原子变量，都由lock_保护
+struct JobHot {
+
+    std::mutex lock_;
+    enum ExecuteStatus exec_status_;
+    enum ExecuteMethod exec_method_; // defer async
+    bool isolate_;
+
+    // 是否存在已经设置的调度(定时器中、队列中或者正在执行)
+    bool armed_;
+
+    // 调度是否还在定时器中，以及定时器的代数，FireTimer中的项不能撤销，
+    // 重新调度的时候增加代数，过期的定时器回调会被丢弃
+    bool timer_pending_;
+    uint64_t sched_gen_;
+
+    // 调度的执行占用调度slot，超时之后watchdog把slot释放掉，
+    // 之后该执行结束的时候不再设置下一次调度。
+    // 每次执行以slot_seq_为序号，cancel_seq_是最近一次被取消的执行的序号，
+    // 序号不超过它的执行都已经被取消，之后新的执行不受影响
+    std::atomic<uint64_t> cancel_seq_;
+    uint64_t slot_seq_;
+    uint64_t slot_owner_;
+    time_t   slot_start_;
+
+    std::atomic<int32_t> running_;   // 正在执行的次数
+
+    // 手动触发的执行，和调度的执行互斥，同一个任务不会同时执行
+    bool manual_;
+
+    // 所属的分片，只有持有该分片的实例才执行，见ShardManager
+    uint32_t shard_;
+
+    // 当前调度是第几次重试，0表示正常的调度
+    uint32_t attempt_;
+
+    // 持久化的调度状态，见StateStore
+    time_t  last_fire_;
+    int32_t last_result_;
+    time_t  next_fire_;
+
+    // 当前调度在FireTimer中的到期时间，用于统计触发的延迟
+    int64_t due_us_;
+
+    // 已经投递到执行队列还没有开始执行的次数，见JobQueue的容量限制
+    int32_t queued_;
+
+    SchTime sch_timer_;              // 时间调度信息，解析后的结果
+
+    void reset(enum ExecuteMethod method, bool isolate) {
+        exec_status_ = ExecuteStatus::kRunning;
+        exec_method_ = method;
+        isolate_ = isolate;
+        armed_ = false;
+        timer_pending_ = false;
+        sched_gen_ = 0;
+        cancel_seq_ = 0;
+        slot_seq_ = 0;
+        slot_owner_ = 0;
+        slot_start_ = 0;
+        manual_ = false;
+        running_ = 0;
+        shard_ = 0;
+        attempt_ = 0;
+        last_fire_ = 0;
+        last_result_ = 0;
+        next_fire_ = 0;
+        due_us_ = 0;
+        queued_ = 0;
+        sch_timer_ = SchTime();
+    }
+};
+
+
+// so的加载统计，dlopen包括RTLD_NOW的符号解析，耗时的单位是微秒
+struct SoLoadStat {
+    uint64_t loads_;
+    uint64_t unloads_;          // lazy模式空闲之后的卸载
+    uint64_t misses_;           // lazy模式执行的时候还没有加载，预取没有覆盖到
+    int64_t  open_us_;          // 最近一次dlopen
+    int64_t  init_us_;          // 最近一次module_init
+    int64_t  init_total_us_;
+    time_t   loaded_at_;
+
+    SoLoadStat() :
+        loads_(0), unloads_(0), misses_(0),
+        open_us_(0), init_us_(0), init_total_us_(0),
+        loaded_at_(0) {
+    }
+};
+
+
+class JobInstance {
 
 public:
 
@@ -78,24 +291,113 @@ public:
         name_(name),
         desc_(desc),
         time_str_(time_str),
-        exec_method_(method),
+        precompiled_(false),
         so_path_(),
+        lazy_(false),
+        timeout_sec_(0),
+        retry_(),
         builtin_func_(func),
-        exec_status_(ExecuteStatus::kRunning),
-        sch_timer_() {
+        prefetching_(false),
+        misfire_(MisfirePolicy::kMisfireSkip),
+        state_slot_(-1),
+        catch_up_(false),
+        run_count_(0),
+        fail_count_(0),
+        timeout_count_(0),
+        retry_count_(0),
+        drop_count_(0),
+        coalesce_count_(0),
+        run_job_id_(0),
+        ref_(),
+        hot_(NULL) {
+        attach_slab(method, false);
     }
 
-    // so动态类型
+    // 内置类型，调度在编译期解析，init()的时候不再解析time_str_
     JobInstance(const std::string& name, const std::string& desc,
-                const std::string& time_str, const std::string& so_path,
+                const CronMask& sch, const std::function<int(JobInstance*)>& func,
                 enum ExecuteMethod method = ExecuteMethod::kExecDefer ):
         name_(name),
         desc_(desc),
-        time_str_(time_str),
-        exec_method_(method),
-        so_path_(so_path),
-        exec_status_(ExecuteStatus::kRunning),
-        sch_timer_() {
+        time_str_(sch.str_),
+        precompiled_(true),
+        so_path_(),
+        lazy_(false),
+        timeout_sec_(0),
+        retry_(),
+        builtin_func_(func),
+        prefetching_(false),
+        misfire_(MisfirePolicy::kMisfireSkip),
+        state_slot_(-1),
+        catch_up_(false),
+        run_count_(0),
+        fail_count_(0),
+        timeout_count_(0),
+        retry_count_(0),
+        drop_count_(0),
+        coalesce_count_(0),
+        run_job_id_(0),
+        ref_(),
+        hot_(NULL) {
+        attach_slab(method, false);
+        if (hot_) {
+            hot_->sch_timer_ = SchTime(sch);
+        }
+    }
+
+    // so动态类型
+    explicit JobInstance(const JobSpec& spec) :
+        name_(spec.name_),
+        desc_(spec.desc_),
+        time_str_(spec.sch_time_),
+        precompiled_(false),
+        so_path_(spec.so_path_),
+        lazy_(spec.lazy_),
+        timeout_sec_(spec.timeout_sec_),
+        retry_(spec.retry_),
+        prefetching_(false),
+        misfire_(spec.misfire_),
+        state_slot_(-1),
+        catch_up_(false),
+        run_count_(0),
+        fail_count_(0),
+        timeout_count_(0),
+        retry_count_(0),
+        drop_count_(0),
+        coalesce_count_(0),
+        run_job_id_(0),
+        ref_(),
+        hot_(NULL) {
+        attach_slab(spec.exec_method_, spec.isolate_);
+    }
+
+    // so动态类型，调度已经在JobManifest中预编译
+    JobInstance(const JobSpec& spec, const CronMask& sch) :
+        name_(spec.name_),
+        desc_(spec.desc_),
+        time_str_(spec.sch_time_),
+        precompiled_(true),
+        so_path_(spec.so_path_),
+        lazy_(spec.lazy_),
+        timeout_sec_(spec.timeout_sec_),
+        retry_(spec.retry_),
+        prefetching_(false),
+        misfire_(spec.misfire_),
+        state_slot_(-1),
+        catch_up_(false),
+        run_count_(0),
+        fail_count_(0),
+        timeout_count_(0),
+        retry_count_(0),
+        drop_count_(0),
+        coalesce_count_(0),
+        run_job_id_(0),
+        ref_(),
+        hot_(NULL) {
+        attach_slab(spec.exec_method_, spec.isolate_);
+        if (hot_) {
+            hot_->sch_timer_ = SchTime(sch);
+        }
     }
 
     ~JobInstance();
@@ -105,43 +407,165 @@ public:
     JobInstance& operator=(const JobInstance&) = delete;
 
 
+    // 独立使用(不经过JobExecutor注册)的任务，初始化之后直接设置第一次调度
     bool init();
+    // 加载so、恢复状态，但是不设置调度，注册到JobExecutor之后再调用start()，
+    // 这样定时器触发的时候任务一定已经可见。
+    // 失败的时候error中是失败的原因，批量加载的时候用于汇总
+    bool init(std::string& error);
+    bool start(std::string& error);
     int operator ()();
+    int run_once();
     bool next_trigger();
     void terminate();
 
+    bool pause();
+    bool resume();
+
+    // 释放so，执行中的调度持有自己的引用，最后一个引用释放的时候才会
+    // module_exit并dlclose，不需要等待任务执行结束
+    void unload();
+
+    // 运行时更新配置，只处理发生变化的部分：
+    // sch_time原地重新调度，exec_method在下次触发时生效，so_path热替换
+    // sch不为空的时候是预编译的调度，不再解析spec.sch_time_
+    bool update(const JobSpec& spec, const CronMask* sch = NULL);
+    JobSpec spec() const;
+
+    const std::string& name() const {
+        return name_;
+    }
+
+    const JobRef& ref() const {
+        return ref_;
+    }
+
     bool is_builtin() const {
         return !!builtin_func_;
     }
 
+    bool is_running() const {
+        return hot_ && hot_->running_ > 0;
+    }
+
+    uint32_t shard() const {
+        return hot_->shard_;
+    }
+
+    // 所属分片的归属发生变化，获得分片的时候立即设置调度，失去的时候撤销
+    // 还在定时器中的调度，已经在队列中或者执行中的结束之后不再设置下一次
+    void shard_changed();
+
+    // 由JobExecutor的定时器周期调用，调度的执行超过timeout_sec_之后设置取消
+    // 标志，并且释放调度：即使执行线程仍然阻塞，也会按时设置下一次调度。
+    // 返回true表示本次检查发现了新的超时
+    bool check_timeout(time_t now);
+
+    // 执行队列满的时候被丢弃的调度，相当于跳过这一次执行，设置下一次调度
+    void on_dropped();
+
+    // so通过job_cancel_requested()查询，只对调用线程上正在执行的那一次有效
+    bool cancel_requested() const;
+
+    // 请求取消当前所有正在执行的调度，删除任务的时候调用
+    void cancel_running();
+
+    // 本次执行对应调度的到期时间，时钟见FireTimer::now_us()
+    int64_t due_us() const {
+        return hot_->due_us_;
+    }
+
+    // 运行时的状态和统计信息
+    std::string stat_str() const;
+
+    // lazy模式的周期检查，由JobExecutor的定时器调用：
+    //  - 下一次调度在prefetch_sec之内还没有加载so的，返回true，调用者在
+    //    其他线程中调用lazy_load()，避免dlopen和module_init阻塞定时器
+    //  - 已经加载，距离上一次触发或者加载超过idle_sec，并且调度不在预取
+    //    窗口内的，释放so_handler_，最后一个执行中的引用释放之后module_exit
+    bool lazy_check(time_t now, int32_t prefetch_sec, int32_t idle_sec);
+
+    // 加载so并设置so_handler_，已经加载的直接返回
+    std::shared_ptr<SoWrapperFunc> lazy_load();
+
     std::string str() const {
+
+        if (!hot_) {
+            return "JobInstance: " + name_ + " (detached)";
+        }
+
+        std::lock_guard<std::mutex> lock(hot_->lock_);
         std::stringstream ss;
 
         ss << "JobInstance: " << name_ << std::endl
             << "desc: " << desc_ << ", "
             << "sch_time: " << time_str_ << ", "
-            << "exec_method: " << static_cast<int32_t>(exec_method_) << ", "
+            << "exec_method: " << static_cast<int32_t>(hot_->exec_method_) << ", "
             << "builtin: " << ( is_builtin()? "true" : "false" ) << ", "
+            << "isolate: " << ( hot_->isolate_ ? "true" : "false" ) << ", "
+            << "lazy: " << ( lazy_ ? "true" : "false" ) << ", "
             << "so_path: " << so_path_;
 
         return ss.str();
     }
 
 private:
-    // 原始配置参数
+    // 原始配置参数，除了name_之外都可以在运行时更新，由hot_->lock_保护
     const std::string name_;
-    const std::string desc_;
-    const std::string time_str_;
-
-    enum  ExecuteMethod exec_method_; // defer async
-    const std::string so_path_;
-    std::unique_ptr<SoWrapperFunc> so_handler_;
+    std::string desc_;
+    std::string time_str_;
+    bool precompiled_;      // hot_->sch_timer_已经在构造的时候设置
+
+    std::string so_path_;
+    bool lazy_;
+    int32_t timeout_sec_;
+    RetryPolicy retry_;
+    // 执行的时候持有一份引用，热替换后旧的so在执行结束后才卸载
+    // lazy模式下没有加载的时候为空
+    std::shared_ptr<SoWrapperFunc> so_handler_;
     std::function<int(JobInstance* inst)> builtin_func_;
 
-    enum ExecuteStatus exec_status_;
+    // 串行化so的加载和替换：预取、执行时的按需加载以及update()，
+    // dlopen和module_init在hot_->lock_之外进行
+    std::mutex load_lock_;
+    SoLoadStat load_stat_;
+    bool prefetching_;          // 已经交给其他线程加载，还没有完成
 
-    SchTime sch_timer_;              // 时间调度信息，解析后的结果
-    std::shared_ptr<roo::TimerObject> timer_;
+    // 加载so并记录耗时，失败的时候返回空
+    std::shared_ptr<SoWrapperFunc> load_so(const std::string& path);
+
+    // run_seq是本次执行的序号，用于判断是否被取消；
+    // manual是run_once()的手动触发，没有对应的调度，序号为0
+    int execute(uint32_t attempt, uint64_t run_seq, bool manual = false);
+
+    // 持久化的调度状态，见StateStore
+    enum MisfirePolicy misfire_;
+    int32_t state_slot_;
+    bool catch_up_;             // init()发现重启期间错过了触发，start()的时候补执行
+
+    bool arm_trigger(int32_t msec);
+    bool retry_trigger(int code);
+
+    friend void job_on_timer(JobRef ref, uint64_t gen);
+    void on_timer(uint64_t gen);
+
+    FRIEND_TEST(SimClockTest, CancelTokenTest);
+
+    std::atomic<uint64_t> run_count_;
+    std::atomic<uint64_t> fail_count_;
+    std::atomic<uint64_t> timeout_count_;
+    std::atomic<uint64_t> retry_count_;
+    std::atomic<uint64_t> drop_count_;      // 执行队列满被丢弃的调度
+    std::atomic<uint64_t> coalesce_count_;  // 合并到队列中等待的同一任务的调度
+
+    // 最近的执行记录，见RunHistory
+    uint32_t   run_job_id_;
+    JobRunRing run_ring_;
+
+    // 在JobSlab中分配热数据，Slab满的时候hot_为空，init()失败
+    void attach_slab(enum ExecuteMethod method, bool isolate);
+    JobRef  ref_;
+    JobHot* hot_;
 };
 
 } // end namespace tzrpc
@@ -0,0 +1,370 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include <other/Log.h>
+
+#include "JobManifest.h"
+
+namespace tzrpc {
+
+static const uint32_t kManifestMagic   = 0x4152474d; // ARGM
+static const uint32_t kManifestVersion = 1;
+
+struct ManifestHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    uint32_t count_;
+    uint32_t checksum_;       // 文件头之后所有内容的校验
+    uint64_t strings_size_;
+    uint64_t reserved_;
+};
+
+static_assert(sizeof(ManifestHeader) == 32, "ManifestHeader should be 32 bytes");
+
+static const uint64_t kSecMask  = (1ULL << 60) - 1;
+static const uint64_t kMinMask  = (1ULL << 60) - 1;
+static const uint64_t kHourMask = (1ULL << 24) - 1;
+
+
+// FNV-1a
+uint32_t JobManifest::checksum(const char* data, size_t len) {
+
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data);
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= ptr[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+bool JobManifest::open(const std::string& path) {
+
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        roo::log_err("open manifest %s failed: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        roo::log_err("fstat manifest %s failed: %s", path.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    if (static_cast<size_t>(st.st_size) < sizeof(ManifestHeader)) {
+        roo::log_err("manifest %s too small: %ld", path.c_str(), static_cast<long>(st.st_size));
+        ::close(fd);
+        return false;
+    }
+
+    // 映射之后文件描述符就不再需要了
+    void* addr = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        roo::log_err("mmap manifest %s with size %ld failed: %s",
+                     path.c_str(), static_cast<long>(st.st_size), strerror(errno));
+        return false;
+    }
+
+    map_addr_ = static_cast<char*>(addr);
+    map_size_ = st.st_size;
+
+    const ManifestHeader* header = reinterpret_cast<const ManifestHeader*>(map_addr_);
+    if (header->magic_ != kManifestMagic || header->version_ != kManifestVersion) {
+        roo::log_err("manifest %s magic/version mismatch: %#x, %u",
+                     path.c_str(), header->magic_, header->version_);
+        close();
+        return false;
+    }
+
+    size_t expect = sizeof(ManifestHeader) +
+                    static_cast<size_t>(header->count_) * sizeof(ManifestRecord) + header->strings_size_;
+    if (header->strings_size_ > map_size_ || expect != map_size_) {
+        roo::log_err("manifest %s size mismatch, expect %lu, real %lu (truncated?)",
+                     path.c_str(), static_cast<unsigned long>(expect), static_cast<unsigned long>(map_size_));
+        close();
+        return false;
+    }
+
+    if (checksum(map_addr_ + sizeof(ManifestHeader), map_size_ - sizeof(ManifestHeader)) != header->checksum_) {
+        roo::log_err("manifest %s checksum mismatch.", path.c_str());
+        close();
+        return false;
+    }
+
+    records_ = reinterpret_cast<const ManifestRecord*>(map_addr_ + sizeof(ManifestHeader));
+    count_ = header->count_;
+    strings_ = map_addr_ + sizeof(ManifestHeader) + count_ * sizeof(ManifestRecord);
+    strings_size_ = header->strings_size_;
+
+    if (!validate(path)) {
+        close();
+        return false;
+    }
+
+    roo::log_warning("manifest %s mapped, %u jobs, %lu bytes of strings.",
+                     path.c_str(), count_, static_cast<unsigned long>(strings_size_));
+    return true;
+}
+
+
+void JobManifest::close() {
+
+    if (map_addr_) {
+        ::munmap(map_addr_, map_size_);
+    }
+
+    map_addr_ = NULL;
+    map_size_ = 0;
+    records_ = NULL;
+    count_ = 0;
+    strings_ = NULL;
+    strings_size_ = 0;
+}
+
+
+bool JobManifest::valid_string(const ManifestString& str) const {
+    return static_cast<size_t>(str.offset_) + str.length_ < strings_size_ &&
+           strings_[str.offset_ + str.length_] == '\0';
+}
+
+// 校验通过之后job_at()不再做任何检查
+bool JobManifest::validate(const std::string& path) const {
+
+    for (uint32_t i = 0; i < count_; ++i) {
+
+        const ManifestRecord& record = records_[i];
+
+        if (!valid_string(record.name_) || !valid_string(record.desc_) ||
+            !valid_string(record.sch_time_) || !valid_string(record.so_path_)) {
+            roo::log_err("manifest %s record %u string out of range.", path.c_str(), i);
+            return false;
+        }
+
+        if (record.name_.length_ == 0 || record.sch_time_.length_ == 0) {
+            roo::log_err("manifest %s record %u without name or sch_time.", path.c_str(), i);
+            return false;
+        }
+
+        if (record.sec_ == 0 || (record.sec_ & ~kSecMask) ||
+            record.min_ == 0 || (record.min_ & ~kMinMask) ||
+            record.hour_ == 0 || (record.hour_ & ~kHourMask)) {
+            roo::log_err("manifest %s record %u invalid schedule mask.", path.c_str(), i);
+            return false;
+        }
+
+        if ((record.exec_method_ != static_cast<uint8_t>(ExecuteMethod::kExecDefer) &&
+             record.exec_method_ != static_cast<uint8_t>(ExecuteMethod::kExecAsync)) ||
+            (record.misfire_ != static_cast<uint8_t>(MisfirePolicy::kMisfireSkip) &&
+             record.misfire_ != static_cast<uint8_t>(MisfirePolicy::kMisfireOnce))) {
+            roo::log_err("manifest %s record %u invalid exec_method or misfire.", path.c_str(), i);
+            return false;
+        }
+
+        if (record.isolate_ > 1 || record.retry_jitter_ > 1 || record.enable_ > 1 || record.lazy_ > 1) {
+            roo::log_err("manifest %s record %u invalid flags.", path.c_str(), i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void JobManifest::job_at(uint32_t index, JobSpec& spec, CronMask& sch) const {
+
+    const ManifestRecord& record = records_[index];
+
+    spec.name_ = string_at(record.name_);
+    spec.desc_ = string_at(record.desc_);
+    spec.sch_time_ = string_at(record.sch_time_);
+    spec.so_path_ = string_at(record.so_path_);
+    spec.exec_method_ = static_cast<ExecuteMethod>(record.exec_method_);
+    spec.misfire_ = static_cast<MisfirePolicy>(record.misfire_);
+    spec.isolate_ = record.isolate_ != 0;
+    spec.timeout_sec_ = record.timeout_sec_;
+    spec.retry_.max_attempts_ = record.retry_max_;
+    spec.retry_.backoff_ms_ = record.retry_backoff_ms_;
+    spec.retry_.backoff_max_ms_ = record.retry_backoff_max_ms_;
+    spec.retry_.jitter_ = record.retry_jitter_ != 0;
+    spec.enable_ = record.enable_ != 0;
+    spec.lazy_ = record.lazy_ != 0;
+
+    sch.sec_ = record.sec_;
+    sch.min_ = record.min_;
+    sch.hour_ = record.hour_;
+    sch.str_ = strings_ + record.sch_time_.offset_;
+}
+
+
+// 相同的字符串(so_path、desc等)只保存一份
+class ManifestStrings {
+
+public:
+    ManifestStrings() {
+        // 偏移0留给空字符串
+        pool_.push_back('\0');
+        index_[std::string()] = 0;
+    }
+
+    ManifestString intern(const std::string& str) {
+
+        ManifestString result {};
+        result.length_ = static_cast<uint32_t>(str.size());
+
+        auto iter = index_.find(str);
+        if (iter != index_.end()) {
+            result.offset_ = iter->second;
+            return result;
+        }
+
+        result.offset_ = static_cast<uint32_t>(pool_.size());
+        pool_.append(str);
+        pool_.push_back('\0');
+        index_[str] = result.offset_;
+        return result;
+    }
+
+    const std::string& pool() const {
+        return pool_;
+    }
+
+private:
+    std::string pool_;
+    std::unordered_map<std::string, uint32_t> index_;
+};
+
+
+bool JobManifest::build(const std::vector<JobSpec>& specs, std::string& content) {
+
+    std::vector<ManifestRecord> records(specs.size());
+    ManifestStrings strings;
+    std::unordered_set<std::string> names;
+
+    for (size_t i = 0; i < specs.size(); ++i) {
+
+        const JobSpec& spec = specs[i];
+        if (spec.name_.empty() || !names.insert(spec.name_).second) {
+            roo::log_err("job #%lu name \"%s\" empty or duplicate.",
+                         static_cast<unsigned long>(i), spec.name_.c_str());
+            return false;
+        }
+
+        SchTime sch;
+        SchError error {};
+        if (!sch.parse(boost::string_ref(spec.sch_time_), error)) {
+            roo::log_err("job %s invalid sch_time \"%s\", %s",
+                         spec.name_.c_str(), spec.sch_time_.c_str(), error.str().c_str());
+            return false;
+        }
+
+        ManifestRecord& record = records[i];
+        record.sec_ = sch.sec_points().to_ullong();
+        record.min_ = sch.min_points().to_ullong();
+        record.hour_ = sch.hour_points().to_ullong();
+        record.name_ = strings.intern(spec.name_);
+        record.desc_ = strings.intern(spec.desc_);
+        record.sch_time_ = strings.intern(spec.sch_time_);
+        record.so_path_ = strings.intern(spec.so_path_);
+        record.timeout_sec_ = spec.timeout_sec_;
+        record.retry_max_ = spec.retry_.max_attempts_;
+        record.retry_backoff_ms_ = spec.retry_.backoff_ms_;
+        record.retry_backoff_max_ms_ = spec.retry_.backoff_max_ms_;
+        record.exec_method_ = static_cast<uint8_t>(spec.exec_method_);
+        record.misfire_ = static_cast<uint8_t>(spec.misfire_);
+        record.isolate_ = spec.isolate_ ? 1 : 0;
+        record.retry_jitter_ = spec.retry_.jitter_ ? 1 : 0;
+        record.enable_ = spec.enable_ ? 1 : 0;
+        record.lazy_ = spec.lazy_ ? 1 : 0;
+
+        if (strings.pool().size() > UINT32_MAX) {
+            roo::log_err("manifest string pool exceeds 4GB.");
+            return false;
+        }
+    }
+
+    ManifestHeader header {};
+    header.magic_ = kManifestMagic;
+    header.version_ = kManifestVersion;
+    header.count_ = static_cast<uint32_t>(records.size());
+    header.strings_size_ = strings.pool().size();
+
+    content.clear();
+    content.reserve(sizeof(ManifestHeader) + records.size() * sizeof(ManifestRecord) + strings.pool().size());
+    content.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!records.empty()) {
+        content.append(reinterpret_cast<const char*>(&records[0]), records.size() * sizeof(ManifestRecord));
+    }
+    content.append(strings.pool());
+
+    ManifestHeader* result = reinterpret_cast<ManifestHeader*>(&content[0]);
+    result->checksum_ = checksum(content.data() + sizeof(ManifestHeader), content.size() - sizeof(ManifestHeader));
+    return true;
+}
+
+
+bool JobManifest::write(const std::string& path, const std::vector<JobSpec>& specs) {
+
+    std::string content;
+    if (!build(specs, content)) {
+        return false;
+    }
+
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        roo::log_err("open %s failed: %s", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < content.size()) {
+        ssize_t ret = ::write(fd, content.data() + written, content.size() - written);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            roo::log_err("write %s failed: %s", tmp_path.c_str(), strerror(errno));
+            ::close(fd);
+            ::unlink(tmp_path.c_str());
+            return false;
+        }
+        written += ret;
+    }
+
+    bool synced = (::fsync(fd) == 0);
+    if (::close(fd) != 0 || !synced) {
+        roo::log_err("sync %s failed: %s", tmp_path.c_str(), strerror(errno));
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
+
+    // 正在映射旧文件的进程不受影响
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        roo::log_err("rename %s to %s failed: %s", tmp_path.c_str(), path.c_str(), strerror(errno));
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+} // end namespace tzrpc
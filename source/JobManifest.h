@@ -0,0 +1,120 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_JOB_MANIFEST_H__
+#define __TZSERIAL_JOB_MANIFEST_H__
+
+#include <xtra_rhel.h>
+
+#include "CronLiteral.h"
+#include "JobInstance.h"
+
+namespace tzrpc {
+
+// 预编译的二进制任务清单，代替配置文件中大量的so_handlers
+//
+// 文件由argus_manifest从libconfig格式的配置转换生成，sch_time已经编译成位图，
+// 字符串去重之后存放在字符串区，启动和reload的时候只读mmap，按照下标直接
+// 取出记录，不需要逐个字段lookupValue，也不需要再解析sch_time。
+//
+//   [ManifestHeader][ManifestRecord * count][字符串区，'\0'结尾]
+//
+// 替换清单需要写入新文件之后rename，不能原地截断重写，否则正在映射的进程
+// 访问的时候会收到SIGBUS。
+
+// 字符串区中的偏移和长度，不包含结尾的'\0'
+struct ManifestString {
+    uint32_t offset_;
+    uint32_t length_;
+};
+
+struct ManifestRecord {
+    uint64_t sec_;
+    uint64_t min_;
+    uint64_t hour_;
+
+    ManifestString name_;
+    ManifestString desc_;
+    ManifestString sch_time_;
+    ManifestString so_path_;
+
+    int32_t timeout_sec_;
+    int32_t retry_max_;
+    int32_t retry_backoff_ms_;
+    int32_t retry_backoff_max_ms_;
+
+    uint8_t exec_method_;
+    uint8_t misfire_;
+    uint8_t isolate_;
+    uint8_t retry_jitter_;
+    uint8_t enable_;
+    uint8_t lazy_;          // 旧版本的文件中为0，即启动时加载
+    uint8_t reserved_[2];
+};
+
+static_assert(sizeof(ManifestRecord) == 80, "ManifestRecord should be 80 bytes");
+
+
+class JobManifest {
+
+public:
+    JobManifest() :
+        map_addr_(NULL),
+        map_size_(0),
+        records_(NULL),
+        count_(0),
+        strings_(NULL),
+        strings_size_(0) {
+    }
+
+    ~JobManifest() {
+        close();
+    }
+
+    // 映射并校验整个文件，失败的时候不保留任何状态
+    bool open(const std::string& path);
+    void close();
+
+    uint32_t size() const {
+        return count_;
+    }
+
+    // 第index个任务，sch中的str_指向映射区域，只在close()之前有效
+    void job_at(uint32_t index, JobSpec& spec, CronMask& sch) const;
+
+    // 编译任务列表生成清单的内容，sch_time非法的时候返回false
+    static bool build(const std::vector<JobSpec>& specs, std::string& content);
+
+    // 写入临时文件后rename到path
+    static bool write(const std::string& path, const std::vector<JobSpec>& specs);
+
+private:
+
+    // 禁止拷贝
+    JobManifest(const JobManifest&) = delete;
+    JobManifest& operator=(const JobManifest&) = delete;
+
+    bool validate(const std::string& path) const;
+    static uint32_t checksum(const char* data, size_t len);
+    bool valid_string(const ManifestString& str) const;
+
+    std::string string_at(const ManifestString& str) const {
+        return std::string(strings_ + str.offset_, str.length_);
+    }
+
+    char* map_addr_;
+    size_t map_size_;
+
+    const ManifestRecord* records_;
+    uint32_t count_;
+    const char* strings_;
+    size_t strings_size_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_JOB_MANIFEST_H__
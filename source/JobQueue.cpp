@@ -0,0 +1,325 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "JobQueue.h"
+
+namespace tzrpc {
+
+JobQueue::~JobQueue() {
+
+    while (head_) {
+        JobQueueNode* node = head_;
+        head_ = node->next_;
+        pool().free(node);
+    }
+    tail_ = NULL;
+    size_ = 0;
+}
+
+JobQueueNode* JobQueue::append_locked(JobQueueNode* first, JobQueueNode* last, size_t count) {
+
+    JobQueueNode* dropped = NULL;
+
+    // 超出容量的新任务从链表中截下来，不入队
+    if (capacity_ && overflow_ == QueueOverflow::kRejectNew && size_ + count > capacity_) {
+        size_t admit = capacity_ > size_ ? capacity_ - size_ : 0;
+        if (admit == 0) {
+            return first;
+        }
+
+        last = first;
+        for (size_t i = 1; i < admit; ++i) {
+            last = last->next_;
+        }
+        dropped = last->next_;
+        last->next_ = NULL;
+        count = admit;
+    }
+
+    if (tail_) {
+        tail_->next_ = first;
+    } else {
+        head_ = first;
+    }
+    tail_ = last;
+    size_ += count;
+
+    // 先挤出本次入队的任务自己更早的调度，同一个任务只保留最新的触发，
+    // 不影响其他任务；剩余的超出部分再从队头挤出等待最久的任务
+    if (capacity_ && overflow_ == QueueOverflow::kDropOldest && size_ > capacity_) {
+        size_t evict = size_ - capacity_;
+        dropped = evict_same_job_locked(first, count, evict);
+        size_ -= evict;
+
+        if (evict) {
+            JobQueueNode* cut = head_;
+            for (size_t i = 1; i < evict; ++i) {
+                cut = cut->next_;
+            }
+            JobQueueNode* oldest = head_;
+            head_ = cut->next_;
+            cut->next_ = dropped;
+            dropped = oldest;
+            if (!head_) {
+                tail_ = NULL;
+            }
+        }
+    }
+
+    return dropped;
+}
+
+JobQueueNode* JobQueue::evict_same_job_locked(JobQueueNode* first, size_t count, size_t& evict) {
+
+    std::vector<uint64_t> keys;
+    keys.reserve(count);
+    for (JobQueueNode* node = first; node; node = node->next_) {
+        keys.push_back(job_key(node->ref_));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    JobQueueNode* dropped = NULL;
+    JobQueueNode* dropped_tail = NULL;
+    JobQueueNode* prev = NULL;
+    JobQueueNode* node = head_;
+
+    // 只在本次入队之前的节点中查找，从队头开始即从最早的调度开始
+    while (evict && node != first) {
+        JobQueueNode* next = node->next_;
+        if (!std::binary_search(keys.begin(), keys.end(), job_key(node->ref_))) {
+            prev = node;
+            node = next;
+            continue;
+        }
+
+        if (prev) {
+            prev->next_ = next;
+        } else {
+            head_ = next;
+        }
+
+        node->next_ = NULL;
+        if (dropped_tail) {
+            dropped_tail->next_ = node;
+        } else {
+            dropped = node;
+        }
+        dropped_tail = node;
+
+        --size_;
+        --evict;
+        node = next;
+    }
+
+    return dropped;
+}
+
+void JobQueue::drop(JobQueueNode* dropped, QueueDropHandler handler) {
+
+    while (dropped) {
+        JobQueueNode* node = dropped;
+        dropped = node->next_;
+        ++dropped_;
+        if (handler) {
+            handler(node->ref_);
+        }
+        pool().free(node);
+    }
+}
+
+void JobQueue::PUSH(const JobRef& ref) {
+
+    JobQueueNode* node = pool().alloc();
+    node->ref_ = ref;
+    node->next_ = NULL;
+
+    JobQueueNode* dropped = NULL;
+    QueueDropHandler handler = NULL;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        handler = drop_handler_;
+        dropped = append_locked(node, node, 1);
+    }
+
+    if (dropped != node) {
+        cond_.notify_one();
+    }
+    drop(dropped, handler);
+}
+
+bool JobQueue::POP(JobRef& ref, uint64_t msec, std::atomic<int32_t>* in_flight) {
+
+    JobQueueNode* node = NULL;
+
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        ++waiting_;
+        bool ready = cond_.wait_for(lock, std::chrono::milliseconds(msec), [this] { return head_ != NULL; });
+        --waiting_;
+        if (!ready) {
+            return false;
+        }
+
+        node = head_;
+        head_ = node->next_;
+        if (!head_) {
+            tail_ = NULL;
+        }
+        --size_;
+        if (in_flight) {
+            ++*in_flight;
+        }
+    }
+
+    ref = node->ref_;
+    pool().free(node);
+    return true;
+}
+
+void JobQueue::PUSH_BATCH(const JobRef* refs, size_t count) {
+
+    if (count == 0) {
+        return;
+    }
+
+    // 在锁外串成链表，加锁之后整体挂到队尾
+    JobQueueNode* first = NULL;
+    JobQueueNode* last = NULL;
+    for (size_t i = 0; i < count; ++i) {
+        JobQueueNode* node = pool().alloc();
+        node->ref_ = refs[i];
+        node->next_ = NULL;
+        if (last) {
+            last->next_ = node;
+        } else {
+            first = node;
+        }
+        last = node;
+    }
+
+    JobQueueNode* dropped = NULL;
+    QueueDropHandler handler = NULL;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        handler = drop_handler_;
+        dropped = append_locked(first, last, count);
+    }
+
+    if (count == 1) {
+        cond_.notify_one();
+    } else {
+        cond_.notify_all();
+    }
+    drop(dropped, handler);
+}
+
+size_t JobQueue::POP_BATCH(JobRef* refs, size_t max, uint64_t msec, std::atomic<int32_t>* in_flight) {
+
+    JobQueueNode* first = NULL;
+    size_t count = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        ++waiting_;
+        bool ready = cond_.wait_for(lock, std::chrono::milliseconds(msec), [this] { return head_ != NULL; });
+        --waiting_;
+        if (!ready) {
+            return 0;
+        }
+
+        // 已经被唤醒但是还没有拿到锁的线程仍然计入waiting_
+        size_t share = (size_ + waiting_) / (waiting_ + 1);
+        count = std::min(max, share);
+
+        first = head_;
+        JobQueueNode* last = head_;
+        for (size_t i = 1; i < count; ++i) {
+            last = last->next_;
+        }
+        head_ = last->next_;
+        if (!head_) {
+            tail_ = NULL;
+        }
+        size_ -= count;
+        if (in_flight) {
+            *in_flight += static_cast<int32_t>(count);
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        JobQueueNode* node = first;
+        first = node->next_;
+        refs[i] = node->ref_;
+        pool().free(node);
+    }
+
+    return count;
+}
+
+size_t JobQueue::HAND_BACK(const JobRef* refs, size_t count, std::atomic<int32_t>* in_flight) {
+
+    // 没有空闲线程的时候不加锁，执行线程每执行完一个任务都会检查一次
+    if (count == 0 || waiting_.load(std::memory_order_relaxed) == 0) {
+        return 0;
+    }
+
+    JobQueueNode* first = NULL;
+    JobQueueNode* last = NULL;
+    for (size_t i = 0; i < count; ++i) {
+        JobQueueNode* node = pool().alloc();
+        node->ref_ = refs[i];
+        node->next_ = NULL;
+        if (last) {
+            last->next_ = node;
+        } else {
+            first = node;
+        }
+        last = node;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        last->next_ = head_;
+        head_ = first;
+        if (!tail_) {
+            tail_ = last;
+        }
+        size_ += count;
+        if (in_flight) {
+            *in_flight -= static_cast<int32_t>(count);
+        }
+    }
+
+    if (count == 1) {
+        cond_.notify_one();
+    } else {
+        cond_.notify_all();
+    }
+    return count;
+}
+
+size_t JobQueue::SIZE() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return size_;
+}
+
+bool JobQueue::EMPTY() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return size_ == 0;
+}
+
+void JobQueue::set_limit(size_t capacity, QueueOverflow overflow, QueueDropHandler handler) {
+    std::lock_guard<std::mutex> lock(lock_);
+    capacity_ = capacity;
+    overflow_ = overflow;
+    drop_handler_ = handler;
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,124 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_JOB_QUEUE_H__
+#define __TZSERIAL_JOB_QUEUE_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+#include <condition_variable>
+
+#include "ObjectPool.h"
+#include "JobInstance.h"
+
+namespace tzrpc {
+
+struct JobQueueNode {
+    JobRef ref_;
+    JobQueueNode* next_;
+};
+
+// 队列满的时候的处理方式
+enum class QueueOverflow : uint8_t {
+    kRejectNew   = 0,   // 丢弃新入队的任务
+    kDropOldest  = 1,   // 新任务入队，优先丢弃同一任务更早的调度，没有的再丢弃等待最久的任务
+};
+
+// 没有入队或者被挤出队列的任务，在锁外回调，由调用者释放该次调度
+typedef void (*QueueDropHandler)(const JobRef& ref);
+
+// 调度队列，接口和roo::EQueue一致
+//
+// 链表节点从ObjectPool中分配，稳定之后入队出队都不再分配内存。
+// 节点的分配和回收都在锁外进行
+//
+// 同一时刻到期的大量任务通过PUSH_BATCH()一次加锁入队，执行线程通过
+// POP_BATCH()一次唤醒取出多个任务，减少加锁和条件变量唤醒的次数
+//
+// 设置了容量之后，超出的任务按照overflow策略丢弃并计数，交给drop_handler，
+// 下游故障期间积压的任务不会无限制的占用内存和增加延迟
+class JobQueue {
+
+public:
+    JobQueue() :
+        head_(NULL),
+        tail_(NULL),
+        size_(0),
+        waiting_(0),
+        capacity_(0),
+        overflow_(QueueOverflow::kDropOldest),
+        drop_handler_(NULL),
+        dropped_(0) {
+    }
+
+    ~JobQueue();
+
+    // 禁止拷贝
+    JobQueue(const JobQueue&) = delete;
+    JobQueue& operator=(const JobQueue&) = delete;
+
+    // in_flight不为空的时候，取出的个数在锁内计入，SIZE()和in_flight之和
+    // 在取出前后不会出现同时为0的空档，排空检查不会漏掉刚取出的任务
+    void PUSH(const JobRef& ref);
+    bool POP(JobRef& ref, uint64_t msec, std::atomic<int32_t>* in_flight = NULL);
+
+    void PUSH_BATCH(const JobRef* refs, size_t count);
+
+    // 最多取出max个，同时按照等待中的线程平分队列中的任务，避免一个线程
+    // 取走所有任务而其他线程空闲。返回取出的个数，超时返回0
+    size_t POP_BATCH(JobRef* refs, size_t max, uint64_t msec, std::atomic<int32_t>* in_flight = NULL);
+
+    // POP_BATCH()取出但是还没有开始执行的任务，有其他线程在等待的时候按照
+    // 原来的顺序放回队头，不受容量限制，in_flight在锁内扣除。返回放回的个数，
+    // 没有等待的线程的时候返回0，由调用者继续执行。慢任务不会拖住同一批的其他任务
+    size_t HAND_BACK(const JobRef* refs, size_t count, std::atomic<int32_t>* in_flight = NULL);
+
+    size_t SIZE();
+    bool EMPTY();
+
+    // capacity为0表示不限制，可以在运行期间修改，已经超出的部分不会立即丢弃
+    void set_limit(size_t capacity, QueueOverflow overflow, QueueDropHandler handler);
+
+    uint64_t dropped() const {
+        return dropped_;
+    }
+
+    static ObjectPool<JobQueueNode>& pool() {
+        return ObjectPool<JobQueueNode>::instance();
+    }
+
+private:
+    std::mutex lock_;
+    std::condition_variable cond_;
+
+    JobQueueNode* head_;
+    JobQueueNode* tail_;
+    size_t size_;
+    std::atomic<size_t> waiting_;    // 在cond_上等待的线程数，锁内修改
+
+    size_t capacity_;
+    QueueOverflow overflow_;
+    QueueDropHandler drop_handler_;
+    std::atomic<uint64_t> dropped_;
+
+    // 在锁内把first到last的count个节点挂到队尾，返回按照容量丢弃的节点链表
+    JobQueueNode* append_locked(JobQueueNode* first, JobQueueNode* last, size_t count);
+
+    // kDropOldest超出容量的时候，从队列中摘下first开始新入队的count个任务自己更早的
+    // 调度，最多evict个，evict扣除摘下的个数，返回摘下的节点链表
+    JobQueueNode* evict_same_job_locked(JobQueueNode* first, size_t count, size_t& evict);
+
+    static uint64_t job_key(const JobRef& ref) {
+        return (static_cast<uint64_t>(ref.id_) << 32) | ref.gen_;
+    }
+    void drop(JobQueueNode* dropped, QueueDropHandler handler);
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_JOB_QUEUE_H__
@@ -0,0 +1,121 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <other/Log.h>
+
+#include "JobSlab.h"
+
+namespace tzrpc {
+
+JobSlab& JobSlab::instance() {
+    static JobSlab helper;
+    return helper;
+}
+
+JobHot* JobSlab::alloc(JobInstance* inst, JobRef& ref) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    uint32_t id = 0;
+    if (!free_.empty()) {
+        id = free_.back();
+        free_.pop_back();
+    } else {
+
+        if (next_id_ >= kChunkSlots * kMaxChunks) {
+            roo::log_err("JobSlab exhausted, total %u slots.", next_id_);
+            return NULL;
+        }
+
+        id = next_id_;
+        uint32_t index = id >> kChunkShift;
+        if (!chunks_[index].load(std::memory_order_relaxed)) {
+
+            // 按照cache line对齐，new[]在C++11中不保证对齐
+            void* mem = NULL;
+            if (::posix_memalign(&mem, 64, sizeof(JobSlot) * kChunkSlots) != 0) {
+                roo::log_err("alloc JobSlab chunk %u failed.", index);
+                return NULL;
+            }
+
+            JobSlot* chunk = static_cast<JobSlot*>(mem);
+            for (uint32_t i = 0; i < kChunkSlots; ++i) {
+                new (chunk + i) JobSlot();
+                chunk[i].gen_ = 0;
+                chunk[i].pins_ = 0;
+                chunk[i].inst_ = NULL;
+            }
+            chunks_[index].store(chunk, std::memory_order_release);
+        }
+
+        ++next_id_;
+    }
+
+    JobSlot* item = slot(id);
+    item->inst_ = inst;
+    ref.id_ = id;
+    ref.gen_ = ++item->gen_;
+
+    ++used_;
+    return &item->hot_;
+}
+
+void JobSlab::release(const JobRef& ref) {
+
+    JobSlot* item = slot(ref.id_);
+    if (!item || item->gen_ != ref.gen_) {
+        return;
+    }
+
+    // 增加代数之后不会再有新的pin，等待已经持有的释放
+    ++item->gen_;
+    for (uint32_t loop = 0; item->pins_ != 0; ++loop) {
+        if (loop % 100 == 0) {
+            roo::log_notice("job slot %u still pinned by %d ...", ref.id_, static_cast<int>(item->pins_));
+        }
+        ::usleep(10 * 1000);
+    }
+
+    item->inst_ = NULL;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    free_.push_back(ref.id_);
+    --used_;
+}
+
+JobInstance* JobSlab::pin(const JobRef& ref) {
+
+    JobSlot* item = slot(ref.id_);
+    if (!item) {
+        return NULL;
+    }
+
+    // 和release()中的顺序相反：先增加pin再检查代数
+    ++item->pins_;
+    if (item->gen_ != ref.gen_) {
+        --item->pins_;
+        return NULL;
+    }
+
+    return item->inst_;
+}
+
+void JobSlab::unpin(const JobRef& ref) {
+    --slot(ref.id_)->pins_;
+}
+
+int32_t JobSlab::pins(const JobRef& ref) const {
+
+    JobSlot* item = slot(ref.id_);
+    if (!item || item->gen_ != ref.gen_) {
+        return 0;
+    }
+
+    return item->pins_;
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,121 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_JOB_SLAB_H__
+#define __TZSERIAL_JOB_SLAB_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+
+#include "JobInstance.h"
+
+namespace tzrpc {
+
+struct JobSlot {
+    std::atomic<uint32_t> gen_;
+    std::atomic<int32_t>  pins_;     // 正在使用该任务的调度线程数
+    JobInstance*          inst_;
+    JobHot                hot_;
+} __attribute__((aligned(64)));
+
+
+// 所有任务热数据的连续存储，按照job id索引
+//
+// 按块分配，已经分配的块不会移动，所以JobHot的指针一直有效，查找也不需要
+// 加锁。调度线程通过pin()/unpin()在执行期间保持任务不被删除，代替原来
+// weak_ptr::lock()的引用计数；删除的时候先增加代数，已经在队列中的JobRef
+// 之后都会失效，然后等待所有的pin释放。
+class JobSlab {
+
+public:
+    static JobSlab& instance();
+
+    // Slab满的时候返回NULL
+    JobHot* alloc(JobInstance* inst, JobRef& ref);
+    void release(const JobRef& ref);
+
+    // 任务已经删除的时候返回NULL
+    JobInstance* pin(const JobRef& ref);
+    void unpin(const JobRef& ref);
+
+    // 当前持有的pin数目，用于删除之前判断release()是否需要等待
+    int32_t pins(const JobRef& ref) const;
+
+    uint32_t size() const {
+        return used_;
+    }
+
+private:
+
+    JobSlab() :
+        next_id_(0),
+        used_(0) {
+        for (uint32_t i = 0; i < kMaxChunks; ++i) {
+            chunks_[i] = NULL;
+        }
+    }
+
+    ~JobSlab() { }
+
+    // 禁止拷贝
+    JobSlab(const JobSlab&) = delete;
+    JobSlab& operator=(const JobSlab&) = delete;
+
+    static const uint32_t kChunkShift = 8;
+    static const uint32_t kChunkSlots = 1u << kChunkShift;
+    static const uint32_t kMaxChunks  = 1024;
+
+    JobSlot* slot(uint32_t id) const {
+        if (id >= kChunkSlots * kMaxChunks) {
+            return NULL;
+        }
+        JobSlot* chunk = chunks_[id >> kChunkShift].load(std::memory_order_acquire);
+        return chunk ? chunk + (id & (kChunkSlots - 1)) : NULL;
+    }
+
+    std::atomic<JobSlot*> chunks_[kMaxChunks];
+
+    // 保护分配和回收
+    std::mutex lock_;
+    std::vector<uint32_t> free_;
+    uint32_t next_id_;
+    std::atomic<uint32_t> used_;
+};
+
+
+// 调度线程在执行期间持有
+class JobPin {
+
+public:
+    explicit JobPin(const JobRef& ref) :
+        ref_(ref),
+        inst_(JobSlab::instance().pin(ref)) {
+    }
+
+    ~JobPin() {
+        if (inst_) {
+            JobSlab::instance().unpin(ref_);
+        }
+    }
+
+    // 禁止拷贝
+    JobPin(const JobPin&) = delete;
+    JobPin& operator=(const JobPin&) = delete;
+
+    JobInstance* get() const {
+        return inst_;
+    }
+
+private:
+    JobRef ref_;
+    JobInstance* inst_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_JOB_SLAB_H__
@@ -0,0 +1,131 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_OBJECT_POOL_H__
+#define __TZSERIAL_OBJECT_POOL_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+
+namespace tzrpc {
+
+// 调度热路径上小对象的对象池
+//
+// 每个线程有自己的空闲列表，分配和回收都不需要加锁。空闲对象超过一定数量
+// 之后批量归还到全局列表，本地为空的时候从全局列表批量取回，所以在一个线程
+// 分配、另一个线程回收的场景(例如队列节点)也能达到稳定。只有全局列表也为空
+// 的时候才真正new，allocated()不再增长说明已经不需要分配内存了。
+//
+// 回收的对象不会析构，再次分配的时候由调用者重新设置所有的成员。
+template<typename T>
+class ObjectPool {
+
+public:
+    static ObjectPool& instance() {
+        // 线程退出的时候还需要归还对象，所以不析构
+        static ObjectPool* helper = new ObjectPool();
+        return *helper;
+    }
+
+    T* alloc() {
+
+        std::vector<T*>& items = local().items_;
+        if (items.empty()) {
+            refill(items);
+        }
+
+        if (!items.empty()) {
+            T* obj = items.back();
+            items.pop_back();
+            reused_.fetch_add(1, std::memory_order_relaxed);
+            return obj;
+        }
+
+        allocated_.fetch_add(1, std::memory_order_relaxed);
+        return new T();
+    }
+
+    void free(T* obj) {
+
+        std::vector<T*>& items = local().items_;
+        items.push_back(obj);
+        if (items.size() >= 2 * kBatch) {
+            recycle(items, kBatch);
+        }
+    }
+
+    // 真正分配内存的次数和复用的次数
+    uint64_t allocated() const {
+        return allocated_;
+    }
+
+    uint64_t reused() const {
+        return reused_;
+    }
+
+private:
+
+    ObjectPool() :
+        allocated_(0),
+        reused_(0) {
+    }
+
+    ~ObjectPool() { }
+
+    // 禁止拷贝
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    static const size_t kBatch = 16;
+
+    struct LocalCache {
+        std::vector<T*> items_;
+
+        LocalCache() {
+            items_.reserve(2 * kBatch);
+        }
+
+        ~LocalCache() {
+            ObjectPool::instance().recycle(items_, items_.size());
+        }
+    };
+
+    static LocalCache& local() {
+        static thread_local LocalCache cache;
+        return cache;
+    }
+
+    void refill(std::vector<T*>& items) {
+
+        std::lock_guard<std::mutex> lock(lock_);
+        size_t count = std::min(kBatch, global_.size());
+        items.insert(items.end(), global_.end() - count, global_.end());
+        global_.resize(global_.size() - count);
+    }
+
+    void recycle(std::vector<T*>& items, size_t count) {
+
+        std::lock_guard<std::mutex> lock(lock_);
+        global_.insert(global_.end(), items.end() - count, items.end());
+        items.resize(items.size() - count);
+    }
+
+    std::mutex lock_;
+    std::vector<T*> global_;
+
+    std::atomic<uint64_t> allocated_;
+    std::atomic<uint64_t> reused_;
+};
+
+// std::min按引用使用，需要类外的定义，否则-O0的时候链接失败
+template<typename T>
+const size_t ObjectPool<T>::kBatch;
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_OBJECT_POOL_H__
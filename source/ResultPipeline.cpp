@@ -0,0 +1,358 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <sstream>
+
+#include <other/Log.h>
+
+#include "ResultPipeline.h"
+
+namespace tzrpc {
+
+ResultPipeline& ResultPipeline::instance() {
+    static ResultPipeline helper;
+    return helper;
+}
+
+bool ResultPipeline::init(const libconfig::Config& conf) {
+
+    int flush_msec = 100;
+    int max_rsp_bytes = 4096;
+    conf.lookupValue("schedule.result_flush_msec", flush_msec);
+    conf.lookupValue("schedule.result_max_rsp_bytes", max_rsp_bytes);
+
+    if (!conf.exists("schedule.result_sinks") || conf.lookup("schedule.result_sinks").getLength() == 0) {
+        roo::log_warning("result_sinks not set, ResultPipeline disabled.");
+        return true;
+    }
+
+    if (flush_msec <= 0 || max_rsp_bytes < 0) {
+        roo::log_err("invalid result setting, flush_msec %d, max_rsp_bytes %d", flush_msec, max_rsp_bytes);
+        return false;
+    }
+
+    const libconfig::Setting& sinks = conf.lookup("schedule.result_sinks");
+    for (int i = 0; i < sinks.getLength(); ++i) {
+        std::shared_ptr<ResultSink> sink = ResultSink::create(sinks[i]);
+        if (!sink || !add_sink(sink)) {
+            roo::log_err("create result sink #%d failed.", i);
+            return false;
+        }
+    }
+
+    return start(flush_msec, static_cast<uint32_t>(max_rsp_bytes));
+}
+
+bool ResultPipeline::add_sink(const std::shared_ptr<ResultSink>& sink) {
+
+    if (running_) {
+        roo::log_err("ResultPipeline already started, can not add sink %s.", sink->name().c_str());
+        return false;
+    }
+
+    if (!sink->open()) {
+        roo::log_err("open result sink %s failed.", sink->name().c_str());
+        return false;
+    }
+
+    sinks_.push_back(sink);
+    return true;
+}
+
+bool ResultPipeline::start(int32_t flush_msec, uint32_t max_rsp_bytes) {
+
+    if (running_) {
+        roo::log_err("ResultPipeline already started.");
+        return false;
+    }
+
+    flush_msec_ = flush_msec;
+    max_rsp_bytes_ = max_rsp_bytes;
+
+    stop_ = false;
+    batch_.reserve(kResultRingSize * 4);
+    drain_thread_ = boost::thread(std::bind(&ResultPipeline::drain_run, this));
+    running_ = true;
+
+    roo::log_warning("ResultPipeline started with %d sinks, flush %d msec, max_rsp %u bytes.",
+                     static_cast<int>(sinks_.size()), flush_msec_, max_rsp_bytes_);
+    return true;
+}
+
+void ResultPipeline::stop() {
+
+    if (!running_) {
+        return;
+    }
+
+    // 之后提交的结果直接丢弃，等待已经看到running_的提交结束，最后一次取出
+    // 之后不会再有结果写入队列，见HotLog::stop()
+    running_ = false;
+
+    {
+        std::lock_guard<std::mutex> drain_lock(drain_lock_);
+        std::lock_guard<std::mutex> lock(lock_);
+        for (size_t i = 0; i < rings_.size(); ++i) {
+            while (rings_[i]->busy_) {
+                boost::this_thread::yield();
+            }
+        }
+    }
+
+    stop_ = true;
+    drain_thread_.join();
+
+    // 停止之前已经写入队列的结果
+    drain();
+
+    std::lock_guard<std::mutex> drain_lock(drain_lock_);
+    for (size_t i = 0; i < sinks_.size(); ++i) {
+        sinks_[i]->close();
+    }
+    sinks_.clear();
+}
+
+
+// 每个线程第一次提交结果的时候分配自己的队列，线程退出之后由后台线程在
+// 队列取空之后放到空闲列表中复用，同HotLog
+namespace {
+
+struct ResultRingHolder {
+
+    void* ring_;
+    std::atomic<bool>* closed_;
+
+    ResultRingHolder() :
+        ring_(NULL),
+        closed_(NULL) {
+    }
+
+    ~ResultRingHolder() {
+        if (closed_) {
+            closed_->store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ResultRingHolder ring_holder;
+
+} // end anonymous namespace
+
+ResultPipeline::ThreadRing* ResultPipeline::thread_ring() {
+
+    if (likely(ring_holder.ring_ != NULL)) {
+        return static_cast<ThreadRing*>(ring_holder.ring_);
+    }
+
+    ThreadRing* ring = NULL;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!free_rings_.empty()) {
+            ring = free_rings_.back();
+            free_rings_.pop_back();
+        } else {
+            ++ring_allocs_;
+        }
+    }
+
+    if (!ring) {
+        ring = new ThreadRing();
+    }
+
+    ring->ring_.reset();
+    ring->closed_ = false;
+    ring->busy_ = false;
+    ring->written_ = 0;
+    ring->dropped_ = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        rings_.push_back(ring);
+    }
+
+    ring_holder.ring_ = ring;
+    ring_holder.closed_ = &ring->closed_;
+    return ring;
+}
+
+void ResultPipeline::submit(JobResult& result) {
+
+    if (!running_) {
+        ::free(result.rsp_);
+        result.rsp_ = NULL;
+        return;
+    }
+
+    // 超长的响应原地缩小，队列中缓存的内存有上限
+    if (result.rsp_len_ > max_rsp_bytes_) {
+        char* shrunk = max_rsp_bytes_ ? static_cast<char*>(::realloc(result.rsp_, max_rsp_bytes_)) : NULL;
+        if (!shrunk) {
+            ::free(result.rsp_);
+        }
+        result.rsp_ = shrunk;
+        result.rsp_len_ = shrunk ? max_rsp_bytes_ : 0;
+        result.flags_ |= kResultTruncated;
+    }
+
+    // 先标记busy_再检查running_，和stop()中的顺序相反
+    ThreadRing* ring = thread_ring();
+    ring->busy_ = true;
+    if (unlikely(!running_)) {
+        ring->busy_ = false;
+        ::free(result.rsp_);
+        result.rsp_ = NULL;
+        return;
+    }
+
+    if (likely(ring->ring_.push(result))) {
+        ring->written_.store(ring->written_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    } else {
+        ring->dropped_.store(ring->dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        ::free(result.rsp_);
+    }
+    ring->busy_.store(false, std::memory_order_release);
+    result.rsp_ = NULL;
+}
+
+
+void ResultPipeline::drain_run() {
+
+    while (!stop_) {
+        // 队列中积压较多的时候立即再取一次，否则攒一段时间成批输出
+        if (drain() < kResultRingSize / 2) {
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(flush_msec_));
+        }
+    }
+}
+
+size_t ResultPipeline::drain() {
+
+    std::lock_guard<std::mutex> drain_lock(drain_lock_);
+
+    std::vector<ThreadRing*> rings;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        rings = rings_;
+    }
+
+    // 取出之前已经关闭的队列，线程的所有写入都在关闭之前，本轮取空之后可以回收
+    std::vector<bool> closed(rings.size(), false);
+    for (size_t i = 0; i < rings.size(); ++i) {
+        closed[i] = rings[i]->closed_.load(std::memory_order_acquire);
+    }
+
+    batch_.clear();
+    JobResult result;
+    for (size_t i = 0; i < rings.size(); ++i) {
+        while (rings[i]->ring_.pop(result)) {
+            batch_.push_back(result);
+        }
+    }
+
+    if (!batch_.empty()) {
+
+        // 本批次内多个线程的结果按照结束的时间输出
+        std::stable_sort(batch_.begin(), batch_.end(),
+                         [](const JobResult& a, const JobResult& b) {
+                             return a.end_us_ < b.end_us_;
+                         });
+
+        for (size_t i = 0; i < sinks_.size(); ++i) {
+            if (sinks_[i]->write(&batch_[0], batch_.size())) {
+                sinks_[i]->written_ += batch_.size();
+            } else {
+                sinks_[i]->failed_ += batch_.size();
+            }
+        }
+
+        for (size_t i = 0; i < batch_.size(); ++i) {
+            ::free(batch_[i].rsp_);
+        }
+        drained_ += batch_.size();
+    }
+
+    for (size_t i = 0; i < rings.size(); ++i) {
+        if (!closed[i]) {
+            continue;
+        }
+
+        // 关闭之后不会再有写入，残留的结果只释放响应
+        while (rings[i]->ring_.pop(result)) {
+            ::free(result.rsp_);
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        rings_.erase(std::find(rings_.begin(), rings_.end(), rings[i]));
+        retired_written_ += rings[i]->written_;
+        retired_dropped_ += rings[i]->dropped_;
+        if (free_rings_.size() < kResultFreeRings) {
+            free_rings_.push_back(rings[i]);
+        } else {
+            delete rings[i];
+        }
+    }
+
+    return batch_.size();
+}
+
+uint64_t ResultPipeline::dropped() {
+
+    std::lock_guard<std::mutex> lock(lock_);
+    uint64_t dropped = retired_dropped_;
+    for (size_t i = 0; i < rings_.size(); ++i) {
+        dropped += rings_[i]->dropped_;
+    }
+    return dropped;
+}
+
+
+int ResultPipeline::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "Argus";
+    name = "ResultPipeline";
+
+    uint64_t written = 0;
+    uint64_t dropped = 0;
+    size_t count = 0;
+    size_t free_count = 0;
+    uint64_t allocs = 0;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        written = retired_written_;
+        dropped = retired_dropped_;
+        for (size_t i = 0; i < rings_.size(); ++i) {
+            written += rings_[i]->written_;
+            dropped += rings_[i]->dropped_;
+        }
+        count = rings_.size();
+        free_count = free_rings_.size();
+        allocs = ring_allocs_;
+    }
+
+    // stop()会清空sinks_，取一份快照再输出
+    std::vector<std::shared_ptr<ResultSink>> sinks;
+    {
+        std::lock_guard<std::mutex> drain_lock(drain_lock_);
+        sinks = sinks_;
+    }
+
+    std::stringstream ss;
+    ss << "rings: " << count << ", free: " << free_count << ", allocated: " << allocs
+       << ", submitted: " << written
+       << ", drained: " << drained_ << ", dropped: " << dropped << std::endl;
+
+    for (size_t i = 0; i < sinks.size(); ++i) {
+        ss << "sink " << sinks[i]->name() << ", written: " << sinks[i]->written_
+           << ", failed: " << sinks[i]->failed_ << std::endl;
+    }
+
+    val = ss.str();
+    return 0;
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,127 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_RESULT_PIPELINE_H__
+#define __TZSERIAL_RESULT_PIPELINE_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <libconfig/libconfig.h++>
+
+#include "ShmRing.h"
+#include "ResultSink.h"
+
+namespace tzrpc {
+
+static const size_t kResultRingSize = 1024;    // 每个执行线程缓存的结果数
+static const size_t kResultFreeRings = 32;     // 保留的已回收队列数
+
+// 任务执行结果的输出
+//
+// 执行线程把返回值、响应和耗时写入本线程的环形队列，不加锁、不等待输出；
+// 后台线程每隔result_flush_msec把所有队列取空，同一批内按照结束时间排序
+// 之后整批交给每个ResultSink，再释放响应的内存；不同批次之间不保证顺序。
+// 队列满的时候丢弃并计数，输出端变慢或者失败只会丢结果，不会阻塞任务的执行。
+//
+//   schedule.result_sinks = ( { type = "file"; path = "./argus_result.log"; },
+//                             { type = "unix"; path = "./argus_result.sock"; },
+//                             { type = "stdout"; } );
+class ResultPipeline {
+
+public:
+    static ResultPipeline& instance();
+
+    // 没有配置result_sinks的时候不启用，enabled()返回false
+    bool init(const libconfig::Config& conf);
+
+    // 输出端需要在start()之前注册
+    bool add_sink(const std::shared_ptr<ResultSink>& sink);
+    bool start(int32_t flush_msec, uint32_t max_rsp_bytes);
+
+    // 输出所有缓存的结果并关闭输出端，之后提交的结果直接丢弃
+    void stop();
+
+    bool enabled() const {
+        return running_.load(std::memory_order_relaxed);
+    }
+
+    // 执行线程调用，result.rsp_的所有权转移给ResultPipeline
+    void submit(JobResult& result);
+
+    // 取出所有队列中的结果并输出，返回输出的条数
+    size_t drain();
+
+    uint64_t dropped();
+    uint64_t drained() const {
+        return drained_;
+    }
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+private:
+
+    ResultPipeline() :
+        running_(false),
+        stop_(false),
+        flush_msec_(100),
+        max_rsp_bytes_(4096),
+        ring_allocs_(0),
+        retired_written_(0),
+        retired_dropped_(0),
+        drained_(0) {
+    }
+
+    ~ResultPipeline() {
+        for (size_t i = 0; i < free_rings_.size(); ++i) {
+            delete free_rings_[i];
+        }
+    }
+
+    // 禁止拷贝
+    ResultPipeline(const ResultPipeline&) = delete;
+    ResultPipeline& operator=(const ResultPipeline&) = delete;
+
+    struct ThreadRing {
+        ShmRing<JobResult, kResultRingSize> ring_;
+        std::atomic<bool>     closed_;      // 所属线程已经退出
+        std::atomic<bool>     busy_;        // 所属线程正在提交，stop()等待提交结束
+        std::atomic<uint64_t> written_;
+        std::atomic<uint64_t> dropped_;
+    };
+
+    ThreadRing* thread_ring();
+    void drain_run();
+
+    std::atomic<bool> running_;
+    std::atomic<bool> stop_;
+    int32_t  flush_msec_;
+    uint32_t max_rsp_bytes_;
+    boost::thread drain_thread_;
+
+    // 运行期间在drain_lock_内使用
+    std::vector<std::shared_ptr<ResultSink>> sinks_;
+
+    std::mutex lock_;
+    std::vector<ThreadRing*> rings_;
+    std::vector<ThreadRing*> free_rings_;   // 线程退出之后取空的队列，新线程优先复用
+    uint64_t ring_allocs_;
+    uint64_t retired_written_;
+    uint64_t retired_dropped_;
+
+    // drain()可能被后台线程和stop()同时调用
+    std::mutex drain_lock_;
+    std::vector<JobResult> batch_;
+    std::atomic<uint64_t> drained_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_RESULT_PIPELINE_H__
@@ -0,0 +1,264 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <other/Log.h>
+
+#include "ResultSink.h"
+
+namespace tzrpc {
+
+// unix socket写入的超时，超时之后丢弃这一批，不长时间阻塞结果线程
+static const int32_t kUnixSinkTimeoutMsec = 100;
+
+static void append_escaped(std::string& line, const char* data, size_t len) {
+
+    static const char kHex[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        switch (c) {
+            case '"':  line.append("\\\""); break;
+            case '\\': line.append("\\\\"); break;
+            case '\n': line.append("\\n"); break;
+            case '\r': line.append("\\r"); break;
+            case '\t': line.append("\\t"); break;
+            default:
+                if (c < 0x20 || c == 0x7f) {
+                    line.append("\\u00");
+                    line.push_back(kHex[c >> 4]);
+                    line.push_back(kHex[c & 0x0f]);
+                } else {
+                    line.push_back(static_cast<char>(c));
+                }
+        }
+    }
+}
+
+void format_result(const JobResult& result, std::string& line) {
+
+    char buf[256];
+    line.append("{\"job\":\"");
+    append_escaped(line, result.name_, ::strnlen(result.name_, kResultNameMax));
+    ::snprintf(buf, sizeof(buf),
+               "\",\"code\":%d,\"attempt\":%u,\"start_us\":%lld,\"end_us\":%lld,\"lag_us\":%lld,"
+               "\"manual\":%s,\"timed_out\":%s,\"truncated\":%s,\"rsp\":\"",
+               result.code_, result.attempt_,
+               static_cast<long long>(result.start_us_), static_cast<long long>(result.end_us_),
+               static_cast<long long>(result.lag_us_),
+               (result.flags_ & kResultManual) ? "true" : "false",
+               (result.flags_ & kResultTimedOut) ? "true" : "false",
+               (result.flags_ & kResultTruncated) ? "true" : "false");
+    line.append(buf);
+    if (result.rsp_) {
+        append_escaped(line, result.rsp_, result.rsp_len_);
+    }
+    line.append("\"}");
+}
+
+static void format_batch(const JobResult* results, size_t count, std::string& buffer) {
+
+    buffer.clear();
+    for (size_t i = 0; i < count; ++i) {
+        format_result(results[i], buffer);
+        buffer.push_back('\n');
+    }
+}
+
+
+std::shared_ptr<ResultSink> ResultSink::create(const libconfig::Setting& setting) {
+
+    std::string type;
+    std::string path;
+    int rotate_mb = 64;
+    int max_files = 5;
+    setting.lookupValue("type", type);
+    setting.lookupValue("path", path);
+    setting.lookupValue("rotate_mb", rotate_mb);
+    setting.lookupValue("max_files", max_files);
+
+    if (type == "stdout") {
+        return std::make_shared<StdoutResultSink>();
+    }
+
+    if (path.empty()) {
+        roo::log_err("result sink %s without path.", type.c_str());
+        return std::shared_ptr<ResultSink>();
+    }
+
+    if (type == "file") {
+        if (rotate_mb <= 0 || max_files <= 0) {
+            roo::log_err("invalid file result sink setting, rotate_mb %d, max_files %d", rotate_mb, max_files);
+            return std::shared_ptr<ResultSink>();
+        }
+        return std::make_shared<FileResultSink>(path, static_cast<int64_t>(rotate_mb) * 1024 * 1024, max_files);
+    }
+
+    if (type == "unix") {
+        if (path.size() >= sizeof(static_cast<struct sockaddr_un*>(NULL)->sun_path)) {
+            roo::log_err("unix result sink path too long: %s", path.c_str());
+            return std::shared_ptr<ResultSink>();
+        }
+        return std::make_shared<UnixResultSink>(path);
+    }
+
+    roo::log_err("unknown result sink type: %s", type.c_str());
+    return std::shared_ptr<ResultSink>();
+}
+
+
+bool FileResultSink::open() {
+
+    fp_ = ::fopen(path_.c_str(), "a");
+    if (!fp_) {
+        roo::log_err("open result file %s failed: %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st {};
+    size_ = (::fstat(::fileno(fp_), &st) == 0) ? st.st_size : 0;
+    return true;
+}
+
+void FileResultSink::close() {
+
+    if (fp_) {
+        ::fclose(fp_);
+        fp_ = NULL;
+    }
+}
+
+bool FileResultSink::rotate() {
+
+    close();
+
+    for (int32_t i = max_files_ - 1; i >= 1; --i) {
+        std::string from = path_ + "." + std::to_string(static_cast<long long>(i));
+        std::string to = path_ + "." + std::to_string(static_cast<long long>(i + 1));
+        ::rename(from.c_str(), to.c_str());
+    }
+    ::rename(path_.c_str(), (path_ + ".1").c_str());
+
+    return open();
+}
+
+bool FileResultSink::write(const JobResult* results, size_t count) {
+
+    if (!fp_ && !open()) {
+        return false;
+    }
+
+    format_batch(results, count, buffer_);
+
+    if (size_ > 0 && size_ + static_cast<int64_t>(buffer_.size()) > rotate_bytes_ && !rotate()) {
+        return false;
+    }
+
+    if (::fwrite(buffer_.data(), 1, buffer_.size(), fp_) != buffer_.size() || ::fflush(fp_) != 0) {
+        roo::log_err("write result file %s failed: %s", path_.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+
+    size_ += buffer_.size();
+    return true;
+}
+
+
+bool UnixResultSink::open() {
+
+    // 采集程序可能晚于服务启动，连接失败不影响初始化
+    if (!connect()) {
+        roo::log_warning("result sink %s not connected yet.", path_.c_str());
+    }
+    return true;
+}
+
+void UnixResultSink::close() {
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool UnixResultSink::connect() {
+
+    last_connect_ = ::time(NULL);
+
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        roo::log_err("create unix socket failed: %s", strerror(errno));
+        return false;
+    }
+
+    struct timeval tv {};
+    tv.tv_sec = kUnixSinkTimeoutMsec / 1000;
+    tv.tv_usec = (kUnixSinkTimeoutMsec % 1000) * 1000;
+    ::setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    ::strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close();
+        return false;
+    }
+
+    roo::log_notice("result sink connected to %s.", path_.c_str());
+    return true;
+}
+
+bool UnixResultSink::write(const JobResult* results, size_t count) {
+
+    if (fd_ < 0) {
+        if (::time(NULL) == last_connect_ || !connect()) {
+            return false;
+        }
+    }
+
+    format_batch(results, count, buffer_);
+
+    // 写入一部分之后超时的，断开连接，接收端不会收到不完整的行之后的内容
+    size_t offset = 0;
+    while (offset < buffer_.size()) {
+        ssize_t len = ::send(fd_, buffer_.data() + offset, buffer_.size() - offset, MSG_NOSIGNAL);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            roo::log_err("write result to %s failed: %s", path_.c_str(), strerror(errno));
+            close();
+            return false;
+        }
+        offset += len;
+    }
+
+    return true;
+}
+
+
+bool StdoutResultSink::write(const JobResult* results, size_t count) {
+
+    format_batch(results, count, buffer_);
+    if (::fwrite(buffer_.data(), 1, buffer_.size(), stdout) != buffer_.size()) {
+        return false;
+    }
+    ::fflush(stdout);
+    return true;
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,171 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_RESULT_SINK_H__
+#define __TZSERIAL_RESULT_SINK_H__
+
+#include <xtra_rhel.h>
+
+#include <cstdio>
+#include <atomic>
+#include <memory>
+
+#include <libconfig/libconfig.h++>
+
+namespace tzrpc {
+
+static const size_t kResultNameMax = 64;
+
+enum ResultFlags : uint32_t {
+    kResultTimedOut  = 0x01,    // 执行超过了timeout_sec，同kRunTimedOut
+    kResultTruncated = 0x02,    // 响应超过result_max_rsp_bytes被截断
+    kResultIsolated  = 0x04,    // 隔离执行，没有响应内容
+    kResultManual    = 0x08,    // 手动触发，没有对应的调度
+};
+
+// 单次执行的结果，固定大小，在执行线程和结果线程之间按值传递。
+// rsp_由so通过fill_msg()分配，所有权随结果一起转移，写入sink之后释放
+struct JobResult {
+    int64_t  lag_us_;           // 开始执行比调度的到期时间晚了多久
+    int64_t  start_us_;
+    int64_t  end_us_;
+    int32_t  code_;
+    uint32_t attempt_;
+    uint32_t flags_;
+    uint32_t rsp_len_;
+    char*    rsp_;
+    char     name_[kResultNameMax];     // 超长的任务名被截断
+};
+
+// 结果输出的一行JSON，响应中的控制字符和引号转义，不以'\n'结尾
+void format_result(const JobResult& result, std::string& line);
+
+
+// 结果的输出端，由ResultPipeline的后台线程调用，不需要是线程安全的。
+// 新的输出端继承之后通过ResultPipeline::add_sink()注册
+class ResultSink {
+
+public:
+    explicit ResultSink(const std::string& name) :
+        name_(name),
+        written_(0),
+        failed_(0) {
+    }
+
+    virtual ~ResultSink() { }
+
+    // 禁止拷贝
+    ResultSink(const ResultSink&) = delete;
+    ResultSink& operator=(const ResultSink&) = delete;
+
+    virtual bool open() = 0;
+    virtual void close() { }
+
+    // 一批结果，返回false的时候这一批被丢弃，下一批继续尝试
+    virtual bool write(const JobResult* results, size_t count) = 0;
+
+    const std::string& name() const {
+        return name_;
+    }
+
+    // 根据配置中的type创建内置的输出端：file、unix、stdout
+    static std::shared_ptr<ResultSink> create(const libconfig::Setting& setting);
+
+private:
+    friend class ResultPipeline;
+
+    std::string name_;
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> failed_;
+};
+
+
+// 本地文件，一行一个结果。超过rotate_bytes之后依次重命名为path.1 ... path.N，
+// 最多保留max_files个历史文件
+class FileResultSink : public ResultSink {
+
+public:
+    FileResultSink(const std::string& path, int64_t rotate_bytes, int32_t max_files) :
+        ResultSink("file:" + path),
+        path_(path),
+        rotate_bytes_(rotate_bytes),
+        max_files_(max_files),
+        fp_(NULL),
+        size_(0) {
+    }
+
+    ~FileResultSink() {
+        close();
+    }
+
+    virtual bool open();
+    virtual void close();
+    virtual bool write(const JobResult* results, size_t count);
+
+private:
+    bool rotate();
+
+    const std::string path_;
+    const int64_t rotate_bytes_;
+    const int32_t max_files_;
+
+    FILE* fp_;
+    int64_t size_;
+    std::string buffer_;
+};
+
+
+// Unix domain stream socket，一行一个结果，由本机的采集程序监听。
+// 连接失败或者写入超时的时候丢弃这一批并断开，之后每秒最多重连一次
+class UnixResultSink : public ResultSink {
+
+public:
+    explicit UnixResultSink(const std::string& path) :
+        ResultSink("unix:" + path),
+        path_(path),
+        fd_(-1),
+        last_connect_(0) {
+    }
+
+    ~UnixResultSink() {
+        close();
+    }
+
+    virtual bool open();
+    virtual void close();
+    virtual bool write(const JobResult* results, size_t count);
+
+private:
+    bool connect();
+
+    const std::string path_;
+    int fd_;
+    time_t last_connect_;
+    std::string buffer_;
+};
+
+
+class StdoutResultSink : public ResultSink {
+
+public:
+    StdoutResultSink() :
+        ResultSink("stdout") {
+    }
+
+    virtual bool open() {
+        return true;
+    }
+
+    virtual bool write(const JobResult* results, size_t count);
+
+private:
+    std::string buffer_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_RESULT_SINK_H__
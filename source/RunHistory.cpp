@@ -0,0 +1,181 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/time.h>
+
+#include <algorithm>
+
+#include <other/Log.h>
+
+#include "RunHistory.h"
+
+namespace tzrpc {
+
+
+RunHistory& RunHistory::instance() {
+    static RunHistory history;
+    return history;
+}
+
+int64_t RunHistory::now_us() {
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return static_cast<int64_t>(tv.tv_sec) * 1000 * 1000 + tv.tv_usec;
+}
+
+
+uint32_t RunHistory::register_job(const std::string& name, const JobRunRing* ring) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+    purge_retired();
+
+    uint32_t job_id = next_job_id_++;
+    jobs_[job_id] = JobEntry { name, ring };
+
+    // 同名的任务重新注册(比如卸载后重新加载)，查询按照最新的实例
+    names_[name] = job_id;
+    return job_id;
+}
+
+void RunHistory::unregister_job(uint32_t job_id) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    auto iter = jobs_.find(job_id);
+    if (iter == jobs_.end()) {
+        return;
+    }
+
+    // 名字仍然保留，全局索引中的记录还可以显示名字
+    iter->second.ring_ = NULL;
+
+    auto name_iter = names_.find(iter->second.name_);
+    if (name_iter != names_.end() && name_iter->second == job_id) {
+        names_.erase(name_iter);
+    }
+
+    retired_.push_back(std::make_pair(global_.total(), job_id));
+    purge_retired();
+}
+
+// 调用者需要持有lock_
+void RunHistory::purge_retired() {
+
+    uint64_t total = global_.total();
+    while (!retired_.empty() && total - retired_.front().first >= kGlobalRunHistorySize) {
+        jobs_.erase(retired_.front().second);
+        retired_.pop_front();
+    }
+}
+
+
+// 调用者需要持有lock_
+void RunHistory::dump_records(const RunRecord* records, const uint32_t* tags, size_t count,
+                              const std::string& job, std::stringstream& ss) {
+
+    for (size_t i = 0; i < count; ++i) {
+
+        const RunRecord& record = records[i];
+
+        std::string name = job;
+        if (tags) {
+            auto iter = jobs_.find(tags[i]);
+            name = (iter != jobs_.end()) ? iter->second.name_ : "<unknown>";
+        }
+
+        time_t start_sec = static_cast<time_t>(record.start_us_ / (1000 * 1000));
+        struct tm tm_time;
+        localtime_r(&start_sec, &tm_time);
+        char start_str[32] {};
+        std::strftime(start_str, sizeof(start_str), "%F %T", &tm_time);
+
+        char line[256] {};
+        snprintf(line, sizeof(line), "%s start: %s.%06ld, cost: %ld us, code: %d, attempt: %u, thread: %#lx%s",
+                 name.c_str(), start_str, static_cast<long>(record.start_us_ % (1000 * 1000)),
+                 static_cast<long>(record.end_us_ - record.start_us_), record.code_,
+                 record.attempt_, static_cast<unsigned long>(record.thread_id_),
+                 (record.flags_ & kRunTimedOut) ? ", timeout" : "");
+        ss << line << std::endl;
+    }
+}
+
+
+bool RunHistory::query(const std::string& cmd, std::string& output) {
+
+    std::vector<std::string> vec {};
+    boost::split(vec, cmd, boost::is_any_of(" \t\r\n"), boost::token_compress_on);
+    for (auto iter = vec.begin(); iter != vec.end();) {
+        if (iter->empty()) {
+            iter = vec.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+
+    std::string job;
+    int count = 0;
+    if (vec.size() == 3 && vec[0] == "runs" && vec[1] == "last") {
+        count = ::atoi(vec[2].c_str());
+    } else if (vec.size() == 4 && vec[0] == "runs" && vec[2] == "last") {
+        job = vec[1];
+        count = ::atoi(vec[3].c_str());
+    } else {
+        output = "usage: runs <job> last <N> | runs last <N>\n";
+        return false;
+    }
+
+    if (count <= 0) {
+        output = "invalid count: " + cmd + "\n";
+        return false;
+    }
+
+    std::stringstream ss;
+    std::lock_guard<std::mutex> lock(lock_);
+
+    if (job.empty()) {
+
+        size_t max = std::min(static_cast<size_t>(count), kGlobalRunHistorySize);
+        std::vector<RunRecord> records(max);
+        std::vector<uint32_t> tags(max);
+
+        size_t got = global_.snapshot(records.data(), tags.data(), max);
+        ss << "total runs: " << global_.total() << ", recent " << got << ":" << std::endl;
+        dump_records(records.data(), tags.data(), got, "", ss);
+
+    } else {
+
+        auto iter = names_.find(job);
+        if (iter == names_.end() || !jobs_[iter->second].ring_) {
+            output = "job " + job + " not found.\n";
+            return false;
+        }
+
+        const JobRunRing* ring = jobs_[iter->second].ring_;
+
+        size_t max = std::min(static_cast<size_t>(count), kJobRunHistorySize);
+        std::vector<RunRecord> records(max);
+
+        size_t got = ring->snapshot(records.data(), NULL, max);
+        ss << job << " total runs: " << ring->total() << ", recent " << got << ":" << std::endl;
+        dump_records(records.data(), NULL, got, job, ss);
+    }
+
+    output = ss.str();
+    return true;
+}
+
+
+int RunHistory::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "Argus";
+    name = "RunHistory";
+
+    query("runs last 10", val);
+    return 0;
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,185 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_RUN_HISTORY_H__
+#define __TZSERIAL_RUN_HISTORY_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+
+namespace tzrpc {
+
+enum RunFlags : uint32_t {
+    kRunTimedOut = 0x01,    // 执行超过了timeout_sec，被请求取消
+};
+
+// 单次执行的记录，固定大小，记录的时候不会分配内存
+struct RunRecord {
+
+    int64_t  start_us_;
+    int64_t  end_us_;
+    int32_t  code_;
+    uint32_t attempt_;
+    uint64_t thread_id_;
+    uint32_t flags_;
+};
+
+
+// 固定大小的环形缓冲，无锁写入，查询的时候通过每个slot的序号校验
+// 读取的记录是否完整 (seqlock)，写入中或者被覆盖的记录直接跳过
+template<size_t N>
+class RunRingBuffer {
+
+public:
+    RunRingBuffer() :
+        head_(0) {
+        for (size_t i = 0; i < N; ++i) {
+            slots_[i].seq_ = 0;
+        }
+    }
+
+    // 禁止拷贝
+    RunRingBuffer(const RunRingBuffer&) = delete;
+    RunRingBuffer& operator=(const RunRingBuffer&) = delete;
+
+    void push(const RunRecord& record, uint32_t tag = 0) {
+
+        uint64_t idx = head_.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = slots_[idx % N];
+
+        slot.seq_.store(2 * idx + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.record_ = record;
+        slot.tag_ = tag;
+
+        slot.seq_.store(2 * idx + 2, std::memory_order_release);
+    }
+
+    // 从新到旧取出最多max条记录，返回实际取到的数目
+    size_t snapshot(RunRecord* records, uint32_t* tags, size_t max) const {
+
+        uint64_t head = head_.load(std::memory_order_acquire);
+        uint64_t count = head < N ? head : N;
+
+        size_t got = 0;
+        for (uint64_t i = 0; i < count && got < max; ++i) {
+
+            uint64_t idx = head - 1 - i;
+            const Slot& slot = slots_[idx % N];
+
+            uint64_t seq = slot.seq_.load(std::memory_order_acquire);
+            if (seq != 2 * idx + 2) {
+                continue;
+            }
+
+            RunRecord record = slot.record_;
+            uint32_t tag = slot.tag_;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq_.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+
+            records[got] = record;
+            if (tags) {
+                tags[got] = tag;
+            }
+            ++got;
+        }
+
+        return got;
+    }
+
+    uint64_t total() const {
+        return head_.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    struct Slot {
+        std::atomic<uint64_t> seq_;
+        RunRecord record_;
+        uint32_t  tag_;
+    };
+
+    std::atomic<uint64_t> head_;
+    Slot slots_[N];
+};
+
+
+// 每个任务保留最近的执行记录
+static const size_t kJobRunHistorySize = 32;
+// 全局按照完成时间排序的索引
+static const size_t kGlobalRunHistorySize = 4096;
+
+typedef RunRingBuffer<kJobRunHistorySize> JobRunRing;
+
+
+class RunHistory {
+
+public:
+    static RunHistory& instance();
+
+    // 注册和注销只在任务加载、卸载的时候调用，可以分配内存
+    uint32_t register_job(const std::string& name, const JobRunRing* ring);
+    void unregister_job(uint32_t job_id);
+
+    // 执行路径上调用，不分配内存、不加锁
+    void record(uint32_t job_id, JobRunRing& ring, const RunRecord& record) {
+        ring.push(record);
+        global_.push(record, job_id);
+    }
+
+    // 支持的命令
+    //   runs <job> last <N>   某个任务最近的N次执行
+    //   runs last <N>         所有任务最近的N次执行，按照完成时间倒序
+    bool query(const std::string& cmd, std::string& output);
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+    static int64_t now_us();
+
+private:
+
+    RunHistory() :
+        next_job_id_(1) {
+    }
+
+    ~RunHistory() { }
+
+    // 禁止拷贝
+    RunHistory(const RunHistory&) = delete;
+    RunHistory& operator=(const RunHistory&) = delete;
+
+    struct JobEntry {
+        std::string name_;
+        const JobRunRing* ring_;
+    };
+
+    void dump_records(const RunRecord* records, const uint32_t* tags, size_t count,
+                      const std::string& job, std::stringstream& ss);
+
+    std::mutex lock_;
+    uint32_t next_job_id_;
+    std::unordered_map<uint32_t, JobEntry> jobs_;
+    std::unordered_map<std::string, uint32_t> names_;
+
+    // 已经注销的任务，等到全局索引中引用它的记录都被覆盖之后再删除名字
+    std::deque<std::pair<uint64_t, uint32_t>> retired_;
+    void purge_retired();
+
+    // 只保存job_id，查询的时候再转换成名字
+    RunRingBuffer<kGlobalRunHistorySize> global_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_RUN_HISTORY_H__
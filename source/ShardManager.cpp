@@ -0,0 +1,323 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <other/Log.h>
+
+#include <concurrency/Timer.h>
+#include <scaffold/Status.h>
+
+#include "Coordinator.h"
+#include "ShardManager.h"
+#include "JobExecutor.h"
+
+#include "Captain.h"
+
+namespace tzrpc {
+
+static const uint32_t kMaxShardCount = 1024;
+
+ShardManager& ShardManager::instance() {
+    static ShardManager helper;
+    return helper;
+}
+
+// FNV-1a，最后再做一次混合，相近的字符串(虚拟节点)在环上也能分散开
+uint32_t ShardManager::hash(const std::string& str) {
+
+    uint32_t val = 2166136261u;
+    for (size_t i = 0; i < str.size(); ++i) {
+        val ^= static_cast<uint8_t>(str[i]);
+        val *= 16777619u;
+    }
+
+    val ^= val >> 16;
+    val *= 0x85ebca6bu;
+    val ^= val >> 13;
+    val *= 0xc2b2ae35u;
+    val ^= val >> 16;
+    return val;
+}
+
+static uint32_t shard_key(uint32_t shard) {
+    return ShardManager::hash("shard." + std::to_string(static_cast<unsigned long long>(shard)));
+}
+
+
+void HashRing::reset(const std::vector<std::string>& nodes) {
+
+    ring_.clear();
+    ring_.reserve(nodes.size() * vnodes_);
+
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (uint32_t j = 0; j < vnodes_; ++j) {
+            std::string vnode = nodes[i] + "#" + std::to_string(static_cast<unsigned long long>(j));
+            ring_.push_back(std::make_pair(ShardManager::hash(vnode), nodes[i]));
+        }
+    }
+
+    // hash值相同的时候按照成员名排序，保证所有实例得到同样的环
+    std::sort(ring_.begin(), ring_.end());
+}
+
+std::string HashRing::locate(uint32_t key) const {
+
+    if (ring_.empty()) {
+        return "";
+    }
+
+    auto iter = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(key, std::string()));
+    if (iter == ring_.end()) {
+        iter = ring_.begin();
+    }
+
+    return iter->second;
+}
+
+uint32_t ShardManager::shard_of(const std::string& name) const {
+    return hash(name) % shard_count_;
+}
+
+bool ShardManager::init(const libconfig::Config& conf) {
+
+    std::string backend;
+    std::string coord_dir = "./argus.coord";
+    int shard_count = 64;
+
+    conf.lookupValue("schedule.coordinator", backend);
+    conf.lookupValue("schedule.coord_dir", coord_dir);
+    conf.lookupValue("schedule.shard_count", shard_count);
+    conf.lookupValue("schedule.instance_id", self_);
+    conf.lookupValue("schedule.rebalance_msec", rebalance_msec_);
+
+    if (shard_count <= 0 || shard_count > static_cast<int>(kMaxShardCount)) {
+        roo::log_err("invalid shard_count setting: %d", shard_count);
+        return false;
+    }
+
+    if (rebalance_msec_ <= 0) {
+        roo::log_err("invalid rebalance_msec setting: %d", rebalance_msec_);
+        return false;
+    }
+
+    shard_count_ = static_cast<uint32_t>(shard_count);
+    owned_.reset(new std::atomic<bool>[shard_count_]);
+
+    if (self_.empty()) {
+        char host[256] {};
+        ::gethostname(host, sizeof(host) - 1);
+        self_ = std::string(host) + ":" + std::to_string(static_cast<long long>(::getpid()));
+    }
+
+    if (backend.empty()) {
+        for (uint32_t i = 0; i < shard_count_; ++i) {
+            owned_[i] = true;
+        }
+        roo::log_warning("ShardManager standalone mode, owns all %u shards.", shard_count_);
+        return true;
+    }
+
+    for (uint32_t i = 0; i < shard_count_; ++i) {
+        owned_[i] = false;
+    }
+
+    if (backend == "local") {
+        coordinator_ = std::make_shared<LocalCoordinator>(coord_dir, self_);
+    }
+#ifdef WITH_ZOOKEEPER
+    else if (backend == "zookeeper") {
+        coordinator_ = std::make_shared<ZkCoordinator>(Captain::instance().zk_frame_,
+                                                       "bankpay", "argus_service");
+    }
+#endif // WITH_ZOOKEEPER
+    else {
+        roo::log_err("unsupported coordinator backend: %s", backend.c_str());
+        return false;
+    }
+
+    if (!coordinator_ || !coordinator_->init()) {
+        roo::log_err("create and init coordinator %s failed.", backend.c_str());
+        return false;
+    }
+
+    // 首次分配同步完成，这样任务加载之后立即知道自己是否持有
+    rebalance();
+
+    rebalance_timer_ = Captain::instance().timer_ptr_->add_better_timer(
+                       std::bind(&ShardManager::rebalance, this), rebalance_msec_, true);
+    if (!rebalance_timer_) {
+        roo::log_err("create shard rebalance timer failed.");
+        return false;
+    }
+
+    Captain::instance().status_ptr_->attach_status_callback(
+        "ShardManager",
+        std::bind(&ShardManager::module_status, this,
+                  std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+    roo::log_warning("ShardManager init with %s backend, self %s, shard_count %u.",
+                     coordinator_->backend().c_str(), self_.c_str(), shard_count_);
+    return true;
+}
+
+
+// 分片的归属由一致性hash决定，所有实例看到同样的成员列表就会得到同样的
+// 分配结果。新分配给自己的分片可能还没有被原来的持有者释放，获取失败的
+// 在下一轮继续尝试。不支持成员管理的后端按照抢占的方式获取所有空闲的分片
+void ShardManager::rebalance() {
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!coordinator_ || stopped_) {
+        return;
+    }
+
+    // 节点被禁用的时候放弃所有的分片
+    std::vector<bool> target(shard_count_, false);
+    std::vector<std::string> nodes;
+    if (Captain::instance().running() && coordinator_->join()) {
+        if (coordinator_->members(nodes) && !nodes.empty()) {
+            ring_.reset(nodes);
+            for (uint32_t i = 0; i < shard_count_; ++i) {
+                target[i] = (ring_.locate(shard_key(i)) == self_);
+            }
+        } else {
+            target.assign(shard_count_, true);
+        }
+    } else {
+        // 退出成员列表，其他实例不再为自己分配分片
+        coordinator_->leave();
+        coordinator_->members(nodes);
+    }
+    members_.swap(nodes);
+
+    std::vector<uint32_t> changed;
+    std::vector<uint32_t> dropped;
+    for (uint32_t i = 0; i < shard_count_; ++i) {
+
+        if (owned_[i] && !target[i]) {
+            owned_[i] = false;
+            dropped.push_back(i);
+            changed.push_back(i);
+            ++released_;
+            roo::log_warning("ShardManager release shard %u.", i);
+        } else if (owned_[i]) {
+            // 重新确认已经持有的分片，会话过期等原因丢失的需要立即停止调度
+            if (!coordinator_->try_acquire(i)) {
+                owned_[i] = false;
+                changed.push_back(i);
+                ++lost_;
+                roo::log_err("ShardManager lost shard %u.", i);
+            }
+        } else if (target[i] && coordinator_->try_acquire(i)) {
+            owned_[i] = true;
+            changed.push_back(i);
+            ++acquired_;
+            roo::log_warning("ShardManager acquire shard %u.", i);
+        }
+    }
+
+    // 先撤销本地的定时器再释放分片锁，接管的实例不会和这里重复触发
+    if (!changed.empty()) {
+        JobExecutor::instance().shards_changed(changed);
+    }
+
+    for (size_t i = 0; i < dropped.size(); ++i) {
+        coordinator_->release(dropped[i]);
+    }
+}
+
+// 单机模式下没有分片锁，直接切换所有分片的归属；多实例的时候standby
+// 需要释放分片锁，由rebalance()完成
+void ShardManager::leadership_changed() {
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (stopped_) {
+            return;
+        }
+
+        if (!coordinator_) {
+            bool running = Captain::instance().running();
+            std::vector<uint32_t> changed;
+            for (uint32_t i = 0; i < shard_count_; ++i) {
+                if (owned_[i] != running) {
+                    owned_[i] = running;
+                    changed.push_back(i);
+                }
+            }
+
+            if (!changed.empty()) {
+                JobExecutor::instance().shards_changed(changed);
+            }
+            return;
+        }
+    }
+
+    rebalance();
+}
+
+void ShardManager::stop() {
+
+    if (rebalance_timer_) {
+        rebalance_timer_->revoke_timer();
+        rebalance_timer_.reset();
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!coordinator_ || stopped_) {
+        return;
+    }
+
+    stopped_ = true;
+    for (uint32_t i = 0; i < shard_count_; ++i) {
+        if (owned_[i]) {
+            owned_[i] = false;
+            coordinator_->release(i);
+        }
+    }
+
+    // 退出成员，其他实例的份额立即生效
+    coordinator_.reset();
+    roo::log_warning("ShardManager stopped, all shards released.");
+}
+
+
+int ShardManager::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "Argus";
+    name = "ShardManager";
+
+    std::stringstream ss;
+    ss << "self: " << self_ << ", shard_count: " << shard_count_
+       << ", acquired: " << acquired_ << ", released: " << released_
+       << ", lost: " << lost_ << std::endl;
+
+    ss << "\towned:";
+    for (uint32_t i = 0; i < shard_count_; ++i) {
+        if (owned_[i]) {
+            ss << " " << i;
+        }
+    }
+    ss << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        ss << "\tmembers:";
+        for (size_t i = 0; i < members_.size(); ++i) {
+            ss << " " << members_[i];
+        }
+        ss << std::endl;
+    }
+
+    val = ss.str();
+    return 0;
+}
+
+} // end namespace tzrpc
@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_SHARD_MANAGER_H__
+#define __TZSERIAL_SHARD_MANAGER_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+
+#include <libconfig/libconfig.h++>
+
+namespace roo {
+class TimerObject;
+}
+
+namespace tzrpc {
+
+class Coordinator;
+
+// 一致性hash环，每个成员在环上放置vnodes个虚拟节点，key归属于顺时针方向
+// 的第一个虚拟节点。成员加入或者退出的时候，只有变化成员相邻区间内的key
+// 需要迁移，其余key的归属保持不变
+class HashRing {
+
+public:
+    explicit HashRing(uint32_t vnodes = 64) :
+        vnodes_(vnodes) {
+    }
+
+    void reset(const std::vector<std::string>& nodes);
+
+    // 环为空的时候返回空串
+    std::string locate(uint32_t key) const;
+
+    bool empty() const {
+        return ring_.empty();
+    }
+
+private:
+    uint32_t vnodes_;
+    std::vector<std::pair<uint32_t, std::string>> ring_;   // 按照hash值排序
+};
+
+// 多实例之间的任务分片
+//
+// 任务按照名字hash到固定数目的分片，分片按照一致性hash分配给当前存活的
+// 成员，每个分片同一时刻只被一个实例持有(分片锁)。实例只为自己持有的分片
+// 中的任务设置定时器，这样多个实例可以分担负载，某个实例加入或者退出的
+// 时候只有少量的分片需要迁移。没有配置coordinator的时候为单机模式，持有
+// 全部的分片。
+class ShardManager {
+
+public:
+    // 跨实例一致的hash，不能依赖std::hash
+    static uint32_t hash(const std::string& str);
+
+
+    static ShardManager& instance();
+
+    bool init(const libconfig::Config& conf);
+
+    uint32_t shard_of(const std::string& name) const;
+
+    bool owns(uint32_t shard) const {
+        return shard < shard_count_ && owned_[shard];
+    }
+
+    // 按照当前的成员重新计算每个分片的归属，释放不再属于自己的分片并获取
+    // 新分配的分片，归属变化的任务由JobExecutor设置或者撤销定时器。由定时器
+    // 周期调用，成员变化的通知也可以直接调用
+    void rebalance();
+
+    // Captain切换running/standby之后调用，standby的时候放弃所有的分片
+    void leadership_changed();
+
+    // 释放所有的分片，其他实例在下一轮rebalance的时候接管
+    void stop();
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+private:
+
+    ShardManager() :
+        shard_count_(64),
+        rebalance_msec_(1000),
+        stopped_(false),
+        acquired_(0),
+        released_(0),
+        lost_(0) {
+    }
+
+    ~ShardManager() { }
+
+    // 禁止拷贝
+    ShardManager(const ShardManager&) = delete;
+    ShardManager& operator=(const ShardManager&) = delete;
+
+    uint32_t shard_count_;
+    int32_t  rebalance_msec_;
+    std::string self_;
+
+    std::unique_ptr<std::atomic<bool>[]> owned_;
+
+    // 为空表示单机模式
+    std::shared_ptr<Coordinator> coordinator_;
+    std::shared_ptr<roo::TimerObject> rebalance_timer_;
+
+    // 保护coordinator_的调用和下面的成员快照
+    std::mutex lock_;
+    bool stopped_;
+    std::vector<std::string> members_;
+    HashRing ring_;
+
+    std::atomic<uint64_t> acquired_;
+    std::atomic<uint64_t> released_;
+    std::atomic<uint64_t> lost_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_SHARD_MANAGER_H__
@@ -0,0 +1,58 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_SHM_RING_H__
+#define __TZSERIAL_SHM_RING_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+namespace tzrpc {
+
+// 单生产者单消费者的环形队列，只使用lock-free的原子变量，不包含任何指针，
+// 所以既可以放在父子进程共享的内存中，也可以作为线程之间的队列
+template<typename T, size_t N>
+struct ShmRing {
+
+    std::atomic<uint64_t> head_;    // 生产者写入位置
+    std::atomic<uint64_t> tail_;    // 消费者读取位置
+    T slots_[N];
+
+    void reset() {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+    bool push(const T& item) {
+
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= N) {
+            return false;
+        }
+
+        slots_[head % N] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = slots_[tail % N];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_SHM_RING_H__
@@ -13,6 +13,8 @@
 #include <dlfcn.h>
 #include <linux/limits.h>
 
+#include <chrono>
+
 #include <other/Log.h>
 #include "SoBridge.h"
 
@@ -22,6 +24,10 @@ namespace tzrpc {
 class SLibLoader {
 public:
     SLibLoader(const std::string& dl_path) :
+        module_init_(NULL),
+        module_exit_(NULL),
+        open_us_(0),
+        init_us_(0),
         dl_path_(dl_path),
         dl_handle_(NULL) {
     }
@@ -33,8 +39,19 @@ public:
         return dl_path_;
     }
 
+    // 最近一次init()中dlopen(包括RTLD_NOW的符号解析)和module_init的耗时
+    int64_t open_us() const {
+        return open_us_;
+    }
+
+    int64_t init_us() const {
+        return init_us_;
+    }
+
     bool init() {
 
+        auto start = std::chrono::steady_clock::now();
+
         // RTLD_LAZY: Linux is not concerned about unresolved symbols until they are referenced.
         // RTLD_NOW: All unresolved symbols resolved when dlopen() is called.
         // dl_handle_ = dlopen(dl_path_.c_str(), RTLD_LAZY);
@@ -44,6 +61,9 @@ public:
             return false;
         }
 
+        auto opened = std::chrono::steady_clock::now();
+        open_us_ = std::chrono::duration_cast<std::chrono::microseconds>(opened - start).count();
+
         // Reset errors
         dlerror();
         char* err_info = NULL;
@@ -56,6 +76,8 @@ public:
 
         // 调用module_init函数
         int ret_code = (*module_init_)();
+        init_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - opened).count();
         if (ret_code != 0) {
             roo::log_err("call module_init failed: %d", ret_code);
             return false;
@@ -118,6 +140,9 @@ private:
     module_init_t module_init_;
     module_exit_t module_exit_;
 
+    int64_t open_us_;
+    int64_t init_us_;
+
 private:
     std::string dl_path_;
     void* dl_handle_;
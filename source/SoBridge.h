@@ -57,6 +57,10 @@ typedef int (* so_handler_t)(const msg_t* req, msg_t* rsp);
 typedef int (* module_init_t)();
 typedef int (* module_exit_t)();
 
+// 由服务导出给so调用，参数为so_handler收到的req。耗时的so应当在处理过程中
+// 周期检查，返回非0表示本次执行已经超过了配置的timeout_sec，需要尽快返回
+int job_cancel_requested(const msg_t* req);
+
 #ifdef __cplusplus
 } // end extern "C"
 #endif
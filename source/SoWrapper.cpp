@@ -30,6 +30,13 @@ bool SoWrapper::load_dl() {
     return true;
 }
 
+int64_t SoWrapper::open_us() const {
+    return dl_ ? dl_->open_us() : 0;
+}
+
+int64_t SoWrapper::init_us() const {
+    return dl_ ? dl_->init_us() : 0;
+}
 
 
 bool SoWrapperFunc::init() {
@@ -45,9 +52,9 @@ bool SoWrapperFunc::init() {
     return true;
 }
 
-int SoWrapperFunc::operator()(JobInstance* inst) {
+int SoWrapperFunc::operator()(JobInstance* inst, msg_t* rsp) {
 
-    if (!func_) {
+    if (!func_ || !dl_) {
         roo::log_err("func not initialized.");
         return -1;
     }
@@ -55,7 +62,7 @@ int SoWrapperFunc::operator()(JobInstance* inst) {
     int ret = 0;
 
     try {
-        ret = func_(reinterpret_cast<const msg_t*>(inst), NULL);
+        ret = func_(reinterpret_cast<const msg_t*>(inst), rsp);
     } catch (const std::exception& e) {
         roo::log_err("post func call std::exception detect: %s.", e.what());
     } catch (...) {
@@ -33,8 +33,14 @@ public:
         dl_({ }) {
     }
 
+    // dl_在init之后不再修改，module_exit和dlclose在最后一个引用释放的时候
+    // 由SLibLoader的析构调用
     bool load_dl();
 
+    // 加载的耗时，见SLibLoader::open_us()和init_us()
+    int64_t open_us() const;
+    int64_t init_us() const;
+
 protected:
     std::string dl_path_;
     std::shared_ptr<SLibLoader> dl_;
@@ -51,7 +57,8 @@ public:
 
     bool init();
 
-    int operator ()(JobInstance* inst);
+    // rsp由so通过fill_msg()分配，调用者负责释放
+    int operator ()(JobInstance* inst, msg_t* rsp = NULL);
 
 private:
     so_handler_t func_;
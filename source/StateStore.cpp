@@ -0,0 +1,340 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <other/Log.h>
+
+#include "StateStore.h"
+
+namespace tzrpc {
+
+static const uint32_t kStateMagic   = 0x41525354; // ARST
+static const uint32_t kStateVersion = 1;
+static const size_t   kStateSlotSize = sizeof(JobStateRecord);
+
+// 文件头占用第一个slot
+struct StateFileHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    char     reserved_[kStateSlotSize - 8];
+};
+
+static_assert(sizeof(StateFileHeader) == kStateSlotSize, "StateFileHeader should be one slot");
+
+
+StateStore& StateStore::instance() {
+    static StateStore store;
+    return store;
+}
+
+StateStore::~StateStore() {
+
+    if (map_addr_) {
+        ::munmap(map_addr_, (map_slots_ + 1) * kStateSlotSize);
+        map_addr_ = NULL;
+    }
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+
+// FNV-1a
+uint32_t StateStore::checksum(const JobStateRecord& record) {
+
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(&record);
+    size_t len = offsetof(JobStateRecord, checksum_);
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= ptr[i];
+        hash *= 16777619u;
+    }
+
+    // 全零的记录是空slot，不能被认为是合法的
+    return hash == 0 ? 1 : hash;
+}
+
+
+bool StateStore::init(const std::string& path) {
+
+    if (path.empty()) {
+        roo::log_warning("state_file not configured, job state will not be persisted.");
+        return true;
+    }
+
+    if (fd_ >= 0) {
+        roo::log_err("StateStore already initialized with %s", path_.c_str());
+        return false;
+    }
+
+    path_ = path;
+    if (!load_file()) {
+        roo::log_err("load state file %s failed.", path_.c_str());
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        return false;
+    }
+
+    roo::log_warning("StateStore initialized with %s, %d job states loaded.",
+                     path_.c_str(), static_cast<int>(index_.size()));
+    return true;
+}
+
+
+bool StateStore::load_file() {
+
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        roo::log_err("open %s failed: %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        roo::log_err("fstat %s failed: %s", path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t file_slots = 0;
+    if (static_cast<size_t>(st.st_size) >= kStateSlotSize) {
+        file_slots = static_cast<size_t>(st.st_size) / kStateSlotSize - 1;
+    }
+
+    // 先校验文件头，不是状态文件的时候不能ftruncate改写用户的文件，
+    // 全零的文件头是扩容之后还没有写入文件头的新文件
+    StateFileHeader header {};
+    if (st.st_size > 0) {
+        if (::pread(fd_, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+            roo::log_err("read state file %s header failed.", path_.c_str());
+            return false;
+        }
+
+        if ((header.magic_ != 0 || header.version_ != 0) &&
+            (header.magic_ != kStateMagic || header.version_ != kStateVersion)) {
+            roo::log_err("state file %s magic/version mismatch: %#x, %u",
+                         path_.c_str(), header.magic_, header.version_);
+            return false;
+        }
+    }
+
+    if (!ensure_capacity(file_slots)) {
+        return false;
+    }
+
+    if (header.magic_ == 0) {
+        StateFileHeader* header = reinterpret_cast<StateFileHeader*>(map_addr_);
+        header->magic_ = kStateMagic;
+        header->version_ = kStateVersion;
+        return true;
+    }
+
+    // 文件是按照容量预分配的，尾部未使用的空slot不需要加载
+    const JobStateRecord* records = reinterpret_cast<const JobStateRecord*>(map_addr_ + kStateSlotSize);
+    while (file_slots > 0 && records[file_slots - 1].checksum_ == 0) {
+        --file_slots;
+    }
+
+    // 没有持有flush_lock_，因为此时还没有定时器，也没有其他的任务
+    shadow_.reserve(file_slots);
+    loaded_.reserve(file_slots);
+    dirty_.reserve(file_slots);
+    index_.reserve(file_slots);
+
+    size_t invalid = 0;
+    for (size_t i = 0; i < file_slots; ++i) {
+
+        const JobStateRecord& record = records[i];
+
+        // 保持slot和文件的位置一一对应，非法的slot仍然占位
+        shadow_.push_back(record);
+        dirty_.push_back(0);
+
+        if (record.checksum_ == 0 || record.checksum_ != checksum(record) ||
+            record.name_[sizeof(record.name_) - 1] != '\0') {
+            if (record.checksum_ != 0) {
+                ++invalid;
+            }
+            loaded_.push_back(0);
+            memset(&shadow_.back(), 0, sizeof(JobStateRecord));
+            continue;
+        }
+
+        loaded_.push_back(1);
+        index_[record.name_] = static_cast<int32_t>(i);
+    }
+
+    if (invalid) {
+        roo::log_err("state file %s contains %d broken records, ignored.",
+                     path_.c_str(), static_cast<int>(invalid));
+    }
+
+    return true;
+}
+
+
+// 调用者需要保证互斥 (flush_lock_ 或者初始化阶段)
+bool StateStore::ensure_capacity(size_t slots) {
+
+    if (map_addr_ && slots <= map_slots_) {
+        return true;
+    }
+
+    // 每次按照两倍扩容，减少ftruncate和重新映射的次数
+    size_t new_slots = map_slots_ ? map_slots_ : 1024;
+    while (new_slots < slots) {
+        new_slots *= 2;
+    }
+
+    size_t new_size = (new_slots + 1) * kStateSlotSize;
+    if (::ftruncate(fd_, new_size) != 0) {
+        roo::log_err("ftruncate %s to %lu failed: %s",
+                     path_.c_str(), static_cast<unsigned long>(new_size), strerror(errno));
+        return false;
+    }
+
+    void* addr = NULL;
+    if (map_addr_) {
+        addr = ::mremap(map_addr_, (map_slots_ + 1) * kStateSlotSize, new_size, MREMAP_MAYMOVE);
+    } else {
+        addr = ::mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    }
+
+    if (addr == MAP_FAILED) {
+        roo::log_err("mmap %s with size %lu failed: %s",
+                     path_.c_str(), static_cast<unsigned long>(new_size), strerror(errno));
+        return false;
+    }
+
+    map_addr_ = static_cast<char*>(addr);
+    map_slots_ = new_slots;
+    return true;
+}
+
+
+int32_t StateStore::attach(const std::string& name) {
+
+    if (fd_ < 0) {
+        return -1;
+    }
+
+    JobStateRecord record {};
+    if (name.empty() || name.size() >= sizeof(record.name_)) {
+        roo::log_err("job name %s too long, its state will not be persisted.", name.c_str());
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    auto iter = index_.find(name);
+    if (iter != index_.end()) {
+        return iter->second;
+    }
+
+    int32_t slot = static_cast<int32_t>(shadow_.size());
+    strncpy(record.name_, name.c_str(), sizeof(record.name_) - 1);
+
+    shadow_.push_back(record);
+    loaded_.push_back(0);
+    dirty_.push_back(0);
+    index_[name] = slot;
+
+    return slot;
+}
+
+
+bool StateStore::lookup(int32_t slot, JobStateRecord& record) {
+
+    if (slot < 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (static_cast<size_t>(slot) >= shadow_.size() || !loaded_[slot]) {
+        return false;
+    }
+
+    record = shadow_[slot];
+    return true;
+}
+
+
+void StateStore::update(int32_t slot, time_t last_fire, int32_t last_result, time_t next_target) {
+
+    if (slot < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (static_cast<size_t>(slot) >= shadow_.size()) {
+        return;
+    }
+
+    JobStateRecord& record = shadow_[slot];
+    record.last_fire_ = last_fire;
+    record.last_result_ = last_result;
+    record.next_target_ = next_target;
+    loaded_[slot] = 1;
+
+    if (!dirty_[slot]) {
+        dirty_[slot] = 1;
+        dirty_list_.push_back(slot);
+    }
+}
+
+
+void StateStore::flush() {
+
+    if (fd_ < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> flush_lock(flush_lock_);
+
+    std::vector<int32_t> slots {};
+    std::vector<JobStateRecord> records {};
+    size_t total = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (dirty_list_.empty()) {
+            return;
+        }
+
+        slots.swap(dirty_list_);
+        records.reserve(slots.size());
+        for (size_t i = 0; i < slots.size(); ++i) {
+            dirty_[slots[i]] = 0;
+            records.push_back(shadow_[slots[i]]);
+        }
+        total = shadow_.size();
+    }
+
+    if (!ensure_capacity(total)) {
+        roo::log_err("extend state file failed, %d records lost.", static_cast<int>(slots.size()));
+        return;
+    }
+
+    JobStateRecord* mapped = reinterpret_cast<JobStateRecord*>(map_addr_ + kStateSlotSize);
+    for (size_t i = 0; i < slots.size(); ++i) {
+        records[i].checksum_ = checksum(records[i]);
+        memcpy(&mapped[slots[i]], &records[i], kStateSlotSize);
+    }
+
+    if (::msync(map_addr_, (total + 1) * kStateSlotSize, MS_SYNC) != 0) {
+        roo::log_err("msync %s failed: %s", path_.c_str(), strerror(errno));
+    }
+}
+
+} // end namespace tzrpc
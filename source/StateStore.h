@@ -0,0 +1,103 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __TZSERIAL_STATE_STORE_H__
+#define __TZSERIAL_STATE_STORE_H__
+
+#include <xtra_rhel.h>
+
+#include <unordered_map>
+
+namespace tzrpc {
+
+// 每个任务在状态文件中占用一个固定的128字节的slot，页大小是slot的整数倍，
+// 这样单条记录不会跨页，msync的时候不会被写坏一半
+struct JobStateRecord {
+
+    char     name_[96];       // 任务名，超长的任务不会被持久化
+    int64_t  last_fire_;      // 上次开始执行的时间
+    int64_t  next_target_;    // 下次预定的触发时间
+    int32_t  last_result_;    // 上次执行的返回值
+    uint32_t checksum_;       // 记录校验，不匹配的记录在加载时忽略
+    int64_t  reserved_;
+
+} __attribute__((aligned(8)));
+
+static_assert(sizeof(JobStateRecord) == 128, "JobStateRecord should be 128 bytes");
+
+
+// 任务调度状态的持久化
+//
+// 状态文件通过mmap映射，执行线程只更新内存中的影子副本并标记dirty，
+// 由定时器批量拷贝到映射区域后统一msync (group commit)，不阻塞任务执行。
+// 重启的时候加载状态，用于判断重启期间是否错过了触发 (misfire)。
+class StateStore {
+
+public:
+    static StateStore& instance();
+
+    StateStore() :
+        fd_(-1),
+        map_addr_(NULL),
+        map_slots_(0) {
+    }
+
+    ~StateStore();
+
+    // path为空则不启用持久化，后续所有的操作都是空操作
+    bool init(const std::string& path);
+
+    bool enabled() const {
+        return fd_ >= 0;
+    }
+
+    // 为任务分配slot，如果状态文件中已经存在该任务，则复用原来的slot
+    // 返回-1表示没有启用或者任务名不能被持久化
+    int32_t attach(const std::string& name);
+
+    // 取出加载或者最近更新的状态，没有记录返回false
+    bool lookup(int32_t slot, JobStateRecord& record);
+    void update(int32_t slot, time_t last_fire, int32_t last_result, time_t next_target);
+
+    // 将dirty的记录写入映射区域并msync，由JobExecutor的定时器周期调用
+    void flush();
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(lock_);
+        return index_.size();
+    }
+
+private:
+
+    // 禁止拷贝
+    StateStore(const StateStore&) = delete;
+    StateStore& operator=(const StateStore&) = delete;
+
+    bool load_file();
+    bool ensure_capacity(size_t slots);
+
+    static uint32_t checksum(const JobStateRecord& record);
+
+    std::string path_;
+    int fd_;
+
+    // 映射区域只在flush中访问，由flush_lock_保护
+    std::mutex flush_lock_;
+    char* map_addr_;
+    size_t map_slots_;
+
+    std::mutex lock_;
+    std::vector<JobStateRecord> shadow_;
+    std::vector<uint8_t> loaded_;    // slot是否含有有效的状态
+    std::vector<uint8_t> dirty_;
+    std::vector<int32_t> dirty_list_;
+    std::unordered_map<std::string, int32_t> index_;
+};
+
+} // end namespace tzrpc
+
+#endif // __TZSERIAL_STATE_STORE_H__
@@ -0,0 +1,165 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <sys/socket.h>
+
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+
+#include <other/Log.h>
+#include <scaffold/Setting.h>
+#include "JobExecutor.h"
+#include "ControlServer.h"
+#include "ShardManager.h"
+
+using namespace tzrpc;
+
+// TestJobModule.cpp编译出的so所在的目录，由CMake传入
+#ifndef TEST_JOB_DIR
+#define TEST_JOB_DIR "./"
+#endif
+
+// 设置调度的时候需要知道分片的归属
+class ControlServerEnv : public ::testing::Environment {
+public:
+    virtual void SetUp() {
+        libconfig::Config conf;
+        conf.readString("schedule = { shard_count = 64; };");
+        ASSERT_THAT(ShardManager::instance().init(conf), Eq(true));
+    }
+};
+
+static ::testing::Environment* const control_server_env = ::testing::AddGlobalTestEnvironment(new ControlServerEnv);
+
+#define INST JobExecutor::instance()
+
+// 等待后台加载的任务注册完成，超时返回false
+static bool wait_exists(const std::string& name, int timeout_ms) {
+
+    auto deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout_ms);
+    while (!INST.task_exists(name)) {
+        if (boost::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+namespace tzrpc {
+
+// 不启动事件循环，连接直接用socketpair的一端，在测试线程中驱动handle_read()
+class ControlServerTest: public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        ASSERT_THAT(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds_), Eq(0));
+    }
+
+    virtual void TearDown() {
+        ::close(fds_[1]);
+    }
+
+    // 发送请求并取回全部的响应
+    std::string request(ControlServer& server, const std::string& req) {
+
+        if (::write(fds_[1], req.data(), req.size()) != static_cast<ssize_t>(req.size())) {
+            return "";
+        }
+        server.handle_read(fds_[0]);
+
+        std::string rsp;
+        char buf[4096];
+        ssize_t len = 0;
+        while ((len = ::read(fds_[1], buf, sizeof(buf))) > 0) {
+            rsp.append(buf, len);
+        }
+        return rsp;
+    }
+
+    int fds_[2];
+};
+
+TEST_F(ControlServerTest, CommandTest) {
+
+    // add和trigger在async_task_中执行，执行器没有完整初始化，这里单独创建
+    if (!INST.async_task_) {
+        INST.async_task_ = std::make_shared<roo::AsyncTask>(4);
+    }
+
+    ControlServer server("./control_server_test.sock");
+    server.conns_[fds_[0]] = ControlServer::Connection();
+
+    ASSERT_THAT(request(server, "hello\n"), StartsWith("ERR unknown command"));
+    ASSERT_THAT(request(server, "pause\n"), StartsWith("ERR unknown command"));
+    ASSERT_THAT(request(server, "add c1 fast " TEST_JOB_DIR "libtest_job_ok.so * * *\n"),
+                Eq("ERR invalid exec_method fast\n"));
+
+    // 空行忽略，一次读取中的多条命令依次响应
+    ASSERT_THAT(request(server, "\nlist\nstats c1\n"),
+                Eq("OK\ntask c1 not registered.\nERR stats failed\n"));
+
+    ASSERT_THAT(request(server, "add c1 defer " TEST_JOB_DIR "libtest_job_ok.so * * *\n"), Eq("OK\n"));
+    ASSERT_THAT(wait_exists("c1", 5000), Eq(true));
+    ASSERT_THAT(request(server, "add c1 defer " TEST_JOB_DIR "libtest_job_ok.so * * *\n"),
+                Eq("ERR add failed\n"));
+
+    // so加载失败的只记录日志，不会注册
+    ASSERT_THAT(request(server, "add c2 defer " TEST_JOB_DIR "libtest_job_missing.so * * *\n"), Eq("OK\n"));
+    ASSERT_THAT(wait_exists("c2", 500), Eq(false));
+
+    ASSERT_THAT(request(server, "pause c1\n"), Eq("OK\n"));
+    ASSERT_THAT(request(server, "pause c1\n"), Eq("ERR pause failed\n"));
+    ASSERT_THAT(request(server, "resume c1\n"), Eq("OK\n"));
+    ASSERT_THAT(request(server, "resume c1\n"), Eq("ERR resume failed\n"));
+    ASSERT_THAT(request(server, "trigger c1\n"), Eq("OK\n"));
+    ASSERT_THAT(request(server, "trigger c3\n"), Eq("ERR trigger failed\n"));
+
+    ASSERT_THAT(request(server, "update c1 async " TEST_JOB_DIR "libtest_job_ok.so */5 * *\n"), Eq("OK\n"));
+    JobSpec spec {};
+    ASSERT_THAT(INST.task_spec("c1", spec), Eq(true));
+    ASSERT_THAT(spec.exec_method_, Eq(ExecuteMethod::kExecAsync));
+    ASSERT_THAT(spec.sch_time_, Eq("*/5 * *"));
+    ASSERT_THAT(request(server, "stats c1\n"), EndsWith("OK\n"));
+
+    // 命令中没有的lazy保持不变，不会在事件循环中加载so
+    JobSpec lazy {};
+    lazy.name_ = "c4";
+    lazy.sch_time_ = "* * *";
+    lazy.so_path_ = TEST_JOB_DIR "libtest_job_ok.so";
+    lazy.lazy_ = true;
+    ASSERT_THAT(INST.add_so_task(lazy), Eq(true));
+    ASSERT_THAT(request(server, "update c4 async " TEST_JOB_DIR "libtest_job_ok.so */5 * *\n"), Eq("OK\n"));
+    ASSERT_THAT(INST.task_spec("c4", spec), Eq(true));
+    ASSERT_THAT(spec.lazy_, Eq(true));
+    ASSERT_THAT(spec.exec_method_, Eq(ExecuteMethod::kExecAsync));
+    ASSERT_THAT(request(server, "stats c4\n"), HasSubstr("so_loads: 0"));
+    ASSERT_THAT(request(server, "remove c4\n"), Eq("OK\n"));
+
+    ASSERT_THAT(request(server, "remove c1\n"), Eq("OK\n"));
+    ASSERT_THAT(INST.task_exists("c1"), Eq(false));
+    ASSERT_THAT(request(server, "remove c1\n"), Eq("ERR remove failed\n"));
+    ASSERT_THAT(request(server, "update c1 defer " TEST_JOB_DIR "libtest_job_ok.so * * *\n"),
+                Eq("ERR update failed\n"));
+
+    server.close_conn(fds_[0]);
+}
+
+// 超过kMaxLineSize还没有换行的连接被关闭
+TEST_F(ControlServerTest, ReadLimitTest) {
+
+    ControlServer server("./control_server_test.sock");
+    server.conns_[fds_[0]] = ControlServer::Connection();
+
+    std::string line(5000, 'a');
+    ASSERT_THAT(::write(fds_[1], line.data(), line.size()), Eq(static_cast<ssize_t>(line.size())));
+    server.handle_read(fds_[0]);
+    ASSERT_THAT(server.conns_.size(), Eq(0u));
+
+    char buf[16];
+    ASSERT_THAT(::read(fds_[1], buf, sizeof(buf)), Eq(0));
+}
+
+} // end tzrpc
@@ -0,0 +1,63 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "Coordinator.h"
+
+using namespace tzrpc;
+
+static const char* kCoordDir = "./coordinator_test.coord";
+
+TEST(CoordinatorTest, LocalShardLockTest) {
+
+    LocalCoordinator node1(kCoordDir, "node-1");
+    LocalCoordinator node2(kCoordDir, "node-2");
+    ASSERT_THAT(node1.init(), Eq(true));
+    ASSERT_THAT(node2.init(), Eq(true));
+
+    // 同一个实例标识不能重复加入
+    LocalCoordinator dup(kCoordDir, "node-1");
+    ASSERT_THAT(dup.init(), Eq(false));
+
+    ASSERT_THAT(node1.try_acquire(3), Eq(true));
+    ASSERT_THAT(node1.try_acquire(3), Eq(true));
+    ASSERT_THAT(node2.try_acquire(3), Eq(false));
+    ASSERT_THAT(node2.try_acquire(4), Eq(true));
+
+    node1.release(3);
+    ASSERT_THAT(node2.try_acquire(3), Eq(true));
+    ASSERT_THAT(node1.try_acquire(3), Eq(false));
+
+    // 退出成员列表之后可以重新加入
+    std::vector<std::string> nodes;
+    node2.leave();
+    ASSERT_THAT(node1.members(nodes), Eq(true));
+    ASSERT_THAT(nodes, ElementsAre("node-1"));
+    ASSERT_THAT(node2.join(), Eq(true));
+    ASSERT_THAT(node1.members(nodes), Eq(true));
+    ASSERT_THAT(nodes, ElementsAre("node-1", "node-2"));
+}
+
+TEST(CoordinatorTest, LocalMembersTest) {
+
+    std::vector<std::string> nodes;
+    LocalCoordinator node1(kCoordDir, "node-1");
+    ASSERT_THAT(node1.init(), Eq(true));
+
+    {
+        LocalCoordinator node2(kCoordDir, "node-2");
+        ASSERT_THAT(node2.init(), Eq(true));
+        ASSERT_THAT(node2.try_acquire(5), Eq(true));
+
+        ASSERT_THAT(node1.members(nodes), Eq(true));
+        ASSERT_THAT(nodes, ElementsAre("node-1", "node-2"));
+        ASSERT_THAT(node1.try_acquire(5), Eq(false));
+    }
+
+    // 实例退出之后成员和分片锁都被释放
+    ASSERT_THAT(node1.members(nodes), Eq(true));
+    ASSERT_THAT(nodes, ElementsAre("node-1"));
+    ASSERT_THAT(node1.try_acquire(5), Eq(true));
+}
@@ -0,0 +1,54 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "JobInstance.h"
+
+using namespace tzrpc;
+
+// 编译期求值，非法的表达式(例如"60 * *"、"1-1 * *")在这里无法通过编译
+static_assert("0 0 *"_cron.hour_ == 0xFFFFFF, "hourly");
+static_assert("*/15 * *"_cron.sec_ == ((1ULL << 0) | (1ULL << 15) | (1ULL << 30) | (1ULL << 45)), "step");
+static_assert(ARGUS_CRON("0 1-3,5 *").min_ == 0x2E, "range");
+
+static constexpr SchTime kDaily = "0 0 3"_cron;
+
+static void expect_same(const char* str, const CronMask& mask) {
+
+    SchTime runtime;
+    ASSERT_THAT(runtime.parse(str), Eq(true)) << str;
+
+    SchTime compiled(mask);
+    ASSERT_THAT(compiled.sec_points(), Eq(runtime.sec_points())) << str;
+    ASSERT_THAT(compiled.min_points(), Eq(runtime.min_points())) << str;
+    ASSERT_THAT(compiled.hour_points(), Eq(runtime.hour_points())) << str;
+}
+
+TEST(CronLiteralTest, SameAsRuntimeTest) {
+
+    expect_same("* * *", "* * *"_cron);
+    expect_same("*/ * *", "*/ * *"_cron);
+    expect_same("*/5 * *", "*/5 * *"_cron);
+    expect_same("0 */15 8-18", "0 */15 8-18"_cron);
+    expect_same("0,30 1,2,3 23", "0,30 1,2,3 23"_cron);
+    expect_same(" 5  10-20,40 */6 ", " 5  10-20,40 */6 "_cron);
+    expect_same("59 59 23", ARGUS_CRON("59 59 23"));
+
+    ASSERT_THAT(kDaily.hour_points().count(), Eq(1));
+    ASSERT_THAT(kDaily.hour_points().test(3), Eq(true));
+}
+
+// 在运行时调用的时候非法表达式抛出异常
+TEST(CronLiteralTest, InvalidTest) {
+
+    const char* invalid[] = {
+        "", "* *", "* * * *", "60 * *", "* * 24", "1-1 * *", "5-3 * *",
+        "*/0 * *", "*/60 * *", "5x * *", "1,,2 * *", "1, * *", "*5 * *", "100 * *",
+    };
+
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        ASSERT_THROW(cron_compile(invalid[i]), std::invalid_argument) << invalid[i];
+    }
+}
@@ -0,0 +1,45 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+
+#include <other/Log.h>
+#include "FireTimer.h"
+
+using namespace tzrpc;
+
+// 等待触发的次数达到expect，超时返回false
+static bool wait_fired(uint64_t expect, int timeout_ms) {
+
+    auto deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout_ms);
+    while (FireTimer::instance().fired() < expect) {
+        if (boost::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+TEST(FireTimerTest, DropRemovedJobTest) {
+
+    ASSERT_THAT(FireTimer::instance().init(), Eq(true));
+
+    // 不存在的任务，触发的时候直接丢弃
+    JobRef ref {};
+    ref.id_ = 0xFFFFFFFF;
+    for (int i = 0; i < 100; ++i) {
+        FireTimer::instance().add(ref, 0, i % 10);
+    }
+
+    ASSERT_THAT(wait_fired(100, 5000), Eq(true));
+    ASSERT_THAT(FireTimer::instance().fired(), Eq(100));
+    ASSERT_THAT(FireTimer::instance().grows(), Eq(0));
+    ASSERT_THAT(FireTimer::instance().size(), Eq(0));
+
+    FireTimer::instance().stop();
+}
@@ -0,0 +1,86 @@
+// HotLog的吞吐测试，不作为ctest的用例执行
+//
+// 模拟每次触发的日志：设置下一次调度以及执行结果，比较同步格式化输出和
+// HotLog异步输出的任务吞吐，同时输出HotLog队列满被丢弃的日志条数，
+// 吞吐需要结合丢弃的数目一起看
+//
+// ./HotLog_bench -n 200000
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <chrono>
+#include <sstream>
+
+#include <other/Log.h>
+#include "HotLog.h"
+
+using namespace tzrpc;
+
+static int bench_job(int i) {
+    return (i % 97 == 0) ? -1 : 0;
+}
+
+static double bench_rate(bool hot, int32_t count) {
+
+    std::string name = "bench-job";
+    auto start = std::chrono::steady_clock::now();
+
+    for (int32_t i = 0; i < count; ++i) {
+        int code = bench_job(i);
+        if (hot) {
+            HOT_LOG_INFO("next trigger for {} success, with next_interval: {} msecs.", name, 1000);
+            if (code != 0) {
+                HOT_LOG_ERR("job {} func return {}, attempt {}.", name, code, 0);
+            }
+        } else {
+            roo::log_info("next trigger for %s success, with next_interval: %d msecs.", name.c_str(), 1000);
+            if (code != 0) {
+                std::stringstream ss;
+                ss << "JobInstance: " << name << std::endl << "desc: bench job, sch_time: * * *";
+                roo::log_err("job func return %d, job desc: %s", code, ss.str().c_str());
+            }
+        }
+    }
+
+    auto stop = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1e6;
+    return count / (elapsed > 0 ? elapsed : 1e-6);
+}
+
+int main(int argc, char* argv[]) {
+
+    int32_t count = 200000;
+
+    int opt_g = 0;
+    while ((opt_g = ::getopt(argc, argv, "n:h")) != -1) {
+        switch (opt_g) {
+            case 'n': count = ::atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n jobs]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [-n jobs]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    double sync_rate = bench_rate(false, count);
+
+    if (!HotLog::instance().init(LOG_DEBUG)) {
+        fprintf(stderr, "init HotLog failed.\n");
+        return EXIT_FAILURE;
+    }
+    double hot_rate = bench_rate(true, count);
+    HotLog::instance().stop();
+
+    uint64_t dropped = HotLog::instance().dropped();
+
+    printf("jobs %d\n", count);
+    printf("sync log  jobs/s %.0f\n", sync_rate);
+    printf("HotLog    jobs/s %.0f  dropped %llu (%.1f%% of info logs)\n",
+           hot_rate, static_cast<unsigned long long>(dropped), 100.0 * dropped / count);
+    return EXIT_SUCCESS;
+}
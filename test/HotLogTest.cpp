@@ -0,0 +1,72 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "HotLog.h"
+
+using namespace tzrpc;
+
+template<typename... Args>
+static std::string hot_format(const char* fmt, const Args&... args) {
+
+    HotLogRecord rec;
+    rec.fmt_ = fmt;
+    rec.argc_ = 0;
+    rec.size_ = 0;
+    hot_log_pack(rec, args...);
+    return HotLog::format(rec);
+}
+
+TEST(HotLogTest, FormatTest) {
+
+    ASSERT_THAT(hot_format("no args"), Eq("no args"));
+    ASSERT_THAT(hot_format("job {} return {}, gen {}", std::string("job-1"), -3, 18446744073709551615ULL),
+                Eq("job job-1 return -3, gen 18446744073709551615"));
+    ASSERT_THAT(hot_format("{} {} {}", "literal", 1.5, true), Eq("literal 1.5 1"));
+
+    // 参数不够的时候保留占位符，多余的参数忽略
+    ASSERT_THAT(hot_format("{} and {}", 1), Eq("1 and {}"));
+    ASSERT_THAT(hot_format("{}", 1, 2), Eq("1"));
+
+    // 超长的字符串被截断
+    std::string long_str(200, 'x');
+    ASSERT_THAT(hot_format("{}", long_str), Eq(std::string(kHotLogStrMax, 'x')));
+
+    // 超过参数个数上限的丢弃
+    ASSERT_THAT(hot_format("{}{}{}{}{}{}{}", 1, 2, 3, 4, 5, 6, 7), Eq("123456{}"));
+}
+
+TEST(HotLogTest, LevelTest) {
+
+    HotLog::set_level(LOG_NOTICE);
+    ASSERT_THAT(HotLog::enabled(LOG_ERR), Eq(true));
+    ASSERT_THAT(HotLog::enabled(LOG_NOTICE), Eq(true));
+    ASSERT_THAT(HotLog::enabled(LOG_INFO), Eq(false));
+    HotLog::set_level(LOG_DEBUG);
+}
+
+
+// 依次退出的线程复用回收的队列，不会每个线程都分配一次
+TEST(HotLogTest, RingReuseTest) {
+
+    HotLog& hot_log = HotLog::instance();
+    ASSERT_THAT(hot_log.init(LOG_INFO), Eq(true));
+
+    for (int i = 0; i < 20; ++i) {
+        boost::thread thread([i]() {
+            HotLog::instance().log(LOG_INFO, "ring reuse {}", i);
+        });
+        thread.join();
+        hot_log.drain();
+    }
+
+    std::string module, name, val;
+    ASSERT_THAT(hot_log.module_status(module, name, val), Eq(0));
+    ASSERT_THAT(val, HasSubstr("rings: 0, free: 1, allocated: 1,"));
+    ASSERT_THAT(val, HasSubstr("written: 20,"));
+
+    hot_log.stop();
+    HotLog::set_level(LOG_DEBUG);
+}
@@ -0,0 +1,125 @@
+#include <gmock/gmock.h>
+#include <cstring>
+#include <string>
+#include <thread>
+
+using namespace ::testing;
+
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+
+#include <other/Log.h>
+#include "IsolatedExecutor.h"
+#include "JobInstance.h"
+
+using namespace tzrpc;
+
+// TestJobModule.cpp编译出的两个so所在的目录，由CMake传入
+#ifndef TEST_JOB_DIR
+#define TEST_JOB_DIR "./"
+#endif
+
+TEST(IsolatedExecutorTest, ShmRingTest) {
+
+    ShmRing<IsolatedResponse, 4> ring;
+    ring.reset();
+
+    IsolatedResponse rsp {};
+    ASSERT_THAT(ring.pop(rsp), Eq(false));
+
+    for (int i = 0; i < 4; ++i) {
+        rsp.seq_ = i;
+        ASSERT_THAT(ring.push(rsp), Eq(true));
+    }
+
+    // 已满，不会覆盖未读取的记录
+    rsp.seq_ = 100;
+    ASSERT_THAT(ring.push(rsp), Eq(false));
+
+    ASSERT_THAT(ring.pop(rsp), Eq(true));
+    ASSERT_THAT(rsp.seq_, Eq(0));
+
+    rsp.seq_ = 4;
+    ASSERT_THAT(ring.push(rsp), Eq(true));
+
+    for (int i = 1; i <= 4; ++i) {
+        ASSERT_THAT(ring.pop(rsp), Eq(true));
+        ASSERT_THAT(rsp.seq_, Eq(static_cast<uint64_t>(i)));
+    }
+
+    ASSERT_THAT(ring.pop(rsp), Eq(false));
+}
+
+TEST(IsolatedExecutorTest, DisabledTest) {
+
+    // 没有设置isolated_workers，不会创建worker进程
+    libconfig::Config conf;
+    ASSERT_THAT(IsolatedExecutor::instance().init(conf), Eq(true));
+    ASSERT_THAT(IsolatedExecutor::instance().enabled(), Eq(false));
+}
+
+// 真实的worker进程执行so，超时之后被kill，下一次执行的时候重建worker
+TEST(IsolatedExecutorTest, ChildRunTest) {
+
+    libconfig::Config conf;
+    conf.readString("schedule = { isolated_workers = 1; };");
+    ASSERT_THAT(IsolatedExecutor::instance().init(conf), Eq(true));
+    ASSERT_THAT(IsolatedExecutor::instance().enabled(), Eq(true));
+
+    JobSpec spec {};
+    spec.name_ = "isolated-ok";
+    spec.so_path_ = TEST_JOB_DIR "libtest_job_ok.so";
+    spec.isolate_ = true;
+    ASSERT_THAT(IsolatedExecutor::instance().execute(spec), Eq(7));
+
+    // so不存在，worker加载失败但是不退出
+    JobSpec missing = spec;
+    missing.name_ = "isolated-missing";
+    missing.so_path_ = TEST_JOB_DIR "libtest_job_missing.so";
+    ASSERT_THAT(IsolatedExecutor::instance().execute(missing), Eq(-1));
+
+    // 不响应取消的so，超时加上取消的宽限时间之后worker被kill。在随后就退出的
+    // 线程中执行，重建的worker不能跟着这个线程的结束而退出
+    JobSpec hang = spec;
+    hang.name_ = "isolated-hang";
+    hang.so_path_ = TEST_JOB_DIR "libtest_job_hang.so";
+    hang.timeout_sec_ = 1;
+
+    int code = 0;
+    int64_t elapsed = 0;
+    std::thread runner([&hang, &code, &elapsed]() {
+        auto start = boost::chrono::steady_clock::now();
+        code = IsolatedExecutor::instance().execute(hang);
+        elapsed = boost::chrono::duration_cast<boost::chrono::milliseconds>(
+                      boost::chrono::steady_clock::now() - start).count();
+    });
+    runner.join();
+
+    ASSERT_THAT(code, Eq(kIsolatedTimeout));
+    ASSERT_THAT(elapsed, Ge(1000));
+    ASSERT_THAT(elapsed, Lt(5000));
+
+    std::string module, name, val;
+    IsolatedExecutor::instance().module_status(module, name, val);
+    ASSERT_THAT(val, HasSubstr("timeouts: 1"));
+
+    // 给误杀留出时间，然后在主线程中使用重建的worker
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+    ASSERT_THAT(IsolatedExecutor::instance().execute(spec), Eq(7));
+    IsolatedExecutor::instance().module_status(module, name, val);
+    ASSERT_THAT(val, HasSubstr("spawned: 2"));
+    ASSERT_THAT(val, HasSubstr("crashed: 0"));
+
+    IsolatedExecutor::instance().stop();
+}
+
+// worker进程由IsolatedExecutor以 "-w arg" 启动测试程序自身
+int main(int argc, char* argv[]) {
+
+    if (argc == 3 && ::strcmp(argv[1], "-w") == 0) {
+        return IsolatedExecutor::worker_main(argv[2]);
+    }
+
+    ::testing::InitGoogleMock(&argc, argv);
+    return RUN_ALL_TESTS();
+}
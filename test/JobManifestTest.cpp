@@ -0,0 +1,128 @@
+#include <gmock/gmock.h>
+#include <string>
+#include <fstream>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "JobManifest.h"
+
+using namespace tzrpc;
+
+static const char* kManifestFile = "./job_manifest_test.manifest";
+
+static JobSpec make_spec(const std::string& name, const std::string& sch_time) {
+
+    JobSpec spec {};
+    spec.name_ = name;
+    spec.desc_ = "manifest test";
+    spec.sch_time_ = sch_time;
+    spec.so_path_ = "../so-bin/libjob1.so";
+    return spec;
+}
+
+TEST(JobManifestTest, RoundTripTest) {
+
+    ::unlink(kManifestFile);
+
+    std::vector<JobSpec> specs;
+    specs.push_back(make_spec("job-1", "*/10 * *"));
+    specs.push_back(make_spec("job-2", "0 30 3"));
+    specs[1].desc_ = "";
+    specs[1].exec_method_ = ExecuteMethod::kExecAsync;
+    specs[1].misfire_ = MisfirePolicy::kMisfireOnce;
+    specs[1].isolate_ = true;
+    specs[1].timeout_sec_ = 5;
+    specs[1].retry_.max_attempts_ = 3;
+    specs[1].retry_.backoff_ms_ = 500;
+    specs[1].retry_.backoff_max_ms_ = 4000;
+    specs[1].retry_.jitter_ = false;
+    specs[1].lazy_ = true;
+    specs[1].enable_ = false;
+
+    ASSERT_THAT(JobManifest::write(kManifestFile, specs), Eq(true));
+
+    JobManifest manifest;
+    ASSERT_THAT(manifest.open(kManifestFile), Eq(true));
+    ASSERT_THAT(manifest.size(), Eq(2u));
+
+    for (uint32_t i = 0; i < manifest.size(); ++i) {
+
+        JobSpec spec {};
+        CronMask sch {};
+        manifest.job_at(i, spec, sch);
+        ASSERT_THAT(spec == specs[i], Eq(true));
+        ASSERT_THAT(std::string(sch.str_), Eq(specs[i].sch_time_));
+
+        SchTime expect;
+        ASSERT_THAT(expect.parse(specs[i].sch_time_), Eq(true));
+        ASSERT_THAT(sch.sec_, Eq(expect.sec_points().to_ullong()));
+        ASSERT_THAT(sch.min_, Eq(expect.min_points().to_ullong()));
+        ASSERT_THAT(sch.hour_, Eq(expect.hour_points().to_ullong()));
+    }
+
+    manifest.close();
+    ::unlink(kManifestFile);
+}
+
+
+TEST(JobManifestTest, InternTest) {
+
+    std::vector<JobSpec> specs;
+    for (int i = 0; i < 1000; ++i) {
+        specs.push_back(make_spec("job-" + std::to_string(static_cast<long long>(i)), "* * *"));
+    }
+
+    std::string content;
+    ASSERT_THAT(JobManifest::build(specs, content), Eq(true));
+
+    // desc、sch_time、so_path只保存一份，剩下的基本都是任务名
+    size_t names = 0;
+    for (size_t i = 0; i < specs.size(); ++i) {
+        names += specs[i].name_.size() + 1;
+    }
+    ASSERT_THAT(content.size() - 32 - specs.size() * sizeof(ManifestRecord), Lt(names + 64));
+}
+
+
+TEST(JobManifestTest, RejectTest) {
+
+    std::vector<JobSpec> specs;
+    std::string content;
+
+    specs.push_back(make_spec("job-1", "* * 24"));
+    ASSERT_THAT(JobManifest::build(specs, content), Eq(false));
+
+    specs[0].sch_time_ = "* * 23";
+    specs.push_back(make_spec("job-1", "* * *"));
+    ASSERT_THAT(JobManifest::build(specs, content), Eq(false));
+
+    specs.pop_back();
+    ASSERT_THAT(JobManifest::build(specs, content), Eq(true));
+
+    JobManifest manifest;
+
+    // 截断、损坏的文件都不能被加载
+    std::string bad = content.substr(0, content.size() - 1);
+    { std::ofstream(kManifestFile, std::ios::binary) << bad; }
+    ASSERT_THAT(manifest.open(kManifestFile), Eq(false));
+
+    bad = content;
+    bad[bad.size() - 2] ^= 0x01;
+    { std::ofstream(kManifestFile, std::ios::binary) << bad; }
+    ASSERT_THAT(manifest.open(kManifestFile), Eq(false));
+
+    bad = content;
+    bad[0] = 'x';
+    { std::ofstream(kManifestFile, std::ios::binary) << bad; }
+    ASSERT_THAT(manifest.open(kManifestFile), Eq(false));
+
+    { std::ofstream(kManifestFile, std::ios::binary) << content; }
+    ASSERT_THAT(manifest.open(kManifestFile), Eq(true));
+    ASSERT_THAT(manifest.size(), Eq(1u));
+
+    ::unlink(kManifestFile);
+    ::unlink("./not_exist.manifest");
+    ASSERT_THAT(manifest.open("./not_exist.manifest"), Eq(false));
+    ASSERT_THAT(manifest.size(), Eq(0u));
+}
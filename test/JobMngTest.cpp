@@ -1,15 +1,35 @@
 #include <gmock/gmock.h>
 #include <string>
 
+#include <dlfcn.h>
+
 using namespace ::testing;
 
 #include <other/Log.h>
 #include <scaffold/Setting.h>
 #include "JobInstance.h"
 #include "JobExecutor.h"
+#include "ShardManager.h"
 
 using namespace tzrpc;
 
+// TestJobModule.cpp编译出的so所在的目录，由CMake传入
+#ifndef TEST_JOB_DIR
+#define TEST_JOB_DIR "./"
+#endif
+
+// 设置调度的时候需要知道分片的归属
+class JobMngEnv : public ::testing::Environment {
+public:
+    virtual void SetUp() {
+        libconfig::Config conf;
+        conf.readString("schedule = { shard_count = 64; };");
+        ASSERT_THAT(ShardManager::instance().init(conf), Eq(true));
+    }
+};
+
+static ::testing::Environment* const job_mng_env = ::testing::AddGlobalTestEnvironment(new JobMngEnv);
+
 int test_func(JobInstance* inst) {
     return 0;
 }
@@ -26,6 +46,70 @@ TEST(JobMngTest, BuiltinJobTest) {
 }
 
 
+static time_t next_fire(const JobInstance& inst) {
+    std::string stat = inst.stat_str();
+    size_t pos = stat.find("next_fire: ");
+    return pos == std::string::npos ? 0 : ::atol(stat.c_str() + pos + 11);
+}
+
+// lazy任务只在调度之前的prefetch_sec之内加载，空闲idle_sec之后卸载，
+// 执行的时候还没有加载的计入misses，update可以在lazy和eager之间切换
+TEST(JobMngTest, LazyCheckTest) {
+
+    // 每天执行一次，距离现在至少11个小时，预取窗口由参数中的时间决定
+    time_t now = ::time(NULL);
+    struct tm tm {};
+    ::localtime_r(&now, &tm);
+
+    JobSpec spec {};
+    spec.name_ = "lazy-1";
+    spec.sch_time_ = "0 0 " + std::to_string((tm.tm_hour + 12) % 24);
+    spec.so_path_ = TEST_JOB_DIR "libtest_job_ok.so";
+    spec.lazy_ = true;
+
+    auto inst = std::make_shared<JobInstance>(spec);
+    ASSERT_THAT(inst->init(), Eq(true));
+    time_t next = next_fire(*inst);
+    ASSERT_THAT(next, Gt(now + 3600));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("so: unloaded, so_loads: 0"));
+
+    // 预取窗口之外不加载，窗口之内只提交一次预取
+    ASSERT_THAT(inst->lazy_check(next - 100, 10, 300), Eq(false));
+    ASSERT_THAT(inst->lazy_check(next - 10, 10, 300), Eq(true));
+    ASSERT_THAT(inst->lazy_check(next - 5, 10, 300), Eq(false));
+    ASSERT_THAT(!!inst->lazy_load(), Eq(true));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("so: loaded, so_loads: 1, so_unloads: 0"));
+
+    // 调度临近的时候即使空闲也不卸载，空闲不到idle_sec的也不卸载
+    ASSERT_THAT(inst->lazy_check(next - 5, 10, 0), Eq(false));
+    ASSERT_THAT(inst->lazy_check(now + 100, 10, 300), Eq(false));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("so: loaded"));
+
+    ASSERT_THAT(inst->lazy_check(now + 400, 10, 300), Eq(false));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("so: unloaded, so_loads: 1, so_unloads: 1, so_misses: 0"));
+
+    // 预取没有覆盖到的执行，在执行线程中加载
+    ASSERT_THAT(inst->run_once(), Eq(7));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("so: loaded, so_loads: 2, so_unloads: 1, so_misses: 1"));
+    ASSERT_THAT(inst->lazy_check(now + 1000, 10, 300), Eq(false));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("so: unloaded"));
+
+    // 切换到eager立即加载，之后不再卸载
+    JobSpec eager = spec;
+    eager.lazy_ = false;
+    ASSERT_THAT(inst->update(eager), Eq(true));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("lazy: false, so: loaded, so_loads: 3"));
+    ASSERT_THAT(inst->lazy_check(now + 5000, 10, 300), Eq(false));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("so: loaded"));
+
+    // 切换回lazy保留已经加载的so，空闲之后卸载
+    ASSERT_THAT(inst->update(spec), Eq(true));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("lazy: true, so: loaded, so_loads: 3"));
+    ASSERT_THAT(inst->lazy_check(now + 5000, 10, 300), Eq(false));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("so: unloaded, so_loads: 3, so_unloads: 3"));
+}
+
+
 // fixture should be in the same namespace
 
 namespace tzrpc {
@@ -88,4 +172,177 @@ TEST_F(ExecutorFriendTest, SoHandleTest) {
 
 }
 
+// 重载的时候配置中删除的任务被卸载，不在配置中的任务(ControlServer添加的)保留
+TEST_F(ExecutorFriendTest, ReloadRemoveTest) {
+
+    const char* names[] = { "conf-1", "conf-2", "manual-1" };
+    for (size_t i = 0; i < 3; ++i) {
+        JobSpec spec {};
+        spec.name_ = names[i];
+        spec.sch_time_ = "* * *";
+        spec.so_path_ = "./libnot_loaded.so";
+
+        std::lock_guard<std::mutex> lock(INST.lock_);
+        INST.tasks_[spec.name_] = std::make_shared<JobInstance>(spec);
+    }
+
+    std::set<std::string> seen;
+    seen.insert("conf-1");
+    seen.insert("conf-2");
+    INST.remove_stale_tasks(seen);
+    ASSERT_THAT(INST.task_exists("conf-1"), Eq(true));
+    ASSERT_THAT(INST.task_exists("conf-2"), Eq(true));
+
+    seen.erase("conf-2");
+    INST.remove_stale_tasks(seen);
+    ASSERT_THAT(INST.task_exists("conf-1"), Eq(true));
+    ASSERT_THAT(INST.task_exists("conf-2"), Eq(false));
+    ASSERT_THAT(INST.task_exists("manual-1"), Eq(true));
+    ASSERT_THAT(INST.conf_tasks_.size(), Eq(1u));
+
+    // 没有执行中的调度，下一次检查的时候回收
+    ASSERT_THAT(INST.retiring_.size(), Eq(1u));
+    INST.reap_retiring();
+    ASSERT_THAT(INST.retiring_.size(), Eq(0u));
+
+    seen.clear();
+    INST.remove_stale_tasks(seen);
+    ASSERT_THAT(INST.task_exists("conf-1"), Eq(false));
+    ASSERT_THAT(INST.task_exists("manual-1"), Eq(true));
+
+    ASSERT_THAT(INST.remove_so_task("manual-1"), Eq(true));
+    INST.reap_retiring();
+    ASSERT_THAT(INST.retiring_.size(), Eq(0u));
+}
+
+// 批量加载中失败的任务不会注册，也不影响其他任务；同一个so的任务在一个
+// 线程中初始化，init()只加载不设置调度，发布之后start()才设置
+TEST_F(ExecutorFriendTest, LoadBatchTest) {
+
+    // 持有so的引用，module_init的记录在加载之后仍然可以查询
+    void* handle = ::dlopen(TEST_JOB_DIR "libtest_job_ok.so", RTLD_NOW);
+    ASSERT_THAT(handle != NULL, Eq(true));
+    auto reset = reinterpret_cast<void (*)()>(::dlsym(handle, "test_job_reset"));
+    auto init_count = reinterpret_cast<int (*)()>(::dlsym(handle, "test_job_init_count"));
+    auto init_threads = reinterpret_cast<int (*)()>(::dlsym(handle, "test_job_init_threads"));
+    ASSERT_THAT(reset && init_count && init_threads, Eq(true));
+    reset();
+
+    JobSpec spec {};
+    spec.sch_time_ = "0 0 0";
+    spec.so_path_ = TEST_JOB_DIR "libtest_job_ok.so";
+
+    spec.name_ = "batch-pre";
+    auto pre = std::make_shared<JobInstance>(spec);
+    std::string error;
+    ASSERT_THAT(pre->init(error), Eq(true));
+    ASSERT_THAT(next_fire(*pre), Eq(0));
+    ASSERT_THAT(pre->start(error), Eq(true));
+    ASSERT_THAT(next_fire(*pre), Gt(0));
+    pre->terminate();
+    pre.reset();
+    reset();
+
+    std::vector<JobLoadItem> batch;
+    spec.name_ = "batch-1";
+    batch.push_back(JobLoadItem { spec });
+    spec.name_ = "batch-2";
+    batch.push_back(JobLoadItem { spec });
+    spec.name_ = "batch-3";
+    spec.so_path_ = TEST_JOB_DIR "libtest_job_hang.so";
+    batch.push_back(JobLoadItem { spec });
+    spec.name_ = "batch-bad";
+    spec.so_path_ = TEST_JOB_DIR "libtest_job_missing.so";
+    batch.push_back(JobLoadItem { spec });
+    spec.name_ = "batch-1";
+    batch.push_back(JobLoadItem { spec });
+
+    ASSERT_THAT(INST.conf_.init_threads_, Gt(1));
+    ASSERT_THAT(INST.load_so_tasks(batch), Eq(false));
+
+    ASSERT_THAT(batch[0].error_, Eq(""));
+    ASSERT_THAT(batch[1].error_, Eq(""));
+    ASSERT_THAT(batch[2].error_, Eq(""));
+    ASSERT_THAT(batch[3].error_, HasSubstr("libtest_job_missing.so"));
+    ASSERT_THAT(batch[4].error_, HasSubstr("already registered"));
+    ASSERT_THAT(INST.task_exists("batch-1"), Eq(true));
+    ASSERT_THAT(INST.task_exists("batch-2"), Eq(true));
+    ASSERT_THAT(INST.task_exists("batch-3"), Eq(true));
+    ASSERT_THAT(INST.task_exists("batch-bad"), Eq(false));
+
+    // 重名的不会初始化，同一个so的两个任务在同一个线程中初始化
+    ASSERT_THAT(init_count(), Eq(2));
+    ASSERT_THAT(init_threads(), Eq(1));
+
+    // 发布之后设置了调度
+    for (size_t i = 0; i < 3; ++i) {
+        auto ins = INST.find_task(batch[i].spec_.name_);
+        ASSERT_THAT(!!ins, Eq(true));
+        ASSERT_THAT(next_fire(*ins), Gt(0));
+    }
+
+    // 已经注册的任务不会被再次加载
+    std::vector<JobLoadItem> again(1, JobLoadItem { batch[0].spec_ });
+    ASSERT_THAT(INST.load_so_tasks(again), Eq(false));
+    ASSERT_THAT(again[0].error_, HasSubstr("already registered"));
+    ASSERT_THAT(init_count(), Eq(2));
+
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_THAT(INST.remove_so_task(batch[i].spec_.name_), Eq(true));
+    }
+    INST.reap_retiring();
+    ::dlclose(handle);
+}
+
+// 运行时配置变化的任务原地更新，不会重新创建，JobRef保持不变；
+// 配置没有变化的任务不做任何修改
+TEST_F(ExecutorFriendTest, RuntimeSpecTest) {
+
+    JobSpec spec {};
+    spec.name_ = "runtime-1";
+    spec.sch_time_ = "0 0 0";
+    spec.so_path_ = TEST_JOB_DIR "libtest_job_ok.so";
+    ASSERT_THAT(INST.add_so_task(spec), Eq(true));
+
+    auto ins = INST.find_task(spec.name_);
+    ASSERT_THAT(!!ins, Eq(true));
+    JobRef ref = ins->ref();
+    std::string stat = ins->stat_str();
+
+    std::vector<JobLoadItem> batch;
+    ASSERT_THAT(INST.handle_so_task_runtime_spec(spec, NULL, batch), Eq(true));
+    ASSERT_THAT(batch.empty(), Eq(true));
+    ASSERT_THAT(ins->stat_str(), Eq(stat));
+
+    JobSpec changed = spec;
+    changed.sch_time_ = "0 30 12";
+    changed.exec_method_ = ExecuteMethod::kExecAsync;
+    changed.timeout_sec_ = 30;
+    ASSERT_THAT(INST.handle_so_task_runtime_spec(changed, NULL, batch), Eq(true));
+    ASSERT_THAT(batch.empty(), Eq(true));
+
+    auto updated = INST.find_task(spec.name_);
+    ASSERT_THAT(updated.get(), Eq(ins.get()));
+    ASSERT_THAT(updated->ref().id_, Eq(ref.id_));
+    ASSERT_THAT(updated->ref().gen_, Eq(ref.gen_));
+
+    JobSpec current {};
+    ASSERT_THAT(INST.task_spec(spec.name_, current), Eq(true));
+    ASSERT_THAT(current == changed, Eq(true));
+
+    // 原地重新设置了调度
+    SchTime sch;
+    ASSERT_THAT(sch.parse(changed.sch_time_), Eq(true));
+    time_t expect = ::time(NULL) + sch.next_interval();
+    ASSERT_THAT(std::abs(static_cast<long>(next_fire(*updated) - expect)), Le(2));
+
+    stat = updated->stat_str();
+    ASSERT_THAT(INST.handle_so_task_runtime_spec(changed, NULL, batch), Eq(true));
+    ASSERT_THAT(batch.empty(), Eq(true));
+    ASSERT_THAT(updated->stat_str(), Eq(stat));
+
+    ASSERT_THAT(INST.remove_so_task(spec.name_), Eq(true));
+    INST.reap_retiring();
+}
+
 } // end tzrpc
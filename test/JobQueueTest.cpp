@@ -0,0 +1,243 @@
+#include <gmock/gmock.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ::testing;
+
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+
+#include <other/Log.h>
+#include <scaffold/Setting.h>
+#include "JobQueue.h"
+#include "JobExecutor.h"
+#include "FireTimer.h"
+#include "ShardManager.h"
+
+using namespace tzrpc;
+
+// 重新设置调度的时候需要知道分片的归属
+class JobQueueEnv : public ::testing::Environment {
+public:
+    virtual void SetUp() {
+        libconfig::Config conf;
+        conf.readString("schedule = { shard_count = 64; };");
+        ASSERT_THAT(ShardManager::instance().init(conf), Eq(true));
+    }
+};
+
+static ::testing::Environment* const job_queue_env = ::testing::AddGlobalTestEnvironment(new JobQueueEnv);
+
+// 一个线程入队，另一个线程出队，稳定之后不再分配节点
+TEST(JobQueueTest, SteadyStateTest) {
+
+    JobQueue queue;
+    std::atomic<bool> stop(false);
+
+    std::thread consumer([&queue, &stop]() {
+        JobRef ref {};
+        while (!stop) {
+            queue.POP(ref, 10);
+        }
+    });
+
+    auto bursts = [&queue](int count) {
+        JobRef ref {};
+        for (int i = 0; i < count; ++i) {
+            for (int j = 0; j < 256; ++j) {
+                ref.id_ = j;
+                queue.PUSH(ref);
+            }
+            while (!queue.EMPTY()) {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    bursts(100);
+    uint64_t warm = JobQueue::pool().allocated();
+
+    bursts(1000);
+    ASSERT_THAT(JobQueue::pool().allocated(), Eq(warm));
+
+    stop = true;
+    consumer.join();
+}
+
+// 批量入队和出队保持FIFO的顺序，没有其他等待的线程时一次最多取出max个
+TEST(JobQueueTest, BatchTest) {
+
+    JobQueue queue;
+    std::vector<JobRef> refs(100);
+    for (size_t i = 0; i < refs.size(); ++i) {
+        refs[i].id_ = static_cast<uint32_t>(i + 1);
+    }
+
+    JobRef ref {};
+    ref.id_ = 0;
+    queue.PUSH(ref);
+    queue.PUSH_BATCH(&refs[0], refs.size());
+    queue.PUSH_BATCH(&refs[0], 0);
+    ASSERT_THAT(queue.SIZE(), Eq(101u));
+
+    std::vector<JobRef> out(16);
+    uint32_t expect = 0;
+    size_t count = 0;
+    while ((count = queue.POP_BATCH(&out[0], out.size(), 10)) > 0) {
+        ASSERT_THAT(count, Le(out.size()));
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_THAT(out[i].id_, Eq(expect++));
+        }
+    }
+
+    ASSERT_THAT(expect, Eq(101u));
+    ASSERT_THAT(queue.EMPTY(), Eq(true));
+
+    // 批量入队之后单个出队
+    queue.PUSH_BATCH(&refs[0], 3);
+    ASSERT_THAT(queue.POP(ref, 10), Eq(true));
+    ASSERT_THAT(ref.id_, Eq(1u));
+    ASSERT_THAT(queue.POP_BATCH(&out[0], out.size(), 10), Eq(2u));
+    ASSERT_THAT(out[1].id_, Eq(3u));
+}
+
+// 有其他线程等待的时候，没有开始执行的任务按照原来的顺序放回队头
+TEST(JobQueueTest, HandBackTest) {
+
+    JobQueue queue;
+    std::atomic<int32_t> in_flight(0);
+    std::vector<JobRef> refs(8);
+    for (size_t i = 0; i < refs.size(); ++i) {
+        refs[i].id_ = static_cast<uint32_t>(i);
+    }
+
+    queue.PUSH_BATCH(&refs[0], refs.size());
+    std::vector<JobRef> out(16);
+    ASSERT_THAT(queue.POP_BATCH(&out[0], out.size(), 10, &in_flight), Eq(8u));
+    ASSERT_THAT(in_flight.load(), Eq(8));
+
+    // 没有等待的线程，由自己继续执行
+    ASSERT_THAT(queue.HAND_BACK(&out[1], 7, &in_flight), Eq(0u));
+    ASSERT_THAT(in_flight.load(), Eq(8));
+
+    std::vector<uint32_t> taken;
+    std::thread waiter([&queue, &in_flight, &taken]() {
+        std::vector<JobRef> got(16);
+        size_t count = queue.POP_BATCH(&got[0], got.size(), 5000, &in_flight);
+        for (size_t i = 0; i < count; ++i) {
+            taken.push_back(got[i].id_);
+        }
+    });
+
+    while (queue.HAND_BACK(&out[1], 7, &in_flight) == 0) {
+        std::this_thread::yield();
+    }
+    waiter.join();
+
+    // 放回的7个中除了自己手上的第一个，其余的都被等待的线程取走并计入in_flight
+    ASSERT_THAT(taken, ElementsAre(1u, 2u, 3u, 4u, 5u, 6u, 7u));
+    ASSERT_THAT(in_flight.load(), Eq(8));
+    ASSERT_THAT(queue.EMPTY(), Eq(true));
+}
+
+static std::vector<uint32_t> queue_dropped;
+static void queue_on_drop(const JobRef& ref) {
+    queue_dropped.push_back(ref.id_);
+}
+
+TEST(JobQueueTest, LimitTest) {
+
+    JobQueue queue;
+    std::vector<JobRef> refs(10);
+    for (size_t i = 0; i < refs.size(); ++i) {
+        refs[i].id_ = static_cast<uint32_t>(i);
+    }
+
+    // 满了之后丢弃新的，批量入队的时候只接受前面的部分
+    queue_dropped.clear();
+    queue.set_limit(4, QueueOverflow::kRejectNew, queue_on_drop);
+    queue.PUSH(refs[0]);
+    queue.PUSH_BATCH(&refs[1], 5);
+    queue.PUSH(refs[6]);
+    ASSERT_THAT(queue.SIZE(), Eq(4u));
+    ASSERT_THAT(queue.dropped(), Eq(3u));
+    ASSERT_THAT(queue_dropped, ElementsAre(4u, 5u, 6u));
+
+    std::vector<JobRef> out(16);
+    ASSERT_THAT(queue.POP_BATCH(&out[0], out.size(), 10), Eq(4u));
+    ASSERT_THAT(out[3].id_, Eq(3u));
+
+    // 满了之后挤出最早的，超过容量的批量入队只保留最后的部分
+    queue_dropped.clear();
+    queue.set_limit(3, QueueOverflow::kDropOldest, queue_on_drop);
+    queue.PUSH_BATCH(&refs[0], 2);
+    queue.PUSH(refs[2]);
+    queue.PUSH(refs[3]);
+    queue.PUSH_BATCH(&refs[4], 5);
+    ASSERT_THAT(queue.SIZE(), Eq(3u));
+    ASSERT_THAT(queue.dropped(), Eq(9u));
+    ASSERT_THAT(queue_dropped, ElementsAre(0u, 1u, 2u, 3u, 4u, 5u));
+
+    ASSERT_THAT(queue.POP_BATCH(&out[0], out.size(), 10), Eq(3u));
+    ASSERT_THAT(out[0].id_, Eq(6u));
+    ASSERT_THAT(out[2].id_, Eq(8u));
+
+    // 同一任务已经在队列中的，挤出的是它自己更早的调度，其他任务不受影响
+    queue_dropped.clear();
+    queue.PUSH_BATCH(&refs[0], 3);
+    queue.PUSH(refs[1]);
+    ASSERT_THAT(queue.SIZE(), Eq(3u));
+    ASSERT_THAT(queue.dropped(), Eq(10u));
+    ASSERT_THAT(queue_dropped, ElementsAre(1u));
+
+    ASSERT_THAT(queue.POP_BATCH(&out[0], out.size(), 10), Eq(3u));
+    ASSERT_THAT(out[0].id_, Eq(0u));
+    ASSERT_THAT(out[1].id_, Eq(2u));
+    ASSERT_THAT(out[2].id_, Eq(1u));
+
+    // 取消限制
+    queue.set_limit(0, QueueOverflow::kRejectNew, queue_on_drop);
+    queue.PUSH_BATCH(&refs[0], refs.size());
+    ASSERT_THAT(queue.SIZE(), Eq(refs.size()));
+    ASSERT_THAT(queue.dropped(), Eq(10u));
+    while (queue.POP_BATCH(&out[0], out.size(), 10) > 0) {
+    }
+}
+
+static int drop_func(JobInstance* inst) {
+    return 0;
+}
+
+// 队列满被丢弃的调度，任务没有其他调度的时候重新设置下一次触发
+TEST(JobQueueTest, DropRearmTest) {
+
+    ASSERT_THAT(FireTimer::instance().init(), Eq(true));
+
+    auto inst = std::make_shared<JobInstance>(std::string("drop-1"), std::string("desc"),
+                                              std::string("* * *"), drop_func);
+    ASSERT_THAT(inst->init(), Eq(true));
+    ASSERT_THAT(FireTimer::instance().size(), Eq(1u));
+
+    // 等待到期投递到执行队列，执行器没有启动，停留在队列中
+    auto deadline = boost::chrono::steady_clock::now() + boost::chrono::seconds(5);
+    while (FireTimer::instance().fired() < 1 && boost::chrono::steady_clock::now() < deadline) {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    }
+    ASSERT_THAT(FireTimer::instance().fired(), Eq(1u));
+    ASSERT_THAT(FireTimer::instance().size(), Eq(0u));
+
+    // 这一次调度在容量为1的队列中被其他任务挤出
+    JobQueue queue;
+    queue.set_limit(1, QueueOverflow::kDropOldest, JE_drop_task);
+    JobRef other {};
+    other.id_ = 0xFFFFFFFF;
+    queue.PUSH(inst->ref());
+    queue.PUSH(other);
+    ASSERT_THAT(queue.dropped(), Eq(1u));
+
+    ASSERT_THAT(FireTimer::instance().size(), Eq(1u));
+    ASSERT_THAT(inst->stat_str(), HasSubstr("drops: 1"));
+
+    FireTimer::instance().stop();
+}
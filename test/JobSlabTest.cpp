@@ -0,0 +1,50 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "JobSlab.h"
+
+using namespace tzrpc;
+
+static int dummy_func(JobInstance* inst) {
+    return 0;
+}
+
+TEST(JobSlabTest, PinAndStaleRefTest) {
+
+    uint32_t base = JobSlab::instance().size();
+
+    std::unique_ptr<JobInstance> job1(new JobInstance("job1", "", "* * *", dummy_func));
+    std::unique_ptr<JobInstance> job2(new JobInstance("job2", "", "* * *", dummy_func));
+    ASSERT_THAT(JobSlab::instance().size(), Eq(base + 2));
+    ASSERT_THAT(job1->ref().id_, Ne(job2->ref().id_));
+
+    {
+        JobPin pin(job1->ref());
+        ASSERT_THAT(pin.get(), Eq(job1.get()));
+    }
+
+    // 删除之后旧的JobRef失效，id被重用的时候代数不同
+    JobRef stale = job1->ref();
+    job1.reset();
+    ASSERT_THAT(JobSlab::instance().size(), Eq(base + 1));
+    ASSERT_THAT(JobSlab::instance().pin(stale), IsNull());
+
+    std::unique_ptr<JobInstance> job3(new JobInstance("job3", "", "* * *", dummy_func));
+    ASSERT_THAT(job3->ref().id_, Eq(stale.id_));
+    ASSERT_THAT(job3->ref().gen_, Ne(stale.gen_));
+    ASSERT_THAT(JobSlab::instance().pin(stale), IsNull());
+
+    JobPin pin(job3->ref());
+    ASSERT_THAT(pin.get(), Eq(job3.get()));
+}
+
+TEST(JobSlabTest, InvalidRefTest) {
+
+    JobRef ref {};
+    ref.id_ = 0xFFFFFFFF;
+    ref.gen_ = 1;
+    ASSERT_THAT(JobSlab::instance().pin(ref), IsNull());
+}
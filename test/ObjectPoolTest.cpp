@@ -0,0 +1,27 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "ObjectPool.h"
+
+using namespace tzrpc;
+
+struct PoolItem {
+    uint64_t val_;
+};
+
+TEST(ObjectPoolTest, ReuseTest) {
+
+    ObjectPool<PoolItem>& pool = ObjectPool<PoolItem>::instance();
+
+    PoolItem* item = pool.alloc();
+    ASSERT_THAT(pool.allocated(), Eq(1));
+    pool.free(item);
+
+    ASSERT_THAT(pool.alloc(), Eq(item));
+    ASSERT_THAT(pool.allocated(), Eq(1));
+    ASSERT_THAT(pool.reused(), Eq(1));
+    pool.free(item);
+}
@@ -0,0 +1,207 @@
+#include <gmock/gmock.h>
+#include <string>
+#include <thread>
+#include <fstream>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "ResultPipeline.h"
+
+using namespace tzrpc;
+
+static JobResult make_result(const char* name, int32_t code, int64_t end_us, const std::string& rsp) {
+
+    JobResult result {};
+    ::strncpy(result.name_, name, kResultNameMax - 1);
+    result.code_ = code;
+    result.start_us_ = end_us - 10;
+    result.end_us_ = end_us;
+    if (!rsp.empty()) {
+        result.rsp_ = static_cast<char*>(::malloc(rsp.size()));
+        ::memcpy(result.rsp_, rsp.data(), rsp.size());
+        result.rsp_len_ = static_cast<uint32_t>(rsp.size());
+    }
+    return result;
+}
+
+// 记录每一批的大小和输出的内容
+class CollectSink : public ResultSink {
+
+public:
+    CollectSink() :
+        ResultSink("collect") {
+    }
+
+    virtual bool open() {
+        return true;
+    }
+
+    virtual bool write(const JobResult* results, size_t count) {
+        batches_.push_back(count);
+        for (size_t i = 0; i < count; ++i) {
+            std::string line;
+            format_result(results[i], line);
+            lines_.push_back(line);
+            end_us_.push_back(results[i].end_us_);
+        }
+        return true;
+    }
+
+    std::vector<size_t> batches_;
+    std::vector<std::string> lines_;
+    std::vector<int64_t> end_us_;
+};
+
+TEST(ResultPipelineTest, FormatTest) {
+
+    JobResult result = make_result("job-\"1\"", -2, 100, std::string("ok\n\x01", 4));
+    result.flags_ = kResultTimedOut;
+
+    std::string line;
+    format_result(result, line);
+    ASSERT_THAT(line, Eq("{\"job\":\"job-\\\"1\\\"\",\"code\":-2,\"attempt\":0,"
+                         "\"start_us\":90,\"end_us\":100,\"lag_us\":0,\"manual\":false,"
+                         "\"timed_out\":true,\"truncated\":false,\"rsp\":\"ok\\n\\u0001\"}"));
+    ::free(result.rsp_);
+}
+
+// 多个线程提交，后台线程成批输出，结束之后一条不少，并且每一批内按照结束时间排序
+TEST(ResultPipelineTest, PipelineTest) {
+
+    auto sink = std::make_shared<CollectSink>();
+    ResultPipeline& pipeline = ResultPipeline::instance();
+    ASSERT_THAT(pipeline.add_sink(sink), Eq(true));
+    ASSERT_THAT(pipeline.start(10, 8), Eq(true));
+    ASSERT_THAT(pipeline.add_sink(std::make_shared<CollectSink>()), Eq(false));
+
+    const int kThreads = 4;
+    const int kResults = 1000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.push_back(std::thread([t]() {
+            for (int i = 0; i < kResults; ++i) {
+                JobResult result = make_result("job", t, i * kThreads + t, "0123456789");
+                ResultPipeline::instance().submit(result);
+                ASSERT_THAT(result.rsp_, IsNull());
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    pipeline.stop();
+    ASSERT_THAT(pipeline.enabled(), Eq(false));
+    ASSERT_THAT(pipeline.drained() + pipeline.dropped(), Eq(static_cast<uint64_t>(kThreads * kResults)));
+    ASSERT_THAT(sink->lines_.size(), Eq(pipeline.drained()));
+    ASSERT_THAT(sink->batches_.size(), Lt(sink->lines_.size()));
+
+    // 同一批内按照结束时间排序，超长的响应被截断
+    size_t offset = 0;
+    for (size_t b = 0; b < sink->batches_.size(); ++b) {
+        ASSERT_THAT(std::is_sorted(sink->end_us_.begin() + offset,
+                                   sink->end_us_.begin() + offset + sink->batches_[b]), Eq(true));
+        offset += sink->batches_[b];
+    }
+    ASSERT_THAT(sink->lines_[0], HasSubstr("\"truncated\":true,\"rsp\":\"01234567\""));
+
+    // 停止之后提交的结果直接释放
+    JobResult result = make_result("job", 0, 0, "late");
+    pipeline.submit(result);
+    ASSERT_THAT(result.rsp_, IsNull());
+    ASSERT_THAT(sink->lines_.size(), Eq(pipeline.drained()));
+}
+
+static uint64_t ring_allocs(ResultPipeline& pipeline) {
+
+    std::string module, name, val;
+    pipeline.module_status(module, name, val);
+    size_t pos = val.find("allocated: ");
+    return pos == std::string::npos ? 0 : ::strtoull(val.c_str() + pos + 11, NULL, 10);
+}
+
+// 每次在新线程中提交结果(异步任务)，复用已经退出的线程回收的队列；
+// 停止的同时查询状态，不会访问被清空的输出端
+TEST(ResultPipelineTest, RingReuseTest) {
+
+    auto sink = std::make_shared<CollectSink>();
+    ResultPipeline& pipeline = ResultPipeline::instance();
+    ASSERT_THAT(pipeline.add_sink(sink), Eq(true));
+    ASSERT_THAT(pipeline.start(10, 64), Eq(true));
+
+    // 先让一个线程分配队列，之后的线程都从空闲列表中取
+    std::thread first([]() {
+        JobResult result = make_result("job", 0, 0, "");
+        ResultPipeline::instance().submit(result);
+    });
+    first.join();
+    pipeline.drain();
+    uint64_t allocs = ring_allocs(pipeline);
+
+    for (int i = 1; i <= 20; ++i) {
+        std::thread thread([i]() {
+            JobResult result = make_result("job", i, i, "");
+            ResultPipeline::instance().submit(result);
+        });
+        thread.join();
+        pipeline.drain();
+    }
+    ASSERT_THAT(ring_allocs(pipeline), Eq(allocs));
+
+    std::atomic<bool> done(false);
+    std::thread status([&done]() {
+        std::string module, name, val;
+        while (!done) {
+            ResultPipeline::instance().module_status(module, name, val);
+        }
+    });
+    pipeline.stop();
+    done = true;
+    status.join();
+
+    ASSERT_THAT(sink->lines_.size(), Eq(21u));
+}
+
+TEST(ResultPipelineTest, FileRotateTest) {
+
+    const std::string path = "./result_pipeline_test.log";
+    for (int i = 0; i <= 3; ++i) {
+        ::unlink((i ? path + "." + std::to_string(static_cast<long long>(i)) : path).c_str());
+    }
+
+    FileResultSink sink(path, 1024, 2);
+    ASSERT_THAT(sink.open(), Eq(true));
+
+    std::vector<JobResult> results;
+    for (int i = 0; i < 10; ++i) {
+        results.push_back(make_result("job", i, i, std::string(100, 'x')));
+    }
+
+    // 每批大约1.6KB，超过1KB之后轮转，最多保留两个历史文件
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_THAT(sink.write(&results[0], results.size()), Eq(true));
+    }
+    sink.close();
+
+    ASSERT_THAT(::access(path.c_str(), F_OK), Eq(0));
+    ASSERT_THAT(::access((path + ".1").c_str(), F_OK), Eq(0));
+    ASSERT_THAT(::access((path + ".2").c_str(), F_OK), Eq(0));
+    ASSERT_THAT(::access((path + ".3").c_str(), F_OK), Ne(0));
+
+    std::ifstream file(path.c_str());
+    std::string line;
+    size_t lines = 0;
+    while (std::getline(file, line)) {
+        ASSERT_THAT(line, HasSubstr("\"job\":\"job\""));
+        ++lines;
+    }
+    ASSERT_THAT(lines, Eq(results.size()));
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        ::free(results[i].rsp_);
+    }
+    for (int i = 0; i <= 3; ++i) {
+        ::unlink((i ? path + "." + std::to_string(static_cast<long long>(i)) : path).c_str());
+    }
+}
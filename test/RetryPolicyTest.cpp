@@ -0,0 +1,123 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include <libconfig/libconfig.h++>
+
+#include "Clock.h"
+#include "HotLog.h"
+#include "FireTimer.h"
+#include "ShardManager.h"
+#include "JobInstance.h"
+
+using namespace tzrpc;
+
+// TestJobModule.cpp编译出的so所在的目录，由CMake传入
+#ifndef TEST_JOB_DIR
+#define TEST_JOB_DIR "./"
+#endif
+
+TEST(RetryPolicyTest, BackoffTest) {
+
+    RetryPolicy policy {};
+    policy.max_attempts_ = 5;
+    policy.backoff_ms_ = 100;
+    policy.backoff_max_ms_ = 500;
+    policy.jitter_ = false;
+
+    ASSERT_THAT(policy.delay_ms(1), Eq(100));
+    ASSERT_THAT(policy.delay_ms(2), Eq(200));
+    ASSERT_THAT(policy.delay_ms(3), Eq(400));
+    ASSERT_THAT(policy.delay_ms(4), Eq(500));
+    ASSERT_THAT(policy.delay_ms(64), Eq(500));
+
+    policy.jitter_ = true;
+    for (int i = 0; i < 100; ++i) {
+        int32_t delay = policy.delay_ms(3);
+        ASSERT_THAT(delay, AllOf(Ge(200), Le(400)));
+    }
+}
+
+static std::string stat_field(const JobInstance& inst, const std::string& field) {
+
+    std::string stat = inst.stat_str();
+    size_t pos = stat.find(field + ": ");
+    if (pos == std::string::npos) {
+        return "";
+    }
+
+    pos += field.size() + 2;
+    return stat.substr(pos, stat.find(',', pos) - pos);
+}
+
+// 本地时间2019-01-07 00:00:00，避开夏令时的切换
+static time_t local_midnight() {
+    struct tm tm_time {};
+    tm_time.tm_year = 2019 - 1900;
+    tm_time.tm_mon = 0;
+    tm_time.tm_mday = 7;
+    tm_time.tm_isdst = -1;
+    return ::mktime(&tm_time);
+}
+
+// 测试so的执行总是返回失败，重试按照退避在定时器上设置；退避时间到达
+// 下一次正常调度的时候放弃重试，由正常调度接管，重试计数重新开始
+TEST(RetryPolicyTest, RetryScheduleTest) {
+
+    HotLog::set_level(LOG_WARNING);
+
+    libconfig::Config conf;
+    conf.readString("schedule = { shard_count = 64; };");
+    ASSERT_THAT(ShardManager::instance().init(conf), Eq(true));
+
+    time_t start = local_midnight();
+    VirtualClock clock(start);
+    Clock::install(&clock);
+    ASSERT_THAT(FireTimer::instance().init(), Eq(true));
+
+    JobSpec spec {};
+    spec.name_ = "retry-1";
+    spec.sch_time_ = "*/10 * *";
+    spec.so_path_ = TEST_JOB_DIR "libtest_job_ok.so";
+    spec.retry_.max_attempts_ = 5;
+    spec.retry_.backoff_ms_ = 3000;
+    spec.retry_.backoff_max_ms_ = 8000;
+    spec.retry_.jitter_ = false;
+
+    JobInstance job(spec);
+    ASSERT_THAT(job.init(), Eq(true));
+    ASSERT_THAT(stat_field(job, "next_fire"), Eq(std::to_string(static_cast<long long>(start + 10))));
+
+    struct Step {
+        int32_t     until_;     // 相对start的秒数
+        const char* retry_;
+        const char* retries_;
+        int32_t     next_fire_;
+    };
+
+    // 10秒失败，3秒后重试；13秒失败，6秒后重试；19秒失败，8秒的退避超过
+    // 20秒的正常调度，不再重试；20秒的正常调度失败之后重新从第一次重试开始
+    const Step steps[] = {
+        { 10, "1/5", "1", 13 },
+        { 13, "2/5", "2", 19 },
+        { 19, "0/5", "2", 20 },
+        { 20, "1/5", "3", 23 },
+    };
+
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); ++i) {
+        uint64_t fired = FireTimer::instance().run_until(clock, static_cast<int64_t>(start + steps[i].until_) * 1000 * 1000);
+        ASSERT_THAT(fired, Eq(1u));
+        ASSERT_THAT(stat_field(job, "last_result"), Eq("7"));
+        ASSERT_THAT(stat_field(job, "retry"), Eq(steps[i].retry_));
+        ASSERT_THAT(stat_field(job, "retries"), Eq(steps[i].retries_));
+        ASSERT_THAT(stat_field(job, "next_fire"),
+                    Eq(std::to_string(static_cast<long long>(start + steps[i].next_fire_))));
+    }
+
+    ASSERT_THAT(stat_field(job, "runs"), Eq("4"));
+
+    job.terminate();
+    Clock::install(NULL);
+}
@@ -0,0 +1,65 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "RunHistory.h"
+
+using namespace tzrpc;
+
+TEST(RunHistoryTest, RingWrapTest) {
+
+    RunRingBuffer<4> ring;
+
+    RunRecord records[8] {};
+    uint32_t tags[8] {};
+    ASSERT_THAT(ring.snapshot(records, tags, 8), Eq(0));
+
+    for (int i = 0; i < 6; ++i) {
+        RunRecord record {};
+        record.start_us_ = i;
+        record.code_ = i;
+        ring.push(record, 100 + i);
+    }
+
+    // 只保留最新的4条，从新到旧
+    ASSERT_THAT(ring.total(), Eq(6));
+    ASSERT_THAT(ring.snapshot(records, tags, 8), Eq(4));
+    ASSERT_THAT(records[0].code_, Eq(5));
+    ASSERT_THAT(tags[0], Eq(105));
+    ASSERT_THAT(records[3].code_, Eq(2));
+
+    ASSERT_THAT(ring.snapshot(records, NULL, 2), Eq(2));
+    ASSERT_THAT(records[1].code_, Eq(4));
+}
+
+
+TEST(RunHistoryTest, QueryTest) {
+
+    JobRunRing ring;
+    uint32_t job_id = RunHistory::instance().register_job("history-job", &ring);
+
+    for (int i = 0; i < 3; ++i) {
+        RunRecord record {};
+        record.start_us_ = RunHistory::now_us();
+        record.end_us_ = record.start_us_ + 10;
+        record.code_ = i;
+        RunHistory::instance().record(job_id, ring, record);
+    }
+
+    std::string output;
+    ASSERT_THAT(RunHistory::instance().query("runs history-job last 2", output), Eq(true));
+    ASSERT_THAT(output, HasSubstr("total runs: 3, recent 2"));
+    ASSERT_THAT(output, HasSubstr("code: 2"));
+    ASSERT_THAT(output, Not(HasSubstr("code: 0")));
+
+    ASSERT_THAT(RunHistory::instance().query("runs last 50", output), Eq(true));
+    ASSERT_THAT(output, HasSubstr("history-job start"));
+
+    ASSERT_THAT(RunHistory::instance().query("runs unknown-job last 2", output), Eq(false));
+    ASSERT_THAT(RunHistory::instance().query("runs history-job", output), Eq(false));
+
+    RunHistory::instance().unregister_job(job_id);
+    ASSERT_THAT(RunHistory::instance().query("runs history-job last 2", output), Eq(false));
+}
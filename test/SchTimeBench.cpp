@@ -0,0 +1,102 @@
+// SchTime::parse()的吞吐测试，不作为ctest的用例执行
+//
+// 预先生成N个混合的表达式(大部分合法，少量非法)，重复解析R轮，
+// 输出每秒的解析次数和每次的耗时
+//
+// ./SchTime_bench -n 100000 -r 20
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <chrono>
+#include <random>
+
+#include "JobInstance.h"
+
+using namespace tzrpc;
+
+static std::string make_field(std::mt19937& rng, int n) {
+
+    std::string field;
+    size_t items = 1 + rng() % 3;
+    for (size_t i = 0; i < items; ++i) {
+        if (i) {
+            field += ",";
+        }
+
+        int from = rng() % n;
+        switch (rng() % 4) {
+            case 0: field += "*"; break;
+            case 1: field += "*/" + std::to_string(static_cast<long long>(1 + rng() % (n - 1))); break;
+            case 2:
+                if (from < n - 1) {
+                    field += std::to_string(static_cast<long long>(from)) + "-" +
+                             std::to_string(static_cast<long long>(from + 1 + rng() % (n - 1 - from)));
+                    break;
+                }
+                // fall through
+            default: field += std::to_string(static_cast<long long>(from)); break;
+        }
+    }
+
+    return field;
+}
+
+int main(int argc, char* argv[]) {
+
+    int32_t count = 100000;
+    int32_t rounds = 20;
+
+    int opt_g = 0;
+    while ((opt_g = ::getopt(argc, argv, "n:r:h")) != -1) {
+        switch (opt_g) {
+            case 'n': count = ::atoi(optarg); break;
+            case 'r': rounds = ::atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n expressions] [-r rounds]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (count <= 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [-n expressions] [-r rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng(20190501);
+    std::vector<std::string> exprs;
+    exprs.reserve(count);
+    size_t bytes = 0;
+    for (int32_t i = 0; i < count; ++i) {
+        std::string expr = make_field(rng, 60) + " " + make_field(rng, 60) + " " + make_field(rng, 24);
+        // 大约5%非法
+        if (rng() % 20 == 0) {
+            expr[rng() % expr.size()] = 'x';
+        }
+        bytes += expr.size();
+        exprs.push_back(expr);
+    }
+
+    SchTime sch{};
+    SchError error{};
+    uint64_t valid = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < exprs.size(); ++i) {
+            if (sch.parse(boost::string_ref(exprs[i]), error)) {
+                ++valid;
+            }
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    double elapsed = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1e6;
+    uint64_t total = static_cast<uint64_t>(count) * rounds;
+
+    printf("expressions %d  avg %.1f bytes  rounds %d  valid %.1f%%\n",
+           count, static_cast<double>(bytes) / count, rounds, 100.0 * valid / total);
+    printf("parses/s %.0f  ns/parse %.1f  MB/s %.1f\n",
+           total / elapsed, elapsed * 1e9 / total, bytes * rounds / elapsed / 1e6);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+// SchTime::parse()的模糊测试，不作为ctest的用例执行
+//
+// 使用clang编译的时候链接libFuzzer：
+//   ./SchTime_fuzz -max_len=64 corpus/
+// 其他编译器生成一个独立的驱动，对种子表达式做随机变异：
+//   ./SchTime_fuzz [iterations] [seed]
+//
+// 除了不能崩溃之外，还检查解析结果和编译期的cron_compile()一致，
+// 以及出错的位置在输入的范围之内。
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <stdexcept>
+
+#include "JobInstance.h"
+#include "CronLiteral.h"
+
+using namespace tzrpc;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+
+    // cron_compile()需要'\0'结尾，输入中间的'\0'截断之后两边的行为一致
+    std::string str(reinterpret_cast<const char*>(data), size);
+    str = str.c_str();
+
+    SchTime sch{};
+    SchError error{};
+    bool ok = sch.parse(boost::string_ref(str), error);
+
+    CronMask mask{};
+    bool expect = true;
+    try {
+        mask = cron_compile(str.c_str());
+    } catch (const std::invalid_argument& e) {
+        expect = false;
+    }
+
+    if (ok != expect ||
+        (ok && (sch.sec_points().to_ullong() != mask.sec_ ||
+                sch.min_points().to_ullong() != mask.min_ ||
+                sch.hour_points().to_ullong() != mask.hour_)) ||
+        (!ok && (error.column_ < 0 || static_cast<size_t>(error.column_) > str.size()))) {
+        fprintf(stderr, "mismatch on \"%s\": parse %d, cron_compile %d, %s\n",
+                str.c_str(), ok, expect, ok ? "" : error.str().c_str());
+        ::abort();
+    }
+
+    return 0;
+}
+
+#ifndef ARGUS_LIBFUZZER
+
+static const char* kSeeds[] = {
+    "* * *", "*/5 1,3-5 *", "0 0 3", "12,24 */2 1-23", "59 59 23", "*/ * 0,1,2",
+};
+
+static const char kAlphabet[] = "0123456789*/-, \t\nx";
+
+int main(int argc, char* argv[]) {
+
+    uint64_t iterations = argc > 1 ? ::strtoull(argv[1], NULL, 10) : 1000000;
+    uint32_t seed = argc > 2 ? static_cast<uint32_t>(::strtoul(argv[2], NULL, 10)) : 20190501;
+    std::mt19937 rng(seed);
+
+    for (uint64_t i = 0; i < iterations; ++i) {
+
+        std::string str = kSeeds[rng() % (sizeof(kSeeds) / sizeof(kSeeds[0]))];
+        size_t mutations = 1 + rng() % 4;
+        for (size_t j = 0; j < mutations; ++j) {
+            size_t pos = str.empty() ? 0 : rng() % (str.size() + 1);
+            char c = kAlphabet[rng() % (sizeof(kAlphabet) - 1)];
+            switch (rng() % 3) {
+                case 0: str.insert(pos, 1, c); break;
+                case 1: if (pos < str.size()) str.erase(pos, 1); break;
+                default: if (pos < str.size()) str[pos] = c; break;
+            }
+        }
+
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(str.data()), str.size());
+    }
+
+    printf("%lu inputs ok\n", static_cast<unsigned long>(iterations));
+    return 0;
+}
+
+#endif // ARGUS_LIBFUZZER
@@ -1,10 +1,12 @@
 #include <gmock/gmock.h>
 #include <string>
+#include <random>
 
 using namespace ::testing;
 
 #include <other/Log.h>
 #include "JobInstance.h"
+#include "CronLiteral.h"
 
 using namespace tzrpc;
 
@@ -29,6 +31,105 @@ TEST(SchTimeTest, SchTimeParseTest) {
 }
 
 
+TEST(SchTimeTest, SchTimeParseErrorTest) {
+
+    SchTime schTm{};
+    SchError error{};
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("*/5 1,3-5 *"), error), Eq(true));
+    ASSERT_THAT(schTm.sec_points().count(), Eq(12u));
+    ASSERT_THAT(schTm.min_points().count(), Eq(4u));
+    ASSERT_THAT(schTm.hour_points().count(), Eq(24u));
+
+    // 解析失败的时候原来的值保持不变
+    ASSERT_THAT(schTm.parse(boost::string_ref("5x * *"), error), Eq(false));
+    ASSERT_THAT(error.field_, Eq(0));
+    ASSERT_THAT(error.column_, Eq(1));
+    ASSERT_THAT(std::string(error.reason_), Eq("unexpected character"));
+    ASSERT_THAT(schTm.sec_points().count(), Eq(12u));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("* 60 *"), error), Eq(false));
+    ASSERT_THAT(error.field_, Eq(1));
+    ASSERT_THAT(error.column_, Eq(2));
+    ASSERT_THAT(std::string(error.reason_), Eq("value out of range"));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("* * 3-24"), error), Eq(false));
+    ASSERT_THAT(error.field_, Eq(2));
+    ASSERT_THAT(error.column_, Eq(6));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("* * 5-5"), error), Eq(false));
+    ASSERT_THAT(std::string(error.reason_), Eq("range from must be less than to"));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("*/0 * *"), error), Eq(false));
+    ASSERT_THAT(std::string(error.reason_), Eq("step must be positive"));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("1,,2 * *"), error), Eq(false));
+    ASSERT_THAT(error.column_, Eq(2));
+    ASSERT_THAT(std::string(error.reason_), Eq("empty item"));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("*5 * *"), error), Eq(false));
+    ASSERT_THAT(std::string(error.reason_), Eq("expect '/' after '*'"));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("* *"), error), Eq(false));
+    ASSERT_THAT(error.field_, Eq(2));
+    ASSERT_THAT(std::string(error.reason_), Eq("missing field"));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("* * * *"), error), Eq(false));
+    ASSERT_THAT(error.field_, Eq(-1));
+    ASSERT_THAT(error.column_, Eq(6));
+    ASSERT_THAT(error.str(), Eq("column 6: too many fields"));
+
+    ASSERT_THAT(schTm.parse(boost::string_ref("*  -1 *"), error), Eq(false));
+    ASSERT_THAT(error.str(), Eq("field min, column 3: expect number"));
+
+    // 字段之间可以有多个空白
+    ASSERT_THAT(schTm.parse(boost::string_ref("\t0  0\n3 "), error), Eq(true));
+    ASSERT_THAT(schTm.hour_points().to_ulong(), Eq(1ul << 3));
+}
+
+// 随机生成的表达式，运行时的解析结果要和编译期的cron_compile()一致
+TEST(SchTimeTest, SchTimeParseRandomTest) {
+
+    static const char kAlphabet[] = "0123456789*/-, \tx";
+    std::mt19937 rng(20190501);
+
+    uint32_t accepted = 0;
+    for (int i = 0; i < 50000; ++i) {
+
+        std::string str;
+        size_t len = rng() % 16;
+        for (size_t j = 0; j < len; ++j) {
+            str.push_back(kAlphabet[rng() % (sizeof(kAlphabet) - 1)]);
+        }
+
+        SchTime schTm{};
+        SchError error{};
+        bool ok = schTm.parse(boost::string_ref(str), error);
+
+        CronMask mask{};
+        bool expect = true;
+        try {
+            mask = cron_compile(str.c_str());
+        } catch (const std::invalid_argument& e) {
+            expect = false;
+        }
+
+        ASSERT_THAT(ok, Eq(expect)) << "\"" << str << "\" " << error.str();
+        if (ok) {
+            ++accepted;
+            ASSERT_THAT(schTm.sec_points().to_ullong(), Eq(mask.sec_));
+            ASSERT_THAT(schTm.min_points().to_ullong(), Eq(mask.min_));
+            ASSERT_THAT(schTm.hour_points().to_ullong(), Eq(mask.hour_));
+        } else {
+            ASSERT_THAT(error.column_, AllOf(Ge(0), Le(static_cast<int32_t>(str.size()))));
+        }
+    }
+
+    ASSERT_THAT(accepted, Gt(0u));
+}
+
+
+
 
 TEST(SchTimeTest, SchTimeNextTest) {
 
@@ -131,5 +232,3 @@ TEST(SchTimeTest, SchTimeNextTest3) {
 
     roo::log_info("SchTimeNextTest3 finished.");
 }
-
-
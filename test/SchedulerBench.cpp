@@ -0,0 +1,220 @@
+// 调度器的吞吐和延迟测试，不作为ctest的用例执行
+//
+// 通过JobExecutor::add_builtin_task()注册N个内置任务，预热之后在固定的
+// 时间窗口内统计：
+//   fires/s      每秒实际执行的次数
+//   latency      任务开始执行的时间和定时器到期时间的差值，p50/p90/p99/p999/max
+//   cpu/fire     进程的user+sys时间除以执行次数，包含任务本身的负载
+//   rss          窗口结束时的常驻内存
+//
+// ./Scheduler_bench -n 2000 -s "* * *" -w 50 -t 10 -m both
+// ./Scheduler_bench -n 10000 -m defer -b 1     执行线程逐个取出任务，对比批量取出
+
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+#include <other/Log.h>
+
+#include "Captain.h"
+#include "FireTimer.h"
+#include "JobInstance.h"
+#include "JobExecutor.h"
+
+using namespace tzrpc;
+
+struct BenchOption {
+    int32_t jobs_;
+    std::string sch_time_;
+    int32_t work_us_;       // 每次执行空转的时间
+    int32_t warmup_sec_;
+    int32_t window_sec_;
+    int32_t threads_;
+    int32_t batch_;         // dispatch_batch
+    int32_t log_level_;
+    std::string method_;    // defer async both
+};
+
+// 只统计窗口内的执行，样本预先分配，超过之后只计数
+static const size_t kMaxSamples = 1024 * 1024;
+
+static std::atomic<bool>     sampling(false);
+static std::atomic<uint64_t> fires(0);
+static std::atomic<uint64_t> sample_index(0);
+static std::vector<int64_t>  samples;
+
+static int bench_func(JobInstance* inst, int32_t work_us) {
+
+    int64_t start = FireTimer::now_us();
+    if (sampling) {
+        ++fires;
+        uint64_t index = sample_index++;
+        if (index < kMaxSamples) {
+            samples[index] = start - inst->due_us();
+        }
+    }
+
+    while (work_us > 0 && FireTimer::now_us() - start < work_us) {
+        // busy loop
+    }
+
+    return 0;
+}
+
+static double cpu_sec() {
+    struct rusage usage {};
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static long rss_kb() {
+    long pages = 0;
+    long resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (::sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+static bool run_phase(const BenchOption& opt, bool async) {
+
+    const char* method = async ? "async" : "defer";
+
+    for (int32_t i = 0; i < opt.jobs_; ++i) {
+        std::string name = std::string(method) + "-" + std::to_string(static_cast<long long>(i));
+        if (!JobExecutor::instance().add_builtin_task(name, "bench", opt.sch_time_,
+                                                       std::bind(bench_func, std::placeholders::_1, opt.work_us_),
+                                                       async)) {
+            fprintf(stderr, "add builtin task %s failed.\n", name.c_str());
+            return false;
+        }
+    }
+
+    ::sleep(opt.warmup_sec_);
+
+    fires = 0;
+    sample_index = 0;
+    double cpu_start = cpu_sec();
+    int64_t start = FireTimer::now_us();
+    sampling = true;
+
+    ::sleep(opt.window_sec_);
+
+    sampling = false;
+    double elapsed = (FireTimer::now_us() - start) / 1e6;
+    double cpu = cpu_sec() - cpu_start;
+
+    std::vector<int64_t> sorted(samples.begin(),
+                                samples.begin() + std::min<uint64_t>(sample_index, kMaxSamples));
+    std::sort(sorted.begin(), sorted.end());
+
+    uint64_t count = fires;
+    printf("%-6s jobs %d  sch_time \"%s\"  work %d us  batch %d  window %.1f s\n",
+           method, opt.jobs_, opt.sch_time_.c_str(), opt.work_us_, opt.batch_, elapsed);
+    printf("       fires %lu  fires/s %.1f\n", static_cast<unsigned long>(count), count / elapsed);
+    printf("       latency us p50 %ld  p90 %ld  p99 %ld  p999 %ld  max %ld\n",
+           static_cast<long>(percentile(sorted, 0.50)), static_cast<long>(percentile(sorted, 0.90)),
+           static_cast<long>(percentile(sorted, 0.99)), static_cast<long>(percentile(sorted, 0.999)),
+           static_cast<long>(sorted.empty() ? 0 : sorted.back()));
+    printf("       cpu/fire %.2f us  rss %ld KB\n", count ? cpu * 1e6 / count : 0.0, rss_kb());
+    fflush(stdout);
+
+    // 停止本阶段的任务，不影响下一阶段的统计
+    for (int32_t i = 0; i < opt.jobs_; ++i) {
+        std::string name = std::string(method) + "-" + std::to_string(static_cast<long long>(i));
+        JobExecutor::instance().pause_task(name);
+    }
+
+    return true;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-n jobs] [-s sch_time] [-w work_us] [-u warmup_sec] [-t window_sec]\n"
+            "          [-p threads] [-b dispatch_batch] [-l log_level] [-m defer|async|both]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+
+    BenchOption opt {};
+    opt.jobs_ = 1000;
+    opt.sch_time_ = "* * *";
+    opt.work_us_ = 0;
+    opt.warmup_sec_ = 2;
+    opt.window_sec_ = 10;
+    opt.threads_ = 8;
+    opt.batch_ = 16;
+    opt.log_level_ = 4;
+    opt.method_ = "both";
+
+    int opt_g = 0;
+    while ((opt_g = ::getopt(argc, argv, "n:s:w:u:t:p:b:l:m:h")) != -1) {
+        switch (opt_g) {
+            case 'n': opt.jobs_ = ::atoi(optarg); break;
+            case 's': opt.sch_time_ = optarg; break;
+            case 'w': opt.work_us_ = ::atoi(optarg); break;
+            case 'u': opt.warmup_sec_ = ::atoi(optarg); break;
+            case 't': opt.window_sec_ = ::atoi(optarg); break;
+            case 'p': opt.threads_ = ::atoi(optarg); break;
+            case 'b': opt.batch_ = ::atoi(optarg); break;
+            case 'l': opt.log_level_ = ::atoi(optarg); break;
+            case 'm': opt.method_ = optarg; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (opt.jobs_ <= 0 || opt.window_sec_ <= 0 ||
+        (opt.method_ != "defer" && opt.method_ != "async" && opt.method_ != "both")) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // 没有任务的最小配置，日志输出到当前目录
+    std::string conf_file = "./scheduler_bench.conf";
+    {
+        std::ofstream conf(conf_file.c_str());
+        conf << "log_level = " << opt.log_level_ << ";" << std::endl
+             << "schedule = {" << std::endl
+             << "  thread_pool_size = " << opt.threads_ << ";" << std::endl
+             << "  thread_pool_size_hard = " << opt.threads_ << ";" << std::endl
+             << "  thread_pool_async_size = " << opt.threads_ << ";" << std::endl
+             << "  dispatch_batch = " << opt.batch_ << ";" << std::endl
+             << "  so_handlers = ( );" << std::endl
+             << "};" << std::endl;
+    }
+
+    if (!Captain::instance().init(conf_file)) {
+        fprintf(stderr, "Captain init with %s failed.\n", conf_file.c_str());
+        return EXIT_FAILURE;
+    }
+
+    samples.resize(kMaxSamples);
+
+    bool ok = true;
+    if (opt.method_ == "defer" || opt.method_ == "both") {
+        ok = ok && run_phase(opt, false);
+    }
+    if (opt.method_ == "async" || opt.method_ == "both") {
+        ok = ok && run_phase(opt, true);
+    }
+
+    Captain::instance().service_graceful();
+    ::unlink(conf_file.c_str());
+
+    // 和正常退出一样不等待其他线程
+    ::_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,66 @@
+#include <gmock/gmock.h>
+#include <string>
+#include <map>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "ShardManager.h"
+
+using namespace tzrpc;
+
+static std::vector<std::string> locate_all(const HashRing& ring, uint32_t count) {
+
+    std::vector<std::string> owners;
+    for (uint32_t i = 0; i < count; ++i) {
+        owners.push_back(ring.locate(ShardManager::hash("key." + std::to_string(i))));
+    }
+    return owners;
+}
+
+TEST(HashRingTest, BalanceTest) {
+
+    HashRing ring;
+    ASSERT_THAT(ring.locate(1234), Eq(""));
+
+    ring.reset({ "node-a", "node-b", "node-c" });
+    std::vector<std::string> owners = locate_all(ring, 3000);
+
+    std::map<std::string, int> count;
+    for (size_t i = 0; i < owners.size(); ++i) {
+        ++count[owners[i]];
+    }
+
+    ASSERT_THAT(count.size(), Eq(3));
+    ASSERT_THAT(count["node-a"], AllOf(Gt(600), Lt(1400)));
+    ASSERT_THAT(count["node-b"], AllOf(Gt(600), Lt(1400)));
+    ASSERT_THAT(count["node-c"], AllOf(Gt(600), Lt(1400)));
+}
+
+// 成员变化的时候，只有和变化成员相关的key需要迁移
+TEST(HashRingTest, MinimalReassignTest) {
+
+    HashRing ring;
+    ring.reset({ "node-a", "node-b", "node-c" });
+    std::vector<std::string> before = locate_all(ring, 3000);
+
+    ring.reset({ "node-a", "node-b", "node-c", "node-d" });
+    std::vector<std::string> joined = locate_all(ring, 3000);
+
+    int moved = 0;
+    for (size_t i = 0; i < before.size(); ++i) {
+        if (before[i] != joined[i]) {
+            ASSERT_THAT(joined[i], Eq("node-d"));
+            ++moved;
+        }
+    }
+    ASSERT_THAT(moved, AllOf(Gt(400), Lt(1200)));
+
+    ring.reset({ "node-a", "node-c" });
+    std::vector<std::string> left = locate_all(ring, 3000);
+    for (size_t i = 0; i < before.size(); ++i) {
+        if (before[i] != "node-b") {
+            ASSERT_THAT(left[i], Eq(before[i]));
+        }
+    }
+}
@@ -0,0 +1,179 @@
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include <libconfig/libconfig.h++>
+
+#include "Clock.h"
+#include "HotLog.h"
+#include "FireTimer.h"
+#include "ShardManager.h"
+#include "JobInstance.h"
+
+using namespace tzrpc;
+
+// 本地时间2019-01-07 00:00:00，避开夏令时的切换
+static time_t local_midnight() {
+    struct tm tm_time {};
+    tm_time.tm_year = 2019 - 1900;
+    tm_time.tm_mon = 0;
+    tm_time.tm_mday = 7;
+    tm_time.tm_isdst = -1;
+    return ::mktime(&tm_time);
+}
+
+TEST(SimClockTest, VirtualNextIntervalTest) {
+
+    time_t start = local_midnight();
+    VirtualClock clock(start + 10);
+    Clock::install(&clock);
+
+    SchTime sch;
+    ASSERT_THAT(sch.parse("0 */5 *"), Eq(true));
+    ASSERT_THAT(sch.next_interval(), Eq(290));
+
+    clock.advance_to(static_cast<int64_t>(start + 300) * 1000 * 1000);
+    ASSERT_THAT(sch.next_interval(), Eq(300));
+
+    // 时间不会后退
+    clock.advance_to(0);
+    ASSERT_THAT(clock.now(), Eq(start + 300));
+
+    Clock::install(NULL);
+}
+
+// 一万个任务的一天调度在虚拟时间中重放，每个任务的执行次数和cron计算的一致
+TEST(SimClockTest, ReplayDayTest) {
+
+    HotLog::set_level(LOG_WARNING);
+
+    libconfig::Config conf;
+    conf.readString("schedule = { shard_count = 64; };");
+    ASSERT_THAT(ShardManager::instance().init(conf), Eq(true));
+
+    time_t start = local_midnight();
+    VirtualClock clock(start);
+    Clock::install(&clock);
+    ASSERT_THAT(FireTimer::instance().init(), Eq(true));
+
+    struct SimSchedule {
+        const char* sch_time_;
+        uint32_t    per_day_;
+    };
+
+    const SimSchedule schedules[] = {
+        { "0 */5 *",  288 },
+        { "0 */15 *", 96 },
+        { "0 0 *",    24 },
+        { "0 0 0",    1 },
+    };
+
+    const int kJobs = 10000;
+    std::vector<uint32_t> counts(kJobs, 0);
+    std::vector<std::unique_ptr<JobInstance>> jobs;
+
+    for (int i = 0; i < kJobs; ++i) {
+        auto func = [&counts, i](JobInstance* inst) -> int {
+            ++counts[i];
+            return 0;
+        };
+        jobs.emplace_back(new JobInstance("sim-" + std::to_string(static_cast<long long>(i)), "",
+                                          schedules[i % 4].sch_time_, func));
+        ASSERT_THAT(jobs.back()->init(), Eq(true));
+    }
+
+    uint64_t fired = FireTimer::instance().run_until(clock, static_cast<int64_t>(start + 24 * 3600) * 1000 * 1000);
+    ASSERT_THAT(clock.now(), Eq(start + 24 * 3600));
+
+    uint64_t expect = 0;
+    for (int i = 0; i < kJobs; ++i) {
+        ASSERT_THAT(counts[i], Eq(schedules[i % 4].per_day_));
+        expect += schedules[i % 4].per_day_;
+    }
+    ASSERT_THAT(fired, Eq(expect));
+
+    for (int i = 0; i < kJobs; ++i) {
+        jobs[i]->terminate();
+    }
+    jobs.clear();
+
+    Clock::install(NULL);
+}
+
+namespace tzrpc {
+
+// 超时的执行由check_timeout()设置取消并释放调度，取消只对超时的那一次
+// 有效；超时的执行之后返回的时候，不会再设置一次调度
+TEST(SimClockTest, CancelTokenTest) {
+
+    HotLog::set_level(LOG_WARNING);
+
+    time_t start = local_midnight() + 2 * 24 * 3600;
+    VirtualClock clock(start);
+    Clock::install(&clock);
+    ASSERT_THAT(FireTimer::instance().init(), Eq(true));
+
+    // 前面用例留在定时器中的调度，任务已经不存在了
+    FireTimer::instance().run_until(clock, static_cast<int64_t>(start) * 1000 * 1000);
+
+    std::vector<bool> cancel_before;
+    std::vector<bool> cancel_after;
+    uint64_t gen_after = 0;
+    time_t next_after = 0;
+    bool released = false;
+
+    auto func = [&](JobInstance* inst) -> int {
+        cancel_before.push_back(inst->cancel_requested());
+
+        // 模拟执行阻塞期间watchdog的检查，只有第一次执行超时
+        if (cancel_before.size() == 1) {
+            time_t now = Clock::instance().now();
+            EXPECT_THAT(inst->check_timeout(now + 30), Eq(false));
+            EXPECT_THAT(inst->check_timeout(now + 61), Eq(true));
+            EXPECT_THAT(inst->check_timeout(now + 120), Eq(false));
+
+            std::lock_guard<std::mutex> lock(inst->hot_->lock_);
+            released = (inst->hot_->slot_owner_ == 0);
+            gen_after = inst->hot_->sched_gen_;
+            next_after = inst->hot_->next_fire_;
+        }
+
+        cancel_after.push_back(inst->cancel_requested());
+        return 0;
+    };
+
+    JobInstance job("sim-cancel", "", "0 */5 *", func);
+    job.timeout_sec_ = 60;
+    ASSERT_THAT(job.init(), Eq(true));
+
+    // 第一次执行超时，调度已经由watchdog设置到下一个周期
+    uint64_t fired = FireTimer::instance().run_until(clock, static_cast<int64_t>(start + 300) * 1000 * 1000);
+    ASSERT_THAT(fired, Eq(1u));
+    ASSERT_THAT(cancel_before, ElementsAre(false));
+    ASSERT_THAT(cancel_after, ElementsAre(true));
+    ASSERT_THAT(released, Eq(true));
+    ASSERT_THAT(next_after, Eq(start + 600));
+    ASSERT_THAT(job.timeout_count_.load(), Eq(1u));
+
+    // 超时的执行返回之后没有重新设置调度
+    {
+        std::lock_guard<std::mutex> lock(job.hot_->lock_);
+        ASSERT_THAT(job.hot_->sched_gen_, Eq(gen_after));
+        ASSERT_THAT(job.hot_->next_fire_, Eq(start + 600));
+        ASSERT_THAT(job.hot_->slot_owner_, Eq(0u));
+    }
+
+    // 下一次执行不受之前取消的影响，定时器中也只有一个调度
+    fired = FireTimer::instance().run_until(clock, static_cast<int64_t>(start + 600) * 1000 * 1000);
+    ASSERT_THAT(fired, Eq(1u));
+    ASSERT_THAT(cancel_before, ElementsAre(false, false));
+    ASSERT_THAT(cancel_after, ElementsAre(true, false));
+    ASSERT_THAT(job.timeout_count_.load(), Eq(1u));
+
+    job.terminate();
+    Clock::install(NULL);
+}
+
+} // end tzrpc
@@ -0,0 +1,110 @@
+#include <gmock/gmock.h>
+#include <string>
+#include <sys/stat.h>
+
+using namespace ::testing;
+
+#include <other/Log.h>
+#include "StateStore.h"
+
+using namespace tzrpc;
+
+static const char* kStateFile = "./state_store_test.state";
+
+TEST(StateStoreTest, PersistReloadTest) {
+
+    ::unlink(kStateFile);
+
+    {
+        StateStore store;
+        ASSERT_THAT(store.init(kStateFile), Eq(true));
+
+        int32_t slot1 = store.attach("job-1");
+        int32_t slot2 = store.attach("job-2");
+        ASSERT_THAT(slot1, Ge(0));
+        ASSERT_THAT(slot2, Ne(slot1));
+        ASSERT_THAT(store.attach("job-1"), Eq(slot1));
+
+        JobStateRecord record {};
+        ASSERT_THAT(store.lookup(slot1, record), Eq(false));
+
+        store.update(slot1, 100, 0, 110);
+        store.update(slot2, 200, -1, 230);
+        store.update(slot2, 230, 3, 260);
+        store.flush();
+    }
+
+    StateStore store;
+    ASSERT_THAT(store.init(kStateFile), Eq(true));
+
+    JobStateRecord record {};
+    int32_t slot2 = store.attach("job-2");
+    ASSERT_THAT(store.lookup(slot2, record), Eq(true));
+    ASSERT_THAT(record.last_fire_, Eq(230));
+    ASSERT_THAT(record.last_result_, Eq(3));
+    ASSERT_THAT(record.next_target_, Eq(260));
+
+    ASSERT_THAT(store.lookup(store.attach("job-1"), record), Eq(true));
+    ASSERT_THAT(record.next_target_, Eq(110));
+
+    ASSERT_THAT(store.lookup(store.attach("job-3"), record), Eq(false));
+    ASSERT_THAT(store.attach(std::string(200, 'x')), Eq(-1));
+
+    ::unlink(kStateFile);
+}
+
+
+TEST(StateStoreTest, BadMagicTest) {
+
+    ::unlink(kStateFile);
+
+    // 不是状态文件的时候拒绝加载，也不能被扩容改写
+    std::string content(300, 'x');
+    FILE* fp = ::fopen(kStateFile, "w");
+    ASSERT_THAT(fp, Ne(static_cast<FILE*>(NULL)));
+    ::fwrite(content.c_str(), 1, content.size(), fp);
+    ::fclose(fp);
+
+    StateStore store;
+    ASSERT_THAT(store.init(kStateFile), Eq(false));
+    ASSERT_THAT(store.enabled(), Eq(false));
+
+    struct stat st;
+    ASSERT_THAT(::stat(kStateFile, &st), Eq(0));
+    ASSERT_THAT(st.st_size, Eq(static_cast<off_t>(content.size())));
+
+    ::unlink(kStateFile);
+}
+
+
+TEST(StateStoreTest, LoadManyTest) {
+
+    ::unlink(kStateFile);
+    const int kJobs = 100000;
+
+    {
+        StateStore store;
+        ASSERT_THAT(store.init(kStateFile), Eq(true));
+        for (int i = 0; i < kJobs; ++i) {
+            int32_t slot = store.attach("job-" + std::to_string(static_cast<long long>(i)));
+            store.update(slot, i, 0, i + 10);
+        }
+        store.flush();
+    }
+
+    auto start = boost::chrono::steady_clock::now();
+
+    StateStore store;
+    ASSERT_THAT(store.init(kStateFile), Eq(true));
+    ASSERT_THAT(store.size(), Eq(static_cast<size_t>(kJobs)));
+
+    auto cost = boost::chrono::duration_cast<boost::chrono::milliseconds>(
+                    boost::chrono::steady_clock::now() - start).count();
+    roo::log_info("load %d job states cost %ld ms.", kJobs, static_cast<long>(cost));
+
+    JobStateRecord record {};
+    ASSERT_THAT(store.lookup(store.attach("job-99999"), record), Eq(true));
+    ASSERT_THAT(record.next_target_, Eq(99999 + 10));
+
+    ::unlink(kStateFile);
+}
@@ -0,0 +1,64 @@
+#include <unistd.h>
+#include <pthread.h>
+
+#include <mutex>
+#include <set>
+
+#include "SoBridge.h"
+
+// 测试中加载的任务so，不使用服务导出的符号，测试程序不需要-rdynamic链接。
+// 定义了TEST_JOB_HANG的版本不响应取消，隔离执行的时候只能在超时之后被kill
+
+// 记录module_init的调用次数和所在的线程，测试程序通过dlsym查询
+static std::mutex init_lock;
+static std::set<pthread_t> init_threads;
+static int init_count = 0;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int module_init() {
+
+    std::lock_guard<std::mutex> lock(init_lock);
+    init_threads.insert(::pthread_self());
+    ++init_count;
+    return 0;
+}
+
+int module_exit() {
+    return 0;
+}
+
+int so_handler(const msg_t* req, msg_t* rsp) {
+
+#ifdef TEST_JOB_HANG
+    for (int i = 0; i < 60; ++i) {
+        ::sleep(1);
+    }
+#endif
+
+    return 7;
+}
+
+void test_job_reset() {
+
+    std::lock_guard<std::mutex> lock(init_lock);
+    init_threads.clear();
+    init_count = 0;
+}
+
+int test_job_init_count() {
+    std::lock_guard<std::mutex> lock(init_lock);
+    return init_count;
+}
+
+int test_job_init_threads() {
+    std::lock_guard<std::mutex> lock(init_lock);
+    return static_cast<int>(init_threads.size());
+}
+
+#ifdef __cplusplus
+}
+#endif
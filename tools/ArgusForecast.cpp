@@ -0,0 +1,315 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+// 离线的调度占用预测
+//
+// 读取argus.conf中schedule.so_handlers的sch_time，用SchTime解析之后按照
+// 位图计算每一秒的触发次数，输出一天(或者多天)的直方图、统计信息以及触发
+// 最集中的时刻和参与的任务。
+//
+// sch_time只有时、分、秒，所以每天的分布是一样的，多天只是重复。计算的时候
+// 先合并相同的调度，再把秒和分相同的调度按照小时聚合，每组只展开一次分秒的
+// 组合，不需要对每个任务逐次调用next_interval()。
+//
+// ./argus_forecast -c argus.conf -d 7 -k 10 -j 10 -o forecast.csv
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <map>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+#include <libconfig/libconfig.h++>
+
+#include "JobInstance.h"
+
+using namespace tzrpc;
+
+static const uint32_t kDaySeconds = 24 * 3600;
+
+struct ForecastSchedule {
+    std::bitset<60> sec_;
+    std::bitset<60> min_;
+    std::bitset<24> hour_;
+    uint32_t weight_;   // 使用该调度的任务数
+};
+
+struct ForecastJob {
+    std::string name_;
+    std::string sch_time_;
+    size_t schedule_;
+};
+
+struct ForecastOption {
+    std::string conf_file_;
+    std::string csv_file_;
+    int32_t days_;
+    int32_t bursts_;
+    int32_t contributors_;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s -c argus.conf [-d days] [-k bursts] [-j contributors] [-o csv_file]\n", prog);
+}
+
+static std::string second_str(uint32_t second) {
+    char buf[32] {};
+    snprintf(buf, sizeof(buf), "%02u:%02u:%02u",
+             second / 3600, (second % 3600) / 60, second % 60);
+    return buf;
+}
+
+// 读取所有启用的任务，合并相同的调度
+static bool load_jobs(const std::string& conf_file,
+                      std::vector<ForecastJob>& jobs, std::vector<ForecastSchedule>& schedules) {
+
+    libconfig::Config conf;
+    try {
+        conf.readFile(conf_file.c_str());
+    } catch (const libconfig::FileIOException& e) {
+        fprintf(stderr, "read conf %s failed.\n", conf_file.c_str());
+        return false;
+    } catch (const libconfig::ParseException& e) {
+        fprintf(stderr, "parse conf %s failed at line %d: %s\n", conf_file.c_str(), e.getLine(), e.getError());
+        return false;
+    }
+
+    if (!conf.exists("schedule.so_handlers")) {
+        fprintf(stderr, "schedule.so_handlers not found in %s.\n", conf_file.c_str());
+        return false;
+    }
+
+    typedef std::array<unsigned long long, 3> ScheduleKey;
+    std::map<ScheduleKey, size_t> index;
+    uint32_t invalid = 0;
+
+    const libconfig::Setting& handlers = conf.lookup("schedule.so_handlers");
+    for (int i = 0; i < handlers.getLength(); ++i) {
+
+        const libconfig::Setting& handler = handlers[i];
+
+        ForecastJob job {};
+        bool enable = true;
+        handler.lookupValue("name", job.name_);
+        handler.lookupValue("sch_time", job.sch_time_);
+        handler.lookupValue("enable", enable);
+        if (!enable) {
+            continue;
+        }
+
+        SchTime sch;
+        if (job.name_.empty() || !sch.parse(job.sch_time_)) {
+            fprintf(stderr, "skip invalid job %s, sch_time \"%s\".\n", job.name_.c_str(), job.sch_time_.c_str());
+            ++invalid;
+            continue;
+        }
+
+        ScheduleKey key = {{ sch.sec_points().to_ullong(), sch.min_points().to_ullong(),
+                             sch.hour_points().to_ullong() }};
+        auto iter = index.find(key);
+        if (iter == index.end()) {
+            ForecastSchedule schedule {};
+            schedule.sec_ = sch.sec_points();
+            schedule.min_ = sch.min_points();
+            schedule.hour_ = sch.hour_points();
+            schedule.weight_ = 0;
+            iter = index.insert(std::make_pair(key, schedules.size())).first;
+            schedules.push_back(schedule);
+        }
+
+        job.schedule_ = iter->second;
+        ++schedules[job.schedule_].weight_;
+        jobs.push_back(job);
+    }
+
+    printf("jobs %lu  distinct schedules %lu  invalid %u\n",
+           static_cast<unsigned long>(jobs.size()), static_cast<unsigned long>(schedules.size()), invalid);
+    return true;
+}
+
+// 秒和分相同的调度按照小时累加权重，每组展开一次分秒的组合
+static void build_histogram(const std::vector<ForecastSchedule>& schedules, std::vector<uint32_t>& day) {
+
+    typedef std::pair<unsigned long long, unsigned long long> GroupKey;
+    std::map<GroupKey, std::array<uint32_t, 24>> groups;
+
+    for (size_t i = 0; i < schedules.size(); ++i) {
+        const ForecastSchedule& schedule = schedules[i];
+        GroupKey key(schedule.sec_.to_ullong(), schedule.min_.to_ullong());
+        auto iter = groups.find(key);
+        if (iter == groups.end()) {
+            std::array<uint32_t, 24> empty {};
+            iter = groups.insert(std::make_pair(key, empty)).first;
+        }
+
+        for (size_t hour = 0; hour < 24; ++hour) {
+            if (schedule.hour_.test(hour)) {
+                iter->second[hour] += schedule.weight_;
+            }
+        }
+    }
+
+    day.assign(kDaySeconds, 0);
+    std::vector<uint32_t> offsets;
+    offsets.reserve(3600);
+
+    for (auto iter = groups.begin(); iter != groups.end(); ++iter) {
+
+        std::bitset<60> sec(iter->first.first);
+        std::bitset<60> min(iter->first.second);
+
+        offsets.clear();
+        for (uint32_t m = 0; m < 60; ++m) {
+            if (!min.test(m)) {
+                continue;
+            }
+            for (uint32_t s = 0; s < 60; ++s) {
+                if (sec.test(s)) {
+                    offsets.push_back(m * 60 + s);
+                }
+            }
+        }
+
+        for (uint32_t hour = 0; hour < 24; ++hour) {
+            uint32_t weight = iter->second[hour];
+            if (weight == 0) {
+                continue;
+            }
+
+            uint32_t* base = &day[hour * 3600];
+            for (size_t i = 0; i < offsets.size(); ++i) {
+                base[offsets[i]] += weight;
+            }
+        }
+    }
+}
+
+static void report(const ForecastOption& opt, const std::vector<ForecastJob>& jobs,
+                   const std::vector<ForecastSchedule>& schedules, const std::vector<uint32_t>& day) {
+
+    uint64_t total = 0;
+    uint32_t busy = 0;
+    for (uint32_t i = 0; i < kDaySeconds; ++i) {
+        total += day[i];
+        if (day[i]) {
+            ++busy;
+        }
+    }
+
+    std::vector<uint32_t> sorted(day);
+    std::sort(sorted.begin(), sorted.end());
+
+    printf("fires per day %lu  over %d days %lu\n",
+           static_cast<unsigned long>(total), opt.days_, static_cast<unsigned long>(total * opt.days_));
+    printf("seconds with fires %u/%u  mean %.2f/s\n", busy, kDaySeconds, static_cast<double>(total) / kDaySeconds);
+    printf("fires per second p50 %u  p90 %u  p99 %u  p999 %u  max %u\n",
+           sorted[kDaySeconds / 2], sorted[kDaySeconds * 9 / 10], sorted[kDaySeconds * 99 / 100],
+           sorted[kDaySeconds * 999 / 1000], sorted[kDaySeconds - 1]);
+
+    // 触发最集中的时刻，相同的次数按照时间先后
+    std::vector<uint32_t> seconds(kDaySeconds);
+    for (uint32_t i = 0; i < kDaySeconds; ++i) {
+        seconds[i] = i;
+    }
+
+    size_t count = std::min<size_t>(std::max(opt.bursts_, 0), kDaySeconds);
+    std::partial_sort(seconds.begin(), seconds.begin() + count, seconds.end(),
+                      [&day](uint32_t a, uint32_t b) {
+                          return day[a] != day[b] ? day[a] > day[b] : a < b;
+                      });
+
+    printf("worst bursts (repeats every day):\n");
+    for (size_t i = 0; i < count && day[seconds[i]] > 0; ++i) {
+
+        uint32_t second = seconds[i];
+        uint32_t hour = second / 3600;
+        uint32_t min = (second % 3600) / 60;
+        uint32_t sec = second % 60;
+
+        printf("  %s  %u fires\n", second_str(second).c_str(), day[second]);
+
+        int32_t listed = 0;
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            const ForecastSchedule& schedule = schedules[jobs[j].schedule_];
+            if (!schedule.hour_.test(hour) || !schedule.min_.test(min) || !schedule.sec_.test(sec)) {
+                continue;
+            }
+
+            if (listed < opt.contributors_) {
+                printf("      %s \"%s\"\n", jobs[j].name_.c_str(), jobs[j].sch_time_.c_str());
+            }
+            ++listed;
+        }
+
+        if (listed > opt.contributors_) {
+            printf("      ... and %d more\n", listed - opt.contributors_);
+        }
+    }
+
+    if (!opt.csv_file_.empty()) {
+        std::ofstream csv(opt.csv_file_.c_str());
+        csv << "day,time,fires" << std::endl;
+        for (int32_t d = 0; d < opt.days_; ++d) {
+            for (uint32_t i = 0; i < kDaySeconds; ++i) {
+                csv << d << "," << second_str(i) << "," << day[i] << "\n";
+            }
+        }
+        printf("histogram written to %s\n", opt.csv_file_.c_str());
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    ForecastOption opt {};
+    opt.days_ = 1;
+    opt.bursts_ = 10;
+    opt.contributors_ = 10;
+
+    int opt_g = 0;
+    while ((opt_g = ::getopt(argc, argv, "c:d:k:j:o:h")) != -1) {
+        switch (opt_g) {
+            case 'c': opt.conf_file_ = optarg; break;
+            case 'd': opt.days_ = ::atoi(optarg); break;
+            case 'k': opt.bursts_ = ::atoi(optarg); break;
+            case 'j': opt.contributors_ = ::atoi(optarg); break;
+            case 'o': opt.csv_file_ = optarg; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (opt.conf_file_.empty() || opt.days_ <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<ForecastJob> jobs;
+    std::vector<ForecastSchedule> schedules;
+    if (!load_jobs(opt.conf_file_, jobs, schedules)) {
+        return EXIT_FAILURE;
+    }
+
+    auto loaded = std::chrono::steady_clock::now();
+
+    std::vector<uint32_t> day;
+    build_histogram(schedules, day);
+
+    auto built = std::chrono::steady_clock::now();
+    report(opt, jobs, schedules, day);
+
+    printf("load %ld ms  histogram %ld ms\n",
+           static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(loaded - start).count()),
+           static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(built - loaded).count()));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+// 任务清单的转换和查看
+//
+// 把argus.conf中schedule.so_handlers转换成预编译的二进制清单，sch_time在转换
+// 的时候解析，非法的配置在这里就报错。生成之后在配置中设置
+//   schedule.so_manifest = "./argus.manifest";
+// 服务启动和reload的时候从清单加载任务，不再读取so_handlers。
+//
+// ./argus_manifest -c argus.conf -o argus.manifest
+// ./argus_manifest -i argus.manifest [-l]
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <chrono>
+
+#include <libconfig/libconfig.h++>
+
+#include "JobExecutor.h"
+#include "JobManifest.h"
+
+using namespace tzrpc;
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s -c argus.conf -o manifest_file\n"
+            "       %s -i manifest_file [-l]\n", prog, prog);
+}
+
+static long elapsed_ms(const std::chrono::steady_clock::time_point& start) {
+    return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - start).count());
+}
+
+// 禁用的任务也需要转换，reload的时候用来卸载
+static int convert(const std::string& conf_file, const std::string& manifest_file) {
+
+    auto start = std::chrono::steady_clock::now();
+
+    libconfig::Config conf;
+    try {
+        conf.readFile(conf_file.c_str());
+    } catch (const libconfig::FileIOException& e) {
+        fprintf(stderr, "read conf %s failed.\n", conf_file.c_str());
+        return EXIT_FAILURE;
+    } catch (const libconfig::ParseException& e) {
+        fprintf(stderr, "parse conf %s failed at line %d: %s\n", conf_file.c_str(), e.getLine(), e.getError());
+        return EXIT_FAILURE;
+    }
+
+    if (!conf.exists("schedule.so_handlers")) {
+        fprintf(stderr, "schedule.so_handlers not found in %s.\n", conf_file.c_str());
+        return EXIT_FAILURE;
+    }
+
+    const libconfig::Setting& handlers = conf.lookup("schedule.so_handlers");
+    std::vector<JobSpec> specs(handlers.getLength());
+    for (int i = 0; i < handlers.getLength(); ++i) {
+        if (!parse_job_spec(handlers[i], specs[i])) {
+            fprintf(stderr, "invalid so_handlers #%d (%s), see log for detail.\n", i, specs[i].name_.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    long parsed = elapsed_ms(start);
+
+    if (!JobManifest::write(manifest_file, specs)) {
+        fprintf(stderr, "write manifest %s failed, see log for detail.\n", manifest_file.c_str());
+        return EXIT_FAILURE;
+    }
+
+    printf("%lu jobs converted to %s, parse %ld ms, write %ld ms\n",
+           static_cast<unsigned long>(specs.size()), manifest_file.c_str(), parsed, elapsed_ms(start) - parsed);
+    return EXIT_SUCCESS;
+}
+
+static int inspect(const std::string& manifest_file, bool list) {
+
+    auto start = std::chrono::steady_clock::now();
+
+    JobManifest manifest;
+    if (!manifest.open(manifest_file)) {
+        fprintf(stderr, "open manifest %s failed, see log for detail.\n", manifest_file.c_str());
+        return EXIT_FAILURE;
+    }
+
+    uint32_t disabled = 0;
+    JobSpec spec {};
+    CronMask sch {};
+    for (uint32_t i = 0; i < manifest.size(); ++i) {
+
+        manifest.job_at(i, spec, sch);
+        if (!spec.enable_) {
+            ++disabled;
+        }
+
+        if (list) {
+            printf("%s\t\"%s\"\t%s\t%s%s%s\n", spec.name_.c_str(), sch.str_, spec.so_path_.c_str(),
+                   spec.exec_method_ == ExecuteMethod::kExecAsync ? "async" : "defer",
+                   spec.lazy_ ? "\tlazy" : "",
+                   spec.enable_ ? "" : "\tdisabled");
+        }
+    }
+
+    printf("%s: %u jobs, %u disabled, load %ld ms\n",
+           manifest_file.c_str(), manifest.size(), disabled, elapsed_ms(start));
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+
+    std::string conf_file;
+    std::string output_file;
+    std::string input_file;
+    bool list = false;
+
+    int opt_g = 0;
+    while ((opt_g = ::getopt(argc, argv, "c:o:i:lh")) != -1) {
+        switch (opt_g) {
+            case 'c': conf_file = optarg; break;
+            case 'o': output_file = optarg; break;
+            case 'i': input_file = optarg; break;
+            case 'l': list = true; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (!conf_file.empty() && !output_file.empty()) {
+        return convert(conf_file, output_file);
+    }
+
+    if (!input_file.empty()) {
+        return inspect(input_file, list);
+    }
+
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}